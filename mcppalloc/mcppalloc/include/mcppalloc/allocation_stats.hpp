@@ -0,0 +1,265 @@
+#pragma once
+#include "declarations.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mcpputil/mcpputil/concurrency.hpp>
+#include <vector>
+namespace mcppalloc
+{
+  /**
+   * \brief Snapshot of allocation counters for a single size bin.
+   **/
+  struct bin_stats_t {
+    uint64_t m_allocations = 0;
+    uint64_t m_deallocations = 0;
+    uint64_t m_bytes_allocated = 0;
+    uint64_t m_bytes_deallocated = 0;
+    uint64_t m_blocks_created = 0;
+    uint64_t m_blocks_destroyed = 0;
+    uint64_t m_global_lock_acquisitions = 0;
+    /**
+     * \brief Pages pre-faulted in bulk that would otherwise have faulted on allocation.
+     **/
+    uint64_t m_pages_prefaulted = 0;
+    /**
+     * \brief Return number of live objects.
+     *
+     * Objects allocated on one thread and freed on another make per thread values meaningless, but sums are exact.
+     **/
+    auto live_objects() const noexcept -> int64_t
+    {
+      return static_cast<int64_t>(m_allocations - m_deallocations);
+    }
+    /**
+     * \brief Return number of live bytes.
+     **/
+    auto live_bytes() const noexcept -> int64_t
+    {
+      return static_cast<int64_t>(m_bytes_allocated - m_bytes_deallocated);
+    }
+    auto operator+=(const bin_stats_t &rhs) noexcept -> bin_stats_t &
+    {
+      m_allocations += rhs.m_allocations;
+      m_deallocations += rhs.m_deallocations;
+      m_bytes_allocated += rhs.m_bytes_allocated;
+      m_bytes_deallocated += rhs.m_bytes_deallocated;
+      m_blocks_created += rhs.m_blocks_created;
+      m_blocks_destroyed += rhs.m_blocks_destroyed;
+      m_global_lock_acquisitions += rhs.m_global_lock_acquisitions;
+      m_pages_prefaulted += rhs.m_pages_prefaulted;
+      return *this;
+    }
+  };
+  /**
+   * \brief Snapshot of allocation counters for an allocator.
+   * @tparam Bins Number of size bins.
+   **/
+  template <size_t Bins>
+  struct allocation_stats_t {
+    static constexpr const size_t cs_num_bins = Bins;
+    /**
+     * \brief Counters by size bin.
+     **/
+    ::std::array<bin_stats_t, Bins> m_bins{};
+    /**
+     * \brief Counters by allocation tag.
+     *
+     * Only maintained if the allocator policy uses allocation tags, block counters are always zero.
+     **/
+    ::std::array<bin_stats_t, c_num_allocation_tags> m_tags{};
+    /**
+     * \brief Number of threads that contributed live counters.
+     **/
+    size_t m_num_threads = 0;
+    /**
+     * \brief Return counters summed over all bins.
+     **/
+    auto totals() const noexcept -> bin_stats_t
+    {
+      bin_stats_t ret;
+      for (auto &&bin : m_bins) {
+        ret += bin;
+      }
+      return ret;
+    }
+    auto operator+=(const allocation_stats_t &rhs) noexcept -> allocation_stats_t &
+    {
+      for (size_t i = 0; i < Bins; ++i) {
+        m_bins[i] += rhs.m_bins[i];
+      }
+      for (size_t i = 0; i < c_num_allocation_tags; ++i) {
+        m_tags[i] += rhs.m_tags[i];
+      }
+      m_num_threads += rhs.m_num_threads;
+      return *this;
+    }
+  };
+  namespace details
+  {
+    /**
+     * \brief Allocation counters for a single size bin.
+     *
+     * These have a single writer, so increments are a relaxed load and store rather than a locked read modify write.
+     * Readers may see slightly stale values but never torn ones.
+     * Padded to a cache line so that bins and threads do not false share.
+     **/
+    struct alignas(64) bin_counters_t {
+      ::std::atomic<uint64_t> m_allocations{0};
+      ::std::atomic<uint64_t> m_deallocations{0};
+      ::std::atomic<uint64_t> m_bytes_allocated{0};
+      ::std::atomic<uint64_t> m_bytes_deallocated{0};
+      ::std::atomic<uint64_t> m_blocks_created{0};
+      ::std::atomic<uint64_t> m_blocks_destroyed{0};
+      ::std::atomic<uint64_t> m_global_lock_acquisitions{0};
+      ::std::atomic<uint64_t> m_pages_prefaulted{0};
+      /**
+       * \brief Increment a counter from its single writer.
+       **/
+      static void increment(::std::atomic<uint64_t> &counter, uint64_t n = 1) noexcept
+      {
+        counter.store(counter.load(::std::memory_order_relaxed) + n, ::std::memory_order_relaxed);
+      }
+      /**
+       * \brief Return a snapshot of the counters.
+       **/
+      auto snapshot() const noexcept -> bin_stats_t
+      {
+        bin_stats_t ret;
+        ret.m_allocations = m_allocations.load(::std::memory_order_relaxed);
+        ret.m_deallocations = m_deallocations.load(::std::memory_order_relaxed);
+        ret.m_bytes_allocated = m_bytes_allocated.load(::std::memory_order_relaxed);
+        ret.m_bytes_deallocated = m_bytes_deallocated.load(::std::memory_order_relaxed);
+        ret.m_blocks_created = m_blocks_created.load(::std::memory_order_relaxed);
+        ret.m_blocks_destroyed = m_blocks_destroyed.load(::std::memory_order_relaxed);
+        ret.m_global_lock_acquisitions = m_global_lock_acquisitions.load(::std::memory_order_relaxed);
+        ret.m_pages_prefaulted = m_pages_prefaulted.load(::std::memory_order_relaxed);
+        return ret;
+      }
+    };
+    static_assert(sizeof(bin_counters_t) == 64, "Bin counters should fit in a cache line.");
+    /**
+     * \brief Per thread allocation counters by size bin.
+     *
+     * Only the owning thread (or a thread holding a lock that serializes all writers) may call the on_* functions.
+     **/
+    template <size_t Bins>
+    class thread_allocation_counters_t
+    {
+    public:
+      using stats_type = allocation_stats_t<Bins>;
+      void on_allocation(size_t bin, size_t bytes) noexcept
+      {
+        bin_counters_t::increment(m_bins[bin].m_allocations);
+        bin_counters_t::increment(m_bins[bin].m_bytes_allocated, bytes);
+      }
+      void on_deallocation(size_t bin, size_t bytes) noexcept
+      {
+        bin_counters_t::increment(m_bins[bin].m_deallocations);
+        bin_counters_t::increment(m_bins[bin].m_bytes_deallocated, bytes);
+      }
+      /**
+       * \brief Count objects that were dropped together rather than deallocated one at a time.
+       **/
+      void on_bulk_deallocation(size_t bin, uint64_t objects, uint64_t bytes) noexcept
+      {
+        bin_counters_t::increment(m_bins[bin].m_deallocations, objects);
+        bin_counters_t::increment(m_bins[bin].m_bytes_deallocated, bytes);
+      }
+      void on_tagged_allocation(allocation_tag_t tag, size_t bytes) noexcept
+      {
+        bin_counters_t::increment(m_tags[tag].m_allocations);
+        bin_counters_t::increment(m_tags[tag].m_bytes_allocated, bytes);
+      }
+      void on_tagged_deallocation(allocation_tag_t tag, size_t bytes) noexcept
+      {
+        bin_counters_t::increment(m_tags[tag].m_deallocations);
+        bin_counters_t::increment(m_tags[tag].m_bytes_deallocated, bytes);
+      }
+      void on_bulk_tagged_deallocation(allocation_tag_t tag, size_t objects, size_t bytes) noexcept
+      {
+        bin_counters_t::increment(m_tags[tag].m_deallocations, objects);
+        bin_counters_t::increment(m_tags[tag].m_bytes_deallocated, bytes);
+      }
+      void on_block_created(size_t bin) noexcept
+      {
+        bin_counters_t::increment(m_bins[bin].m_blocks_created);
+      }
+      void on_block_destroyed(size_t bin) noexcept
+      {
+        bin_counters_t::increment(m_bins[bin].m_blocks_destroyed);
+      }
+      void on_global_lock(size_t bin) noexcept
+      {
+        bin_counters_t::increment(m_bins[bin].m_global_lock_acquisitions);
+      }
+      void on_pages_prefaulted(size_t bin, uint64_t pages) noexcept
+      {
+        bin_counters_t::increment(m_bins[bin].m_pages_prefaulted, pages);
+      }
+      /**
+       * \brief Add a snapshot of these counters to stats.
+       **/
+      void add_to(stats_type &stats) const noexcept
+      {
+        for (size_t i = 0; i < Bins; ++i) {
+          stats.m_bins[i] += m_bins[i].snapshot();
+        }
+        for (size_t i = 0; i < c_num_allocation_tags; ++i) {
+          stats.m_tags[i] += m_tags[i].snapshot();
+        }
+      }
+
+    private:
+      ::std::array<bin_counters_t, Bins> m_bins;
+      ::std::array<bin_counters_t, c_num_allocation_tags> m_tags;
+    };
+    /**
+     * \brief Registry of per thread counters for an allocator.
+     *
+     * Thread counters register on creation and fold into a retired total on destruction.
+     * Snapshots only take the registry lock, never an allocator lock, so allocation continues during a snapshot.
+     **/
+    template <size_t Bins>
+    class allocation_counters_registry_t
+    {
+    public:
+      using counters_type = thread_allocation_counters_t<Bins>;
+      using stats_type = allocation_stats_t<Bins>;
+      void register_counters(const counters_type &counters) REQUIRES(!m_mutex)
+      {
+        MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+        m_counters.push_back(&counters);
+      }
+      void unregister_counters(const counters_type &counters) REQUIRES(!m_mutex)
+      {
+        MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+        auto it = ::std::find(m_counters.begin(), m_counters.end(), &counters);
+        if (it == m_counters.end()) {
+          return;
+        }
+        counters.add_to(m_retired);
+        m_counters.erase(it);
+      }
+      /**
+       * \brief Return a snapshot of all counters ever registered.
+       **/
+      auto snapshot() const -> stats_type REQUIRES(!m_mutex)
+      {
+        MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+        stats_type ret = m_retired;
+        ret.m_num_threads = m_counters.size();
+        for (auto &&counters : m_counters) {
+          counters->add_to(ret);
+        }
+        return ret;
+      }
+
+    private:
+      mutable ::mcpputil::mutex_t m_mutex;
+      ::std::vector<const counters_type *> m_counters GUARDED_BY(m_mutex);
+      stats_type m_retired GUARDED_BY(m_mutex);
+    };
+  }
+}
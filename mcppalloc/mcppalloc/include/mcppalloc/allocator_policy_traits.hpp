@@ -0,0 +1,89 @@
+#pragma once
+#include <mcpputil/mcpputil/declarations.hpp>
+#include <type_traits>
+#include <utility>
+namespace mcppalloc
+{
+  namespace details
+  {
+    /**
+     * \brief True if a member pointer refers to a mcpputil::do_nothing_t hook.
+     **/
+    template <typename Member_Pointer>
+    struct is_do_nothing_hook_t : ::std::false_type {
+    };
+    template <typename Class>
+    struct is_do_nothing_hook_t<::mcpputil::do_nothing_t Class::*> : ::std::true_type {
+    };
+  }
+  /**
+   * \brief True if the thread policy does something on allocation.
+   *
+   * Hooks that are not data members of type mcpputil::do_nothing_t (member functions, functors, etc) are always called.
+   **/
+  template <typename Thread_Policy, typename = void>
+  struct has_on_allocation_t : ::std::true_type {
+  };
+  template <typename Thread_Policy>
+  struct has_on_allocation_t<Thread_Policy, ::std::enable_if_t<details::is_do_nothing_hook_t<decltype(&Thread_Policy::on_allocation)>::value>>
+      : ::std::false_type {
+  };
+  template <typename Thread_Policy>
+  static constexpr const bool has_on_allocation_v = has_on_allocation_t<Thread_Policy>::value;
+  namespace details
+  {
+    template <typename Thread_Policy, typename = void>
+    struct is_do_nothing_on_deallocation_t : ::std::false_type {
+    };
+    template <typename Thread_Policy>
+    struct is_do_nothing_on_deallocation_t<
+        Thread_Policy,
+        ::std::enable_if_t<is_do_nothing_hook_t<decltype(&Thread_Policy::on_deallocation)>::value>> : ::std::true_type {
+    };
+  }
+  /**
+   * \brief True if the thread policy does something on deallocation.
+   *
+   * This hook is optional so policies that predate it need not define it.
+   **/
+  template <typename Thread_Policy, typename = void>
+  struct has_on_deallocation_t : ::std::false_type {
+  };
+  template <typename Thread_Policy>
+  struct has_on_deallocation_t<Thread_Policy,
+                               ::std::void_t<decltype(::std::declval<Thread_Policy &>().on_deallocation(::std::declval<void *>()))>>
+      : ::std::integral_constant<bool, !details::is_do_nothing_on_deallocation_t<Thread_Policy>::value> {
+  };
+  template <typename Thread_Policy>
+  static constexpr const bool has_on_deallocation_v = has_on_deallocation_t<Thread_Policy>::value;
+  /**
+   * \brief True if the allocator policy uses per object user data.
+   *
+   * Policies opt out by defining cs_uses_user_data as false.
+   * If a policy opts out, object states are not given user data on allocation and user data is not destroyed on destruction.
+   **/
+  template <typename Allocator_Policy, typename = void>
+  struct uses_user_data_t : ::std::true_type {
+  };
+  template <typename Allocator_Policy>
+  struct uses_user_data_t<Allocator_Policy, ::std::void_t<decltype(Allocator_Policy::cs_uses_user_data)>>
+      : ::std::integral_constant<bool, Allocator_Policy::cs_uses_user_data> {
+  };
+  template <typename Allocator_Policy>
+  static constexpr const bool uses_user_data_v = uses_user_data_t<Allocator_Policy>::value;
+  /**
+   * \brief True if the allocator policy tags allocations.
+   *
+   * Policies opt in by defining cs_uses_allocation_tags as true.
+   * Tags are kept in the object state user flags, so policies that use user flags for something else must not opt in.
+   **/
+  template <typename Allocator_Policy, typename = void>
+  struct uses_allocation_tags_t : ::std::false_type {
+  };
+  template <typename Allocator_Policy>
+  struct uses_allocation_tags_t<Allocator_Policy, ::std::void_t<decltype(Allocator_Policy::cs_uses_allocation_tags)>>
+      : ::std::integral_constant<bool, Allocator_Policy::cs_uses_allocation_tags> {
+  };
+  template <typename Allocator_Policy>
+  static constexpr const bool uses_allocation_tags_v = uses_allocation_tags_t<Allocator_Policy>::value;
+}
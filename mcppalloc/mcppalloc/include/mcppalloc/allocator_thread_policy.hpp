@@ -1,11 +1,38 @@
 #pragma once
+#include "declarations.hpp"
 namespace mcppalloc::details
 {
+  /**
+   * \brief Reason for an allocation failure.
+   **/
+  enum class allocation_failure_reason_t : uint8_t {
+    /**
+     * \brief No memory was available.
+     **/
+    out_of_memory,
+    /**
+     * \brief The allocation crossed the soft quota of its tag.
+     *
+     * The allocation goes ahead whatever the action is, this is only a notification.
+     **/
+    soft_quota,
+    /**
+     * \brief The allocation would exceed the hard quota of its tag.
+     *
+     * The allocation fails unless the action asks to repeat and the tag is then under quota.
+     **/
+    hard_quota
+  };
   /**
    * \brief Structure containing information on an allocation failure.
    **/
   struct allocation_failure_t {
     size_t m_failures;
+    allocation_failure_reason_t m_reason = allocation_failure_reason_t::out_of_memory;
+    /**
+     * \brief Tag of the allocation.
+     **/
+    allocation_tag_t m_tag = 0;
   };
   /**
    * \brief Structure containing information on what to do in responce to allocation failure.
@@ -19,6 +46,13 @@ namespace mcppalloc::details
      * \brief True if should attempt allocation again.
      **/
     bool m_repeat;
+    /**
+     * \brief True if memory should be reclaimed before attempting allocation again.
+     *
+     * Reclaiming collects global blocks, purges empty blocks and collapses the free list, so it is slow.
+     * Allocators that do not support reclaiming ignore this.
+     **/
+    bool m_reclaim = false;
   };
 
   struct allocator_thread_policy_tag_t {
@@ -5,4 +5,33 @@ namespace mcppalloc
   // type for representing infinite length.
   static constexpr const size_t c_infinite_length = static_cast<size_t>(-1);
   static constexpr const unsigned int c_debug_level = 0;
+  /**
+   * \brief Tag attributing an allocation to a subsystem.
+   *
+   * Tags are stored in the 3 user flag bits of the object state, so there are 8 of them.
+   * Tag 0 is untagged.
+   **/
+  using allocation_tag_t = uint8_t;
+  static constexpr const size_t c_num_allocation_tags = 8;
+  /**
+   * \brief Hint of how long an allocation will live.
+   *
+   * Allocators that support hints keep allocations with different hints apart,
+   * so a long lived object does not keep memory of short lived objects around it from being freed.
+   **/
+  enum class allocation_lifetime_t : uint8_t {
+    /**
+     * \brief Default, freed soon after allocation.
+     **/
+    short_lived = 0,
+    /**
+     * \brief Outlives most other allocations.
+     **/
+    long_lived = 1,
+    /**
+     * \brief Lives until the allocator is destroyed.
+     **/
+    permanent = 2
+  };
+  static constexpr const size_t c_num_allocation_lifetimes = 3;
 }
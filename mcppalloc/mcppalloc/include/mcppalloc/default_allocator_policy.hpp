@@ -1,5 +1,6 @@
 #pragma once
 #include "allocator_policy.hpp"
+#include "allocator_policy_traits.hpp"
 #include "default_allocator_thread_policy.hpp"
 #include <cstdint>
 namespace mcppalloc
@@ -14,6 +15,10 @@ namespace mcppalloc
     using user_data_type = details::user_data_base_t;
     using thread_policy_type = default_allocator_thread_policy_t;
     static const constexpr size_type cs_minimum_alignment = 16;
+    /**
+     * \brief Nothing in the default policy reads user data, so do not maintain it.
+     **/
+    static const constexpr bool cs_uses_user_data = false;
     default_allocator_policy_t() = delete;
   };
 }
@@ -15,9 +15,16 @@ namespace mcppalloc
    **/
   struct default_allocator_thread_policy_t : public details::allocator_thread_policy_tag_t {
     mcpputil::do_nothing_t on_allocation;
+    mcpputil::do_nothing_t on_deallocation;
     mcpputil::do_nothing_t on_create_allocator_block;
     mcpputil::do_nothing_t on_destroy_allocator_block;
     mcpputil::do_nothing_t on_creation;
+    /**
+     * \brief Called with the allocator lock held after the allocator responds to memory pressure.
+     *
+     * Takes a const memory_pressure_t &.
+     **/
+    mcpputil::do_nothing_t on_memory_pressure;
     details::allocation_failure_action_t on_allocation_failure(const details::allocation_failure_t &)
     {
       return details::allocation_failure_action_t{false, false};
@@ -0,0 +1,157 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+namespace mcppalloc
+{
+  /**
+   * \brief How hard an allocator should try to give memory back.
+   **/
+  enum class memory_pressure_level_t : uint8_t { none = 0, moderate = 1, critical = 2 };
+  /**
+   * \brief Memory pressure as observed by a watcher.
+   **/
+  struct memory_pressure_t {
+    memory_pressure_level_t m_level = memory_pressure_level_t::none;
+    /**
+     * \brief Bytes currently charged to the cgroup.
+     **/
+    size_t m_current = 0;
+    /**
+     * \brief Throttling limit of the cgroup or 0 if there is none.
+     **/
+    size_t m_high = 0;
+    /**
+     * \brief Number of times the cgroup went over its high limit since the last poll.
+     **/
+    size_t m_new_high_events = 0;
+    /**
+     * \brief Number of times the cgroup hit its max limit or invoked the OOM killer since the last poll.
+     **/
+    size_t m_new_max_events = 0;
+  };
+  /**
+   * \brief Watcher for cgroup v2 memory pressure.
+   *
+   * This reads memory.current, memory.high and memory.events on every poll.
+   * Usage above a fraction of memory.high or new events since the last poll raise the pressure level.
+   * This is not thread safe, the owning allocator serializes polls.
+   **/
+  class cgroup_memory_watcher_t
+  {
+  public:
+    /**
+     * \brief Default fraction of memory.high above which pressure is moderate.
+     **/
+    static constexpr const double cs_default_moderate_ratio = 0.8;
+    /**
+     * \brief Default fraction of memory.high above which pressure is critical.
+     **/
+    static constexpr const double cs_default_critical_ratio = 0.95;
+    /**
+     * \brief Watch the cgroup mounted at the given directory.
+     **/
+    explicit cgroup_memory_watcher_t(const ::std::string &cgroup_directory = "/sys/fs/cgroup")
+        : cgroup_memory_watcher_t(cgroup_directory + "/memory.current", cgroup_directory + "/memory.high",
+                                  cgroup_directory + "/memory.events")
+    {
+    }
+    /**
+     * \brief Watch the given files.
+     *
+     * This lets tests supply fake files.
+     **/
+    cgroup_memory_watcher_t(::std::string current_path, ::std::string high_path, ::std::string events_path)
+        : m_current_path(::std::move(current_path)), m_high_path(::std::move(high_path)), m_events_path(::std::move(events_path))
+    {
+    }
+    /**
+     * \brief Set fractions of memory.high above which pressure is moderate and critical.
+     **/
+    void set_thresholds(double moderate_ratio, double critical_ratio) noexcept
+    {
+      m_moderate_ratio = moderate_ratio;
+      m_critical_ratio = critical_ratio;
+    }
+    auto moderate_ratio() const noexcept -> double
+    {
+      return m_moderate_ratio;
+    }
+    auto critical_ratio() const noexcept -> double
+    {
+      return m_critical_ratio;
+    }
+    /**
+     * \brief Read the cgroup files and return the current pressure.
+     *
+     * Files that can not be read count as no pressure.
+     **/
+    auto poll() -> memory_pressure_t
+    {
+      memory_pressure_t ret;
+      ret.m_current = _read_value(m_current_path);
+      ret.m_high = _read_value(m_high_path);
+      size_t high_events = 0;
+      size_t max_events = 0;
+      _read_events(high_events, max_events);
+      // the first poll only sets a baseline, counters only go down if the cgroup is recreated.
+      if (m_has_baseline) {
+        ret.m_new_high_events = high_events >= m_high_events ? high_events - m_high_events : 0;
+        ret.m_new_max_events = max_events >= m_max_events ? max_events - m_max_events : 0;
+      }
+      m_has_baseline = true;
+      m_high_events = high_events;
+      m_max_events = max_events;
+      if (ret.m_new_max_events || (ret.m_high && static_cast<double>(ret.m_current) >= static_cast<double>(ret.m_high) * m_critical_ratio)) {
+        ret.m_level = memory_pressure_level_t::critical;
+      } else if (ret.m_new_high_events ||
+                 (ret.m_high && static_cast<double>(ret.m_current) >= static_cast<double>(ret.m_high) * m_moderate_ratio)) {
+        ret.m_level = memory_pressure_level_t::moderate;
+      }
+      return ret;
+    }
+
+  private:
+    /**
+     * \brief Read a single value, "max" and unreadable files are 0.
+     **/
+    static auto _read_value(const ::std::string &path) -> size_t
+    {
+      ::std::ifstream file(path);
+      size_t ret = 0;
+      if (!(file >> ret)) {
+        return 0;
+      }
+      return ret;
+    }
+    /**
+     * \brief Read the cumulative event counts from memory.events.
+     **/
+    void _read_events(size_t &high_events, size_t &max_events) const
+    {
+      ::std::ifstream file(m_events_path);
+      ::std::string key;
+      size_t value = 0;
+      while (file >> key >> value) {
+        if (key == "high") {
+          high_events = value;
+        } else if (key == "max" || key == "oom" || key == "oom_kill") {
+          max_events += value;
+        }
+      }
+    }
+    ::std::string m_current_path;
+    ::std::string m_high_path;
+    ::std::string m_events_path;
+    double m_moderate_ratio = cs_default_moderate_ratio;
+    double m_critical_ratio = cs_default_critical_ratio;
+    /**
+     * \brief Event counts seen at the last poll.
+     **/
+    size_t m_high_events = 0;
+    size_t m_max_events = 0;
+    bool m_has_baseline = false;
+  };
+}
@@ -0,0 +1,258 @@
+#pragma once
+#include "default_allocator_thread_policy.hpp"
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <execinfo.h>
+#include <fstream>
+#include <map>
+#include <mcpputil/mcpputil/concurrency.hpp>
+#include <mcpputil/mcpputil/intrinsics.hpp>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+namespace mcppalloc
+{
+  /**
+   * \brief Thread policy that samples allocations to build a live heap profile.
+   *
+   * Allocations are sampled as a Poisson process over allocated bytes with a mean of sampling_interval() bytes.
+   * A sampled allocation records its backtrace until it is deallocated.
+   * The samples that are still live can be written in the legacy pprof heap profile text format.
+   *
+   * The unsampled allocation path is a thread local decrement and compare.
+   * The unsampled deallocation path is a single relaxed load from a counting filter of sampled addresses.
+   **/
+  class sampling_heap_profiler_thread_policy_t : public default_allocator_thread_policy_t
+  {
+  public:
+    /**
+     * \brief Maximum number of frames recorded for a sample.
+     **/
+    static constexpr const size_t cs_max_frames = 64;
+    /**
+     * \brief Default mean bytes between samples.
+     **/
+    static constexpr const size_t cs_default_sampling_interval = 512 * 1024;
+    /**
+     * \brief Number of entries in the filter of sampled addresses.
+     **/
+    static constexpr const size_t cs_filter_size = 1 << 16;
+    /**
+     * \brief Sampled statistics for a single call stack.
+     **/
+    struct stack_stats_t {
+      size_t m_live_objects = 0;
+      size_t m_live_bytes = 0;
+      size_t m_total_objects = 0;
+      size_t m_total_bytes = 0;
+    };
+    using stack_type = ::std::vector<void *>;
+
+    sampling_heap_profiler_thread_policy_t() = default;
+    sampling_heap_profiler_thread_policy_t(const sampling_heap_profiler_thread_policy_t &) = delete;
+    sampling_heap_profiler_thread_policy_t(sampling_heap_profiler_thread_policy_t &&) = delete;
+    sampling_heap_profiler_thread_policy_t &operator=(const sampling_heap_profiler_thread_policy_t &) = delete;
+    sampling_heap_profiler_thread_policy_t &operator=(sampling_heap_profiler_thread_policy_t &&) = delete;
+    /**
+     * \brief Called on every allocation.
+     **/
+    void on_allocation(void *ptr, size_t sz) REQUIRES(!m_mutex)
+    {
+      auto &state = _thread_state();
+      state.m_bytes_until_sample -= static_cast<int64_t>(sz);
+      if (mcpputil_unlikely(state.m_bytes_until_sample < 0)) {
+        _sample(ptr, sz, state);
+      }
+    }
+    /**
+     * \brief Called on every deallocation.
+     **/
+    void on_deallocation(void *ptr) noexcept REQUIRES(!m_mutex)
+    {
+      if (mcpputil_unlikely(m_filter[_filter_index(ptr)].load(::std::memory_order_relaxed) != 0)) {
+        _drop_sample(ptr);
+      }
+    }
+    /**
+     * \brief Return mean bytes between samples.
+     **/
+    auto sampling_interval() const noexcept -> size_t
+    {
+      return m_sampling_interval.load(::std::memory_order_relaxed);
+    }
+    /**
+     * \brief Set mean bytes between samples.
+     *
+     * Threads pick up the new interval after their next sample.
+     * @param interval Mean bytes between samples.  Must be non-zero.
+     **/
+    void set_sampling_interval(size_t interval) noexcept
+    {
+      assert(interval > 0);
+      m_sampling_interval.store(interval, ::std::memory_order_relaxed);
+    }
+    /**
+     * \brief Return the number of sampled objects that are still live.
+     **/
+    auto num_live_samples() const -> size_t REQUIRES(!m_mutex)
+    {
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+      return m_samples.size();
+    }
+    /**
+     * \brief Return a copy of the sampled statistics by call stack.
+     **/
+    auto stack_stats() const -> ::std::map<stack_type, stack_stats_t> REQUIRES(!m_mutex)
+    {
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+      return m_stacks;
+    }
+    /**
+     * \brief Write the heap profile in the legacy pprof text format.
+     *
+     * Counts are of sampled objects.
+     * pprof rescales them using the sampling interval in the header.
+     **/
+    void write_profile(::std::ostream &os) const REQUIRES(!m_mutex)
+    {
+      {
+        MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+        stack_stats_t total;
+        for (auto &&stack : m_stacks) {
+          total.m_live_objects += stack.second.m_live_objects;
+          total.m_live_bytes += stack.second.m_live_bytes;
+          total.m_total_objects += stack.second.m_total_objects;
+          total.m_total_bytes += stack.second.m_total_bytes;
+        }
+        os << "heap profile: " << total.m_live_objects << ": " << total.m_live_bytes << " [" << total.m_total_objects << ": "
+           << total.m_total_bytes << "] @ heap_v2/" << sampling_interval() << "\n";
+        for (auto &&stack : m_stacks) {
+          os << stack.second.m_live_objects << ": " << stack.second.m_live_bytes << " [" << stack.second.m_total_objects << ": "
+             << stack.second.m_total_bytes << "] @";
+          for (auto &&frame : stack.first) {
+            os << " " << frame;
+          }
+          os << "\n";
+        }
+      }
+      // pprof needs the mappings to symbolize.
+      os << "\nMAPPED_LIBRARIES:\n";
+      ::std::ifstream maps("/proc/self/maps");
+      if (maps) {
+        os << maps.rdbuf();
+      }
+    }
+
+  private:
+    /**
+     * \brief Per thread sampling state.
+     *
+     * This is shared by all profiler instances used by a thread, which keeps it trivially initialized.
+     **/
+    struct thread_state_t {
+      int64_t m_bytes_until_sample;
+      uint64_t m_random;
+    };
+    struct sample_t {
+      size_t m_size;
+      stack_stats_t *m_stats;
+    };
+    static auto _thread_state() noexcept -> thread_state_t &
+    {
+      static thread_local thread_state_t s_state{0, 0};
+      return s_state;
+    }
+    static auto _filter_index(void *ptr) noexcept -> size_t
+    {
+      // fibonacci hashing of the address with the alignment bits removed.
+      return static_cast<size_t>((reinterpret_cast<uintptr_t>(ptr) >> 4) * 11400714819323198485ull) >> (64 - 16);
+    }
+    static_assert(cs_filter_size == 1 << 16, "Filter index must match filter size.");
+    /**
+     * \brief Return the number of bytes until the next sample drawn from an exponential distribution.
+     **/
+    auto _next_sample_distance(thread_state_t &state) const noexcept -> int64_t
+    {
+      // xorshift64*
+      state.m_random ^= state.m_random >> 12;
+      state.m_random ^= state.m_random << 25;
+      state.m_random ^= state.m_random >> 27;
+      const uint64_t bits = (state.m_random * 2685821657736338717ull) >> 11;
+      // uniform in (0,1].
+      const double uniform = (static_cast<double>(bits) + 1.0) / 9007199254740992.0;
+      return static_cast<int64_t>(-::std::log(uniform) * static_cast<double>(sampling_interval())) + 1;
+    }
+    void _sample(void *ptr, size_t sz, thread_state_t &state) REQUIRES(!m_mutex)
+    {
+      if (mcpputil_unlikely(!state.m_random)) {
+        // first allocation on this thread, seed and start counting.
+        state.m_random = reinterpret_cast<uintptr_t>(&state) ^
+                         static_cast<uint64_t>(::std::chrono::steady_clock::now().time_since_epoch().count()) ^ 0x9e3779b97f4a7c15ull;
+        if (!state.m_random) {
+          state.m_random = 1;
+        }
+        state.m_bytes_until_sample = _next_sample_distance(state);
+        return;
+      }
+      state.m_bytes_until_sample = _next_sample_distance(state);
+      ::std::array<void *, cs_max_frames> frames;
+      const int num_frames = ::backtrace(frames.data(), static_cast<int>(frames.size()));
+      stack_type stack(frames.begin(), frames.begin() + ::std::max(num_frames, 0));
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+      auto &stats = m_stacks[::std::move(stack)];
+      stats.m_live_objects++;
+      stats.m_live_bytes += sz;
+      stats.m_total_objects++;
+      stats.m_total_bytes += sz;
+      auto inserted = m_samples.emplace(ptr, sample_t{sz, &stats});
+      if (!inserted.second) {
+        // the object was freed without notification, so replace it.
+        inserted.first->second.m_stats->m_live_objects--;
+        inserted.first->second.m_stats->m_live_bytes -= inserted.first->second.m_size;
+        inserted.first->second = sample_t{sz, &stats};
+        return;
+      }
+      m_filter[_filter_index(ptr)].fetch_add(1, ::std::memory_order_relaxed);
+    }
+    void _drop_sample(void *ptr) noexcept REQUIRES(!m_mutex)
+    {
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+      auto it = m_samples.find(ptr);
+      if (it == m_samples.end()) {
+        return;
+      }
+      it->second.m_stats->m_live_objects--;
+      it->second.m_stats->m_live_bytes -= it->second.m_size;
+      m_samples.erase(it);
+      m_filter[_filter_index(ptr)].fetch_sub(1, ::std::memory_order_relaxed);
+    }
+    /**
+     * \brief Mutex protecting samples.
+     **/
+    mutable ::mcpputil::mutex_t m_mutex;
+    /**
+     * \brief Mean bytes between samples.
+     **/
+    ::std::atomic<size_t> m_sampling_interval{cs_default_sampling_interval};
+    /**
+     * \brief Sampled statistics by call stack.
+     *
+     * Node based so sample_t can point into it.
+     **/
+    ::std::map<stack_type, stack_stats_t> m_stacks GUARDED_BY(m_mutex);
+    /**
+     * \brief Live samples by address.
+     **/
+    ::std::unordered_map<void *, sample_t> m_samples GUARDED_BY(m_mutex);
+    /**
+     * \brief Count of live samples by filter index.
+     *
+     * Deallocations only take the lock if the count for their index is non-zero.
+     **/
+    ::std::array<::std::atomic<uint32_t>, cs_filter_size> m_filter{};
+  };
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mcpputil/mcpputil/intrinsics.hpp>
+namespace mcppalloc
+{
+  /**
+   * \brief What a thread allocator does on a slow path taken inside a no slow path section.
+   **/
+  enum class slow_path_action_t : uint8_t {
+    /**
+     * \brief Count the event and carry on.
+     **/
+    count = 0,
+    /**
+     * \brief Report the event and abort, for finding the cause in testing.
+     **/
+    abort = 1
+  };
+  namespace details
+  {
+    /**
+     * \brief Watches for slow paths of a thread allocator inside sections that must not take them.
+     *
+     * Slow paths are taking the global lock, getting new blocks, expanding the heap and maintenance.
+     * Only the owning thread begins and ends sections and reports events, the count may be read from any thread.
+     **/
+    class slow_path_monitor_t
+    {
+    public:
+      void begin(slow_path_action_t action) noexcept
+      {
+        m_action = action;
+        m_active = true;
+      }
+      void end() noexcept
+      {
+        m_active = false;
+      }
+      /**
+       * \brief Return true inside a no slow path section.
+       **/
+      bool active() const noexcept
+      {
+        return m_active;
+      }
+      /**
+       * \brief Report a slow path, which does nothing outside a no slow path section.
+       * @param event Name of the slow path for the abort message.
+       **/
+      void on_slow_path(const char *event) noexcept
+      {
+        if (mcpputil_likely(!m_active)) {
+          return;
+        }
+        m_num_events.store(m_num_events.load(::std::memory_order_relaxed) + 1, ::std::memory_order_relaxed);
+        if (m_action == slow_path_action_t::abort) {
+          ::std::cerr << "mcppalloc slow path " << event << " taken in no slow path section 3c0f5e2b-8a9d-4b61-9e47-d21a6f83c590\n";
+          ::std::abort();
+        }
+      }
+      /**
+       * \brief Return the number of slow paths taken inside no slow path sections.
+       **/
+      auto num_events() const noexcept -> uint64_t
+      {
+        return m_num_events.load(::std::memory_order_relaxed);
+      }
+
+    private:
+      bool m_active{false};
+      slow_path_action_t m_action{slow_path_action_t::count};
+      ::std::atomic<uint64_t> m_num_events{0};
+    };
+  }
+}
@@ -21,6 +21,10 @@ namespace mcppalloc::bitmap_allocator
       using thread_allocator_type = bitmap_thread_allocator_t<allocator_policy_type>;
       using internal_allocator_type = typename allocator_policy_type::internal_allocator_type;
       using slab_allocator_type = ::mcppalloc::slab_allocator::details::slab_allocator_t;
+      using slab_cache_type = ::mcppalloc::slab_allocator::details::slab_thread_cache_t;
+      using stats_type = typename thread_allocator_type::stats_type;
+      using counters_registry_type =
+          ::mcppalloc::details::allocation_counters_registry_t<bitmap_package_t<allocator_policy_type>::cs_num_vectors>;
 
       bitmap_allocator_t(size_t size, size_t size_hint);
       bitmap_allocator_t(const bitmap_allocator_t &) = delete;
@@ -31,7 +35,10 @@ namespace mcppalloc::bitmap_allocator
 
       REQUIRES(!m_mutex) void shutdown();
 
-      REQUIRES(!m_mutex) auto _get_memory() -> bitmap_state_t *;
+      /**
+       * \brief Get memory for a new bitmap state, from free sections of slab first and then through a thread cache.
+       **/
+      REQUIRES(!m_mutex) auto _get_memory(slab_cache_type &cache) -> bitmap_state_t *;
       void _u_to_global(size_t id, type_id_t type, bitmap_state_t *state) noexcept REQUIRES(m_mutex);
       void _u_to_free(void *v) noexcept REQUIRES(m_mutex);
       /**
@@ -43,7 +50,25 @@ namespace mcppalloc::bitmap_allocator
        **/
       REQUIRES(!m_mutex) void destroy_thread();
       REQUIRES(!m_mutex) auto num_free_blocks() const noexcept -> size_t;
+      /**
+       * \brief Give the pages of free blocks back to the system, keeping the first page with the block header.
+       *
+       * Free blocks stay available and are faulted back in when reused.
+       * Thread allocators are told to do maintenance, which returns blocks in their caches to the slab.
+       * @return Number of bytes purged.
+       **/
+      REQUIRES(!m_mutex) auto purge_free_blocks() -> size_t;
       REQUIRES(!m_mutex) auto num_globals(size_t id, type_id_t type) const noexcept -> size_t;
+      /**
+       * \brief Return a snapshot of allocation counters for all threads.
+       *
+       * This does not take the allocator lock.
+       **/
+      auto stats_snapshot() const -> stats_type;
+      /**
+       * \brief Return registry of thread allocation counters.
+       **/
+      auto _counters_registry() noexcept -> counters_registry_type &;
 
       RETURN_CAPABILITY(m_mutex) auto _mutex() const noexcept -> mutex_type &;
 
@@ -112,6 +137,10 @@ namespace mcppalloc::bitmap_allocator
        * \brief Allocator policy.
        **/
       allocator_thread_policy_type m_policy;
+      /**
+       * \brief Registry of thread allocation counters.
+       **/
+      counters_registry_type m_counters_registry;
       /**
        * \brief In use states held by global.
        **/
@@ -136,6 +165,10 @@ namespace mcppalloc::bitmap_allocator
        * \brief Free sections of slab.
        **/
       free_list_type m_free_globals GUARDED_BY(m_mutex);
+      /**
+       * \brief Size of free globals, so refills can skip the lock when it is empty.
+       **/
+      ::std::atomic<size_t> m_num_free_globals{0};
       using thread_allocators_pair_type = typename ::std::pair<::std::thread::id, thread_allocator_unique_ptr_type>;
       using thread_allocators_allocator_type =
           typename internal_allocator_traits::template rebind_alloc<thread_allocators_pair_type>;
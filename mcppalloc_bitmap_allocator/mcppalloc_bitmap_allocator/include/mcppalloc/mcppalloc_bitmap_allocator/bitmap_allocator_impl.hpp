@@ -2,6 +2,9 @@
 #include <mcpputil/mcpputil/boost/property_tree/json_parser.hpp>
 #include <mcpputil/mcpputil/boost/property_tree/ptree.hpp>
 #include <mcpputil/mcpputil/thread_id_manager.hpp>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 namespace mcppalloc::bitmap_allocator::details
 {
   template <typename Allocator_Policy>
@@ -16,7 +19,6 @@ namespace mcppalloc::bitmap_allocator::details
     for (auto &&ptr : m_thread_allocator_by_manager_id) {
       ptr = nullptr;
     }
-    m_slab.align_next(c_bitmap_block_size);
   }
   template <typename Allocator_Policy>
   bitmap_allocator_t<Allocator_Policy>::~bitmap_allocator_t() = default;
@@ -30,6 +32,7 @@ namespace mcppalloc::bitmap_allocator::details
     m_types.clear();
     m_thread_allocators.clear();
     m_free_globals.clear();
+    m_num_free_globals.store(0, ::std::memory_order_relaxed);
     for (auto &&package_it : m_globals) {
       package_it.second.shutdown();
     }
@@ -52,18 +55,21 @@ namespace mcppalloc::bitmap_allocator::details
     m_thread_allocator_by_manager_id[::gsl::narrow<size_t>(mcpputil::thread_id_manager_t::gs().current_thread_id())] = ta;
   }
   template <typename Allocator_Policy>
-  auto bitmap_allocator_t<Allocator_Policy>::_get_memory() -> bitmap_state_t *
+  auto bitmap_allocator_t<Allocator_Policy>::_get_memory(slab_cache_type &cache) -> bitmap_state_t *
   {
     bitmap_state_t *ret;
-    {
+    if (m_num_free_globals.load(::std::memory_order_relaxed)) {
       MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
       if (!m_free_globals.empty()) {
         ret = mcpputil::unsafe_cast<bitmap_state_t>(m_free_globals.back());
         m_free_globals.pop_back();
+        m_num_free_globals.store(m_free_globals.size(), ::std::memory_order_relaxed);
         return ret;
       }
     }
-    ret = mcpputil::unsafe_cast<bitmap_state_t>(m_slab.allocate_raw(c_bitmap_block_size - slab_allocator_type::cs_header_sz));
+    // the slab header starts the block, see get_state, so consecutive blocks fill the slab exactly.
+    ret = mcpputil::unsafe_cast<bitmap_state_t>(cache.allocate_aligned(
+        c_bitmap_block_size - slab_allocator_type::cs_header_sz, c_bitmap_block_size, slab_allocator_type::cs_header_sz));
     if (mcpputil_unlikely(!ret)) {
       return nullptr;
     }
@@ -130,6 +136,7 @@ namespace mcppalloc::bitmap_allocator::details
   void bitmap_allocator_t<Allocator_Policy>::_u_to_free(void *v) noexcept
   {
     m_free_globals.push_back(v);
+    m_num_free_globals.store(m_free_globals.size(), ::std::memory_order_relaxed);
   }
   template <typename Allocator_Policy>
   auto bitmap_allocator_t<Allocator_Policy>::num_free_blocks() const noexcept -> size_t
@@ -138,6 +145,35 @@ namespace mcppalloc::bitmap_allocator::details
     return m_free_globals.size();
   }
   template <typename Allocator_Policy>
+  auto bitmap_allocator_t<Allocator_Policy>::purge_free_blocks() -> size_t
+  {
+    size_t ret = 0;
+#ifndef _WIN32
+    const size_t page_size = mcpputil::slab_t::page_size();
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    // thread caches are only reachable from their threads, so have them flushed at their next allocation.
+    _u_set_force_maintenance();
+    for (auto &&v : m_free_globals) {
+      // blocks start at the slab header before the state, see get_state.
+      auto block = reinterpret_cast<uint8_t *>(v) - slab_allocator_type::cs_header_sz;
+      if (::madvise(block + page_size, c_bitmap_block_size - page_size, MADV_DONTNEED) == 0) {
+        ret += c_bitmap_block_size - page_size;
+      }
+    }
+#endif
+    return ret;
+  }
+  template <typename Allocator_Policy>
+  auto bitmap_allocator_t<Allocator_Policy>::stats_snapshot() const -> stats_type
+  {
+    return m_counters_registry.snapshot();
+  }
+  template <typename Allocator_Policy>
+  auto bitmap_allocator_t<Allocator_Policy>::_counters_registry() noexcept -> counters_registry_type &
+  {
+    return m_counters_registry;
+  }
+  template <typename Allocator_Policy>
   auto bitmap_allocator_t<Allocator_Policy>::num_globals(size_t id, type_id_t type) const noexcept -> size_t
   {
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
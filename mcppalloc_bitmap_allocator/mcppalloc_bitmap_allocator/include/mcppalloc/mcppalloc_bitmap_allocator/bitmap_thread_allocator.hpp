@@ -2,7 +2,10 @@
 #include "bitmap_package.hpp"
 #include "bitmap_state.hpp"
 #include "declarations.hpp"
+#include <mcppalloc/allocation_stats.hpp>
 #include <mcppalloc/block.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/slab_thread_cache.hpp>
+#include <mcppalloc/slow_path_monitor.hpp>
 #include <mcpputil/mcpputil/boost/container/flat_map.hpp>
 namespace mcppalloc::bitmap_allocator::details
 {
@@ -11,10 +14,13 @@ namespace mcppalloc::bitmap_allocator::details
   {
   public:
     using allocator_policy_type = Allocator_Policy;
+    using allocator_thread_policy_type = typename allocator_policy_type::thread_policy_type;
     using package_type = bitmap_package_t<allocator_policy_type>;
     using block_type = block_t<allocator_policy_type>;
     using internal_allocator_type = typename allocator_policy_type::internal_allocator_type;
     using internal_allocator_traits = typename ::std::allocator_traits<internal_allocator_type>;
+    using counters_type = ::mcppalloc::details::thread_allocation_counters_t<package_type::cs_num_vectors>;
+    using stats_type = typename counters_type::stats_type;
     bitmap_thread_allocator_t(bitmap_allocator_t<allocator_policy_type> &allocator);
     bitmap_thread_allocator_t(const bitmap_thread_allocator_t &) = delete;
     bitmap_thread_allocator_t(bitmap_thread_allocator_t &&) noexcept;
@@ -33,6 +39,9 @@ namespace mcppalloc::bitmap_allocator::details
     auto max_free() const noexcept -> size_t;
 
     void do_maintenance(package_type &package);
+    /**
+     * \brief Do maintenance on all packages and return the blocks cached by this thread to the slab.
+     **/
     void do_maintenance();
 
     template <typename Predicate>
@@ -43,12 +52,40 @@ namespace mcppalloc::bitmap_allocator::details
      * \brief Tell thread to perform maintenance at next opportunity.
      **/
     void set_force_maintenance();
+    /**
+     * \brief Make sure n objects of size sz can be allocated for a type without getting states from the global allocator.
+     *
+     * States are added to the free list and the retention limits are raised so maintenance keeps them.
+     * @return False if the size is too large for a bitmap or no memory is left.
+     **/
+    bool reserve(size_t sz, size_t n, type_id_t type_id = 0);
+    /**
+     * \brief Start a section in which this thread allocator should not take slow paths.
+     *
+     * Forced maintenance is put off until after the section.
+     * Other slow paths are counted or abort depending on action.
+     **/
+    void begin_no_slow_path(::mcppalloc::slow_path_action_t action = ::mcppalloc::slow_path_action_t::count) noexcept;
+    /**
+     * \brief End a section started by begin_no_slow_path().
+     **/
+    void end_no_slow_path() noexcept;
+    /**
+     * \brief Return the number of slow paths taken inside no slow path sections.
+     **/
+    auto num_slow_path_events() const noexcept -> uint64_t;
 
     /**
      * \brief Put information about allocator into a property tree.
      * @param level Level of information to give.  Higher is more verbose.
      **/
     void to_ptree(::boost::property_tree::ptree &ptree, int level);
+    /**
+     * \brief Return allocation counters for this thread allocator.
+     *
+     * These may be read from any thread.
+     **/
+    auto counters() const noexcept -> const counters_type &;
 
   private:
     auto get_package_by_type(type_id_t type_id) -> package_type &;
@@ -60,10 +97,22 @@ namespace mcppalloc::bitmap_allocator::details
     ::std::atomic<bool> m_force_maintenance{false};
     mcpputil::rebind_vector_t<void *, internal_allocator_type> m_free_list;
     bitmap_allocator_t<allocator_policy_type> &m_allocator;
+    /**
+     * \brief Cache of slab memory so refills rarely take the slab lock.
+     **/
+    ::mcppalloc::slab_allocator::details::slab_thread_cache_t m_slab_cache;
     ::std::array<size_t, package_type::cs_num_vectors> m_popcount_max;
     size_t m_max_in_use{10};
     size_t m_max_free{5};
     bool m_in_destructor{false};
+    /**
+     * \brief Allocation counters.
+     **/
+    counters_type m_counters;
+    /**
+     * \brief Slow paths taken inside no slow path sections.
+     **/
+    ::mcppalloc::details::slow_path_monitor_t m_slow_path_monitor;
   };
 }
 #include "bitmap_thread_allocator_impl.hpp"
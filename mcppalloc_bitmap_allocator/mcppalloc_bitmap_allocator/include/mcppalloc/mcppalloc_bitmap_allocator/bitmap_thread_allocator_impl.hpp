@@ -1,4 +1,5 @@
 #pragma once
+#include <mcppalloc/allocator_policy_traits.hpp>
 #include <mcppalloc/allocator_thread_policy.hpp>
 #include <mcpputil/mcpputil/boost/property_tree/ptree.hpp>
 #include <mcpputil/mcpputil/concurrency.hpp>
@@ -9,19 +10,21 @@ namespace mcppalloc::bitmap_allocator::details
   template <typename Allocator_Policy>
   bitmap_thread_allocator_t<Allocator_Policy>::bitmap_thread_allocator_t(bitmap_thread_allocator_t &&ta) noexcept
       : m_locals(::std::move(ta.m_locals)), m_force_maintenance(ta.force_maintenance.load()),
-        m_free_list(::std::move(ta.m_free_list)), m_allocator(ta.m_allocator), m_popcount_max(::std::move(ta.m_popcount_max)),
+        m_free_list(::std::move(ta.m_free_list)), m_allocator(ta.m_allocator),
+        m_slab_cache(ta.m_allocator.underlying_memory()), m_popcount_max(::std::move(ta.m_popcount_max)),
         m_max_in_use(::std::move(ta.m_max_in_use)), m_max_free(::std::move(ta.m_max_free))
   {
   }
   template <typename Allocator_Policy>
   bitmap_thread_allocator_t<Allocator_Policy>::bitmap_thread_allocator_t(bitmap_allocator_t<allocator_policy_type> &allocator)
-      : m_allocator(allocator)
+      : m_allocator(allocator), m_slab_cache(allocator.underlying_memory())
   {
     for (size_t i = 0; i < m_popcount_max.size(); ++i) {
       bitmap_state_t state;
       state.m_internal.m_info = package_type::_get_info(i);
       m_popcount_max[i] = state.size() / 2;
     }
+    m_allocator._counters_registry().register_counters(m_counters);
   }
   template <typename Allocator_Policy>
   bitmap_thread_allocator_t<Allocator_Policy>::~bitmap_thread_allocator_t()
@@ -43,6 +46,7 @@ namespace mcppalloc::bitmap_allocator::details
     if (mcpputil_unlikely(!m_free_list.empty())) {
       ::std::cerr << ::std::this_thread::get_id() << " error deallocating bitmap_thread_allocator_t with free list nonempty\n";
     }
+    m_allocator._counters_registry().unregister_counters(m_counters);
   }
   template <typename Allocator_Policy>
   void bitmap_thread_allocator_t<Allocator_Policy>::set_max_in_use(size_t max_in_use)
@@ -70,10 +74,13 @@ namespace mcppalloc::bitmap_allocator::details
     for (auto &&pair : m_locals) {
       do_maintenance(pair.second);
     }
+    // return cached blocks to the slab so they can coalesce and be trimmed.
+    m_slab_cache.flush();
   }
   template <typename Allocator_Policy>
   void bitmap_thread_allocator_t<Allocator_Policy>::do_maintenance(package_type &package)
   {
+    m_slow_path_monitor.on_slow_path("maintenance");
     m_force_maintenance = false;
 
     package.do_maintenance(m_free_list);
@@ -122,6 +129,7 @@ namespace mcppalloc::bitmap_allocator::details
         }
         assert(static_cast<size_t>(vec.m_vector.end() - end) == num_to_be_moved);
         {
+          m_counters.on_global_lock(id);
           MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_allocator._mutex());
           for (auto it = end; it != vec.m_vector.end(); ++it) {
             m_allocator._u_to_global(id, (*it)->type_id(), *it);
@@ -132,10 +140,12 @@ namespace mcppalloc::bitmap_allocator::details
       // move extra free to global.
 
       if (m_free_list.size() > m_max_free) {
+        m_counters.on_global_lock(id);
         MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_allocator._mutex());
         while (m_free_list.size() != m_max_free) {
           m_allocator._u_to_free(m_free_list.back());
           m_free_list.pop_back();
+          m_counters.on_block_destroyed(id);
         }
       }
       ++id;
@@ -174,13 +184,19 @@ namespace mcppalloc::bitmap_allocator::details
         ret.m_size = state->real_entry_size();
 
         package.insert(id, state);
-        m_allocator.allocator_policy().on_allocation(ret.m_ptr, ret.m_size);
+        m_counters.on_allocation(id, ret.m_size);
+        if_constexpr(has_on_allocation_v<allocator_thread_policy_type>)
+        {
+          m_allocator.allocator_policy().on_allocation(ret.m_ptr, ret.m_size);
+        }
         state->verify_magic();
         return ret;
       }
       // free list empty
       auto &type_info = m_allocator.get_type(package.type_id());
-      bitmap_state_t *state = m_allocator._get_memory();
+      m_slow_path_monitor.on_slow_path("get state");
+      m_counters.on_global_lock(id);
+      bitmap_state_t *state = m_allocator._get_memory(m_slab_cache);
       if (state == nullptr) {
         ::mcppalloc::details::allocation_failure_t failure{attempts++};
         auto action = m_allocator.allocator_policy().on_allocation_failure(failure);
@@ -199,17 +215,30 @@ namespace mcppalloc::bitmap_allocator::details
       ret.m_ptr = state->allocate();
       ret.m_size = state->real_entry_size();
       package.insert(id, state);
-      m_allocator.allocator_policy().on_allocation(ret.m_ptr, ret.m_size);
+      m_counters.on_block_created(id);
+      m_counters.on_allocation(id, ret.m_size);
+      if_constexpr(has_on_allocation_v<allocator_thread_policy_type>)
+      {
+        m_allocator.allocator_policy().on_allocation(ret.m_ptr, ret.m_size);
+      }
       state->verify_magic();
       return ret;
     }
     assert(ret.m_size >= sz);
-    m_allocator.allocator_policy().on_allocation(ret.m_ptr, ret.m_size);
+    m_counters.on_allocation(id, ret.m_size);
+    if_constexpr(has_on_allocation_v<allocator_thread_policy_type>)
+    {
+      m_allocator.allocator_policy().on_allocation(ret.m_ptr, ret.m_size);
+    }
     return ret;
   }
   template <typename Allocator_Policy>
   auto bitmap_thread_allocator_t<Allocator_Policy>::deallocate(void *v, package_type &package) noexcept -> bool
   {
+    if_constexpr(has_on_deallocation_v<allocator_thread_policy_type>)
+    {
+      m_allocator.allocator_policy().on_deallocation(v);
+    }
     bitmap_state_t *state = get_state(v);
     state->verify_magic();
     if (mcpputil_unlikely(!state->has_valid_magic_numbers())) {
@@ -217,12 +246,13 @@ namespace mcppalloc::bitmap_allocator::details
       ::std::abort();
     }
     state->deallocate(v);
+    const auto id = get_bitmap_size_id(state->declared_entry_size());
+    if (mcpputil_unlikely(id == ::std::numeric_limits<size_t>::max())) {
+      ::std::cerr << "mcppalloc bitmap_thread_allocator consistency error aa16e07a-5f8c-4a97-b809-c944ff4c45b9\n";
+      ::std::abort();
+    }
+    m_counters.on_deallocation(id, state->real_entry_size());
     if (state->all_free()) {
-      auto id = get_bitmap_size_id(state->declared_entry_size());
-      if (mcpputil_unlikely(id == ::std::numeric_limits<size_t>::max())) {
-        ::std::cerr << "mcppalloc bitmap_thread_allocator consistency error aa16e07a-5f8c-4a97-b809-c944ff4c45b9\n";
-        ::std::abort();
-      }
       bool success = package.remove(id, state);
       // if it fails it could be anywhere.
       if (!success) {
@@ -254,11 +284,60 @@ namespace mcppalloc::bitmap_allocator::details
   template <typename Allocator_Policy>
   void bitmap_thread_allocator_t<Allocator_Policy>::_check_maintenance()
   {
-    if (mcpputil_unlikely(m_force_maintenance.load(::std::memory_order_relaxed))) {
+    // put off until after any no slow path section.
+    if (mcpputil_unlikely(m_force_maintenance.load(::std::memory_order_relaxed)) && !m_slow_path_monitor.active()) {
       do_maintenance();
     }
   }
   template <typename Allocator_Policy>
+  bool bitmap_thread_allocator_t<Allocator_Policy>::reserve(size_t sz, size_t n, type_id_t type_id)
+  {
+    const auto id = get_bitmap_size_id(sz);
+    if (id == ::std::numeric_limits<size_t>::max()) {
+      return false;
+    }
+    auto package = m_locals.find(type_id);
+    if (package == m_locals.end()) {
+      package = m_locals.insert(::std::make_pair(type_id, package_type(type_id))).first;
+    }
+    auto &vec = package->second.m_vectors[id].m_vector;
+    bitmap_state_t info_state;
+    info_state.m_internal.m_info = package_type::_get_info(id);
+    const size_t entries_per_state = info_state.size();
+    size_t available = 0;
+    for (auto &&state : vec) {
+      available += state->free_popcount();
+    }
+    while (available + m_free_list.size() * entries_per_state < n) {
+      m_counters.on_global_lock(id);
+      bitmap_state_t *state = m_allocator._get_memory(m_slab_cache);
+      if (state == nullptr) {
+        return false;
+      }
+      m_free_list.push_back(state);
+      m_counters.on_block_created(id);
+    }
+    // keep what was reserved through maintenance.
+    m_max_free = ::std::max(m_max_free, m_free_list.size());
+    m_max_in_use = ::std::max(m_max_in_use, vec.size() + m_free_list.size());
+    return true;
+  }
+  template <typename Allocator_Policy>
+  void bitmap_thread_allocator_t<Allocator_Policy>::begin_no_slow_path(::mcppalloc::slow_path_action_t action) noexcept
+  {
+    m_slow_path_monitor.begin(action);
+  }
+  template <typename Allocator_Policy>
+  void bitmap_thread_allocator_t<Allocator_Policy>::end_no_slow_path() noexcept
+  {
+    m_slow_path_monitor.end();
+  }
+  template <typename Allocator_Policy>
+  auto bitmap_thread_allocator_t<Allocator_Policy>::num_slow_path_events() const noexcept -> uint64_t
+  {
+    return m_slow_path_monitor.num_events();
+  }
+  template <typename Allocator_Policy>
   void bitmap_thread_allocator_t<Allocator_Policy>::to_ptree(::boost::property_tree::ptree &ptree, int level)
   {
     ptree.put("max_in_use", ::std::to_string(max_in_use()));
@@ -276,6 +355,11 @@ namespace mcppalloc::bitmap_allocator::details
     }
   }
   template <typename Allocator_Policy>
+  auto bitmap_thread_allocator_t<Allocator_Policy>::counters() const noexcept -> const counters_type &
+  {
+    return m_counters;
+  }
+  template <typename Allocator_Policy>
   template <typename Predicate>
   void bitmap_thread_allocator_t<Allocator_Policy>::for_all_state(Predicate &predicate)
   {
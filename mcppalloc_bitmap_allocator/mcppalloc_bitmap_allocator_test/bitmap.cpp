@@ -1,5 +1,6 @@
 #include <mcppalloc/mcppalloc_bitmap_allocator/bitmap_allocator.hpp>
 #include <mcppalloc/mcppalloc_slab_allocator/slab_allocator.hpp>
+#include <mcppalloc/sampling_heap_profiler_thread_policy.hpp>
 #include <mcpputil/mcpputil/bandit.hpp>
 #include <mcpputil/mcpputil/security.hpp>
 
@@ -7,6 +8,15 @@ using bitmap_allocator =
     mcppalloc::bitmap_allocator::details::bitmap_allocator_t<mcppalloc::default_allocator_policy_t<std::allocator<void>>>;
 template <>
 ::std::vector<bitmap_allocator::thread_allocator_type *> bitmap_allocator::m_thread_allocator_by_manager_id{};
+namespace
+{
+  struct profiled_allocator_policy_t : public ::mcppalloc::default_allocator_policy_t<::std::allocator<void>> {
+    using thread_policy_type = ::mcppalloc::sampling_heap_profiler_thread_policy_t;
+  };
+}
+using profiled_bitmap_allocator = mcppalloc::bitmap_allocator::details::bitmap_allocator_t<profiled_allocator_policy_t>;
+template <>
+::std::vector<profiled_bitmap_allocator::thread_allocator_type *> profiled_bitmap_allocator::m_thread_allocator_by_manager_id{};
 
 using namespace bandit;
 using namespace ::snowhouse;
@@ -232,6 +242,11 @@ static void multiple_slab_test1()
   // make sure destroying twice does not crash.
   poa.destroy_thread();
   AssertThat(poa.num_free_blocks(), Equals(1_sz));
+#ifndef _WIN32
+  // purged free blocks are still reused below.
+  AssertThat(poa.purge_free_blocks(),
+             Equals(mcppalloc::bitmap_allocator::details::c_bitmap_block_size - mcpputil::slab_t::page_size()));
+#endif
   for (size_t i = 0; i < allocator_type::package_type::cs_num_vectors; ++i)
     AssertThat(poa.num_globals(i, 0), Equals(0_sz));
   // ok, now take and check that destroying with a valid block puts it in globals not freed.
@@ -298,6 +313,87 @@ void exhaustive_test()
   }
 }
 
+void profiler_test()
+{
+  profiled_bitmap_allocator bitmap_allocator(20000000, 20000000);
+  bitmap_allocator.add_type(::mcppalloc::bitmap_allocator::details::bitmap_type_info_t(0, 0));
+  auto &profiler = bitmap_allocator.allocator_policy();
+  profiler.set_sampling_interval(1);
+  auto &ta = bitmap_allocator.initialize_thread();
+  ::std::vector<void *> ptrs;
+  for (size_t i = 0; i < 100; ++i) {
+    ptrs.push_back(ta.allocate(128).m_ptr);
+  }
+  // the first allocation on a thread may only seed the sampler.
+  AssertThat(profiler.num_live_samples(), IsGreaterThanOrEqualTo(99_sz));
+  for (auto &&ptr : ptrs) {
+    AssertThat(ta.deallocate(ptr), IsTrue());
+  }
+  AssertThat(profiler.num_live_samples(), Equals(0_sz));
+}
+
+void stats_test()
+{
+  bitmap_allocator allocator(20000000, 20000000);
+  allocator.add_type(::mcppalloc::bitmap_allocator::details::bitmap_type_info_t(0, 0));
+  auto &ta = allocator.initialize_thread();
+  ::std::vector<void *> ptrs;
+  for (size_t i = 0; i < 100; ++i) {
+    ptrs.push_back(ta.allocate(128).m_ptr);
+  }
+  const size_t id = ::mcppalloc::bitmap_allocator::details::get_bitmap_size_id(128);
+  auto stats = allocator.stats_snapshot();
+  AssertThat(stats.m_num_threads, Equals(1_sz));
+  AssertThat(stats.m_bins[id].m_allocations, Equals(100u));
+  AssertThat(stats.m_bins[id].m_bytes_allocated, IsGreaterThanOrEqualTo(12800u));
+  AssertThat(stats.m_bins[id].m_blocks_created, IsGreaterThanOrEqualTo(1u));
+  AssertThat(stats.totals().live_objects(), Equals(100));
+  for (auto &&ptr : ptrs) {
+    AssertThat(ta.deallocate(ptr), IsTrue());
+  }
+  stats = allocator.stats_snapshot();
+  AssertThat(stats.m_bins[id].m_deallocations, Equals(100u));
+  AssertThat(stats.totals().live_bytes(), Equals(0));
+}
+
+void reserve_test()
+{
+  bitmap_allocator allocator(20000000, 20000000);
+  allocator.add_type(::mcppalloc::bitmap_allocator::details::bitmap_type_info_t(0, 0));
+  auto &ta = allocator.initialize_thread();
+  AssertThat(ta.reserve(128, 1000), IsTrue());
+  ta.begin_no_slow_path();
+  ::std::vector<void *> ptrs;
+  for (size_t i = 0; i < 1000; ++i) {
+    ptrs.push_back(ta.allocate(128).m_ptr);
+  }
+  for (auto &&ptr : ptrs) {
+    AssertThat(ta.deallocate(ptr), IsTrue());
+  }
+  AssertThat(ta.num_slow_path_events(), Equals(0u));
+  ta.do_maintenance();
+  AssertThat(ta.num_slow_path_events(), Equals(1u));
+  ta.end_no_slow_path();
+}
+
+void slab_cache_test()
+{
+  bitmap_allocator allocator(20000000, 20000000);
+  allocator.add_type(::mcppalloc::bitmap_allocator::details::bitmap_type_info_t(0, 0));
+  auto &slab = allocator.underlying_memory();
+  auto &ta = allocator.initialize_thread();
+  void *ptr = ta.allocate(128).m_ptr;
+  AssertThat(ptr != nullptr, IsTrue());
+  // the thread cache refills a batch of blocks.
+  const auto cached_bytes = slab.stats_snapshot().totals().live_bytes();
+  AssertThat(cached_bytes, IsGreaterThan(static_cast<int64_t>(::mcppalloc::bitmap_allocator::details::c_bitmap_block_size)));
+  // maintenance returns the blocks not in use to the slab.
+  ta.do_maintenance();
+  AssertThat(slab.stats_snapshot().totals().live_bytes(),
+             IsLessThanOrEqualTo(static_cast<int64_t>(::mcppalloc::bitmap_allocator::details::c_bitmap_block_size)));
+  AssertThat(ta.deallocate(ptr), IsTrue());
+}
+
 void bitmap_allocator_tests()
 {
   auto manager = ::std::make_unique<mcpputil::thread_id_manager_t>();
@@ -311,5 +407,9 @@ void bitmap_allocator_tests()
     it("multiple_slab_test0b", []() { multiple_slab_test0b(); });
     it("multiple_slab_test1", []() { multiple_slab_test1(); });
     it("exhaustive_test", []() { exhaustive_test(); });
+    it("profiler_test", []() { profiler_test(); });
+    it("stats_test", []() { stats_test(); });
+    it("reserve_test", []() { reserve_test(); });
+    it("slab_cache_test", []() { slab_cache_test(); });
   });
 }
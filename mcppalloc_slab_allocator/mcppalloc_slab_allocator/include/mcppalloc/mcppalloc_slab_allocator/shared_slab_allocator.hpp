@@ -0,0 +1,226 @@
+#pragma once
+#ifndef _WIN32
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+namespace mcppalloc::slab_allocator::details
+{
+  /**
+   * \brief Slab allocator that lives in a shared memory file and may be used by several processes at once.
+   *
+   * The lock, free lists and object headers are all stored in the file and linked by offsets from its start.
+   * Each process may map it at a different address, so pointers are passed between processes as offset().
+   * The lock is a robust process shared mutex.
+   * If a process dies holding it, the free lists are rebuilt from the object headers on the next lock.
+   * Objects a dead process still had allocated stay allocated until some other process deallocates them.
+   * Capacity is fixed at creation since other processes could not follow the mapping being grown.
+   **/
+  class shared_slab_allocator_t
+  {
+  public:
+    /**
+     * \brief Alignment of object headers and object memory.
+     **/
+    static constexpr const size_t cs_alignment = 64;
+    /**
+     * \brief Size of the header before each object.
+     **/
+    static constexpr const size_t cs_header_sz = 64;
+    /**
+     * \brief Smallest object including header, smaller remainders are not split off.
+     **/
+    static constexpr const size_t cs_min_object_sz = cs_header_sz + cs_alignment;
+    /**
+     * \brief Number of power of two free lists.
+     **/
+    static constexpr const size_t cs_num_classes = 48;
+    /**
+     * \brief Create a new allocator in a file, which is resized to capacity.
+     *
+     * Throws ::std::system_error if the file can not be resized or mapped.
+     * @param fd Descriptor of a file from shm_open, memfd_create or open, it is not closed.
+     * @param capacity Size of the file including the control block.
+     **/
+    shared_slab_allocator_t(int fd, size_t capacity);
+    /**
+     * \brief Attach to an allocator created in a file by this or another process.
+     *
+     * Throws ::std::system_error if the file can not be mapped and ::std::invalid_argument if it holds no allocator.
+     * @param fd Descriptor of the file, it is not closed.
+     **/
+    explicit shared_slab_allocator_t(int fd);
+    shared_slab_allocator_t(const shared_slab_allocator_t &) = delete;
+    shared_slab_allocator_t(shared_slab_allocator_t &&) = delete;
+    shared_slab_allocator_t &operator=(const shared_slab_allocator_t &) = delete;
+    shared_slab_allocator_t &operator=(shared_slab_allocator_t &&) = delete;
+    /**
+     * \brief Destructor, unmaps the file and leaves the allocator in it for other processes.
+     **/
+    ~shared_slab_allocator_t();
+    /**
+     * \brief Allocate memory.
+     * @param sz Size of object allocation required.
+     * @return Start of object memory or nullptr if no free object is large enough.
+     **/
+    void *allocate_raw(size_t sz);
+    /**
+     * \brief Deallocate memory allocated by any process attached to the file.
+     **/
+    void deallocate_raw(void *v);
+    /**
+     * \brief Return the offset of v from the start of the file, valid in every process.
+     **/
+    auto offset(const void *v) const noexcept -> size_t;
+    /**
+     * \brief Return the address of an offset in this process.
+     **/
+    void *from_offset(size_t offset) const noexcept;
+    /**
+     * \brief Return true if v is in the object memory of the file.
+     **/
+    bool contains(const void *v) const noexcept;
+    /**
+     * \brief Return start address of the mapping in this process.
+     **/
+    uint8_t *begin() const noexcept;
+    /**
+     * \brief Return end address of the mapping in this process.
+     **/
+    uint8_t *end() const noexcept;
+    /**
+     * \brief Return size of the file.
+     **/
+    auto capacity() const noexcept -> size_t;
+    /**
+     * \brief Return the number of free objects.
+     **/
+    auto num_free() -> size_t;
+    /**
+     * \brief Return bytes of allocated objects including headers.
+     **/
+    auto bytes_in_use() -> size_t;
+    /**
+     * \brief Check object headers and free lists, terminating on corruption.
+     **/
+    void _verify();
+    /**
+     * \brief Return the process shared lock.
+     **/
+    auto _mutex() noexcept -> pthread_mutex_t &;
+
+  private:
+    /**
+     * \brief Header before each object.
+     **/
+    struct object_t {
+      uint64_t m_magic;
+      /**
+       * \brief Size including header, the low bit is set while in use.
+       **/
+      uint64_t m_size;
+      /**
+       * \brief Size of the previous object or zero for the first, the boundary tag used to coalesce backwards.
+       **/
+      uint64_t m_prev_size;
+      /**
+       * \brief Free list links as offsets, zero for none, only meaningful while free.
+       **/
+      uint64_t m_next_free;
+      uint64_t m_prev_free;
+    };
+    static_assert(sizeof(object_t) <= cs_header_sz, "Object header too large");
+    /**
+     * \brief Control block at the start of the file.
+     **/
+    struct control_t {
+      uint64_t m_magic;
+      uint64_t m_version;
+      uint64_t m_capacity;
+      pthread_mutex_t m_mutex;
+      uint64_t m_num_free;
+      uint64_t m_bytes_in_use;
+      /**
+       * \brief Heads of free lists, where list i holds objects of at least 2^i times the alignment.
+       **/
+      ::std::array<uint64_t, cs_num_classes> m_free_heads;
+    };
+    /**
+     * \brief Offset of the first object.
+     **/
+    static constexpr const size_t cs_data_offset = (sizeof(control_t) + cs_alignment - 1) / cs_alignment * cs_alignment;
+    static constexpr const uint64_t cs_magic = 0x6d6370707368736cull;
+    static constexpr const uint64_t cs_version = 1;
+    static constexpr const uint64_t cs_object_magic = 0x5348534c4f424a21ull;
+    static constexpr const uint64_t cs_in_use = 1;
+    /**
+     * \brief Holds the lock, recovering the allocator if its previous owner died.
+     **/
+    class lock_guard_t
+    {
+    public:
+      explicit lock_guard_t(shared_slab_allocator_t &allocator);
+      lock_guard_t(const lock_guard_t &) = delete;
+      lock_guard_t &operator=(const lock_guard_t &) = delete;
+      ~lock_guard_t();
+
+    private:
+      shared_slab_allocator_t &m_allocator;
+    };
+    void _map(int fd, size_t size);
+    auto _control() const noexcept -> control_t *;
+    auto _object(uint64_t offset) const noexcept -> object_t *;
+    static auto _size(const object_t *object) noexcept -> uint64_t;
+    static auto _in_use(const object_t *object) noexcept -> bool;
+    static auto _class(uint64_t size) noexcept -> size_t;
+    /**
+     * \brief Return the offset of the first free object of at least size or zero if there is none.
+     **/
+    auto _u_find_free(uint64_t size) noexcept -> uint64_t;
+    void _u_add_free(uint64_t offset) noexcept;
+    void _u_remove_free(uint64_t offset) noexcept;
+    /**
+     * \brief Rebuild free lists and counters by walking object headers, merging neighbouring free objects.
+     **/
+    void _u_recover();
+    uint8_t *m_begin{nullptr};
+    size_t m_size{0};
+  };
+  inline auto shared_slab_allocator_t::offset(const void *v) const noexcept -> size_t
+  {
+    return static_cast<size_t>(reinterpret_cast<const uint8_t *>(v) - m_begin);
+  }
+  inline void *shared_slab_allocator_t::from_offset(size_t offset) const noexcept
+  {
+    return m_begin + offset;
+  }
+  inline bool shared_slab_allocator_t::contains(const void *v) const noexcept
+  {
+    return v >= m_begin + cs_data_offset + cs_header_sz && v < m_begin + m_size;
+  }
+  inline uint8_t *shared_slab_allocator_t::begin() const noexcept
+  {
+    return m_begin;
+  }
+  inline uint8_t *shared_slab_allocator_t::end() const noexcept
+  {
+    return m_begin + m_size;
+  }
+  inline auto shared_slab_allocator_t::capacity() const noexcept -> size_t
+  {
+    return m_size;
+  }
+  inline auto shared_slab_allocator_t::_mutex() noexcept -> pthread_mutex_t &
+  {
+    return _control()->m_mutex;
+  }
+  inline auto shared_slab_allocator_t::_control() const noexcept -> control_t *
+  {
+    return reinterpret_cast<control_t *>(m_begin);
+  }
+  inline auto shared_slab_allocator_t::_object(uint64_t offset) const noexcept -> object_t *
+  {
+    return reinterpret_cast<object_t *>(m_begin + offset);
+  }
+}
+#endif
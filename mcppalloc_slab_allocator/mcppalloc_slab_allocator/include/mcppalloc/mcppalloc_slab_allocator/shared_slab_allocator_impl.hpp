@@ -0,0 +1,294 @@
+#pragma once
+#ifndef _WIN32
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <mcpputil/mcpputil/intrinsics.hpp>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+namespace mcppalloc::slab_allocator::details
+{
+  shared_slab_allocator_t::shared_slab_allocator_t(int fd, size_t capacity)
+  {
+    capacity = capacity / cs_alignment * cs_alignment;
+    if (capacity < cs_data_offset + cs_min_object_sz)
+      throw ::std::invalid_argument("mcppalloc shared slab allocator capacity too small");
+    if (::ftruncate(fd, static_cast<off_t>(capacity)))
+      throw ::std::system_error(errno, ::std::generic_category(), "mcppalloc shared slab allocator ftruncate");
+    _map(fd, capacity);
+    auto control = _control();
+    pthread_mutexattr_t attr;
+    ::pthread_mutexattr_init(&attr);
+    ::pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    ::pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    const int ret = ::pthread_mutex_init(&control->m_mutex, &attr);
+    ::pthread_mutexattr_destroy(&attr);
+    if (ret) {
+      ::munmap(m_begin, m_size);
+      throw ::std::system_error(ret, ::std::generic_category(), "mcppalloc shared slab allocator pthread_mutex_init");
+    }
+    control->m_version = cs_version;
+    control->m_capacity = capacity;
+    control->m_num_free = 0;
+    control->m_bytes_in_use = 0;
+    control->m_free_heads.fill(0);
+    auto object = _object(cs_data_offset);
+    object->m_magic = cs_object_magic;
+    object->m_size = capacity - cs_data_offset;
+    object->m_prev_size = 0;
+    _u_add_free(cs_data_offset);
+    // written last so a process attaching early does not see a half made allocator.
+    __atomic_store_n(&control->m_magic, cs_magic, __ATOMIC_RELEASE);
+  }
+  shared_slab_allocator_t::shared_slab_allocator_t(int fd)
+  {
+    struct ::stat st;
+    if (::fstat(fd, &st))
+      throw ::std::system_error(errno, ::std::generic_category(), "mcppalloc shared slab allocator fstat");
+    const auto size = static_cast<size_t>(st.st_size);
+    if (size < cs_data_offset + cs_min_object_sz)
+      throw ::std::invalid_argument("mcppalloc shared slab allocator file too small");
+    _map(fd, size);
+    auto control = _control();
+    if (__atomic_load_n(&control->m_magic, __ATOMIC_ACQUIRE) != cs_magic || control->m_version != cs_version ||
+        control->m_capacity != size) {
+      ::munmap(m_begin, m_size);
+      throw ::std::invalid_argument("mcppalloc shared slab allocator file holds no allocator");
+    }
+  }
+  shared_slab_allocator_t::~shared_slab_allocator_t()
+  {
+    ::munmap(m_begin, m_size);
+  }
+  void shared_slab_allocator_t::_map(int fd, size_t size)
+  {
+    void *ret = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ret == MAP_FAILED)
+      throw ::std::system_error(errno, ::std::generic_category(), "mcppalloc shared slab allocator mmap");
+    m_begin = reinterpret_cast<uint8_t *>(ret);
+    m_size = size;
+  }
+  shared_slab_allocator_t::lock_guard_t::lock_guard_t(shared_slab_allocator_t &allocator) : m_allocator(allocator)
+  {
+    auto &mutex = m_allocator._mutex();
+    const int ret = ::pthread_mutex_lock(&mutex);
+    if (ret == EOWNERDEAD) {
+      // the owner died part way through a change, so trust only the object headers.
+      m_allocator._u_recover();
+      ::pthread_mutex_consistent(&mutex);
+    } else if (ret) {
+      ::std::cerr << "mcppalloc shared slab allocator lock failed 5985a10f-107d-41c4-ad7e-e35dc2d2c154" << ::std::endl;
+      ::std::terminate();
+    }
+  }
+  shared_slab_allocator_t::lock_guard_t::~lock_guard_t()
+  {
+    ::pthread_mutex_unlock(&m_allocator._mutex());
+  }
+  auto shared_slab_allocator_t::_size(const object_t *object) noexcept -> uint64_t
+  {
+    return object->m_size & ~cs_in_use;
+  }
+  auto shared_slab_allocator_t::_in_use(const object_t *object) noexcept -> bool
+  {
+    return object->m_size & cs_in_use;
+  }
+  auto shared_slab_allocator_t::_class(uint64_t size) noexcept -> size_t
+  {
+    return static_cast<size_t>(63 - mcpputil::clz(size / cs_alignment));
+  }
+  auto shared_slab_allocator_t::_u_find_free(uint64_t size) noexcept -> uint64_t
+  {
+    auto control = _control();
+    // the list for size may hold smaller objects, so take the first that fits.
+    const size_t size_class = _class(size);
+    for (uint64_t it = control->m_free_heads[size_class]; it; it = _object(it)->m_next_free) {
+      if (_size(_object(it)) >= size) {
+        return it;
+      }
+    }
+    // every object in a larger list fits.
+    for (size_t i = size_class + 1; i < cs_num_classes; ++i) {
+      if (control->m_free_heads[i]) {
+        return control->m_free_heads[i];
+      }
+    }
+    return 0;
+  }
+  void shared_slab_allocator_t::_u_add_free(uint64_t offset) noexcept
+  {
+    auto control = _control();
+    auto object = _object(offset);
+    auto &head = control->m_free_heads[_class(_size(object))];
+    object->m_prev_free = 0;
+    object->m_next_free = head;
+    if (head) {
+      _object(head)->m_prev_free = offset;
+    }
+    head = offset;
+    ++control->m_num_free;
+  }
+  void shared_slab_allocator_t::_u_remove_free(uint64_t offset) noexcept
+  {
+    auto control = _control();
+    auto object = _object(offset);
+    if (object->m_prev_free) {
+      _object(object->m_prev_free)->m_next_free = object->m_next_free;
+    } else {
+      control->m_free_heads[_class(_size(object))] = object->m_next_free;
+    }
+    if (object->m_next_free) {
+      _object(object->m_next_free)->m_prev_free = object->m_prev_free;
+    }
+    --control->m_num_free;
+  }
+  void *shared_slab_allocator_t::allocate_raw(size_t sz)
+  {
+    if (sz > m_size) {
+      return nullptr;
+    }
+    const uint64_t needed =
+        ::std::max<uint64_t>((sz + cs_alignment - 1) / cs_alignment * cs_alignment + cs_header_sz, cs_min_object_sz);
+    lock_guard_t lock(*this);
+    const uint64_t offset = _u_find_free(needed);
+    if (!offset) {
+      return nullptr;
+    }
+    _u_remove_free(offset);
+    auto object = _object(offset);
+    const uint64_t size = _size(object);
+    if (size - needed >= cs_min_object_sz) {
+      // split off the remainder, which stays free.
+      auto rest = _object(offset + needed);
+      rest->m_magic = cs_object_magic;
+      rest->m_size = size - needed;
+      rest->m_prev_size = needed;
+      if (offset + size < m_size) {
+        _object(offset + size)->m_prev_size = size - needed;
+      }
+      object->m_size = needed;
+      _u_add_free(offset + needed);
+    }
+    object->m_size |= cs_in_use;
+    _control()->m_bytes_in_use += _size(object);
+    return m_begin + offset + cs_header_sz;
+  }
+  void shared_slab_allocator_t::deallocate_raw(void *v)
+  {
+    uint64_t offset = shared_slab_allocator_t::offset(v) - cs_header_sz;
+    if (mcpputil_unlikely(!contains(v) || offset % cs_alignment || _object(offset)->m_magic != cs_object_magic)) {
+      ::std::cerr << "mcppalloc shared slab allocator bad deallocation 88b74248-1500-4a5b-8bdd-e4d9cae7a4ab" << ::std::endl;
+      ::std::terminate();
+    }
+    lock_guard_t lock(*this);
+    auto object = _object(offset);
+    if (mcpputil_unlikely(!_in_use(object))) {
+      ::std::cerr << "mcppalloc shared slab allocator double free 152c8dc2-96d2-46b9-8b7c-6097ae0981e8" << ::std::endl;
+      ::std::terminate();
+    }
+    uint64_t size = _size(object);
+    _control()->m_bytes_in_use -= size;
+    // coalesce forward.
+    if (offset + size < m_size && !_in_use(_object(offset + size))) {
+      _u_remove_free(offset + size);
+      size += _size(_object(offset + size));
+    }
+    // coalesce backward using the boundary tag.
+    if (object->m_prev_size && !_in_use(_object(offset - object->m_prev_size))) {
+      offset -= object->m_prev_size;
+      _u_remove_free(offset);
+      size += _size(_object(offset));
+      object = _object(offset);
+    }
+    object->m_size = size;
+    if (offset + size < m_size) {
+      _object(offset + size)->m_prev_size = size;
+    }
+    _u_add_free(offset);
+  }
+  void shared_slab_allocator_t::_u_recover()
+  {
+    auto control = _control();
+    control->m_free_heads.fill(0);
+    control->m_num_free = 0;
+    control->m_bytes_in_use = 0;
+    uint64_t prev = 0;
+    uint64_t pending_free = 0;
+    for (uint64_t offset = cs_data_offset; offset < m_size;) {
+      auto object = _object(offset);
+      const uint64_t size = _size(object);
+      if (object->m_magic != cs_object_magic || size < cs_min_object_sz || size % cs_alignment || size > m_size - offset) {
+        ::std::cerr << "mcppalloc shared slab allocator unrecoverable 4d9fda42-3380-4200-bafb-e3bcc6dd2a24" << ::std::endl;
+        ::std::terminate();
+      }
+      if (_in_use(object)) {
+        if (pending_free) {
+          _u_add_free(pending_free);
+          pending_free = 0;
+        }
+        control->m_bytes_in_use += size;
+      } else if (pending_free) {
+        // a coalesce was interrupted, finish it.
+        _object(pending_free)->m_size += size;
+        offset += size;
+        continue;
+      } else {
+        pending_free = offset;
+      }
+      object->m_prev_size = prev ? _size(_object(prev)) : 0;
+      prev = offset;
+      offset += size;
+    }
+    if (pending_free) {
+      _u_add_free(pending_free);
+    }
+  }
+  auto shared_slab_allocator_t::num_free() -> size_t
+  {
+    lock_guard_t lock(*this);
+    return _control()->m_num_free;
+  }
+  auto shared_slab_allocator_t::bytes_in_use() -> size_t
+  {
+    lock_guard_t lock(*this);
+    return _control()->m_bytes_in_use;
+  }
+  void shared_slab_allocator_t::_verify()
+  {
+    lock_guard_t lock(*this);
+    auto control = _control();
+    uint64_t prev_size = 0;
+    bool prev_free = false;
+    uint64_t num_free = 0;
+    uint64_t bytes_in_use = 0;
+    for (uint64_t offset = cs_data_offset; offset < m_size;) {
+      auto object = _object(offset);
+      const uint64_t size = _size(object);
+      const bool free = !_in_use(object);
+      if (object->m_magic != cs_object_magic || object->m_prev_size != prev_size || size < cs_min_object_sz ||
+          size > m_size - offset || (free && prev_free)) {
+        ::std::cerr << "mcppalloc shared slab allocator verify failed 2a093b4c-207e-4d57-bc47-d4897d075a24" << ::std::endl;
+        ::std::terminate();
+      }
+      num_free += free;
+      bytes_in_use += free ? 0 : size;
+      prev_free = free;
+      prev_size = size;
+      offset += size;
+    }
+    uint64_t num_listed = 0;
+    for (auto head : control->m_free_heads) {
+      for (uint64_t it = head; it; it = _object(it)->m_next_free) {
+        ++num_listed;
+      }
+    }
+    if (num_free != control->m_num_free || num_listed != num_free || bytes_in_use != control->m_bytes_in_use) {
+      ::std::cerr << "mcppalloc shared slab allocator verify failed 2a093b4c-207e-4d57-bc47-d4897d075a24" << ::std::endl;
+      ::std::terminate();
+    }
+  }
+}
+#endif
@@ -0,0 +1,128 @@
+#pragma once
+#include "slab_allocator.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+namespace mcppalloc::slab_allocator::details
+{
+  /**
+   * \brief Lock free allocator that is async signal safe.
+   *
+   * Capacity is reserved up front from a slab allocator, so nothing is mapped or expanded while allocating.
+   * Allocation bumps an atomic pointer over that region.
+   * Freed objects go on lock free stacks per power of two size class and are reused before bumping.
+   * Freed memory is never coalesced or given back to the slab until destruction.
+   * allocate_raw and deallocate_raw may be called from any thread and from signal handlers.
+   **/
+  class signal_safe_slab_allocator_t
+  {
+  public:
+    /**
+     * \brief Size of header before each object, it holds the size class.
+     **/
+    static constexpr const size_t cs_header_sz = 16;
+    /**
+     * \brief Size of the smallest size class including header.
+     **/
+    static constexpr const size_t cs_min_size = 64;
+    /**
+     * \brief Number of size classes.
+     **/
+    static constexpr const size_t cs_num_classes = 16;
+    /**
+     * \brief Largest allocation that can be requested.
+     **/
+    static constexpr const size_t cs_max_allocation = (cs_min_size << (cs_num_classes - 1)) - cs_header_sz;
+    static_assert(::std::atomic<uint64_t>::is_always_lock_free, "Signal safety requires lock free 64 bit atomics");
+    static_assert(::std::atomic<size_t>::is_always_lock_free, "Signal safety requires lock free size_t atomics");
+    /**
+     * \brief Constructor.
+     *
+     * This is not signal safe.
+     * Throws ::std::bad_alloc if the capacity can not be reserved.
+     * @param slab Slab allocator to reserve capacity from.
+     * @param capacity Bytes to reserve.
+     **/
+    signal_safe_slab_allocator_t(slab_allocator_t &slab, size_t capacity);
+    signal_safe_slab_allocator_t(const signal_safe_slab_allocator_t &) = delete;
+    signal_safe_slab_allocator_t(signal_safe_slab_allocator_t &&) = delete;
+    signal_safe_slab_allocator_t &operator=(const signal_safe_slab_allocator_t &) = delete;
+    signal_safe_slab_allocator_t &operator=(signal_safe_slab_allocator_t &&) = delete;
+    /**
+     * \brief Destructor, gives the reserved capacity back to the slab allocator.
+     *
+     * This is not signal safe.
+     **/
+    ~signal_safe_slab_allocator_t();
+    /**
+     * \brief Allocate memory.
+     *
+     * Async signal safe and lock free.
+     * @param sz Size of object allocation required.
+     * @return Start of object memory, 16 byte aligned, or nullptr if capacity is exhausted or sz is too large.
+     **/
+    void *allocate_raw(size_t sz) noexcept;
+    /**
+     * \brief Deallocate memory allocated by this allocator.
+     *
+     * Async signal safe and lock free.
+     **/
+    void deallocate_raw(void *v) noexcept;
+    /**
+     * \brief Return true if v was allocated by this allocator.
+     **/
+    bool contains(const void *v) const noexcept;
+    /**
+     * \brief Return bytes reserved.
+     **/
+    auto capacity() const noexcept -> size_t;
+    /**
+     * \brief Return bytes never bumped over, freed objects are not included.
+     **/
+    auto remaining() const noexcept -> size_t;
+    /**
+     * \brief Return the size class for an allocation of sz, cs_num_classes if it is too large.
+     **/
+    static auto size_class(size_t sz) noexcept -> size_t;
+
+  private:
+    /**
+     * \brief Header before each object.
+     **/
+    struct header_t {
+      uint32_t m_magic;
+      uint32_t m_size_class;
+    };
+    static constexpr const uint32_t cs_magic = 0x5a17e5afu;
+    /**
+     * \brief Return the free stack link stored in a freed object.
+     **/
+    static auto _link(uint8_t *object) noexcept -> ::std::atomic<uint32_t> *;
+    slab_allocator_t &m_slab;
+    uint8_t *m_begin;
+    size_t m_capacity;
+    /**
+     * \brief Offset of the bump pointer from begin.
+     **/
+    ::std::atomic<size_t> m_bump{0};
+    /**
+     * \brief Heads of free stacks.
+     *
+     * The low 32 bits are the index of the top object in units of cs_header_sz plus one, zero if empty.
+     * The high 32 bits are a tag incremented on every change so a stale head can not be swapped in.
+     **/
+    ::std::array<::std::atomic<uint64_t>, cs_num_classes> m_free_heads{};
+  };
+  inline bool signal_safe_slab_allocator_t::contains(const void *v) const noexcept
+  {
+    return v >= m_begin && v < m_begin + m_capacity;
+  }
+  inline auto signal_safe_slab_allocator_t::capacity() const noexcept -> size_t
+  {
+    return m_capacity;
+  }
+  inline auto signal_safe_slab_allocator_t::remaining() const noexcept -> size_t
+  {
+    return m_capacity - ::std::min(m_capacity, m_bump.load(::std::memory_order_relaxed));
+  }
+}
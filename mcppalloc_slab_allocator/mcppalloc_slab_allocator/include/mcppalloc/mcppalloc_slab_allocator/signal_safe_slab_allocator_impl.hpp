@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdlib>
+#include <mcpputil/mcpputil/intrinsics.hpp>
+#include <new>
+namespace mcppalloc::slab_allocator::details
+{
+  signal_safe_slab_allocator_t::signal_safe_slab_allocator_t(slab_allocator_t &slab, size_t capacity)
+      : m_slab(slab), m_capacity(mcpputil::align(capacity, cs_min_size))
+  {
+    // free stack heads hold 32 bit indices.
+    if (m_capacity / cs_header_sz >= ::std::numeric_limits<uint32_t>::max())
+      throw ::std::bad_alloc();
+    m_begin = reinterpret_cast<uint8_t *>(m_slab.allocate_raw(m_capacity));
+    if (!m_begin)
+      throw ::std::bad_alloc();
+  }
+  signal_safe_slab_allocator_t::~signal_safe_slab_allocator_t()
+  {
+    m_slab.deallocate_raw(m_begin);
+  }
+  auto signal_safe_slab_allocator_t::size_class(size_t sz) noexcept -> size_t
+  {
+    if (sz > cs_max_allocation) {
+      return cs_num_classes;
+    }
+    const size_t units = (sz + cs_header_sz + cs_min_size - 1) / cs_min_size;
+    if (units <= 1) {
+      return 0;
+    }
+    return static_cast<size_t>(64 - mcpputil::clz(units - 1));
+  }
+  auto signal_safe_slab_allocator_t::_link(uint8_t *object) noexcept -> ::std::atomic<uint32_t> *
+  {
+    return reinterpret_cast<::std::atomic<uint32_t> *>(object + cs_header_sz);
+  }
+  void *signal_safe_slab_allocator_t::allocate_raw(size_t sz) noexcept
+  {
+    const size_t size_class = signal_safe_slab_allocator_t::size_class(sz);
+    if (mcpputil_unlikely(size_class >= cs_num_classes)) {
+      return nullptr;
+    }
+    // reuse a freed object first.
+    auto &head = m_free_heads[size_class];
+    uint64_t old_head = head.load(::std::memory_order_acquire);
+    while (static_cast<uint32_t>(old_head)) {
+      uint8_t *object = m_begin + (static_cast<uint32_t>(old_head) - 1) * cs_header_sz;
+      // the object may be popped and reused concurrently, then the link is garbage but the tag makes the swap fail.
+      const uint64_t next = _link(object)->load(::std::memory_order_relaxed);
+      const uint64_t new_head = ((old_head >> 32) + 1) << 32 | next;
+      if (head.compare_exchange_weak(old_head, new_head, ::std::memory_order_acquire, ::std::memory_order_acquire)) {
+        return object + cs_header_sz;
+      }
+    }
+    // bump, without ever moving past capacity so remaining stays exact.
+    const size_t total = cs_min_size << size_class;
+    size_t offset = m_bump.load(::std::memory_order_relaxed);
+    do {
+      if (mcpputil_unlikely(m_capacity - offset < total)) {
+        return nullptr;
+      }
+    } while (!m_bump.compare_exchange_weak(offset, offset + total, ::std::memory_order_relaxed, ::std::memory_order_relaxed));
+    auto header = reinterpret_cast<header_t *>(m_begin + offset);
+    header->m_magic = cs_magic;
+    header->m_size_class = static_cast<uint32_t>(size_class);
+    return m_begin + offset + cs_header_sz;
+  }
+  void signal_safe_slab_allocator_t::deallocate_raw(void *v) noexcept
+  {
+    uint8_t *object = reinterpret_cast<uint8_t *>(v) - cs_header_sz;
+    const auto header = reinterpret_cast<header_t *>(object);
+    // printing is not signal safe, so just abort.
+    if (mcpputil_unlikely(!contains(v) || header->m_magic != cs_magic || header->m_size_class >= cs_num_classes)) {
+      ::std::abort();
+    }
+    auto &head = m_free_heads[header->m_size_class];
+    const uint64_t index = static_cast<uint64_t>(object - m_begin) / cs_header_sz + 1;
+    uint64_t old_head = head.load(::std::memory_order_relaxed);
+    do {
+      _link(object)->store(static_cast<uint32_t>(old_head), ::std::memory_order_relaxed);
+    } while (!head.compare_exchange_weak(old_head, ((old_head >> 32) + 1) << 32 | index, ::std::memory_order_release,
+                                         ::std::memory_order_relaxed));
+  }
+}
@@ -1,10 +1,9 @@
 #pragma once
 #include "slab_allocator_dll.hpp"
-#include <array>
 #include <boost/property_tree/ptree_fwd.hpp>
+#include <mcppalloc/allocation_stats.hpp>
 #include <mcppalloc/object_state.hpp>
 #include <mcpputil/mcpputil/alignment.hpp>
-#include <mcpputil/mcpputil/backed_ordered_map.hpp>
 #include <mcpputil/mcpputil/concurrency.hpp>
 #include <mcpputil/mcpputil/function_iterator.hpp>
 #include <mcpputil/mcpputil/memory_range.hpp>
@@ -15,6 +14,39 @@ namespace mcppalloc::slab_allocator::details
   using mutex_type = mcpputil::mutex_t;
   using slab_allocator_object_t = ::mcppalloc::details::object_state_base_t;
   static_assert(::std::is_pod<slab_allocator_object_t>::value, "slab_allocator_object_t is not POD");
+  /**
+   * \brief Links kept in the header padding after the object state.
+   **/
+  struct slab_allocator_links_t {
+    /**
+     * \brief Previous object state or nullptr for the first, the boundary tag used to coalesce backwards.
+     **/
+    slab_allocator_object_t *m_prev;
+    /**
+     * \brief Children in the free index, only meaningful while the object is free.
+     **/
+    slab_allocator_object_t *m_left;
+    slab_allocator_object_t *m_right;
+  };
+  /**
+   * \brief How a slab allocator grows when it runs out of memory.
+   *
+   * The new size is the old size times the factor plus the step, limited to the maximum size.
+   **/
+  struct slab_growth_policy_t {
+    /**
+     * \brief Factor the size is multiplied by, one for fixed steps.
+     **/
+    double m_factor{2.0};
+    /**
+     * \brief Bytes added after applying the factor.
+     **/
+    size_t m_step{0};
+    /**
+     * \brief Largest size to grow to, zero for no limit.
+     **/
+    size_t m_max_size{0};
+  };
   /**
    * \brief This is a thread safe reentrant* slab allocator.
    *
@@ -34,11 +66,17 @@ namespace mcppalloc::slab_allocator::details
      * \brief Type of memory range.
      **/
     using memory_range_type = mcpputil::memory_range_t<pointer_type>;
+    /**
+     * \brief Type of allocation statistics snapshot.
+     **/
+    using stats_type = ::mcppalloc::allocation_stats_t<1>;
 
     static inline constexpr const size_t cs_alignment = 64;
     static inline constexpr const size_t cs_header_sz = mcpputil::cs_align(sizeof(slab_allocator_object_t), cs_alignment);
     static constexpr size_t alignment() noexcept;
     static_assert(cs_header_sz == 64, "");
+    static_assert(sizeof(slab_allocator_object_t) + sizeof(slab_allocator_links_t) <= cs_header_sz,
+                  "Links must fit in header padding");
     /**
      * \brief Constructor.
      *
@@ -53,6 +91,7 @@ namespace mcppalloc::slab_allocator::details
     /**
      * \brief Align the next allocation to the given size.
      * This is only guarenteed to work if done before any deallocation.
+     * It leaves a padding object allocated, prefer allocate_aligned.
      **/
     void align_next(size_t sz) REQUIRES(!m_mutex);
     /**
@@ -122,6 +161,50 @@ namespace mcppalloc::slab_allocator::details
      * @param v Memory to deallocate.
      **/
     void deallocate_raw(void *v) REQUIRES(!m_mutex);
+    /**
+     * \brief Allocate memory whose start is offset bytes past an aligned boundary.
+     *
+     * A free object is split so the start lands on the boundary and the leading remainder stays free.
+     * @param sz Size of object allocation required.
+     * @param alignment Power of two alignment, alignments up to alignment() need no splitting.
+     * @param offset Multiple of alignment() less than alignment, cs_header_sz aligns the object header instead.
+     * @return Start of object memory or nullptr on out of memory.
+     **/
+    void *allocate_aligned(size_t sz, size_t alignment, size_t offset = 0) REQUIRES(!m_mutex);
+    /**
+     * \brief Allocate up to n aligned objects of size sz while taking the lock once.
+     * @return Number of objects allocated, less than n on out of memory.
+     **/
+    auto allocate_aligned_batch(size_t sz, size_t alignment, size_t offset, void **out, size_t n) -> size_t REQUIRES(!m_mutex);
+    /**
+     * \brief Allocate up to n objects of size sz while taking the lock once.
+     *
+     * @param sz Size of object allocation required.
+     * @param out Array of at least n pointers to fill.
+     * @param n Number of objects wanted.
+     * @return Number of objects allocated, less than n on out of memory.
+     **/
+    auto allocate_raw_batch(size_t sz, void **out, size_t n) -> size_t REQUIRES(!m_mutex);
+    /**
+     * \brief Deallocate n objects while taking the lock once.
+     **/
+    void deallocate_raw_batch(void *const *v, size_t n) REQUIRES(!m_mutex);
+    /**
+     * \brief Set how the slab grows when it runs out of memory.
+     **/
+    void set_growth_policy(const slab_growth_policy_t &policy) REQUIRES(!m_mutex);
+    /**
+     * \brief Return how the slab grows when it runs out of memory.
+     **/
+    auto growth_policy() const noexcept -> slab_growth_policy_t;
+    /**
+     * \brief Give back the pages above the current end to the system, they read as zero if used again.
+     *
+     * The slab keeps its size, so this does not move memory or invalidate pointers.
+     * @param keep_bytes Bytes past the current end to keep for allocations to come.
+     * @return Number of bytes purged.
+     **/
+    auto trim(size_t keep_bytes = 0) -> size_t REQUIRES(!m_mutex);
     /**
      * \brief Return offset from start of slab for pointer.
      **/
@@ -135,12 +218,82 @@ namespace mcppalloc::slab_allocator::details
      * @param level Level of information to give.  Higher is more verbose.
      **/
     void to_ptree(::boost::property_tree::ptree &ptree, int level) const;
+    /**
+     * \brief Return a snapshot of allocation counters.
+     *
+     * This does not take the allocator lock.
+     **/
+    auto stats_snapshot() const noexcept -> stats_type;
+
+    /**
+     * \brief Return the number of free objects in the free index.
+     **/
+    auto _u_num_free() const noexcept -> size_t;
+    /**
+     * \brief Return the links stored in the header of an object state.
+     **/
+    static slab_allocator_links_t *_links(slab_allocator_object_t *object) noexcept;
 
   private:
+    void *_u_allocate_raw(size_t sz) REQUIRES(m_mutex);
+    /**
+     * \brief Grow the slab once according to the growth policy.
+     * @return False if the policy does not allow growing or the slab could not expand.
+     **/
+    bool _u_expand() REQUIRES(m_mutex);
+    void _u_deallocate_raw(void *v) REQUIRES(m_mutex);
+    void *_u_allocate_aligned(size_t sz, size_t alignment, size_t offset) REQUIRES(m_mutex);
+    /**
+     * \brief Return where the aligned start of an allocation in the free object starting at object would go.
+     *
+     * Any gap before it is large enough to remain a free object.
+     **/
+    static uint8_t *_aligned_start(slab_allocator_object_t *object, size_t alignment, size_t offset) noexcept;
+    /**
+     * \brief Return the smallest free object in the subtree at node that fits sz at alignment.
+     * @return nullptr if none fits.
+     **/
+    slab_allocator_object_t *_u_find_free_aligned(slab_allocator_object_t *node, size_t sz, size_t alignment, size_t offset)
+        REQUIRES(m_mutex);
+    /**
+     * \brief Add a free object to the free index.
+     **/
     void _u_add_free(slab_allocator_object_t *v) REQUIRES(m_mutex);
+    /**
+     * \brief Remove a free object from the free index.
+     *
+     * The object size must not have changed since it was added.
+     **/
     void _u_remove_free(slab_allocator_object_t *v) REQUIRES(m_mutex);
-    void _u_generate_free_list() REQUIRES(m_mutex);
-    void _u_move_free(slab_allocator_object_t *orig, slab_allocator_object_t *new_obj) REQUIRES(m_mutex);
+    /**
+     * \brief Return the smallest free object that fits sz, lowest address first among equal sizes.
+     * @return nullptr if none fits.
+     **/
+    slab_allocator_object_t *_u_find_free(size_t sz) REQUIRES(m_mutex);
+    /**
+     * \brief Set the boundary tag of the object after object, if there is one.
+     **/
+    void _u_link_next(slab_allocator_object_t *object) noexcept;
+    /**
+     * \brief Order of the free index, by size and then address so best fit prefers low addresses.
+     **/
+    static bool _free_index_less(slab_allocator_object_t *a, slab_allocator_object_t *b) noexcept;
+    /**
+     * \brief Treap priority of a free object, a hash of its address.
+     **/
+    static uint64_t _free_index_priority(slab_allocator_object_t *v) noexcept;
+    /**
+     * \brief Insert v into the subtree at root and return the new root of the subtree.
+     **/
+    static slab_allocator_object_t *_free_index_insert(slab_allocator_object_t *root, slab_allocator_object_t *v) noexcept;
+    /**
+     * \brief Join two subtrees where every object in a orders before every object in b.
+     **/
+    static slab_allocator_object_t *_free_index_merge(slab_allocator_object_t *a, slab_allocator_object_t *b) noexcept;
+    /**
+     * \brief Erase v from the subtree at root and return the new root of the subtree.
+     **/
+    static slab_allocator_object_t *_free_index_erase(slab_allocator_object_t *root, slab_allocator_object_t *v) noexcept;
     /**
      * \brief Mutex for allocator.
      **/
@@ -154,18 +307,26 @@ namespace mcppalloc::slab_allocator::details
      **/
     slab_allocator_object_t *m_end;
     /**
-     * \brief True if free map overflowed and dumped free positions on the floor.
+     * \brief Root of the free index.
+     *
+     * The index is a treap ordered by size and then address, with a hash of the address as priority.
+     * It is intrusive so it is unbounded without allocating.
      **/
-    bool m_free_map_needs_regeneration{false};
-    using free_map_type = mcpputil::containers::backed_ordered_multimap<size_t, slab_allocator_object_t *>;
+    slab_allocator_object_t *m_free_root{nullptr};
     /**
-     * \brief Map of free positions.
+     * \brief Number of objects in the free index.
      **/
-    free_map_type m_free_map;
+    size_t m_num_free{0};
     /**
-     * \brief Array backing for free map.
+     * \brief How the slab grows.
      **/
-    ::std::array<typename free_map_type::value_type, 1500> m_free_map_back;
+    slab_growth_policy_t m_growth_policy;
+    /**
+     * \brief Allocation counters.
+     *
+     * Only written while holding the lock.
+     **/
+    ::mcppalloc::details::thread_allocation_counters_t<1> m_counters;
   };
   constexpr inline size_t slab_allocator_t::alignment() noexcept
   {
@@ -199,4 +360,16 @@ namespace mcppalloc::slab_allocator::details
   {
     return _u_object_current_end() == _u_object_begin();
   }
+  inline auto slab_allocator_t::growth_policy() const noexcept -> slab_growth_policy_t
+  {
+    return m_growth_policy;
+  }
+  inline auto slab_allocator_t::_u_num_free() const noexcept -> size_t
+  {
+    return m_num_free;
+  }
+  inline slab_allocator_links_t *slab_allocator_t::_links(slab_allocator_object_t *object) noexcept
+  {
+    return reinterpret_cast<slab_allocator_links_t *>(reinterpret_cast<uint8_t *>(object) + sizeof(slab_allocator_object_t));
+  }
 }
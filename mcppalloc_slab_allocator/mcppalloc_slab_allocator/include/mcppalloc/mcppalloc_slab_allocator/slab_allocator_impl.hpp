@@ -1,17 +1,88 @@
 #pragma once
+#include <algorithm>
 #include <iostream>
 #include <mcpputil/mcpputil/unsafe_cast.hpp>
 #include <stdexcept>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 namespace mcppalloc::slab_allocator::details
 {
+  bool slab_allocator_t::_free_index_less(slab_allocator_object_t *a, slab_allocator_object_t *b) noexcept
+  {
+    const auto a_sz = a->object_size(cs_alignment);
+    const auto b_sz = b->object_size(cs_alignment);
+    return a_sz < b_sz || (a_sz == b_sz && a < b);
+  }
+  uint64_t slab_allocator_t::_free_index_priority(slab_allocator_object_t *v) noexcept
+  {
+    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(v) / cs_alignment) * 0x9e3779b97f4a7c15ull;
+  }
+  slab_allocator_object_t *slab_allocator_t::_free_index_insert(slab_allocator_object_t *root, slab_allocator_object_t *v) noexcept
+  {
+    if (!root) {
+      return v;
+    }
+    auto root_links = _links(root);
+    if (_free_index_less(v, root)) {
+      auto left = _free_index_insert(root_links->m_left, v);
+      root_links->m_left = left;
+      if (_free_index_priority(left) > _free_index_priority(root)) {
+        root_links->m_left = _links(left)->m_right;
+        _links(left)->m_right = root;
+        return left;
+      }
+    } else {
+      auto right = _free_index_insert(root_links->m_right, v);
+      root_links->m_right = right;
+      if (_free_index_priority(right) > _free_index_priority(root)) {
+        root_links->m_right = _links(right)->m_left;
+        _links(right)->m_left = root;
+        return right;
+      }
+    }
+    return root;
+  }
+  slab_allocator_object_t *slab_allocator_t::_free_index_merge(slab_allocator_object_t *a, slab_allocator_object_t *b) noexcept
+  {
+    if (!a) {
+      return b;
+    }
+    if (!b) {
+      return a;
+    }
+    if (_free_index_priority(a) > _free_index_priority(b)) {
+      _links(a)->m_right = _free_index_merge(_links(a)->m_right, b);
+      return a;
+    }
+    _links(b)->m_left = _free_index_merge(a, _links(b)->m_left);
+    return b;
+  }
+  slab_allocator_object_t *slab_allocator_t::_free_index_erase(slab_allocator_object_t *root, slab_allocator_object_t *v) noexcept
+  {
+    if (mcpputil_unlikely(!root)) {
+      ::std::cerr << "mcppalloc slab allocator free index missing object 5b0f3f43-7d2a-4c63-9e0a-2f6c1d8b7a94" << ::std::endl;
+      ::std::terminate();
+    }
+    auto root_links = _links(root);
+    if (root == v) {
+      return _free_index_merge(root_links->m_left, root_links->m_right);
+    }
+    if (_free_index_less(v, root)) {
+      root_links->m_left = _free_index_erase(root_links->m_left, v);
+    } else {
+      root_links->m_right = _free_index_erase(root_links->m_right, v);
+    }
+    return root;
+  }
   slab_allocator_t::slab_allocator_t(size_t size, size_t size_hint)
 
   {
-    m_free_map = free_map_type(m_free_map_back.data(), sizeof(m_free_map_back));
     if (!m_slab.allocate(size, mcpputil::slab_t::find_hole(size_hint)))
       throw ::std::runtime_error("Unable to allocate slab");
     m_end = reinterpret_cast<slab_allocator_object_t *>(m_slab.begin());
     m_end->set_all(reinterpret_cast<slab_allocator_object_t *>(m_slab.end()), false, false);
+    _links(m_end)->m_prev = nullptr;
   }
   slab_allocator_t::~slab_allocator_t()
   {
@@ -20,8 +91,14 @@ namespace mcppalloc::slab_allocator::details
   void slab_allocator_t::_verify()
   {
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    slab_allocator_object_t *prev = nullptr;
     for (auto it = _u_object_begin(); it != _u_object_current_end(); ++it) {
       it->verify_magic();
+      if (mcpputil_unlikely(_links(it)->m_prev != prev)) {
+        ::std::cerr << "mcppalloc slab allocator boundary tag error 0c8e6d1e-3b57-4f2a-8a41-6e9d2b4f1c73" << ::std::endl;
+        ::std::terminate();
+      }
+      prev = it;
     }
   }
   void slab_allocator_t::align_next(size_t sz)
@@ -34,60 +111,42 @@ namespace mcppalloc::slab_allocator::details
   }
   void slab_allocator_t::_u_add_free(slab_allocator_object_t *v)
   {
-    auto ret = m_free_map.insert(::std::make_pair(v->object_size(), v));
-    if (!ret.second)
-      m_free_map_needs_regeneration = true;
+    auto links = _links(v);
+    links->m_left = nullptr;
+    links->m_right = nullptr;
+    m_free_root = _free_index_insert(m_free_root, v);
+    ++m_num_free;
   }
   void slab_allocator_t::_u_remove_free(slab_allocator_object_t *v)
   {
-    for (auto it = m_free_map.begin(); it != m_free_map.end(); ++it) {
-      if (it->second == v) {
-        m_free_map.erase(it);
-        return;
-      }
-    }
+    m_free_root = _free_index_erase(m_free_root, v);
+    --m_num_free;
   }
-  void slab_allocator_t::_u_move_free(slab_allocator_object_t *orig, slab_allocator_object_t *new_obj)
+  slab_allocator_object_t *slab_allocator_t::_u_find_free(size_t sz)
   {
-    auto orig_it = m_free_map.lower_bound(orig->object_size());
-    while (orig_it != m_free_map.end()) {
-      if (orig_it->second != orig)
-        orig_it++;
-      else
-        break;
-    }
-    if (orig_it == m_free_map.end()) {
-      _u_add_free(new_obj);
-      return;
+    slab_allocator_object_t *best = nullptr;
+    auto node = m_free_root;
+    while (node) {
+      if (node->object_size(cs_alignment) >= sz) {
+        best = node;
+        node = _links(node)->m_left;
+      } else {
+        node = _links(node)->m_right;
+      }
     }
-    m_free_map.move(orig_it, ::std::make_pair(new_obj->object_size(), new_obj));
+    return best;
   }
-  void slab_allocator_t::_u_generate_free_list()
+  void slab_allocator_t::_u_link_next(slab_allocator_object_t *object) noexcept
   {
-    m_free_map_needs_regeneration = false;
-    for (auto it = _u_object_begin(); it != _u_object_current_end(); ++it) {
-      it->verify_magic();
-      if (mcpputil_unlikely(&*it >= _u_object_end())) {
-        ::std::cerr << "mcppalloc slab allocator consistency error a35664e3-21f9-4ea7-a921-844b8a2dc598" << ::std::endl;
-        ::std::terminate();
-      }
-      // if in use, go to next.
-      if (it->not_available())
-        continue;
-      // if next valid, and both this and next object state are not in use, coalesce.
-      while (it->next_valid() && !it->next()->not_available()) {
-        if (!it->next()->next_valid())
-          break;
-        it->set_all(it->next()->next(), false, it->next()->next_valid());
-      }
-      _u_add_free(it);
+    if (object->next_valid()) {
+      _links(object->next())->m_prev = object;
     }
   }
   void *slab_allocator_t::_u_split_allocate(slab_allocator_object_t *object, size_t sz)
   {
     object->verify_magic();
+    _u_remove_free(object);
     if (sz + cs_header_sz * 2 > object->object_size(cs_alignment)) {
-      _u_remove_free(object);
       // if not enough space to split, just take it all.
       object->set_in_use(true);
       return object->object_start(cs_alignment);
@@ -96,9 +155,11 @@ namespace mcppalloc::slab_allocator::details
       auto new_next = reinterpret_cast<slab_allocator_object_t *>(object->object_start(cs_alignment) + sz);
       // set new object state.
       new_next->set_all(object->next(), false, object->next_valid());
-      _u_move_free(object, new_next);
+      _links(new_next)->m_prev = object;
+      _u_link_next(new_next);
       // set current object  state.
       object->set_all(new_next, true, true);
+      _u_add_free(new_next);
       // return location of start of object.
       return object->object_start(cs_alignment);
     }
@@ -113,73 +174,217 @@ namespace mcppalloc::slab_allocator::details
     auto object = m_end;
     // tack on needed size to current end.
     auto new_end = reinterpret_cast<slab_allocator_object_t *>(reinterpret_cast<uint8_t *>(m_end) + total_size);
-    // expand until current end is in the slab.
-    while (new_end > _u_object_end() && m_slab.expand(m_slab.size() * 2)) {
+    // expand until there is room for the end object state after the allocation.
+    // without one, an allocation made there after a later expand would not be linked to its predecessor.
+    while (new_end >= _u_object_end() && _u_expand()) {
     }
     // if we couldn't do that, then we are out of memory and hard fail.
-    if (new_end > _u_object_end())
+    if (new_end >= _u_object_end())
       return nullptr;
     m_end = new_end;
     // ok, setup object state for new allocation.
     object->set_in_use(true);
     object->set_next(m_end);
-
-    if (m_end == &*_u_object_end()) {
-      // have used all space so no object state afterwards.
-      m_end = _u_object_end();
-      object->set_next_valid(false);
-    } else {
-      // ok, we haven't used all the space, so lets put a object state afterwards.
-      object->set_next_valid(true);
-      m_end->set_all(&*_u_object_end(), false, false);
-    }
+    object->set_next_valid(true);
+    m_end->set_all(&*_u_object_end(), false, false);
+    _links(m_end)->m_prev = object;
     auto ret = object->object_start(cs_alignment);
     return ret;
   }
+  bool slab_allocator_t::_u_expand()
+  {
+    const size_t size = m_slab.size();
+    auto new_size = static_cast<size_t>(static_cast<double>(size) * m_growth_policy.m_factor) + m_growth_policy.m_step;
+    if (m_growth_policy.m_max_size) {
+      new_size = ::std::min(new_size, m_growth_policy.m_max_size);
+    }
+    if (new_size <= size || !m_slab.expand(new_size)) {
+      return false;
+    }
+    m_counters.on_block_created(0);
+    return true;
+  }
+  void slab_allocator_t::set_growth_policy(const slab_growth_policy_t &policy)
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    m_growth_policy = policy;
+  }
+  auto slab_allocator_t::trim(size_t keep_bytes) -> size_t
+  {
+    size_t ret = 0;
+#ifndef _WIN32
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    const size_t page_size = mcpputil::slab_t::page_size();
+    // the end object state stays, only whole pages after it can be purged.
+    auto begin = reinterpret_cast<uint8_t *>(m_end) + cs_header_sz;
+    begin = mcpputil::align(begin + ::std::min(keep_bytes, static_cast<size_t>(end() - begin)), page_size);
+    if (begin < end() && ::madvise(begin, static_cast<size_t>(end() - begin), MADV_DONTNEED) == 0) {
+      ret = static_cast<size_t>(end() - begin);
+    }
+#else
+    (void)keep_bytes;
+#endif
+    return ret;
+  }
   void *slab_allocator_t::allocate_raw(size_t sz)
   {
     sz = mcpputil::align(sz, cs_alignment);
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
-    // if empty, create at end.
-    if (_u_empty()) {
+    m_counters.on_global_lock(0);
+    auto ret = _u_allocate_raw(sz);
+    if (ret) {
+      m_counters.on_allocation(0, slab_allocator_object_t::from_object_start(ret, cs_alignment)->object_size(cs_alignment));
+    }
+    return ret;
+  }
+  void *slab_allocator_t::_u_allocate_raw(size_t sz)
+  {
+    auto object = _u_find_free(sz);
+    if (!object) {
       return _u_allocate_raw_at_end(::gsl::narrow<ptrdiff_t>(sz));
     }
-    auto it = m_free_map.lower_bound(sz);
-    if (it == m_free_map.end()) {
-      if (m_free_map.size() == m_free_map.capacity())
-        return _u_allocate_raw_at_end(::gsl::narrow<ptrdiff_t>(sz));
-      else {
-        if (m_free_map_needs_regeneration) {
-          _u_generate_free_list();
-          it = m_free_map.find(sz);
-        }
-        if (it == m_free_map.end())
-          return _u_allocate_raw_at_end(::gsl::narrow<ptrdiff_t>(sz));
-        else
-          return _u_split_allocate(it->second, sz);
+    return _u_split_allocate(object, sz);
+  }
+  void *slab_allocator_t::allocate_aligned(size_t sz, size_t alignment, size_t offset)
+  {
+    void *ret = nullptr;
+    allocate_aligned_batch(sz, alignment, offset, &ret, 1);
+    return ret;
+  }
+  auto slab_allocator_t::allocate_aligned_batch(size_t sz, size_t alignment, size_t offset, void **out, size_t n) -> size_t
+  {
+    sz = mcpputil::align(sz, cs_alignment);
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    m_counters.on_global_lock(0);
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = alignment <= cs_alignment ? _u_allocate_raw(sz) : _u_allocate_aligned(sz, alignment, offset);
+      if (!out[i]) {
+        return i;
       }
-    } else {
-      return _u_split_allocate(it->second, sz);
+      m_counters.on_allocation(0, slab_allocator_object_t::from_object_start(out[i], cs_alignment)->object_size(cs_alignment));
     }
+    return n;
+  }
+  uint8_t *slab_allocator_t::_aligned_start(slab_allocator_object_t *object, size_t alignment, size_t offset) noexcept
+  {
+    auto start = object->object_start(cs_alignment);
+    auto ret = reinterpret_cast<uint8_t *>(mcpputil::align(reinterpret_cast<uintptr_t>(start) - offset, alignment) + offset);
+    // the leading free object needs a header and some room of its own.
+    if (ret != start && static_cast<size_t>(ret - start) < cs_header_sz + cs_alignment) {
+      ret += alignment;
+    }
+    return ret;
+  }
+  slab_allocator_object_t *
+  slab_allocator_t::_u_find_free_aligned(slab_allocator_object_t *node, size_t sz, size_t alignment, size_t offset)
+  {
+    while (node) {
+      const auto size = node->object_size(cs_alignment);
+      if (size < sz) {
+        node = _links(node)->m_right;
+        continue;
+      }
+      // in order, so smaller candidates first.
+      if (auto ret = _u_find_free_aligned(_links(node)->m_left, sz, alignment, offset)) {
+        return ret;
+      }
+      // objects of at least sz + alignment + 2 * cs_header_sz always fit, so the search stops at the first of those.
+      if (_aligned_start(node, alignment, offset) + sz <= reinterpret_cast<uint8_t *>(node->next())) {
+        return node;
+      }
+      node = _links(node)->m_right;
+    }
+    return nullptr;
+  }
+  void *slab_allocator_t::_u_allocate_aligned(size_t sz, size_t alignment, size_t offset)
+  {
+    if (auto object = _u_find_free_aligned(m_free_root, sz, alignment, offset)) {
+      auto start = _aligned_start(object, alignment, offset);
+      if (start != object->object_start(cs_alignment)) {
+        // split off the leading remainder, which stays free.
+        _u_remove_free(object);
+        auto aligned = slab_allocator_object_t::from_object_start(start, cs_alignment);
+        aligned->set_all(object->next(), false, object->next_valid());
+        _links(aligned)->m_prev = object;
+        _u_link_next(aligned);
+        object->set_all(aligned, false, true);
+        _u_add_free(object);
+        _u_add_free(aligned);
+        object = aligned;
+      }
+      return _u_split_allocate(object, sz);
+    }
+    // allocate at the end, expanding first so nothing changes on out of memory.
+    auto start = _aligned_start(m_end, alignment, offset);
+    while (start + sz >= end() && _u_expand()) {
+    }
+    if (start + sz >= end()) {
+      return nullptr;
+    }
+    if (start != m_end->object_start(cs_alignment)) {
+      auto aligned = slab_allocator_object_t::from_object_start(start, cs_alignment);
+      aligned->set_all(&*_u_object_end(), false, false);
+      _links(aligned)->m_prev = m_end;
+      m_end->set_all(aligned, false, true);
+      _u_add_free(m_end);
+      m_end = aligned;
+    }
+    return _u_allocate_raw_at_end(::gsl::narrow<ptrdiff_t>(sz));
+  }
+  auto slab_allocator_t::allocate_raw_batch(size_t sz, void **out, size_t n) -> size_t
+  {
+    sz = mcpputil::align(sz, cs_alignment);
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    m_counters.on_global_lock(0);
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = _u_allocate_raw(sz);
+      if (!out[i]) {
+        return i;
+      }
+      m_counters.on_allocation(0, slab_allocator_object_t::from_object_start(out[i], cs_alignment)->object_size(cs_alignment));
+    }
+    return n;
   }
   void slab_allocator_t::deallocate_raw(void *v)
   {
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    m_counters.on_global_lock(0);
+    _u_deallocate_raw(v);
+  }
+  void slab_allocator_t::deallocate_raw_batch(void *const *v, size_t n)
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    m_counters.on_global_lock(0);
+    for (size_t i = 0; i < n; ++i) {
+      _u_deallocate_raw(v[i]);
+    }
+  }
+  void slab_allocator_t::_u_deallocate_raw(void *v)
+  {
     auto object = slab_allocator_object_t::from_object_start(v, cs_alignment);
     object->verify_magic();
+    m_counters.on_deallocation(0, object->object_size(cs_alignment));
     // set not in use.
     object->set_in_use(false);
-    // coalesce if possible.
-    while (object->next_valid() && !object->next()->not_available()) {
+    // coalesce forward, the current end is free but not in the free index.
+    if (object->next_valid() && !object->next()->not_available()) {
       auto next = object->next();
-      object->set_all(next->next(), false, next->next_valid());
       if (next != _u_object_current_end()) {
         _u_remove_free(next);
       }
+      object->set_all(next->next(), false, next->next_valid());
+      _u_link_next(object);
+    }
+    // coalesce backward using the boundary tag.
+    auto prev = _links(object)->m_prev;
+    if (prev && !prev->not_available()) {
+      _u_remove_free(prev);
+      prev->set_all(object->next(), false, object->next_valid());
+      _u_link_next(prev);
+      object = prev;
     }
-    // if we can coallesce into end pointer, do that.
-    if (!object->next_valid() ||
-        (object->next_valid() && !object->next()->not_available() && object->next()->next() == &*_u_object_end())) {
+    // if we reached the end of used memory, this becomes the end pointer.
+    if (!object->next_valid()) {
       object->set_next(&*_u_object_end());
       m_end = object;
     } else {
@@ -200,4 +405,10 @@ namespace mcppalloc::slab_allocator::details
     ptree.put("size", ::std::to_string(m_slab.size()));
     ptree.put("current_size", ::std::to_string(current_size()));
   }
+  auto slab_allocator_t::stats_snapshot() const noexcept -> stats_type
+  {
+    stats_type ret;
+    m_counters.add_to(ret);
+    return ret;
+  }
 }
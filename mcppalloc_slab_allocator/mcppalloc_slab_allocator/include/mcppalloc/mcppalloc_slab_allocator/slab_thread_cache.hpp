@@ -0,0 +1,126 @@
+#pragma once
+#include "slab_allocator.hpp"
+#include <array>
+namespace mcppalloc::slab_allocator::details
+{
+  /**
+   * \brief Per thread cache of slab allocator objects.
+   *
+   * Freed objects are kept in buckets by size rounded up to a power of two times the slab alignment.
+   * Allocations are served from the cache without the slab lock.
+   * Misses refill a batch from the slab and overflow returns a batch, each taking the slab lock once.
+   * Cached objects stay allocated as far as the slab is concerned, so they do not coalesce until returned.
+   * A cache may only be used by one thread at a time and must be destroyed before its slab allocator.
+   **/
+  class slab_thread_cache_t
+  {
+  public:
+    /**
+     * \brief Number of size buckets.
+     **/
+    static constexpr const size_t cs_num_buckets = 16;
+    /**
+     * \brief Largest size that is cached, larger objects go directly to the slab.
+     **/
+    static constexpr const size_t cs_max_cached_size = slab_allocator_t::cs_alignment << (cs_num_buckets - 1);
+    /**
+     * \brief Largest number of objects moved to or from the slab at once.
+     **/
+    static constexpr const size_t cs_max_batch = 32;
+    /**
+     * \brief Default bytes of objects held before half are returned.
+     **/
+    static constexpr const size_t cs_default_max_bytes = 1 << 22;
+    /**
+     * \brief Constructor.
+     * @param slab Slab allocator to cache objects of.
+     * @param max_bytes Bytes of objects held before half are returned, this also bounds refill batches.
+     **/
+    explicit slab_thread_cache_t(slab_allocator_t &slab, size_t max_bytes = cs_default_max_bytes) noexcept;
+    slab_thread_cache_t(const slab_thread_cache_t &) = delete;
+    slab_thread_cache_t(slab_thread_cache_t &&) = delete;
+    slab_thread_cache_t &operator=(const slab_thread_cache_t &) = delete;
+    slab_thread_cache_t &operator=(slab_thread_cache_t &&) = delete;
+    /**
+     * \brief Destructor, returns every cached object.
+     **/
+    ~slab_thread_cache_t();
+    /**
+     * \brief Allocate memory.
+     * @param sz Size of object allocation required.
+     * @return Start of object memory or nullptr on out of memory.
+     **/
+    void *allocate_raw(size_t sz);
+    /**
+     * \brief Allocate memory whose start is offset bytes past an aligned boundary.
+     * @param sz Size of object allocation required.
+     * @param alignment Power of two alignment.
+     * @param offset Multiple of the slab alignment less than alignment.
+     * @return Start of object memory or nullptr on out of memory.
+     **/
+    void *allocate_aligned(size_t sz, size_t alignment, size_t offset = 0);
+    /**
+     * \brief Deallocate memory allocated from this cache or its slab allocator.
+     **/
+    void deallocate_raw(void *v);
+    /**
+     * \brief Return every cached object to the slab allocator.
+     **/
+    void flush();
+    /**
+     * \brief Return the number of cached objects.
+     **/
+    auto num_cached() const noexcept -> size_t;
+    /**
+     * \brief Return the bytes of cached objects.
+     **/
+    auto cached_bytes() const noexcept -> size_t;
+    /**
+     * \brief Return the slab allocator objects are cached from.
+     **/
+    auto slab() const noexcept -> slab_allocator_t &;
+
+  private:
+    /**
+     * \brief Return the bucket for an object or request of size sz.
+     **/
+    static auto _bucket(size_t sz) noexcept -> size_t;
+    /**
+     * \brief Add an object to its bucket.
+     **/
+    void _push(void *v) noexcept;
+    /**
+     * \brief Take the first cached object of at least sz whose start is aligned.
+     * @return nullptr if there is none.
+     **/
+    void *_pop(size_t sz, size_t alignment, size_t offset) noexcept;
+    /**
+     * \brief Allocate a batch from the slab, keep all but the first and return the first.
+     **/
+    void *_refill(size_t sz, size_t alignment, size_t offset);
+    /**
+     * \brief Return objects to the slab allocator until at most target bytes are cached, largest buckets first.
+     **/
+    void _flush(size_t target);
+    slab_allocator_t &m_slab;
+    size_t m_max_bytes;
+    /**
+     * \brief Heads of singly linked lists of cached objects, linked through their first word.
+     **/
+    ::std::array<void *, cs_num_buckets> m_buckets{};
+    size_t m_num_cached{0};
+    size_t m_cached_bytes{0};
+  };
+  inline auto slab_thread_cache_t::num_cached() const noexcept -> size_t
+  {
+    return m_num_cached;
+  }
+  inline auto slab_thread_cache_t::cached_bytes() const noexcept -> size_t
+  {
+    return m_cached_bytes;
+  }
+  inline auto slab_thread_cache_t::slab() const noexcept -> slab_allocator_t &
+  {
+    return m_slab;
+  }
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <mcpputil/mcpputil/intrinsics.hpp>
+#include <mcpputil/mcpputil/unsafe_cast.hpp>
+namespace mcppalloc::slab_allocator::details
+{
+  slab_thread_cache_t::slab_thread_cache_t(slab_allocator_t &slab, size_t max_bytes) noexcept
+      : m_slab(slab), m_max_bytes(max_bytes)
+  {
+  }
+  slab_thread_cache_t::~slab_thread_cache_t()
+  {
+    flush();
+  }
+  auto slab_thread_cache_t::_bucket(size_t sz) noexcept -> size_t
+  {
+    const size_t units = sz / slab_allocator_t::cs_alignment;
+    if (units <= 1) {
+      return 0;
+    }
+    return static_cast<size_t>(64 - mcpputil::clz(units - 1));
+  }
+  void slab_thread_cache_t::_push(void *v) noexcept
+  {
+    const auto size = slab_allocator_object_t::from_object_start(v, slab_allocator_t::cs_alignment)
+                          ->object_size(slab_allocator_t::cs_alignment);
+    auto &head = m_buckets[_bucket(size)];
+    *mcpputil::unsafe_cast<void *>(v) = head;
+    head = v;
+    ++m_num_cached;
+    m_cached_bytes += size;
+  }
+  void *slab_thread_cache_t::allocate_raw(size_t sz)
+  {
+    return allocate_aligned(sz, slab_allocator_t::cs_alignment);
+  }
+  void *slab_thread_cache_t::allocate_aligned(size_t sz, size_t alignment, size_t offset)
+  {
+    sz = mcpputil::align(sz, slab_allocator_t::cs_alignment);
+    if (mcpputil_unlikely(!sz || sz > cs_max_cached_size)) {
+      return m_slab.allocate_aligned(sz, alignment, offset);
+    }
+    if (auto ret = _pop(sz, alignment, offset)) {
+      return ret;
+    }
+    return _refill(sz, alignment, offset);
+  }
+  void *slab_thread_cache_t::_pop(size_t sz, size_t alignment, size_t offset) noexcept
+  {
+    // objects in a bucket may be smaller than the request, so take the first that fits.
+    void **link = &m_buckets[_bucket(sz)];
+    while (*link) {
+      void *v = *link;
+      const auto size = slab_allocator_object_t::from_object_start(v, slab_allocator_t::cs_alignment)
+                            ->object_size(slab_allocator_t::cs_alignment);
+      if (size >= sz && (reinterpret_cast<uintptr_t>(v) - offset) % alignment == 0) {
+        *link = *mcpputil::unsafe_cast<void *>(v);
+        --m_num_cached;
+        m_cached_bytes -= size;
+        return v;
+      }
+      link = mcpputil::unsafe_cast<void *>(v);
+    }
+    return nullptr;
+  }
+  void *slab_thread_cache_t::_refill(size_t sz, size_t alignment, size_t offset)
+  {
+    // refill a batch that uses at most half of the cache.
+    ::std::array<void *, cs_max_batch> batch;
+    const size_t n = ::std::clamp<size_t>(m_max_bytes / 2 / sz, 1, cs_max_batch);
+    const size_t num_allocated = m_slab.allocate_aligned_batch(sz, alignment, offset, batch.data(), n);
+    if (mcpputil_unlikely(!num_allocated)) {
+      return nullptr;
+    }
+    // push in reverse so the batch is handed out in address order like direct allocations.
+    for (size_t i = num_allocated; i-- > 1;) {
+      _push(batch[i]);
+    }
+    return batch[0];
+  }
+  void slab_thread_cache_t::deallocate_raw(void *v)
+  {
+    const auto size = slab_allocator_object_t::from_object_start(v, slab_allocator_t::cs_alignment)
+                          ->object_size(slab_allocator_t::cs_alignment);
+    if (mcpputil_unlikely(size > cs_max_cached_size)) {
+      m_slab.deallocate_raw(v);
+      return;
+    }
+    _push(v);
+    if (mcpputil_unlikely(m_cached_bytes > m_max_bytes)) {
+      _flush(m_max_bytes / 2);
+    }
+  }
+  void slab_thread_cache_t::flush()
+  {
+    _flush(0);
+  }
+  void slab_thread_cache_t::_flush(size_t target)
+  {
+    ::std::array<void *, cs_max_batch> batch;
+    size_t n = 0;
+    for (size_t bucket = cs_num_buckets; bucket-- > 0 && m_cached_bytes > target;) {
+      auto &head = m_buckets[bucket];
+      while (head && m_cached_bytes > target) {
+        void *v = head;
+        head = *mcpputil::unsafe_cast<void *>(v);
+        --m_num_cached;
+        m_cached_bytes -= slab_allocator_object_t::from_object_start(v, slab_allocator_t::cs_alignment)
+                              ->object_size(slab_allocator_t::cs_alignment);
+        batch[n++] = v;
+        if (n == batch.size()) {
+          m_slab.deallocate_raw_batch(batch.data(), n);
+          n = 0;
+        }
+      }
+    }
+    if (n) {
+      m_slab.deallocate_raw_batch(batch.data(), n);
+    }
+  }
+}
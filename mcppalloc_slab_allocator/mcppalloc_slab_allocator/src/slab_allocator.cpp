@@ -2,3 +2,9 @@
 // This Must be first.
 #include <mcppalloc/mcppalloc_slab_allocator/slab_allocator.hpp>
 #include <mcppalloc/mcppalloc_slab_allocator/slab_allocator_impl.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/signal_safe_slab_allocator.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/signal_safe_slab_allocator_impl.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/slab_thread_cache.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/slab_thread_cache_impl.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/shared_slab_allocator.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/shared_slab_allocator_impl.hpp>
@@ -1,8 +1,12 @@
 #pragma once
 #include "allocator_block_handle.hpp"
 #include "allocator_block_set.hpp"
+#include "persistent_heap.hpp"
 #include "thread_allocator.hpp"
+#include <array>
 #include <map>
+#include <optional>
+#include <set>
 #include <mcppalloc/object_state.hpp>
 #include <mcpputil/mcpputil/boost/container/flat_map.hpp>
 #include <mcpputil/mcpputil/concurrency.hpp>
@@ -23,8 +27,9 @@ namespace mcppalloc::sparse
      *
      * The allocator stores a list of global blocks that have been returned from thread allocators.
      * These can later be reused by other threads.
-     * The allocator stores a free list of locations not used in the slab.
-     * The free list must be occasionally collected to defragment the free list.
+     * The heap is made of one or more slab segments that need not be contiguous.
+     * Each segment stores a free list of locations not used in the segment.
+     * The free lists must be occasionally collected to defragment them.
      **/
     template <typename Allocator_Policy = default_allocator_policy_t<::std::allocator<void>>>
     class allocator_t
@@ -61,6 +66,38 @@ namespace mcppalloc::sparse
       using memory_range_vector_t =
           typename ::std::vector<mcpputil::system_memory_range_t,
                                  typename allocator::template rebind<mcpputil::system_memory_range_t>::other>;
+      /**
+       * \brief A contiguous segment of the heap.
+       *
+       * The heap grows by expanding the newest segment in place.
+       * If the address space after it is taken, a new segment is added wherever there is room.
+       **/
+      struct heap_segment_t {
+        /**
+         * \brief Underlying slab.
+         **/
+        mcpputil::slab_t m_slab;
+        /**
+         * \brief Pointer to end of currently used portion of slab.
+         **/
+        uint8_t *m_current_end = nullptr;
+        /**
+         * \brief Free interval vector.
+         *
+         * List of all intervals of free memory in the used portion of the slab sorted by size.
+         **/
+        memory_range_vector_t m_free_list;
+      };
+      /**
+       * \brief Maximum number of heap segments.
+       *
+       * Segments are reserved up front so that the initial segment never moves.
+       **/
+      static constexpr const size_t cs_max_heap_segments = 64;
+      /**
+       * \brief Number of new block requests between polls of the memory pressure watcher.
+       **/
+      static constexpr const size_t cs_memory_pressure_poll_interval = 64;
       /**
        * \brief Type of thread allocator used by this allocator.
        *
@@ -68,6 +105,14 @@ namespace mcppalloc::sparse
        **/
       using this_thread_allocator_t = thread_allocator_t<this_type, allocator_policy_type>;
       using thread_allocator_type = this_thread_allocator_t;
+      /**
+       * \brief Type of allocation statistics snapshot.
+       **/
+      using stats_type = typename this_thread_allocator_t::stats_type;
+      /**
+       * \brief Type of memory usage by size bin.
+       **/
+      using memory_usage_stats_type = typename this_thread_allocator_t::memory_usage_stats_type;
       /**
        * \brief Type of handles to blocks in this allocator.
        **/
@@ -98,9 +143,156 @@ namespace mcppalloc::sparse
        * Note that suggested max heap size does not guarentee the heap can expand to that size depending on platform.
        * @param initial_gc_heap_size Initial size of gc heap.
        * @param max_heap_size Hint about how large the gc heap may grow.
+       * @param emergency_reserve_size Bytes set aside for a thread that runs out of memory.
        * @return True on success, false on failure.
        **/
-      bool initialize(size_t initial_gc_heap_size, size_t max_heap_size) REQUIRES(!m_mutex);
+      bool initialize(size_t initial_gc_heap_size, size_t max_heap_size, size_t emergency_reserve_size = 0) REQUIRES(!m_mutex);
+      /**
+       * \brief Initialize the allocator with a heap backed by a file, reattaching the heap already in the file if there is one.
+       *
+       * The heap is mapped at the address it was created at so that pointers stored in it stay valid, and it does not grow.
+       * On reattach each recorded block is rebuilt by walking its object states and becomes a global block.
+       * Live objects stay live and are found again through the persistent root.
+       * Changes reach the file as the operating system writes back pages, sync() forces them out.
+       * This is only available on posix.
+       * @param path File backing the heap, created if it does not exist.
+       * @param heap_size Size of the heap in a new file, ignored on reattach.
+       * @return True on success, false if the file can not be used or the heap address is taken.
+       **/
+      bool initialize_persistent(const char *path, size_t heap_size) REQUIRES(!m_mutex);
+      /**
+       * \brief Return true if the heap is backed by a file.
+       **/
+      bool is_persistent() const REQUIRES(!m_mutex);
+      /**
+       * \brief Write the persistent heap to its file.
+       * @return True on success or if the heap is not persistent.
+       **/
+      bool sync() REQUIRES(!m_mutex);
+      /**
+       * \brief Set the object that the persistent heap is reached from after a restart.
+       **/
+      void set_persistent_root(void *root) REQUIRES(!m_mutex);
+      /**
+       * \brief Return the object set by set_persistent_root(), nullptr if none.
+       **/
+      auto persistent_root() const -> void * REQUIRES(!m_mutex);
+      /**
+       * \brief Release the emergency reserve into the heap.
+       *
+       * This is done for a thread that has run out of memory so that it can make progress and shed load.
+       * @return True if there was a reserve to release, false otherwise.
+       **/
+      bool release_emergency_reserve() REQUIRES(!m_mutex);
+      /**
+       * \brief Set aside the emergency reserve again after it was released.
+       * @return True if the reserve is held, false if there was not enough memory.
+       **/
+      bool replenish_emergency_reserve() REQUIRES(!m_mutex);
+      /**
+       * \brief Return the bytes currently held in the emergency reserve.
+       **/
+      auto emergency_reserve_available() const -> size_t REQUIRES(!m_mutex);
+      /**
+       * \brief Return the number of times the emergency reserve was released.
+       **/
+      auto num_emergency_reserve_releases() const noexcept -> size_t;
+      /**
+       * \brief Reclaim memory after an allocation failure.
+       *
+       * This synchronously collects global blocks, asks all thread allocators to free empty blocks and collapses the free list.
+       **/
+      void reclaim_memory() REQUIRES(!m_mutex);
+      /**
+       * \brief Watch a cgroup for memory pressure.
+       *
+       * The watcher is polled by thread allocators when they need new blocks, without holding the allocator lock.
+       **/
+      void set_memory_pressure_watcher(cgroup_memory_watcher_t watcher) REQUIRES(!m_mutex, !m_memory_pressure_mutex);
+      /**
+       * \brief Stop watching for memory pressure.
+       **/
+      void clear_memory_pressure_watcher() REQUIRES(!m_mutex, !m_memory_pressure_mutex);
+      /**
+       * \brief Poll the memory pressure watcher now and respond to the result.
+       * @return Observed memory pressure, no pressure if there is no watcher.
+       **/
+      auto check_memory_pressure() -> memory_pressure_t REQUIRES(!m_mutex, !m_memory_pressure_mutex);
+      /**
+       * \brief Respond to memory pressure.
+       *
+       * This can be used to feed pressure from a source other than the cgroup watcher.
+       * Under pressure thread allocators stop caching empty blocks, global blocks are collected,
+       * the free list is collapsed and free pages are given back to the operating system.
+       * If the level changed the thread policy on_memory_pressure hook is then called with the lock held.
+       **/
+      void on_memory_pressure(const memory_pressure_t &pressure) REQUIRES(!m_mutex);
+      /**
+       * \brief Respond to memory pressure.
+       *
+       * Requires holding lock.
+       **/
+      void _u_on_memory_pressure(const memory_pressure_t &pressure) REQUIRES(m_mutex);
+      /**
+       * \brief Poll the memory pressure watcher if it is due.
+       *
+       * The allocator lock is only taken if there is pressure or the level changed.
+       **/
+      void maybe_check_memory_pressure() REQUIRES(!m_mutex, !m_memory_pressure_mutex);
+      /**
+       * \brief Respond to a poll of the memory pressure watcher.
+       **/
+      void _on_polled_memory_pressure(const memory_pressure_t &pressure) REQUIRES(!m_mutex);
+      /**
+       * \brief Return the last memory pressure level responded to.
+       **/
+      auto memory_pressure() const noexcept -> memory_pressure_level_t;
+      /**
+       * \brief Give pages of free memory back to the operating system.
+       *
+       * The address space stays reserved and is zero filled on next use.
+       * @return Number of bytes purged.
+       **/
+      auto purge_free_memory() -> size_t REQUIRES(!m_mutex);
+      /**
+       * \brief Give pages of free memory back to the operating system.
+       *
+       * Requires holding lock.
+       * @return Number of bytes purged.
+       **/
+      auto _u_purge_free_memory() -> size_t REQUIRES(m_mutex);
+      /**
+       * \brief Set the quotas of an allocation tag in bytes, 0 is no quota.
+       *
+       * Crossing the soft quota calls the thread policy on_allocation_failure once as a notification.
+       * Allocations that would exceed the hard quota call on_allocation_failure until it stops repeating and then fail.
+       * The thread policy is asked at most cs_max_allocation_attempts times per allocation.
+       * Quotas are checked against tag_live_bytes(), which lags behind by up to cs_tag_flush_bytes per thread.
+       * This does nothing unless the allocator policy uses allocation tags.
+       **/
+      void set_tag_quota(allocation_tag_t tag, size_t soft, size_t hard) noexcept;
+      /**
+       * \brief Return the soft quota of an allocation tag, 0 is no quota.
+       **/
+      auto tag_soft_quota(allocation_tag_t tag) const noexcept -> size_t;
+      /**
+       * \brief Return the hard quota of an allocation tag, 0 is no quota.
+       **/
+      auto tag_hard_quota(allocation_tag_t tag) const noexcept -> size_t;
+      /**
+       * \brief Return the approximate bytes live in an allocation tag.
+       *
+       * Thread allocators flush their changes in batches, exact per tag counts are in stats_snapshot().
+       **/
+      auto tag_live_bytes(allocation_tag_t tag) const noexcept -> size_t;
+      /**
+       * \brief Return the flushed bytes live in an allocation tag, this may be negative while batches are pending.
+       **/
+      auto _tag_live_bytes(allocation_tag_t tag) const noexcept -> int64_t;
+      /**
+       * \brief Add a batch of changes to the bytes live in an allocation tag.
+       **/
+      void _add_tag_live_bytes(allocation_tag_t tag, int64_t delta) noexcept;
       /**
        * \brief Return a thread allocator for the current thread.
        *
@@ -109,8 +301,39 @@ namespace mcppalloc::sparse
       this_thread_allocator_t &initialize_thread() REQUIRES(!m_mutex);
       /**
        * \brief Destroy thread local data for currently running thread.
+       *
+       * If parking is enabled and there is room, the thread allocator is parked with its blocks instead of destroyed.
        **/
       void destroy_thread() REQUIRES(!m_mutex);
+      /**
+       * \brief Maximum number of parked thread allocators.
+       **/
+      static constexpr const size_t cs_max_parked_thread_allocators = 64;
+      /**
+       * \brief Set maximum number of parked thread allocators.
+       *
+       * A parked thread allocator keeps its blocks and is adopted whole by the next thread to initialize.
+       * This is capped at cs_max_parked_thread_allocators.  Zero (the default) disables parking.
+       **/
+      void set_max_parked_thread_allocators(size_t max) noexcept;
+      /**
+       * \brief Return maximum number of parked thread allocators.
+       **/
+      auto max_parked_thread_allocators() const noexcept -> size_t;
+      /**
+       * \brief Set when pages of blocks taken on by thread allocators are faulted in.
+       *
+       * Pre-faulting moves the page faults of a new block off the allocation path into one bulk pass.
+       **/
+      void set_prefault_mode(prefault_mode_t mode) noexcept;
+      /**
+       * \brief Return when pages of blocks taken on by thread allocators are faulted in.
+       **/
+      auto prefault_mode() const noexcept -> prefault_mode_t;
+      /**
+       * \brief Return number of parked thread allocators.
+       **/
+      auto num_parked_thread_allocators() const noexcept -> size_t;
       /**
        * \brief Get an interval of memory.
        *
@@ -137,6 +360,7 @@ namespace mcppalloc::sparse
        * @param create_sz Size of block requested.
        * @param minimum_alloc_length Minimum allocation length for block.
        * @param maximum_alloc_length Maximum allocation length for block.
+       * @param require_empty Only reuse empty global blocks, so lifetimes are not mixed.
        * @param out_block Returned allocator block.
        * @param try_expand Attempt to expand underlying slab if necessary
        * @return True on success, false on failure.
@@ -146,6 +370,7 @@ namespace mcppalloc::sparse
                                                size_t minimum_alloc_length,
                                                size_t maximum_alloc_length,
                                                size_t allocate_size,
+                                               bool require_empty,
                                                allocator_block_type &out_block,
                                                bool try_expand) REQUIRES(m_mutex);
 
@@ -162,6 +387,34 @@ namespace mcppalloc::sparse
        * @param pair Memory interval to release.
        **/
       void _u_release_memory(const mcpputil::system_memory_range_t &pair) REQUIRES(m_mutex);
+      /**
+       * \brief Return the number of heap segments.
+       **/
+      auto num_heap_segments() const -> size_t REQUIRES(!m_mutex);
+      /**
+       * \brief Return true if the address is in some heap segment.
+       *
+       * Does not take the lock, so it is cheap enough for debug checks on the deallocation path.
+       **/
+      auto heap_contains(const void *addr) const noexcept -> bool;
+      /**
+       * \brief Return the heap segment containing an address, nullptr if none.
+       *
+       * Requires holding lock.
+       **/
+      auto _u_find_heap_segment(const void *addr) const -> const heap_segment_t * REQUIRES(m_mutex);
+      /**
+       * \brief Return the heap segment containing an address, nullptr if none.
+       *
+       * Requires holding lock.
+       **/
+      auto _u_find_heap_segment(const void *addr) -> heap_segment_t * REQUIRES(m_mutex);
+      /**
+       * \brief Publish the bounds of all heap segments for heap_contains.
+       *
+       * Requires holding lock.
+       **/
+      void _u_publish_segment_bounds() noexcept REQUIRES(m_mutex);
 
       /**
        * \brief Return true if the interval of memory is in the free list.
@@ -193,6 +446,14 @@ namespace mcppalloc::sparse
        * @param block Block to destroy.
        **/
       void _u_destroy_global_allocator_block(allocator_block_type &&block) REQUIRES(m_mutex);
+      /**
+       * \brief Destroy an allocator block.
+       *
+       * Requires holding lock.
+       * @param ta Requesting thread allocator.
+       * @param block Block to destroy.
+       **/
+      void _u_destroy_allocator_block(this_thread_allocator_t &ta, allocator_block_type &&block) REQUIRES(m_mutex);
       /**
        * \brief Unregister a registered allocator block before moving/destruction.
        *
@@ -252,10 +513,16 @@ namespace mcppalloc::sparse
        * @return nullptr on error.
        **/
       const this_allocator_block_handle_t *_u_find_block(void *addr) REQUIRES(m_mutex);
+      /**
+       * \brief Return the slab of the initial heap segment.
+       **/
       auto underlying_memory() -> ::mcpputil::slab_t &;
+      /**
+       * \brief Return the slab of the initial heap segment.
+       **/
       auto underlying_memory() const -> const ::mcpputil::slab_t &;
       /**
-       * \brief Return the end of the currently used portion of the slab.
+       * \brief Return the end of the currently used portion of the initial heap segment.
        **/
       uint8_t *current_end() const REQUIRES(!m_mutex);
       /**
@@ -263,19 +530,19 @@ namespace mcppalloc::sparse
        **/
       mcpputil::system_memory_range_t current_range() const REQUIRES(!m_mutex);
       /**
-       * \brief Return the size of the slab.
+       * \brief Return the size of all heap segments.
        **/
       REQUIRES(!m_mutex) auto size() const noexcept -> size_t;
       /**
-       * \brief Return the currently used size of slab.
+       * \brief Return the currently used size of all heap segments.
        **/
       REQUIRES(!m_mutex) auto current_size() const noexcept -> size_t;
       /**
-       * \brief Return the size of the slab.
+       * \brief Return the size of all heap segments.
        **/
       REQUIRES(m_mutex) auto _u_size() const noexcept -> size_t;
       /**
-       * \brief Return the currently used size of slab.
+       * \brief Return the currently used size of all heap segments.
        **/
       REQUIRES(m_mutex) auto _u_current_size() const noexcept -> size_t;
       /**
@@ -286,6 +553,12 @@ namespace mcppalloc::sparse
        * \brief Collapse the free list.
        **/
       void collapse() REQUIRES(!m_mutex);
+      /**
+       * \brief Collapse the free list.
+       *
+       * Requires holding lock.
+       **/
+      void _u_collapse() REQUIRES(m_mutex);
       /**
        * \brief Return a reference to the spinlock.
        **/
@@ -296,20 +569,43 @@ namespace mcppalloc::sparse
       /**
        * \brief Destroy all memory pairs in the container.
        *
+       * Objects are marked quasi freed and their memory is reused once their blocks are collected.
+       * Counters and allocation tags are settled immediately.
        * This clears the container when done.
        **/
       template <typename Container>
       void bulk_destroy_memory(Container &container) REQUIRES(!m_mutex);
+      /**
+       * \brief Destroy an object that may belong to another thread.
+       *
+       * Objects in blocks owned by a thread allocator are queued for the owning thread to destroy.
+       * Objects in global blocks are destroyed now.
+       * Requires holding lock.
+       **/
+      void _u_destroy_remote(void *v) REQUIRES(m_mutex);
+      /**
+       * \brief Destroy an object in a global block.
+       *
+       * Requires holding lock.
+       * @param index Index of block in global blocks.
+       **/
+      void _u_destroy_global_object(size_t index, void *v) REQUIRES(m_mutex);
+      /**
+       * \brief Account for an object destroyed without the thread allocator that owned it.
+       *
+       * Requires holding lock, orphan counters have one writer at a time.
+       **/
+      void _u_on_orphan_deallocation(const ::mcppalloc::details::object_state_base_t &os) noexcept REQUIRES(m_mutex);
       /**
        * \brief Return the free list for debugging purposes.
        **/
       memory_range_vector_t _d_free_list() const REQUIRES(!m_mutex);
       /**
-       * \brief Return the free list for debugging purposes without locking.
+       * \brief Return the free lists of all heap segments for debugging purposes without locking.
        **/
-      const memory_range_vector_t &_ud_free_list() const REQUIRES(m_mutex);
+      memory_range_vector_t _ud_free_list() const REQUIRES(m_mutex);
       /**
-       * \brief Return the end of the currently used portion of the slab.
+       * \brief Return the end of the currently used portion of the initial heap segment.
        *
        * Requires holding lock.
        **/
@@ -334,6 +630,45 @@ namespace mcppalloc::sparse
        * \brief Return reference to allocator traits.
        **/
       auto thread_policy() const noexcept -> const allocator_thread_policy_type &;
+      /**
+       * \brief Return a snapshot of allocation counters for all threads.
+       *
+       * This does not take the allocator lock.
+       **/
+      auto stats_snapshot() const -> stats_type;
+      /**
+       * \brief Return memory usage by size bin for all thread allocators and global blocks.
+       *
+       * Usage is maintained incrementally, so this is linear in the number of thread allocators rather than blocks.
+       **/
+      auto memory_usage() const -> memory_usage_stats_type REQUIRES(!m_mutex);
+      /**
+       * \brief Return registry of thread allocation counters.
+       **/
+      auto _counters_registry() noexcept -> ::mcppalloc::details::allocation_counters_registry_t<this_thread_allocator_t::c_bins> &;
+      /**
+       * \brief Maximum outstanding block requests per bin.
+       **/
+      static constexpr const size_t cs_max_block_demand = 8;
+      /**
+       * \brief Record that a thread allocator had to create a new block for a bin.
+       *
+       * Other thread allocators donate surplus blocks for that bin during maintenance.
+       * This is lock free.
+       * @return True if the request was recorded, false if the bin already has the maximum outstanding requests.
+       **/
+      bool _request_block(size_t id) noexcept;
+      /**
+       * \brief Return number of outstanding block requests for a bin.
+       **/
+      auto _block_demand(size_t id) const noexcept -> size_t;
+      /**
+       * \brief Claim an outstanding block request for a bin.
+       *
+       * This is lock free.
+       * @return True if a request was claimed and the caller should donate a block, false otherwise.
+       **/
+      bool _claim_block_demand(size_t id) noexcept;
       /**
        * \brief Return number of global blocks.
        **/
@@ -380,6 +715,32 @@ namespace mcppalloc::sparse
        * \brief Vector type for storing blocks held by the global allocator.
        **/
       using global_block_vector_type = mcpputil::rebind_vector_t<allocator_block_type, allocator>;
+      /**
+       * \brief Type of global block index entry.
+       *
+       * First part is the maximum allocation available when indexed.
+       * Second part is the position in m_global_blocks.
+       **/
+      using global_block_index_entry_type = ::std::pair<size_t, size_t>;
+      using global_block_index_set_type =
+          ::std::set<global_block_index_entry_type,
+                     ::std::less<global_block_index_entry_type>,
+                     typename ::std::allocator_traits<allocator>::template rebind_alloc<global_block_index_entry_type>>;
+      /**
+       * \brief Type of global block index key (minimum and maximum allocation length).
+       **/
+      using global_block_index_key_type = ::std::pair<size_t, size_t>;
+      using global_block_index_type =
+          ::std::map<global_block_index_key_type,
+                     global_block_index_set_type,
+                     ::std::less<global_block_index_key_type>,
+                     typename ::std::allocator_traits<allocator>::template rebind_alloc<
+                         ::std::pair<const global_block_index_key_type, global_block_index_set_type>>>;
+      /**
+       * \brief Location of a global block in the index.
+       **/
+      using global_block_index_location_type =
+          ::std::pair<global_block_index_set_type *, typename global_block_index_set_type::iterator>;
       /**
        * \brief Return an allocator block.
        *
@@ -405,10 +766,40 @@ namespace mcppalloc::sparse
        * @param sz Size of memory available for allocation.
        * @param minimum_alloc_length Minimum allocation length for block.
        * @param maximum_alloc_length Maximum allocation length for block.
+       * @param require_empty Only return empty blocks.
        **/
       REQUIRES(m_mutex)
-      auto _u_find_global_allocator_block(size_t sz, size_t minimum_alloc_length, size_t maximum_alloc_length) ->
-          typename global_block_vector_type::iterator;
+      auto _u_find_global_allocator_block(size_t sz, size_t minimum_alloc_length, size_t maximum_alloc_length, bool require_empty)
+          -> typename global_block_vector_type::iterator;
+      /**
+       * \brief Add global block at position i to the index.
+       *
+       * Requires holding lock.
+       **/
+      void _u_index_global_block(size_t i) REQUIRES(m_mutex);
+      /**
+       * \brief Remove global block at position i from the index.
+       *
+       * Requires holding lock.
+       **/
+      void _u_unindex_global_block(size_t i) REQUIRES(m_mutex);
+      /**
+       * \brief Remove the global block at position i, which must already be unregistered or moved from.
+       *
+       * The last global block is moved into the hole, so this is constant time.
+       * Requires holding lock.
+       **/
+      void _u_remove_global_block(size_t i) REQUIRES(m_mutex);
+      /**
+       * \brief Account for a block that was added to global blocks.
+       **/
+      void _u_account_global_block_added(allocator_block_type &block) REQUIRES(m_mutex);
+      /**
+       * \brief Account for a block that is being removed from global blocks.
+       *
+       * This only uses members that survive the block being moved from.
+       **/
+      void _u_account_global_block_removed(const allocator_block_type &block) REQUIRES(m_mutex);
 
       /**
        * \brief Internal helper function for moving registered blocks.
@@ -441,29 +832,117 @@ namespace mcppalloc::sparse
        **/
       std::atomic<bool> m_shutdown{false};
       /**
-       * \brief Free interval vector.
+       * \brief Initial size of gc heap.
+       **/
+      size_t m_initial_gc_heap_size GUARDED_BY(m_mutex) = 0;
+      /**
+       * \brief Minimum size to expand heap by.
+       **/
+      size_t m_minimum_expansion_size GUARDED_BY(m_mutex) = 0;
+      /**
+       * \brief Heap segments in order of creation.
        *
-       * List of all intervals of free memory in the slab.
-       * This is not stored in sorted order.
-       * This must be collapsed occasionally.
+       * Modified only while holding the lock.
+       * The initial segment is first and never moves, so it may be read without the lock.
        **/
-      memory_range_vector_t m_free_list GUARDED_BY(m_mutex);
+      mcpputil::rebind_vector_t<heap_segment_t, allocator> m_segments;
       /**
-       * \brief Pointer to end of currently used portion of slab.
+       * \brief Begin and end of each heap segment, readable without the lock.
+       *
+       * Written under the lock whenever a segment is added or grows.
        **/
-      uint8_t *m_current_end GUARDED_BY(m_mutex) = nullptr;
+      ::std::array<::std::pair<::std::atomic<const void *>, ::std::atomic<const void *>>, cs_max_heap_segments>
+          m_segment_bounds{};
       /**
-       * \brief Initial size of gc heap.
+       * \brief Number of entries of m_segment_bounds that are valid.
        **/
-      size_t m_initial_gc_heap_size GUARDED_BY(m_mutex) = 0;
+      ::std::atomic<size_t> m_num_published_segments{0};
       /**
-       * \brief Minimum size to expand heap by.
+       * \brief Bytes to set aside for a thread that runs out of memory.
        **/
-      size_t m_minimum_expansion_size GUARDED_BY(m_mutex) = 0;
+      size_t m_emergency_reserve_size GUARDED_BY(m_mutex) = 0;
+      /**
+       * \brief Memory set aside for a thread that runs out of memory.
+       **/
+      mcpputil::system_memory_range_t m_emergency_reserve GUARDED_BY(m_mutex);
+      /**
+       * \brief Header of the file backing the heap, nullptr if the heap is not persistent.
+       **/
+      persistent_heap_header_t *m_persistent_header GUARDED_BY(m_mutex) = nullptr;
+      /**
+       * \brief Descriptor of the file backing the heap.
+       **/
+      int m_persistent_fd GUARDED_BY(m_mutex) = -1;
+      /**
+       * \brief Number of times the emergency reserve was released.
+       **/
+      ::std::atomic<size_t> m_num_emergency_reserve_releases{0};
+      /**
+       * \brief Optional watcher for memory pressure.
+       **/
+      ::std::optional<cgroup_memory_watcher_t> m_memory_pressure_watcher GUARDED_BY(m_memory_pressure_mutex);
+      /**
+       * \brief Mutex for the memory pressure watcher, so polling files does not hold the allocator lock.
+       *
+       * This is never taken while holding the allocator lock.
+       **/
+      mutable mutex_type m_memory_pressure_mutex;
+      /**
+       * \brief True if there is a memory pressure watcher.
+       **/
+      ::std::atomic<bool> m_has_memory_pressure_watcher{false};
+      /**
+       * \brief New block requests left until the memory pressure watcher is polled.
+       **/
+      ::std::atomic<ptrdiff_t> m_memory_pressure_poll_countdown{0};
+      /**
+       * \brief Last memory pressure level responded to.
+       **/
+      ::std::atomic<memory_pressure_level_t> m_memory_pressure{memory_pressure_level_t::none};
+      /**
+       * \brief Quotas by allocation tag.
+       **/
+      ::std::array<::std::atomic<size_t>, c_num_allocation_tags> m_tag_soft_quotas{};
+      ::std::array<::std::atomic<size_t>, c_num_allocation_tags> m_tag_hard_quotas{};
+      /**
+       * \brief Bytes live by allocation tag as flushed by thread allocators.
+       **/
+      ::std::array<::std::atomic<int64_t>, c_num_allocation_tags> m_tag_live_bytes{};
+      /**
+       * \brief Get an interval of memory from the free list of a segment.
+       * @return (nullptr,nullptr) if there is no interval large enough.
+       **/
+      mcpputil::system_memory_range_t _u_get_memory_from_free_list(heap_segment_t &segment, size_t sz) REQUIRES(m_mutex);
+      /**
+       * \brief Get an interval of memory from the unused tail of a segment.
+       * @return (nullptr,nullptr) if the tail is not large enough.
+       **/
+      mcpputil::system_memory_range_t _u_get_memory_from_tail(heap_segment_t &segment, size_t sz) REQUIRES(m_mutex);
+      /**
+       * \brief Grow the heap so that the newest segment has at least sz bytes free at its tail.
+       *
+       * This first tries to expand the newest segment in place and then tries to add a new segment.
+       * @return True on success, false on failure.
+       **/
+      bool _u_grow_heap(size_t sz) REQUIRES(m_mutex);
+      /**
+       * \brief Record a new block in the persistent heap header.
+       * @return False if the header has no room for another block.
+       **/
+      bool _u_record_persistent_block(const allocator_block_type &block, size_t minimum_alloc_length, size_t maximum_alloc_length)
+          REQUIRES(m_mutex);
+      /**
+       * \brief Remove the record of the block starting at begin from the persistent heap header, if there is one.
+       **/
+      void _u_forget_persistent_block(const void *begin) REQUIRES(m_mutex);
+      /**
+       * \brief Rebuild blocks and the free list of a reattached persistent heap in one pass over it in address order.
+       **/
+      void _u_recover_persistent_heap() REQUIRES(m_mutex);
       /**
-       * \brief Underlying slab.
+       * \brief Unmap the persistent heap header and close its file.
        **/
-      mcpputil::slab_t m_slab;
+      void _u_close_persistent_heap() REQUIRES(m_mutex);
       /**
        * \brief Type that is an owning pointer to a thread allocator that uses the control allocator to handle memory.
        **/
@@ -489,6 +968,18 @@ namespace mcppalloc::sparse
        * This uses the control allocator for control memory.
        **/
       global_block_vector_type m_global_blocks;
+      /**
+       * \brief Index of global blocks by allocation lengths and then by maximum allocation available.
+       **/
+      global_block_index_type m_global_block_index GUARDED_BY(m_mutex);
+      /**
+       * \brief Location in index of each global block, parallel to m_global_blocks.
+       **/
+      mcpputil::rebind_vector_t<global_block_index_location_type, allocator> m_global_block_index_locations GUARDED_BY(m_mutex);
+      /**
+       * \brief Running memory usage of global blocks.
+       **/
+      memory_usage_counters_t m_global_memory_usage GUARDED_BY(m_mutex);
       /**
        * \brief Map from thread ids to thread allocators.
        **/
@@ -504,6 +995,54 @@ namespace mcppalloc::sparse
        * \brief Thread allocator policy.
        **/
       typename allocator_policy_type::thread_policy_type m_thread_policy;
+      /**
+       * \brief Registry of thread allocation counters.
+       **/
+      ::mcppalloc::details::allocation_counters_registry_t<this_thread_allocator_t::c_bins> m_counters_registry;
+      /**
+       * \brief Counters for objects destroyed without the thread allocator that owned them.
+       *
+       * These are only written while holding the lock, snapshots read them without it.
+       **/
+      typename this_thread_allocator_t::counters_type m_orphan_counters;
+      /**
+       * \brief Park a thread allocator.
+       *
+       * This is lock free.
+       * @return True if parked (ta is released), false if there was no room (ta is unchanged).
+       **/
+      bool _park_thread_allocator(thread_allocator_unique_ptr_t &ta) noexcept;
+      /**
+       * \brief Adopt a parked thread allocator.
+       *
+       * This is lock free.
+       * @return Parked thread allocator or nullptr if none are parked.
+       **/
+      auto _adopt_parked_thread_allocator() noexcept -> thread_allocator_unique_ptr_t;
+      /**
+       * \brief Parked thread allocators.
+       *
+       * Slots are claimed with a compare exchange and emptied with an exchange, so there is no ABA problem.
+       **/
+      ::std::array<::std::atomic<this_thread_allocator_t *>, cs_max_parked_thread_allocators> m_parked_thread_allocators{};
+      /**
+       * \brief Maximum number of parked thread allocators.
+       **/
+      ::std::atomic<size_t> m_max_parked_thread_allocators{0};
+      /**
+       * \brief When pages of blocks taken on by thread allocators are faulted in.
+       **/
+      ::std::atomic<prefault_mode_t> m_prefault_mode{prefault_mode_t::none};
+      /**
+       * \brief Number of parked thread allocators.
+       **/
+      ::std::atomic<size_t> m_num_parked_thread_allocators{0};
+      /**
+       * \brief Outstanding block requests by bin.
+       *
+       * Thread allocators that had to create blocks increment these, thread allocators with surplus blocks claim them.
+       **/
+      ::std::array<::std::atomic<size_t>, this_thread_allocator_t::c_bins> m_block_demand{};
 
       /**
        * \brief Maximum heap size.
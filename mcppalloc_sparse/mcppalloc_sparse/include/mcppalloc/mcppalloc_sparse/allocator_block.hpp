@@ -1,6 +1,7 @@
 #pragma once
 #include "sparse_allocator_block_base.hpp"
 #include <algorithm>
+#include <mcppalloc/allocator_policy_traits.hpp>
 #include <mcppalloc/block.hpp>
 #include <mcppalloc/default_allocator_policy.hpp>
 #include <mcpputil/mcpputil/boost/property_tree/ptree_fwd.hpp>
@@ -58,6 +59,14 @@ namespace mcppalloc
       using user_data_type = typename allocator_policy_type::user_data_type;
       using object_state_type = ::mcppalloc::details::object_state_t<allocator_policy_type>;
       static user_data_type s_default_user_data;
+      /**
+       * \brief True if object states are given user data on allocation.
+       **/
+      static constexpr const bool cs_uses_user_data = uses_user_data_v<allocator_policy_type>;
+      /**
+       * \brief Maximum number of free intervals allocate_near compares by distance.
+       **/
+      static constexpr const size_t cs_max_allocate_near_candidates = 16;
       using block_type = block_t<allocator_policy_type>;
       using allocation_return_type = ::std::tuple<block_type, object_state_type *>;
 
@@ -82,6 +91,13 @@ namespace mcppalloc
        * @return Valid pointer if possible, nullptr otherwise.
        **/
       auto allocate(size_t size) -> allocation_return_type;
+      /**
+       * \brief Allocate size bytes on the block as close to hint as possible.
+       *
+       * This compares the smallest cs_max_allocate_near_candidates free intervals that fit and the tail.
+       * @return Valid pointer if possible, nullptr otherwise.
+       **/
+      auto allocate_near(const void *hint, size_t size) -> allocation_return_type;
       /**
        * \brief Destroy a v that is on the block.
        *
@@ -104,6 +120,23 @@ namespace mcppalloc
        * @param num_quasifreed Increment by number of quasifreed found.
        **/
       void collect(size_t &num_quasifreed);
+      /**
+       * \brief Collect any adjacent blocks that may have formed into one block.
+       * @param num_quasifreed Increment by number of quasifreed found.
+       * @param quasifreed_bytes Increment by object bytes of quasifreed found.
+       **/
+      void collect(size_t &num_quasifreed, size_t &quasifreed_bytes);
+      /**
+       * \brief Rebuild a block from object states already in memory, such as a block in a reattached persistent heap.
+       *
+       * Unlike the constructor this does not write the first object state.
+       * Objects in use keep their memory, but their user data is reset to the default.
+       * @param start Start of memory block that this allocator uses.
+       * @param length Length of memory block that this allocator uses
+       * @param minimum_alloc_length Minimum length the block was constructed with.
+       * @param maximum_alloc_length Maximum length the block was constructed with.
+       **/
+      void _recover(void *start, size_t length, size_t minimum_alloc_length, size_t maximum_alloc_length);
       /**
        * \brief Return the maximum allocation size available.
        **/
@@ -177,6 +210,36 @@ namespace mcppalloc
                                    mcppalloc::details::os_size_compare,
                                    typename allocator::template rebind<mcppalloc::details::object_state_base_t *>::other>
           m_free_list;
+      /**
+       * \brief Bytes in live objects.
+       *
+       * Maintained by the owner of the block so that usage follows the block when it changes owner.
+       **/
+      size_t m_live_bytes = 0;
+      /**
+       * \brief Number of live objects.
+       **/
+      size_t m_live_objects = 0;
+      /**
+       * \brief Secondary memory used as last accounted for by the owner of the block.
+       **/
+      size_t m_accounted_secondary_memory = 0;
+
+    private:
+      using free_list_iterator = typename decltype(m_free_list)::iterator;
+      /**
+       * \brief Allocate from a free interval.
+       * @param size Size including object state.
+       * @param original_size Requested size.
+       **/
+      auto _allocate_from_free_list(free_list_iterator it, size_t size, size_t original_size) -> allocation_return_type;
+      /**
+       * \brief Allocate from the untouched memory at the end of the block.
+       * @param size Size including object state.
+       * @param original_size Requested size.
+       * @return Valid pointer if possible, nullptr otherwise.
+       **/
+      auto _allocate_from_tail(size_t size, size_t original_size) -> allocation_return_type;
     };
 
     template <typename Allocator_Policy>
@@ -35,7 +35,9 @@ namespace mcppalloc::sparse::details
   MCPPALLOC_ALWAYS_INLINE allocator_block_t<Allocator_Policy>::allocator_block_t(allocator_block_t &&block) noexcept
       : sparse_allocator_block_base_t(::std::move(block)), m_default_user_data(::std::move(block.m_default_user_data)),
         m_last_max_alloc_available(::std::move(block.m_last_max_alloc_available)),
-        m_maximum_alloc_length(::std::move(block.m_maximum_alloc_length))
+        m_maximum_alloc_length(::std::move(block.m_maximum_alloc_length)), m_free_list(::std::move(block.m_free_list)),
+        m_live_bytes(block.m_live_bytes), m_live_objects(block.m_live_objects),
+        m_accounted_secondary_memory(block.m_accounted_secondary_memory)
   {
   }
   template <typename Allocator_Policy>
@@ -50,6 +52,9 @@ namespace mcppalloc::sparse::details
     m_free_list = std::move(block.m_free_list);
     m_last_max_alloc_available = block.m_last_max_alloc_available;
     m_maximum_alloc_length = block.m_maximum_alloc_length;
+    m_live_bytes = block.m_live_bytes;
+    m_live_objects = block.m_live_objects;
+    m_accounted_secondary_memory = block.m_accounted_secondary_memory;
     // invalidate moved from block.
     // block.clear();
     return *this;
@@ -93,8 +98,6 @@ namespace mcppalloc::sparse::details
     size = object_state_type::needed_size(sizeof(object_state_type), size);
     assert(size >= minimum_allocation_length());
     assert(size <= maximum_allocation_length());
-    // compute this now.
-    object_state_type *later_next = reinterpret_cast<object_state_type *>(reinterpret_cast<uint8_t *>(m_next_alloc_ptr) + size);
     // if the free list isn't trivial, check it first.
     if (!m_free_list.empty()) {
       // do a reverse search from back of free list for somewhere to put the data.
@@ -108,36 +111,89 @@ namespace mcppalloc::sparse::details
         if (state->object_size() < original_size) {
           continue;
         }
-        auto forward_it = it.base() - 1;
-        // erase found from free list.
-        m_free_list.erase(forward_it);
+        return _allocate_from_free_list(it.base() - 1, size, original_size);
+      }
+    }
+    return _allocate_from_tail(size, original_size);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_block_t<Allocator_Policy>::allocate_near(const void *hint, size_t size) -> allocation_return_type
+  {
+    assert(minimum_allocation_length() <= maximum_allocation_length());
+    _verify(nullptr);
+    const size_t original_size = size;
+    size = object_state_type::needed_size(sizeof(object_state_type), size);
+    assert(size >= minimum_allocation_length());
+    assert(size <= maximum_allocation_length());
+    const auto distance = [hint](const void *v) {
+      const auto a = reinterpret_cast<uintptr_t>(v);
+      const auto b = reinterpret_cast<uintptr_t>(hint);
+      return a > b ? a - b : b - a;
+    };
+    // the free list is ordered by size and not by distance, so only the smallest entries that fit are compared.
+    auto it = ::std::partition_point(m_free_list.begin(), m_free_list.end(),
+                                     [original_size](auto &&state) { return state->object_size() < original_size; });
+    auto best = m_free_list.end();
+    size_t best_distance = ::std::numeric_limits<size_t>::max();
+    for (size_t i = 0; i < cs_max_allocate_near_candidates && it != m_free_list.end(); ++i, ++it) {
+      const size_t d = distance(*it);
+      if (d < best_distance) {
+        best = it;
+        best_distance = d;
+      }
+    }
+    // the tail may be closer, for instance when building a structure in a fresh block.
+    if (m_next_alloc_ptr && distance(m_next_alloc_ptr) < best_distance) {
+      auto ret = _allocate_from_tail(size, original_size);
+      if (allocation_valid(ret)) {
+        return ret;
+      }
+    }
+    if (best == m_free_list.end()) {
+      return allocation_return_type(block_type{nullptr, 0}, nullptr);
+    }
+    static_cast<object_state_type *>(*best)->verify_magic();
+    return _allocate_from_free_list(best, size, original_size);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_block_t<Allocator_Policy>::_allocate_from_free_list(free_list_iterator it, size_t size, size_t original_size)
+      -> allocation_return_type
+  {
+    object_state_type *const state = static_cast<object_state_type *>(*it);
+    // erase found from free list.
+    m_free_list.erase(it);
 
-        // figure out theoretical next pointer.
-        object_state_type *const next = reinterpret_cast<object_state_type *>(reinterpret_cast<uint8_t *>(state) + size);
-        // see if we can split the memory.
-        if (reinterpret_cast<uint8_t *>(next) + m_minimum_alloc_length <= reinterpret_cast<uint8_t *>(state->next())) {
-          // if we are here, the memory left over is bigger then minimum alloc size, so split.
-          next->set_all(state->next(), false, state->next_valid());
+    // figure out theoretical next pointer.
+    object_state_type *const next = reinterpret_cast<object_state_type *>(reinterpret_cast<uint8_t *>(state) + size);
+    // see if we can split the memory.
+    if (reinterpret_cast<uint8_t *>(next) + m_minimum_alloc_length <= reinterpret_cast<uint8_t *>(state->next())) {
+      // if we are here, the memory left over is bigger then minimum alloc size, so split.
+      next->set_all(state->next(), false, state->next_valid());
 
-          assert(next->object_size() >=
-                 m_minimum_alloc_length - mcpputil::align(sizeof(object_state_type), minimum_header_alignment()));
-          state->set_next(next);
-          state->set_next_valid(true);
-          _verify(next);
-          _verify(state);
-          m_free_list.insert(next);
-        }
-        // take all of the memory.
-        state->set_in_use(true);
-        state->set_user_data(m_default_user_data.get());
-        assert(state->object_size() >= original_size);
-        //          }
-        _verify(state);
-        assert(state->user_data());
-        return allocation_return_type(block_type{state->object_start(), state->object_size()}, state);
-      }
+      assert(next->object_size() >=
+             m_minimum_alloc_length - mcpputil::align(sizeof(object_state_type), minimum_header_alignment()));
+      state->set_next(next);
+      state->set_next_valid(true);
+      _verify(next);
+      _verify(state);
+      m_free_list.insert(next);
+    }
+    // take all of the memory.
+    state->set_in_use(true);
+    if_constexpr(cs_uses_user_data)
+    {
+      state->set_user_data(m_default_user_data.get());
+      assert(state->user_data());
     }
-    object_state_type *next = later_next;
+    assert(state->object_size() >= original_size);
+    //          }
+    _verify(state);
+    return allocation_return_type(block_type{state->object_start(), state->object_size()}, state);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_block_t<Allocator_Policy>::_allocate_from_tail(size_t size, size_t original_size) -> allocation_return_type
+  {
+    object_state_type *next = reinterpret_cast<object_state_type *>(reinterpret_cast<uint8_t *>(m_next_alloc_ptr) + size);
     // check to see if we have memory left over at tail.
     if (mcpputil_unlikely(!m_next_alloc_ptr)) {
       return allocation_return_type(block_type{nullptr, 0}, nullptr);
@@ -151,7 +207,10 @@ namespace mcppalloc::sparse::details
                                  original_size)) {
       return allocation_return_type(block_type{nullptr, 0}, nullptr);
     }
-    static_cast<object_state_type *>(m_next_alloc_ptr)->m_user_data = 0;
+    if_constexpr(cs_uses_user_data)
+    {
+      static_cast<object_state_type *>(m_next_alloc_ptr)->m_user_data = 0;
+    }
     const auto ret_os = static_cast<object_state_type *>(m_next_alloc_ptr);
     // see if we should split memory left over after this allocation.
     bool do_split = reinterpret_cast<uint8_t *>(next) + m_minimum_alloc_length <= end();
@@ -161,12 +220,15 @@ namespace mcppalloc::sparse::details
       next->set_all(static_cast<object_state_type *>(m_next_alloc_ptr)->next(), false,
                     static_cast<object_state_type *>(m_next_alloc_ptr)->next_valid());
       static_cast<object_state_type *>(m_next_alloc_ptr)->set_all(next, true, true);
-      static_cast<object_state_type *>(m_next_alloc_ptr)->set_user_data(m_default_user_data.get());
+      if_constexpr(cs_uses_user_data)
+      {
+        static_cast<object_state_type *>(m_next_alloc_ptr)->set_user_data(m_default_user_data.get());
+        assert(static_cast<object_state_type *>(m_next_alloc_ptr)->user_data());
+      }
       auto ret = static_cast<object_state_type *>(m_next_alloc_ptr)->object_start();
       auto sz = static_cast<object_state_type *>(m_next_alloc_ptr)->object_size();
       assert(static_cast<object_state_type *>(m_next_alloc_ptr)->object_size() >= original_size);
       _verify(static_cast<object_state_type *>(m_next_alloc_ptr));
-      assert(static_cast<object_state_type *>(m_next_alloc_ptr)->user_data());
       m_next_alloc_ptr = next;
       _verify(next);
       return allocation_return_type(block_type{ret, sz}, ret_os);
@@ -175,13 +237,16 @@ namespace mcppalloc::sparse::details
     // take all the memory.
     static_cast<object_state_type *>(m_next_alloc_ptr)->set_all(reinterpret_cast<object_state_type *>(end()), true, false);
     assert(static_cast<object_state_type *>(m_next_alloc_ptr)->next() == reinterpret_cast<object_state_type *>(end()));
-    static_cast<object_state_type *>(m_next_alloc_ptr)->set_user_data(m_default_user_data.get());
+    if_constexpr(cs_uses_user_data)
+    {
+      static_cast<object_state_type *>(m_next_alloc_ptr)->set_user_data(m_default_user_data.get());
+      assert(static_cast<object_state_type *>(m_next_alloc_ptr)->user_data());
+    }
     auto ret = static_cast<object_state_type *>(m_next_alloc_ptr)->object_start();
     auto sz = static_cast<object_state_type *>(m_next_alloc_ptr)->object_size();
     assert(static_cast<object_state_type *>(m_next_alloc_ptr)->object_size() >= original_size);
     assert(static_cast<object_state_type *>(m_next_alloc_ptr)->next() == reinterpret_cast<object_state_type *>(end()));
     _verify(static_cast<object_state_type *>(m_next_alloc_ptr));
-    assert(static_cast<object_state_type *>(m_next_alloc_ptr)->user_data());
     m_next_alloc_ptr = nullptr;
     _verify(static_cast<object_state_type *>(m_next_alloc_ptr));
     return allocation_return_type(block_type{ret, sz}, ret_os);
@@ -205,10 +270,13 @@ namespace mcppalloc::sparse::details
       return false;
     }
     // if has user data, destroy it.
-    if (state->user_data() && state->user_data() != m_default_user_data.get()) {
-      typename allocator::template rebind<user_data_type>::other a;
-      a.destroy(static_cast<user_data_type *>(state->user_data()));
-      a.deallocate(static_cast<user_data_type *>(state->user_data()), 1);
+    if_constexpr(cs_uses_user_data)
+    {
+      if (state->user_data() && state->user_data() != m_default_user_data.get()) {
+        typename allocator::template rebind<user_data_type>::other a;
+        a.destroy(static_cast<user_data_type *>(state->user_data()));
+        a.deallocate(static_cast<user_data_type *>(state->user_data()), 1);
+      }
     }
     // no longer in use.
     state->set_in_use(false);
@@ -258,6 +326,12 @@ namespace mcppalloc::sparse::details
   }
   template <typename Allocator_Policy>
   void allocator_block_t<Allocator_Policy>::collect(size_t &num_quasifreed)
+  {
+    size_t quasifreed_bytes = 0;
+    collect(num_quasifreed, quasifreed_bytes);
+  }
+  template <typename Allocator_Policy>
+  void allocator_block_t<Allocator_Policy>::collect(size_t &num_quasifreed, size_t &quasifreed_bytes)
   {
     // reset max alloc available.
     m_last_max_alloc_available = 0;
@@ -280,12 +354,14 @@ namespace mcppalloc::sparse::details
         state->set_quasi_freed(false);
         needs_insert = true;
         num_quasifreed++;
+        quasifreed_bytes += state->object_size();
         assert(!state->quasi_freed());
       }
       // note only check in use for next, it may be quasifree.
       if (!state->not_available() && !state->next()->in_use()) {
         if (state->next()->quasi_freed()) {
           num_quasifreed++;
+          quasifreed_bytes += state->next()->object_size();
         }
         // ok, both this state and next one available, so merge them.
         object_state_type *const next = state->template next<object_state_type>();
@@ -312,6 +388,7 @@ namespace mcppalloc::sparse::details
     if (!state->not_available()) {
       if (state->quasi_freed()) {
         num_quasifreed++;
+        quasifreed_bytes += state->object_size();
       }
       // ok at end of list, if its available.
       // try to find it in free list.
@@ -325,6 +402,52 @@ namespace mcppalloc::sparse::details
     max_alloc_available();
   }
   template <typename Allocator_Policy>
+  void allocator_block_t<Allocator_Policy>::_recover(void *start,
+                                                     size_t length,
+                                                     size_t minimum_alloc_length,
+                                                     size_t maximum_alloc_length)
+  {
+    m_start = reinterpret_cast<uint8_t *>(start);
+    m_end = m_start + length;
+    m_object_state_type_size = sizeof(object_state_type);
+    m_minimum_alloc_length = object_state_type::needed_size(sizeof(object_state_type), minimum_alloc_length);
+    if (maximum_alloc_length == c_infinite_length) {
+      m_maximum_alloc_length = maximum_alloc_length;
+    } else {
+      m_maximum_alloc_length = object_state_type::needed_size(sizeof(object_state_type), maximum_alloc_length);
+    }
+    if (m_default_user_data.get() != &s_default_user_data) {
+      m_default_user_data = mcpputil::allocator_unique_ptr_t<user_data_type, allocator>(&s_default_user_data);
+      m_default_user_data->set_is_default(true);
+    }
+    // the tail is found again by collect.
+    m_next_alloc_ptr = nullptr;
+    m_live_bytes = 0;
+    m_live_objects = 0;
+    object_state_type *state = reinterpret_cast<object_state_type *>(begin());
+    for (;;) {
+      state->verify_magic();
+      if (state->in_use()) {
+        // user data pointed into the address space that wrote the block.
+        if_constexpr(cs_uses_user_data)
+        {
+          state->set_user_data(m_default_user_data.get());
+        }
+        m_live_bytes += state->object_size();
+        m_live_objects += 1;
+      }
+      if (!state->next_valid()) {
+        break;
+      }
+      state = state->template next<object_state_type>();
+    }
+    size_t num_quasifreed = 0;
+    size_t quasifreed_bytes = 0;
+    collect(num_quasifreed, quasifreed_bytes);
+    m_live_bytes -= ::std::min(quasifreed_bytes, m_live_bytes);
+    m_live_objects -= ::std::min(num_quasifreed, m_live_objects);
+  }
+  template <typename Allocator_Policy>
   size_t allocator_block_t<Allocator_Policy>::minimum_allocation_length() const
   {
     return m_minimum_alloc_length;
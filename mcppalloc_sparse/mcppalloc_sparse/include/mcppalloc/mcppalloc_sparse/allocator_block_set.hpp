@@ -1,6 +1,7 @@
 #pragma once
 #include "allocator_block.hpp"
 #include "functor.hpp"
+#include "memory_usage.hpp"
 #include <boost/container/flat_set.hpp>
 #include <boost/property_tree/ptree_fwd.hpp>
 #include <mcppalloc/object_state.hpp>
@@ -79,6 +80,14 @@ namespace mcppalloc::sparse::details
      * @return A pointer to allocated memory, nullptr on failure.
      **/
     auto allocate(size_t sz) -> allocation_return_type;
+    /**
+     * \brief Allocate memory of given size in the block containing hint or the next block by address.
+     *
+     * @param hint Address to allocate near.
+     * @param sz Size to allocate.
+     * @return Allocation that is not valid if neither block has room.
+     **/
+    auto allocate_near(const void *hint, size_t sz) -> allocation_return_type;
     /**
      * \brief Destroy memory.
      * @return True if this block set allocated the memory and thus destroyed it, false otherwise.
@@ -152,6 +161,14 @@ namespace mcppalloc::sparse::details
                            Move_Functional &&move_func,
                            size_t min_to_leave = 0);
 
+    /**
+     * \brief Remove all blocks from the set without visiting the objects in them.
+     *
+     * Objects in the blocks are dropped, so this is only safe if nothing refers to them.
+     * @param l Function to call on removed blocks (called multiple times with r val block ref).
+     **/
+    template <typename L>
+    void release_all_blocks(L &&l);
     /**
      * \brief Return the number of memory addresses destroyed since last free empty blocks operation.
      **/
@@ -171,6 +188,12 @@ namespace mcppalloc::sparse::details
      * \brief Return the bytes of secondary memory used.
      **/
     auto secondary_memory_used() const noexcept -> size_t;
+    /**
+     * \brief Return the memory usage of the set.
+     *
+     * This is maintained incrementally so it is constant time and may be called from any thread.
+     **/
+    auto memory_usage() const noexcept -> memory_usage_t;
     /**
      * \brief Return the bytes of secondary memory used for self only.
      **/
@@ -190,6 +213,38 @@ namespace mcppalloc::sparse::details
     void to_ptree(::boost::property_tree::ptree &ptree, int level) const;
 
   private:
+    /**
+     * \brief Account for a block that was added to the set.
+     **/
+    void _account_block_added(allocator_block_type &block) noexcept;
+    /**
+     * \brief Account for an allocation in a block.
+     **/
+    void _account_allocation(allocator_block_type &block, const allocation_return_type &ret) noexcept;
+    /**
+     * \brief Allocate memory of given size in a specific block as close to hint as possible, keeping available blocks sorted.
+     *
+     * @return Allocation that is not valid if the block has no room.
+     **/
+    auto _allocate_in_block(allocator_block_type &block, const void *hint, size_t sz) -> allocation_return_type;
+    /**
+     * \brief Account for a block that is being removed from the set.
+     *
+     * This only uses members that survive the block being moved from.
+     **/
+    void _account_block_removed(const allocator_block_type &block) noexcept;
+    /**
+     * \brief Account for a change in secondary memory used by a block.
+     **/
+    void _account_block_secondary_memory(allocator_block_type &block) noexcept;
+    /**
+     * \brief Account for a change in secondary memory used by the set itself.
+     **/
+    void _account_secondary_memory_self() noexcept;
+    /**
+     * \brief Collect a block and account for objects that were quasifreed.
+     **/
+    void _collect_block(allocator_block_type &block);
     static const constexpr uint64_t cs_magic_prefix = 0x54a89202;
     const volatile uint64_t m_magic_prefix{cs_magic_prefix};
     allocator_block_type *m_last_block = nullptr;
@@ -225,6 +280,14 @@ namespace mcppalloc::sparse::details
      * \brief Number of memory addresses destroyed since last free empty blocks operation.
      **/
     size_t m_num_destroyed_since_free = 0;
+    /**
+     * \brief Running memory usage counters.
+     **/
+    memory_usage_counters_t m_memory_usage;
+    /**
+     * \brief Secondary memory used by the set itself as last accounted for.
+     **/
+    size_t m_accounted_secondary_memory_self = 0;
   };
 }
 #include "allocator_block_set_impl.hpp"
@@ -45,7 +45,7 @@ namespace mcppalloc::sparse::details
   template <typename Allocator_Policy>
   void allocator_block_set_t<Allocator_Policy>::regenerate_available_blocks()
   {
-    allocator_block_vector_t blocks;
+    allocator_block_reference_vector_t blocks;
     // clear available blocks.
     m_available_blocks.clear();
     for (auto &block : m_blocks) {
@@ -60,6 +60,7 @@ namespace mcppalloc::sparse::details
       }
     }
     m_available_blocks.insert(blocks.begin(), blocks.end());
+    _account_secondary_memory_self();
     sparse_allocator_block_set_verifier_t::verify_all(*this);
   }
   template <typename Allocator_Policy>
@@ -67,7 +68,7 @@ namespace mcppalloc::sparse::details
   {
     // collect all blocks.
     for (auto &block : m_blocks) {
-      block.collect(m_num_destroyed_since_free);
+      _collect_block(block);
     }
     // some blocks may have become available so regenerate available blocks.
     regenerate_available_blocks();
@@ -85,6 +86,9 @@ namespace mcppalloc::sparse::details
           return ret;
         }
         ret = last_block()->allocate(sz);
+        if (allocation_valid(ret)) {
+          _account_allocation(*last_block(), ret);
+        }
         sparse_allocator_block_set_verifier_t::verify_all(*this);
         return ret;
       }
@@ -99,6 +103,9 @@ namespace mcppalloc::sparse::details
           return ret;
         }
         ret = last_block()->allocate(sz);
+        if (allocation_valid(ret)) {
+          _account_allocation(*last_block(), ret);
+        }
         sparse_allocator_block_set_verifier_t::verify_all(*this);
         return ret;
       }
@@ -125,6 +132,7 @@ namespace mcppalloc::sparse::details
       ::std::abort();
     }
     // ok, so we have allocated the memory.
+    _account_allocation(*lower_bound->second, ret);
     const auto new_max_alloc = lower_bound->second->max_alloc_available();
     // see if there is allocation left in block.
     if (new_max_alloc == 0) {
@@ -152,6 +160,55 @@ namespace mcppalloc::sparse::details
     return ret;
   }
   template <typename Allocator_Policy>
+  auto allocator_block_set_t<Allocator_Policy>::allocate_near(const void *hint, size_t sz) -> allocation_return_type
+  {
+    sparse_allocator_block_set_verifier_t::verify_all(*this);
+    // first block that does not end before hint, so either the block containing it or the next one.
+    auto it = ::std::lower_bound(m_blocks.begin(), m_blocks.end(), static_cast<const uint8_t *>(hint), end_val_compare);
+    for (size_t i = 0; i < 2 && it != m_blocks.end(); ++i, ++it) {
+      if (!it->valid()) {
+        continue;
+      }
+      auto ret = _allocate_in_block(*it, hint, sz);
+      if (allocation_valid(ret)) {
+        return ret;
+      }
+    }
+    return allocation_return_type(block_type{nullptr, 0}, nullptr);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_block_set_t<Allocator_Policy>::_allocate_in_block(allocator_block_type &block, const void *hint, size_t sz)
+      -> allocation_return_type
+  {
+    allocation_return_type ret(block_type{nullptr, 0}, nullptr);
+    // the last block is never in available blocks.
+    if (&block == last_block()) {
+      ret = block.allocate_near(hint, sz);
+      if (allocation_valid(ret)) {
+        _account_allocation(block, ret);
+      }
+      return ret;
+    }
+    // entries are keyed by the last known size of their block, so this finds the entry if there is one.
+    const auto ab_it = m_available_blocks.lower_bound(sized_block_ref_t(block.last_max_alloc_available(), &block));
+    // blocks that are not available are full.
+    if (ab_it == m_available_blocks.end() || ab_it->second != &block || ab_it->first < sz) {
+      return ret;
+    }
+    ret = block.allocate_near(hint, sz);
+    if (!allocation_valid(ret)) {
+      return ret;
+    }
+    _account_allocation(block, ret);
+    m_available_blocks.erase(ab_it);
+    const auto new_max_alloc = block.max_alloc_available();
+    if (new_max_alloc) {
+      m_available_blocks.insert(sized_block_ref_t(new_max_alloc, &block));
+    }
+    sparse_allocator_block_set_verifier_t::verify_all(*this);
+    return ret;
+  }
+  template <typename Allocator_Policy>
   bool allocator_block_set_t<Allocator_Policy>::destroy(void *v)
   {
     sparse_allocator_block_set_verifier_t::verify_all(*this);
@@ -161,7 +218,14 @@ namespace mcppalloc::sparse::details
     if (it == m_blocks.end()) {
       return false;
     }
+    // grab the size now as destroying may merge the object with its neighbours.
+    const size_t object_size = allocator_block_type::object_state_type::from_object_start(v)->object_size();
     if (it->destroy(v, last_collapsed_size, prev_last_max_alloc_available)) {
+      it->m_live_bytes -= object_size;
+      it->m_live_objects -= 1;
+      memory_usage_counters_t::sub(m_memory_usage.m_live_bytes, object_size);
+      memory_usage_counters_t::sub(m_memory_usage.m_live_objects, 1);
+      _account_block_secondary_memory(*it);
       if (&*it != last_block() && !it->full()) {
         // find the block.
         sized_block_ref_t pair2 = ::std::make_pair(prev_last_max_alloc_available, &*it);
@@ -197,6 +261,7 @@ namespace mcppalloc::sparse::details
           sparse_allocator_block_set_verifier_t::verify_all(*this);
         }
       }
+      _account_secondary_memory_self();
       // increment destroyed count.
       m_num_destroyed_since_free += 1;
       sparse_allocator_block_set_verifier_t::verify_all(*this);
@@ -251,6 +316,8 @@ namespace mcppalloc::sparse::details
       m_blocks.emplace_back(::std::move(block));
       m_last_block = &m_blocks.back();
     }
+    _account_block_added(*m_last_block);
+    _account_secondary_memory_self();
     sparse_allocator_block_set_verifier_t::verify_all(*this);
     assert(!m_blocks.empty());
     return *m_last_block;
@@ -268,6 +335,7 @@ namespace mcppalloc::sparse::details
                                                              Move_Functional &&move_func)
   {
     sparse_allocator_block_set_verifier_t::verify_all(*this);
+    _account_block_removed(*it);
     // adjust available blocks.
     const auto ait =
         ::std::find_if(m_available_blocks.begin(), m_available_blocks.end(), [&it](auto &&abp) { return abp.second == &*it; });
@@ -324,6 +392,7 @@ namespace mcppalloc::sparse::details
       mcpputil::adjust_pointer_by_offset(pair.second, offset);
     }
     mcpputil::adjust_pointer_by_offset(m_last_block, offset);
+    _account_secondary_memory_self();
     sparse_allocator_block_set_verifier_t::verify_all(*this);
     return static_cast<size_t>(offset);
   }
@@ -335,21 +404,18 @@ namespace mcppalloc::sparse::details
   template <typename Allocator_Policy>
   auto allocator_block_set_t<Allocator_Policy>::primary_memory_used() const noexcept -> size_t
   {
-    size_t sz = 0;
-    for (auto &&block : m_blocks) {
-      sz += block.memory_size();
-    }
-    return sz;
+    return m_memory_usage.m_primary_bytes.load(::std::memory_order_relaxed);
   }
   template <typename Allocator_Policy>
   auto allocator_block_set_t<Allocator_Policy>::secondary_memory_used() const noexcept -> size_t
   {
-    size_t sz = 0;
-    for (auto &&block : m_blocks) {
-      sz += block.secondary_memory_used();
-    }
-    sz += secondary_memory_used_self();
-    return sz;
+    return m_memory_usage.m_secondary_bytes.load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_block_set_t<Allocator_Policy>::memory_usage() const noexcept -> memory_usage_t
+  {
+    using object_state_type = typename allocator_block_type::object_state_type;
+    return m_memory_usage.snapshot(mcpputil::align(sizeof(object_state_type), allocator_block_type::minimum_header_alignment()));
   }
   template <typename Allocator_Policy>
   auto allocator_block_set_t<Allocator_Policy>::secondary_memory_used_self() const noexcept -> size_t
@@ -365,12 +431,78 @@ namespace mcppalloc::sparse::details
     shrink_secondary_memory_usage_to_fit_self();
     for (auto &&block : m_blocks) {
       block.shrink_secondary_memory_usage_to_fit();
+      _account_block_secondary_memory(block);
     }
   }
   template <typename Allocator_Policy>
   void allocator_block_set_t<Allocator_Policy>::shrink_secondary_memory_usage_to_fit_self()
   {
     m_available_blocks.shrink_to_fit();
+    _account_secondary_memory_self();
+  }
+  template <typename Allocator_Policy>
+  void allocator_block_set_t<Allocator_Policy>::_account_allocation(allocator_block_type &block,
+                                                                    const allocation_return_type &ret) noexcept
+  {
+    const size_t sz = get_allocated_size(ret);
+    block.m_live_bytes += sz;
+    block.m_live_objects += 1;
+    memory_usage_counters_t::add(m_memory_usage.m_live_bytes, sz);
+    memory_usage_counters_t::add(m_memory_usage.m_live_objects, 1);
+  }
+  template <typename Allocator_Policy>
+  void allocator_block_set_t<Allocator_Policy>::_account_block_added(allocator_block_type &block) noexcept
+  {
+    block.m_accounted_secondary_memory = block.secondary_memory_used();
+    memory_usage_counters_t::add(m_memory_usage.m_primary_bytes, block.memory_size());
+    memory_usage_counters_t::add(m_memory_usage.m_secondary_bytes, block.m_accounted_secondary_memory);
+    memory_usage_counters_t::add(m_memory_usage.m_live_bytes, block.m_live_bytes);
+    memory_usage_counters_t::add(m_memory_usage.m_live_objects, block.m_live_objects);
+  }
+  template <typename Allocator_Policy>
+  void allocator_block_set_t<Allocator_Policy>::_account_block_removed(const allocator_block_type &block) noexcept
+  {
+    memory_usage_counters_t::sub(m_memory_usage.m_primary_bytes, block.memory_size());
+    memory_usage_counters_t::sub(m_memory_usage.m_secondary_bytes, block.m_accounted_secondary_memory);
+    memory_usage_counters_t::sub(m_memory_usage.m_live_bytes, block.m_live_bytes);
+    memory_usage_counters_t::sub(m_memory_usage.m_live_objects, block.m_live_objects);
+  }
+  template <typename Allocator_Policy>
+  void allocator_block_set_t<Allocator_Policy>::_account_block_secondary_memory(allocator_block_type &block) noexcept
+  {
+    const size_t secondary = block.secondary_memory_used();
+    if (secondary != block.m_accounted_secondary_memory) {
+      memory_usage_counters_t::sub(m_memory_usage.m_secondary_bytes, block.m_accounted_secondary_memory);
+      memory_usage_counters_t::add(m_memory_usage.m_secondary_bytes, secondary);
+      block.m_accounted_secondary_memory = secondary;
+    }
+  }
+  template <typename Allocator_Policy>
+  void allocator_block_set_t<Allocator_Policy>::_account_secondary_memory_self() noexcept
+  {
+    const size_t secondary = secondary_memory_used_self();
+    if (secondary != m_accounted_secondary_memory_self) {
+      memory_usage_counters_t::sub(m_memory_usage.m_secondary_bytes, m_accounted_secondary_memory_self);
+      memory_usage_counters_t::add(m_memory_usage.m_secondary_bytes, secondary);
+      m_accounted_secondary_memory_self = secondary;
+    }
+  }
+  template <typename Allocator_Policy>
+  void allocator_block_set_t<Allocator_Policy>::_collect_block(allocator_block_type &block)
+  {
+    size_t num_quasifreed = 0;
+    size_t quasifreed_bytes = 0;
+    block.collect(num_quasifreed, quasifreed_bytes);
+    // counters and tags of quasifreed objects were settled when they were marked.
+    m_num_destroyed_since_free += num_quasifreed;
+    // blocks filled outside of a set may have quasifreed objects that were never accounted for.
+    quasifreed_bytes = ::std::min(quasifreed_bytes, block.m_live_bytes);
+    num_quasifreed = ::std::min(num_quasifreed, block.m_live_objects);
+    block.m_live_bytes -= quasifreed_bytes;
+    block.m_live_objects -= num_quasifreed;
+    memory_usage_counters_t::sub(m_memory_usage.m_live_bytes, quasifreed_bytes);
+    memory_usage_counters_t::sub(m_memory_usage.m_live_objects, num_quasifreed);
+    _account_block_secondary_memory(block);
   }
 
   template <typename Allocator_Policy>
@@ -394,7 +526,7 @@ namespace mcppalloc::sparse::details
     size_t num_empty = 0;
     // first we collect and see how many total empty blocks there are.
     for (auto &block : m_blocks) {
-      block.collect(m_num_destroyed_since_free);
+      _collect_block(block);
       if (block.empty()) {
         num_empty++;
       } else {
@@ -429,6 +561,25 @@ namespace mcppalloc::sparse::details
     sparse_allocator_block_set_verifier_t::verify_all(*this);
   }
   template <typename Allocator_Policy>
+  template <typename L>
+  void allocator_block_set_t<Allocator_Policy>::release_all_blocks(L &&l)
+  {
+    sparse_allocator_block_set_verifier_t::verify_all(*this);
+    for (auto &block : m_blocks) {
+      if (!block.valid()) {
+        continue;
+      }
+      _account_block_removed(block);
+      l(::std::move(block));
+    }
+    m_available_blocks.clear();
+    m_blocks.clear();
+    m_last_block = nullptr;
+    m_num_destroyed_since_free = 0;
+    _account_secondary_memory_self();
+    sparse_allocator_block_set_verifier_t::verify_all(*this);
+  }
+  template <typename Allocator_Policy>
   auto allocator_block_set_t<Allocator_Policy>::num_destroyed_since_last_free() const noexcept -> size_t
   {
     return m_num_destroyed_since_free;
@@ -440,6 +591,10 @@ namespace mcppalloc::sparse::details
     ptree.put("primary_memory_used", ::std::to_string(primary_memory_used()));
     ptree.put("secondary_memory_used_self", ::std::to_string(secondary_memory_used_self()));
     ptree.put("secondary_memory_used", ::std::to_string(secondary_memory_used()));
+    const auto usage = memory_usage();
+    ptree.put("live_bytes", ::std::to_string(usage.m_live_bytes));
+    ptree.put("live_objects", ::std::to_string(usage.m_live_objects));
+    ptree.put("free_bytes", ::std::to_string(usage.m_free_bytes));
     ptree.put("allocator_min_size", ::std::to_string(allocator_min_size()));
     ptree.put("allocator_max_size", ::std::to_string(allocator_max_size()));
     ptree.put("num_destroyed_since_free", ::std::to_string(num_destroyed_since_last_free()));
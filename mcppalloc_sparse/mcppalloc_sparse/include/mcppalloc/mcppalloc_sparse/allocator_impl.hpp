@@ -7,6 +7,12 @@
 #include "sparse_allocator_verifier.hpp"
 #include <iostream>
 #include <mcpputil/mcpputil/container_functions.hpp>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 namespace mcppalloc::sparse::details
 {
   template <typename Allocator_Policy>
@@ -34,15 +40,33 @@ namespace mcppalloc::sparse::details
     ;
     // first shutdown all thread allocators.
     m_thread_allocators.clear();
+    while (_adopt_parked_thread_allocator()) {
+    }
     // then get rid of all block handles.
     m_blocks.clear();
     // then get rid of any lingering blocks.
     m_global_blocks.clear();
-    m_free_list.clear();
+    m_global_block_index.clear();
+    m_global_block_index_locations.clear();
+    m_global_memory_usage.m_primary_bytes = 0;
+    m_global_memory_usage.m_secondary_bytes = 0;
+    m_global_memory_usage.m_live_bytes = 0;
+    m_global_memory_usage.m_live_objects = 0;
+    for (auto &&segment : m_segments) {
+      segment.m_free_list.clear();
+      mcpputil::clear_capacity(segment.m_free_list);
+    }
+    m_emergency_reserve = {};
+    _u_close_persistent_heap();
+    {
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_memory_pressure_mutex);
+      m_has_memory_pressure_watcher.store(false, ::std::memory_order_relaxed);
+      m_memory_pressure_watcher.reset();
+    }
     mcpputil::clear_capacity(m_thread_allocators);
     mcpputil::clear_capacity(m_blocks);
     mcpputil::clear_capacity(m_global_blocks);
-    mcpputil::clear_capacity(m_free_list);
+    mcpputil::clear_capacity(m_global_block_index_locations);
     // tell the world the destructor has been called.
     m_shutdown = true;
   }
@@ -52,7 +76,7 @@ namespace mcppalloc::sparse::details
     return m_shutdown;
   }
   template <typename Allocator_Policy>
-  bool allocator_t<Allocator_Policy>::initialize(size_t initial_gc_heap_size, size_t max_heap_size)
+  bool allocator_t<Allocator_Policy>::initialize(size_t initial_gc_heap_size, size_t max_heap_size, size_t emergency_reserve_size)
   {
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
     // sanity check heap size.
@@ -61,17 +85,445 @@ namespace mcppalloc::sparse::details
     }
     m_initial_gc_heap_size = initial_gc_heap_size;
     m_minimum_expansion_size = m_initial_gc_heap_size;
+    m_maximum_heap_size = ::std::max(max_heap_size, initial_gc_heap_size);
+    // reserve all segments so that the initial segment never moves.
+    m_segments.reserve(cs_max_heap_segments);
+    m_segments.emplace_back();
     // try to allocate at a location that has room for expansion.
-    if (!m_slab.allocate(m_initial_gc_heap_size, mcpputil::slab_t::find_hole(max_heap_size))) {
+    if (!m_segments.back().m_slab.allocate(m_initial_gc_heap_size, mcpputil::slab_t::find_hole(max_heap_size))) {
+      m_segments.clear();
+      m_initial_gc_heap_size = 0;
       return false;
     }
     // setup current end point (nothing used yet).
-    m_current_end = m_slab.begin();
+    m_segments.back().m_current_end = m_segments.back().m_slab.begin();
+    _u_publish_segment_bounds();
+    // carve the emergency reserve now while memory is plentiful.
+    m_emergency_reserve_size = emergency_reserve_size;
+    if (m_emergency_reserve_size) {
+      m_emergency_reserve = _u_get_memory(m_emergency_reserve_size, true);
+      if (!m_emergency_reserve.begin()) {
+        return false;
+      }
+    }
     sparse_allocator_verifier_t::verify_blocks_sorted(*this);
     ;
     return true;
   }
   template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::initialize_persistent(const char *path, size_t heap_size)
+  {
+#ifdef _WIN32
+    (void)path;
+    (void)heap_size;
+    return false;
+#else
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    if (m_initial_gc_heap_size) {
+      return false;
+    }
+    const int fd = ::open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+      return false;
+    }
+    const auto fail = [&](void *header) {
+      if (header) {
+        ::munmap(header, persistent_heap_header_t::cs_size);
+      }
+      ::close(fd);
+      m_segments.clear();
+      return false;
+    };
+    struct ::stat st;
+    if (::fstat(fd, &st)) {
+      return fail(nullptr);
+    }
+    const bool reattach = static_cast<size_t>(st.st_size) >= persistent_heap_header_t::cs_size;
+    heap_size = mcpputil::align(heap_size, mcpputil::slab_t::page_size());
+    if (!reattach && (!heap_size || ::ftruncate(fd, static_cast<off_t>(persistent_heap_header_t::cs_size + heap_size)))) {
+      return fail(nullptr);
+    }
+    void *header_memory =
+        ::mmap(nullptr, persistent_heap_header_t::cs_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header_memory == MAP_FAILED) {
+      return fail(nullptr);
+    }
+    auto header = static_cast<persistent_heap_header_t *>(header_memory);
+    void *address = nullptr;
+    if (reattach) {
+      if (header->m_magic != persistent_heap_header_t::cs_magic || header->m_version != persistent_heap_header_t::cs_version ||
+          header->m_num_blocks > persistent_heap_header_t::cs_max_blocks ||
+          static_cast<size_t>(st.st_size) < persistent_heap_header_t::cs_size + header->m_heap_size) {
+        return fail(header);
+      }
+      heap_size = header->m_heap_size;
+      address = reinterpret_cast<void *>(header->m_heap_address);
+    } else {
+      address = mcpputil::slab_t::find_hole(heap_size);
+    }
+    // reserve the address space through a slab and then put the file in its place.
+    m_segments.reserve(cs_max_heap_segments);
+    m_segments.emplace_back();
+    auto &slab = m_segments.back().m_slab;
+    if (!slab.allocate(heap_size, address) || (reattach && slab.begin() != address) || slab.size() != heap_size) {
+      return fail(header);
+    }
+    if (::mmap(slab.begin(), heap_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+               static_cast<off_t>(persistent_heap_header_t::cs_size)) == MAP_FAILED) {
+      return fail(header);
+    }
+    if (!reattach) {
+      header->m_version = persistent_heap_header_t::cs_version;
+      header->m_heap_address = reinterpret_cast<uint64_t>(slab.begin());
+      header->m_heap_size = heap_size;
+      header->m_num_blocks = 0;
+      header->m_root = 0;
+      // written last so that a file whose creation was cut short is not reattached.
+      header->m_magic = persistent_heap_header_t::cs_magic;
+    }
+    m_persistent_header = header;
+    m_persistent_fd = fd;
+    m_initial_gc_heap_size = heap_size;
+    m_minimum_expansion_size = heap_size;
+    m_maximum_heap_size = heap_size;
+    m_segments.back().m_current_end = slab.begin();
+    _u_publish_segment_bounds();
+    if (reattach) {
+      _u_recover_persistent_heap();
+    }
+    sparse_allocator_verifier_t::verify_blocks_sorted(*this);
+    return true;
+#endif
+  }
+  template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::is_persistent() const
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    return m_persistent_header != nullptr;
+  }
+  template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::sync()
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+#ifndef _WIN32
+    if (m_persistent_header) {
+      auto &segment = m_segments.front();
+      const auto used = static_cast<size_t>(segment.m_current_end - segment.m_slab.begin());
+      // heap first so that the header never records blocks whose contents did not make it to the file.
+      if (used && ::msync(segment.m_slab.begin(), used, MS_SYNC)) {
+        return false;
+      }
+      return ::msync(m_persistent_header, persistent_heap_header_t::cs_size, MS_SYNC) == 0;
+    }
+#endif
+    return true;
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::set_persistent_root(void *root)
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    if (m_persistent_header) {
+      m_persistent_header->m_root = reinterpret_cast<uint64_t>(root);
+    }
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::persistent_root() const -> void *
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    if (!m_persistent_header) {
+      return nullptr;
+    }
+    return reinterpret_cast<void *>(m_persistent_header->m_root);
+  }
+  template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::_u_record_persistent_block(const allocator_block_type &block,
+                                                                 size_t minimum_alloc_length,
+                                                                 size_t maximum_alloc_length)
+  {
+    if (!m_persistent_header) {
+      return true;
+    }
+    auto &num_blocks = m_persistent_header->m_num_blocks;
+    if (num_blocks == persistent_heap_header_t::cs_max_blocks) {
+      return false;
+    }
+    auto &record = m_persistent_header->m_blocks[num_blocks++];
+    record.m_offset = static_cast<uint64_t>(block.begin() - m_segments.front().m_slab.begin());
+    record.m_length = static_cast<uint64_t>(block.end() - block.begin());
+    record.m_minimum_alloc_length = minimum_alloc_length;
+    record.m_maximum_alloc_length = maximum_alloc_length;
+    return true;
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_forget_persistent_block(const void *begin)
+  {
+    if (!m_persistent_header) {
+      return;
+    }
+    const auto offset = static_cast<uint64_t>(static_cast<const uint8_t *>(begin) - m_segments.front().m_slab.begin());
+    auto &blocks = m_persistent_header->m_blocks;
+    auto &num_blocks = m_persistent_header->m_num_blocks;
+    for (size_t i = 0; i < num_blocks; ++i) {
+      if (blocks[i].m_offset == offset) {
+        blocks[i] = blocks[--num_blocks];
+        return;
+      }
+    }
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_recover_persistent_heap()
+  {
+    auto &segment = m_segments.front();
+    auto &blocks = m_persistent_header->m_blocks;
+    auto &num_blocks = m_persistent_header->m_num_blocks;
+    ::std::sort(blocks.begin(), blocks.begin() + static_cast<ptrdiff_t>(num_blocks),
+                [](const persistent_block_record_t &a, const persistent_block_record_t &b) { return a.m_offset < b.m_offset; });
+    // blocks are moved into place, so make room for all of them before taking addresses.
+    m_global_blocks.reserve(::std::max<size_t>(20000, num_blocks));
+    uint8_t *cursor = segment.m_slab.begin();
+    size_t num_kept = 0;
+    for (size_t i = 0; i < num_blocks; ++i) {
+      const auto record = blocks[i];
+      uint8_t *const begin = segment.m_slab.begin() + record.m_offset;
+      if (mcpputil_unlikely(begin < cursor || record.m_offset + record.m_length > segment.m_slab.size())) {
+        ::std::cerr << "Persistent heap block records overlap. 5d1e0c7a-3f43-4d8e-9a0b-2f6c1e9b7d54\n";
+        ::std::abort();
+      }
+      m_global_blocks.emplace_back();
+      auto &block = m_global_blocks.back();
+      block._recover(begin, static_cast<size_t>(record.m_length), static_cast<size_t>(record.m_minimum_alloc_length),
+                     static_cast<size_t>(record.m_maximum_alloc_length));
+      if (block.empty()) {
+        // nothing live, so the block is free memory like the gaps.
+        m_global_blocks.pop_back();
+        continue;
+      }
+      if (begin != cursor) {
+        auto &free_list = segment.m_free_list;
+        const mcpputil::system_memory_range_t gap(cursor, begin);
+        free_list.insert(
+            ::std::upper_bound(free_list.begin(), free_list.end(), gap, mcpputil::system_memory_range_t::size_comparator()), gap);
+      }
+      // blocks are visited in address order, so handles stay sorted.
+      m_blocks.emplace_back();
+      m_blocks.back().initialize(nullptr, &block, block.begin());
+      m_global_block_index_locations.emplace_back();
+      _u_index_global_block(m_global_blocks.size() - 1);
+      _u_account_global_block_added(block);
+      blocks[num_kept++] = record;
+      cursor = block.end();
+    }
+    num_blocks = num_kept;
+    segment.m_current_end = cursor;
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_close_persistent_heap()
+  {
+#ifndef _WIN32
+    if (m_persistent_header) {
+      ::munmap(m_persistent_header, persistent_heap_header_t::cs_size);
+      ::close(m_persistent_fd);
+    }
+#endif
+    m_persistent_header = nullptr;
+    m_persistent_fd = -1;
+  }
+  template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::release_emergency_reserve()
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    if (!m_emergency_reserve.begin()) {
+      return false;
+    }
+    _u_release_memory(m_emergency_reserve);
+    m_emergency_reserve = {};
+    m_num_emergency_reserve_releases.fetch_add(1, ::std::memory_order_relaxed);
+    return true;
+  }
+  template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::replenish_emergency_reserve()
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    if (m_emergency_reserve.begin() || !m_emergency_reserve_size) {
+      return true;
+    }
+    m_emergency_reserve = _u_get_memory(m_emergency_reserve_size, true);
+    return m_emergency_reserve.begin() != nullptr;
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::emergency_reserve_available() const -> size_t
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    return m_emergency_reserve.size();
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::num_emergency_reserve_releases() const noexcept -> size_t
+  {
+    return m_num_emergency_reserve_releases.load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::reclaim_memory()
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    // global blocks that are now empty go back to the free list.
+    _u_collect();
+    // threads give back their empty blocks on their next allocation.
+    _u_set_force_free_empty_blocks();
+    _u_collapse();
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::set_memory_pressure_watcher(cgroup_memory_watcher_t watcher)
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_memory_pressure_mutex);
+    m_memory_pressure_watcher.emplace(::std::move(watcher));
+    m_memory_pressure_poll_countdown.store(cs_memory_pressure_poll_interval, ::std::memory_order_relaxed);
+    m_has_memory_pressure_watcher.store(true, ::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::clear_memory_pressure_watcher()
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_memory_pressure_mutex);
+    m_has_memory_pressure_watcher.store(false, ::std::memory_order_relaxed);
+    m_memory_pressure_watcher.reset();
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::check_memory_pressure() -> memory_pressure_t
+  {
+    memory_pressure_t pressure;
+    {
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_memory_pressure_mutex);
+      if (!m_memory_pressure_watcher) {
+        return {};
+      }
+      m_memory_pressure_poll_countdown.store(cs_memory_pressure_poll_interval, ::std::memory_order_relaxed);
+      pressure = m_memory_pressure_watcher->poll();
+    }
+    _on_polled_memory_pressure(pressure);
+    return pressure;
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::maybe_check_memory_pressure()
+  {
+    if (mcpputil_likely(!m_has_memory_pressure_watcher.load(::std::memory_order_relaxed))) {
+      return;
+    }
+    if (m_memory_pressure_poll_countdown.fetch_sub(1, ::std::memory_order_relaxed) > 0) {
+      return;
+    }
+    memory_pressure_t pressure;
+    {
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_memory_pressure_mutex);
+      if (!m_memory_pressure_watcher) {
+        return;
+      }
+      m_memory_pressure_poll_countdown.store(cs_memory_pressure_poll_interval, ::std::memory_order_relaxed);
+      pressure = m_memory_pressure_watcher->poll();
+    }
+    _on_polled_memory_pressure(pressure);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_on_polled_memory_pressure(const memory_pressure_t &pressure)
+  {
+    // most polls find nothing new, so do not take the lock for them.
+    if (pressure.m_level == memory_pressure_level_t::none && memory_pressure() == memory_pressure_level_t::none) {
+      return;
+    }
+    on_memory_pressure(pressure);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::on_memory_pressure(const memory_pressure_t &pressure)
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    _u_on_memory_pressure(pressure);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_on_memory_pressure(const memory_pressure_t &pressure)
+  {
+    const auto previous = m_memory_pressure.exchange(pressure.m_level, ::std::memory_order_relaxed);
+    // thread allocators apply their own settings on their next allocation.
+    for (auto &&pair : m_thread_allocators) {
+      pair.second->set_memory_pressure(pressure.m_level);
+    }
+    if (pressure.m_level != memory_pressure_level_t::none) {
+      _u_set_force_free_empty_blocks();
+      _u_collect();
+      _u_collapse();
+      _u_purge_free_memory();
+    }
+    if (pressure.m_level != previous) {
+      m_thread_policy.on_memory_pressure(pressure);
+    }
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::memory_pressure() const noexcept -> memory_pressure_level_t
+  {
+    return m_memory_pressure.load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::set_tag_quota(allocation_tag_t tag, size_t soft, size_t hard) noexcept
+  {
+    m_tag_soft_quotas[tag].store(soft, ::std::memory_order_relaxed);
+    m_tag_hard_quotas[tag].store(hard, ::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::tag_soft_quota(allocation_tag_t tag) const noexcept -> size_t
+  {
+    return m_tag_soft_quotas[tag].load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::tag_hard_quota(allocation_tag_t tag) const noexcept -> size_t
+  {
+    return m_tag_hard_quotas[tag].load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::tag_live_bytes(allocation_tag_t tag) const noexcept -> size_t
+  {
+    // batches from different threads may arrive out of order.
+    return static_cast<size_t>(::std::max(_tag_live_bytes(tag), static_cast<int64_t>(0)));
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::_tag_live_bytes(allocation_tag_t tag) const noexcept -> int64_t
+  {
+    return m_tag_live_bytes[tag].load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_add_tag_live_bytes(allocation_tag_t tag, int64_t delta) noexcept
+  {
+    m_tag_live_bytes[tag].fetch_add(delta, ::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::purge_free_memory() -> size_t
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    return _u_purge_free_memory();
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::_u_purge_free_memory() -> size_t
+  {
+    size_t ret = 0;
+#ifndef _WIN32
+    const size_t page_size = mcpputil::slab_t::page_size();
+    const auto purge = [&ret, page_size](uint8_t *begin, uint8_t *end) {
+      // only whole pages can be purged.
+      begin = mcpputil::align(begin, page_size);
+      end = reinterpret_cast<uint8_t *>(reinterpret_cast<uintptr_t>(end) & ~(page_size - 1));
+      if (begin >= end) {
+        return;
+      }
+      if (::madvise(begin, static_cast<size_t>(end - begin), MADV_DONTNEED) == 0) {
+        ret += static_cast<size_t>(end - begin);
+      }
+    };
+    for (auto &&segment : m_segments) {
+      for (auto &&range : segment.m_free_list) {
+        purge(range.begin(), range.end());
+      }
+      purge(segment.m_current_end, segment.m_slab.end());
+    }
+#endif
+    return ret;
+  }
+  template <typename Allocator_Policy>
   auto allocator_t<Allocator_Policy>::get_memory(size_t sz, bool try_expand) -> mcpputil::system_memory_range_t
   {
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
@@ -84,102 +536,134 @@ namespace mcppalloc::sparse::details
     sparse_allocator_verifier_t::verify_blocks_sorted(*this);
     ;
     sz = mcpputil::align(sz, mcpputil::c_alignment);
+    // prefer reusing freed intervals to consuming new memory.
+    for (auto &&segment : m_segments) {
+      auto ret = _u_get_memory_from_free_list(segment, sz);
+      if (ret.begin()) {
+        return ret;
+      }
+    }
+    // no space available in free lists.
+    for (auto &&segment : m_segments) {
+      auto ret = _u_get_memory_from_tail(segment, sz);
+      if (ret.begin()) {
+        return ret;
+      }
+    }
+    // we need to expand the heap.
+    if (!try_expand || m_segments.empty()) {
+      return {};
+    }
+    if (!_u_grow_heap(sz)) {
+      return {};
+    }
+    auto ret = _u_get_memory_from_tail(m_segments.back(), sz);
+    assert(ret.begin());
+    sparse_allocator_verifier_t::verify_blocks_sorted(*this);
+    ;
+    return ret;
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::_u_get_memory_from_free_list(heap_segment_t &segment, size_t sz)
+      -> mcpputil::system_memory_range_t
+  {
+    auto &free_list = segment.m_free_list;
     // do worst fit memory vector lookup
-    auto worst = m_free_list.end();
     auto find_pair = mcpputil::system_memory_range_t(nullptr, reinterpret_cast<uint8_t *>(sz));
-    worst = last_greater_equal_than(m_free_list.begin(), m_free_list.end(), find_pair,
-                                    mcpputil::system_memory_range_t::size_comparator());
-    if (worst != m_free_list.end()) {
-      // subdivide
-      mcpputil::system_memory_range_t ret = *worst;
-      m_free_list.erase(worst);
-      // calculate part not used.
-      mcpputil::system_memory_range_t free_pair(ret.begin() + sz, ret.end());
-      ret.set_end(free_pair.begin());
-      if (!free_pair.empty()) {
-        auto ub = ::std::upper_bound(m_free_list.begin(), m_free_list.end(), free_pair,
-                                     mcpputil::system_memory_range_t::size_comparator());
-        if (m_current_end == free_pair.end()) {
-          m_current_end = free_pair.begin();
-        } else {
-          m_free_list.emplace(ub, free_pair);
-        }
+    auto worst = last_greater_equal_than(free_list.begin(), free_list.end(), find_pair,
+                                         mcpputil::system_memory_range_t::size_comparator());
+    if (worst == free_list.end()) {
+      return {};
+    }
+    // subdivide
+    mcpputil::system_memory_range_t ret = *worst;
+    free_list.erase(worst);
+    // calculate part not used.
+    mcpputil::system_memory_range_t free_pair(ret.begin() + sz, ret.end());
+    ret.set_end(free_pair.begin());
+    if (!free_pair.empty()) {
+      auto ub =
+          ::std::upper_bound(free_list.begin(), free_list.end(), free_pair, mcpputil::system_memory_range_t::size_comparator());
+      if (segment.m_current_end == free_pair.end()) {
+        segment.m_current_end = free_pair.begin();
+      } else {
+        free_list.emplace(ub, free_pair);
       }
-      assert(reinterpret_cast<uintptr_t>(ret.begin()) % mcpputil::c_alignment == 0);
-      assert(reinterpret_cast<uintptr_t>(ret.end()) % mcpputil::c_alignment == 0);
-      return mcpputil::system_memory_range_t(ret.begin(), ret.end());
     }
-    // no space available in free list.
-    auto sz_available = m_slab.end() - m_current_end;
+    assert(reinterpret_cast<uintptr_t>(ret.begin()) % mcpputil::c_alignment == 0);
+    assert(reinterpret_cast<uintptr_t>(ret.end()) % mcpputil::c_alignment == 0);
+    return mcpputil::system_memory_range_t(ret.begin(), ret.end());
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::_u_get_memory_from_tail(heap_segment_t &segment, size_t sz)
+      -> mcpputil::system_memory_range_t
+  {
+    auto sz_available = segment.m_slab.end() - segment.m_current_end;
     // heap out of memory.
     if (sz_available < 0) // shouldn't happen
     {
       ::std::abort();
     }
-    if (static_cast<size_t>(sz_available) >= sz) {
-      // recalculate used end.
-      uint8_t *new_end = m_current_end + sz;
-      // create the memory interval pair.
-      auto ret = ::std::make_pair(m_current_end, new_end);
-      assert(new_end <= m_slab.end());
-      m_current_end = new_end;
-      assert(reinterpret_cast<uintptr_t>(ret.first) % mcpputil::c_alignment == 0);
-      assert(reinterpret_cast<uintptr_t>(ret.second) % mcpputil::c_alignment == 0);
-      return ret;
-    }
-    // we need to expand the heap.
-    assert(m_current_end <= m_slab.end());
-    size_t expansion_size = ::std::max(m_slab.size() + m_minimum_expansion_size, m_slab.size() + sz);
-    if (expansion_size > max_heap_size()) {
-      return {};
-    }
-    if (!try_expand) {
-      return {};
-    }
-    if (!m_slab.expand(expansion_size)) {
-      ::std::cerr << "Unable to expand slab to " << expansion_size << ::std::endl;
-      // unable to expand heap so return error condition.
+    if (static_cast<size_t>(sz_available) < sz) {
       return {};
     }
     // recalculate used end.
-    uint8_t *new_end = m_current_end + sz;
-    assert(new_end <= m_slab.end());
+    uint8_t *new_end = segment.m_current_end + sz;
     // create the memory interval pair.
-    auto ret = ::std::make_pair(m_current_end, new_end);
-    m_current_end = new_end;
-    sparse_allocator_verifier_t::verify_blocks_sorted(*this);
-    ;
+    auto ret = ::std::make_pair(segment.m_current_end, new_end);
+    assert(new_end <= segment.m_slab.end());
+    segment.m_current_end = new_end;
     assert(reinterpret_cast<uintptr_t>(ret.first) % mcpputil::c_alignment == 0);
     assert(reinterpret_cast<uintptr_t>(ret.second) % mcpputil::c_alignment == 0);
     return ret;
   }
   template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::_u_grow_heap(size_t sz)
+  {
+    auto &last = m_segments.back();
+    assert(last.m_current_end <= last.m_slab.end());
+    // first try to grow the newest segment in place.
+    const size_t used = static_cast<size_t>(last.m_current_end - last.m_slab.begin());
+    const size_t expansion_size = ::std::max(last.m_slab.size() + m_minimum_expansion_size, used + sz);
+    if (_u_size() - last.m_slab.size() + expansion_size <= max_heap_size() && last.m_slab.expand(expansion_size)) {
+      _u_publish_segment_bounds();
+      return true;
+    }
+    // the address space after the newest segment is taken, so add a segment elsewhere.
+    const size_t segment_size = ::std::max(m_minimum_expansion_size, sz);
+    if (_u_size() + segment_size > max_heap_size() || m_segments.size() == cs_max_heap_segments) {
+      return false;
+    }
+    heap_segment_t segment;
+    if (!segment.m_slab.allocate(segment_size, mcpputil::slab_t::find_hole(segment_size))) {
+      ::std::cerr << "Unable to add heap segment of " << segment_size << ::std::endl;
+      // unable to expand heap so return error condition.
+      return false;
+    }
+    segment.m_current_end = segment.m_slab.begin();
+    m_segments.emplace_back(::std::move(segment));
+    _u_publish_segment_bounds();
+    return true;
+  }
+  template <typename Allocator_Policy>
   bool allocator_t<Allocator_Policy>::_u_get_unregistered_allocator_block(this_thread_allocator_t &ta,
                                                                           size_t create_sz,
                                                                           size_t minimum_alloc_length,
                                                                           size_t maximum_alloc_length,
                                                                           size_t allocate_size,
+                                                                          bool require_empty,
                                                                           allocator_block_type &out_block,
                                                                           bool try_expand)
   {
     // first check to see if we can find a partially used block that fits parameters.
-    auto found_block = _u_find_global_allocator_block(allocate_size, minimum_alloc_length, maximum_alloc_length);
+    auto found_block = _u_find_global_allocator_block(allocate_size, minimum_alloc_length, maximum_alloc_length, require_empty);
     if (found_block != m_global_blocks.end()) {
       // reuse old block.
-      auto old_block_addr = &*found_block;
-      _u_unregister_allocator_block(*old_block_addr);
+      _u_unregister_allocator_block(*found_block);
       // move old block into new address.
       out_block = ::std::move(*found_block);
-      // move block registration.
-      //          _u_move_registered_block(old_block_addr, &block);
-      // figure out location in vector that shifted.
-      size_t location = static_cast<size_t>(found_block - m_global_blocks.begin());
-      // remove block from vector.
-      m_global_blocks.erase(found_block);
-      // move all registrations after that global block back one position.
-      for (size_t i = location; i < m_global_blocks.size(); ++i) {
-        _u_move_registered_block(&m_global_blocks[i + 1], &m_global_blocks[i]);
-      }
+      // remove block from global blocks.
+      _u_remove_global_block(static_cast<size_t>(found_block - m_global_blocks.begin()));
       return true;
     }
     // otherwise just create a new block
@@ -206,6 +690,11 @@ namespace mcppalloc::sparse::details
     block.~allocator_block_type();
     new (&block)
         allocator_block_type(memory.begin(), static_cast<size_t>(memory_size), minimum_alloc_length, maximum_alloc_length);
+    if (mcpputil_unlikely(!_u_record_persistent_block(block, minimum_alloc_length, maximum_alloc_length))) {
+      block.clear();
+      _u_release_memory(memory);
+      return false;
+    }
     // call traits function that gets called when block is created.
     m_thread_policy.on_create_allocator_block(ta, block);
     return true;
@@ -221,6 +710,16 @@ namespace mcppalloc::sparse::details
     release_memory(std::make_pair(block.begin(), block.end()));
   }
   template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_destroy_allocator_block(this_thread_allocator_t &ta, allocator_block_type &&block)
+  {
+    // notify traits that a memory block is being destroyed.
+    m_thread_policy.on_destroy_allocator_block(ta, block);
+    // unregister block.
+    _u_unregister_allocator_block(block);
+    // release memory now that block is unregistered.
+    _u_release_memory(std::make_pair(block.begin(), block.end()));
+  }
+  template <typename Allocator_Policy>
   void allocator_t<Allocator_Policy>::_u_destroy_global_allocator_block(allocator_block_type &&block)
   {
     // unregister block.
@@ -304,9 +803,10 @@ namespace mcppalloc::sparse::details
       size_t contiguous = 0;
       // first we must locate a section of contiuous blocks.
       do {
-        auto &block_handle = *(lb + static_cast<difference_type>(i));
-        auto next_old_block =
-            reinterpret_cast<allocator_block_type *>(reinterpret_cast<uint8_t *>(old_block) + i * sizeof(allocator_block_type));
+        // lb and old_block are those of the start of the current run.
+        auto &block_handle = *(lb + static_cast<difference_type>(i - contig_start));
+        auto next_old_block = reinterpret_cast<allocator_block_type *>(reinterpret_cast<uint8_t *>(old_block) +
+                                                                        (i - contig_start) * sizeof(allocator_block_type));
         if (block_handle.m_block == next_old_block) {
           // another contiguous block found.
           contiguous++;
@@ -431,6 +931,11 @@ namespace mcppalloc::sparse::details
     // this is done because moving them is non-trivial.
     if (!m_global_blocks.capacity()) {
       m_global_blocks.reserve(20000);
+    } else if (m_global_blocks.size() == m_global_blocks.capacity()) {
+      // growing moves every global block, so move their registrations too.
+      auto old_data = reinterpret_cast<uint8_t *>(m_global_blocks.data());
+      m_global_blocks.reserve(m_global_blocks.capacity() * 2);
+      _u_move_registered_blocks(m_global_blocks, reinterpret_cast<uint8_t *>(m_global_blocks.data()) - old_data);
     }
     // grab the old block address.
     auto old_block_addr = &block;
@@ -438,6 +943,9 @@ namespace mcppalloc::sparse::details
     m_global_blocks.emplace_back(std::move(block));
     // move the registration for the block.
     _u_move_registered_block(old_block_addr, &m_global_blocks.back());
+    m_global_block_index_locations.emplace_back();
+    _u_index_global_block(m_global_blocks.size() - 1);
+    _u_account_global_block_added(m_global_blocks.back());
     sparse_allocator_verifier_t::verify_blocks_sorted(*this);
     ;
   }
@@ -453,15 +961,21 @@ namespace mcppalloc::sparse::details
   {
     sparse_allocator_verifier_t::verify_blocks_sorted(*this);
     ;
-    // if the interval is at the end of the currently used part of slab, just move slab pointer.
-    if (pair.end() == m_current_end) {
-      m_current_end = pair.begin();
-      assert(m_current_end <= m_slab.end());
+    _u_forget_persistent_block(pair.begin());
+    auto segment = _u_find_heap_segment(pair.begin());
+    if (mcpputil_unlikely(!segment)) {
+      ::std::cerr << "Released memory is not in any heap segment. 0c3ad3f5-5b0e-4b8c-9f0b-6a7c8e2d4f11\n";
+      ::std::abort();
+    }
+    // if the interval is at the end of the currently used part of segment, just move segment pointer.
+    if (pair.end() == segment->m_current_end) {
+      segment->m_current_end = pair.begin();
+      assert(segment->m_current_end <= segment->m_slab.end());
       return;
     }
-    auto ub =
-        ::std::upper_bound(m_free_list.begin(), m_free_list.end(), pair, mcpputil::system_memory_range_t::size_comparator());
-    m_free_list.insert(ub, pair);
+    auto &free_list = segment->m_free_list;
+    auto ub = ::std::upper_bound(free_list.begin(), free_list.end(), pair, mcpputil::system_memory_range_t::size_comparator());
+    free_list.insert(ub, pair);
     sparse_allocator_verifier_t::verify_blocks_sorted(*this);
     ;
   }
@@ -469,12 +983,16 @@ namespace mcppalloc::sparse::details
   auto allocator_t<Allocator_Policy>::in_free_list(const mcpputil::system_memory_range_t &pair) const noexcept -> bool
   {
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
-    // first check to see if it is past end of used slab.
-    if (_u_current_end() <= pair.begin() && pair.end() <= underlying_memory().end()) {
+    auto segment = _u_find_heap_segment(pair.begin());
+    if (!segment) {
+      return false;
+    }
+    // first check to see if it is past end of used segment.
+    if (segment->m_current_end <= pair.begin() && pair.end() <= segment->m_slab.end()) {
       return true;
     }
     // otherwise check to see if it is in some interval in the free list.
-    for (auto &&fpair : m_free_list) {
+    for (auto &&fpair : segment->m_free_list) {
       if (fpair.contains(pair)) {
         return true;
       }
@@ -485,23 +1003,73 @@ namespace mcppalloc::sparse::details
   auto allocator_t<Allocator_Policy>::free_list_length() const noexcept -> size_t
   {
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
-    return m_free_list.size();
+    size_t ret = 0;
+    for (auto &&segment : m_segments) {
+      ret += segment.m_free_list.size();
+    }
+    return ret;
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::num_heap_segments() const -> size_t
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    return m_segments.size();
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::heap_contains(const void *addr) const noexcept -> bool
+  {
+    const size_t num_segments = m_num_published_segments.load(::std::memory_order_acquire);
+    for (size_t i = 0; i < num_segments; ++i) {
+      const auto &bounds = m_segment_bounds[i];
+      if (bounds.first.load(::std::memory_order_relaxed) <= addr && addr < bounds.second.load(::std::memory_order_acquire)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_publish_segment_bounds() noexcept
+  {
+    // segments only ever grow, so a reader racing this sees at worst the old, smaller bounds.
+    size_t i = 0;
+    for (auto &&segment : m_segments) {
+      m_segment_bounds[i].first.store(segment.m_slab.begin(), ::std::memory_order_relaxed);
+      m_segment_bounds[i].second.store(segment.m_slab.end(), ::std::memory_order_release);
+      ++i;
+    }
+    m_num_published_segments.store(i, ::std::memory_order_release);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::_u_find_heap_segment(const void *addr) const -> const heap_segment_t *
+  {
+    // there are few segments, so a linear scan is cheaper than keeping them sorted.
+    for (auto &&segment : m_segments) {
+      if (segment.m_slab.begin() <= addr && addr < segment.m_slab.end()) {
+        return &segment;
+      }
+    }
+    return nullptr;
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::_u_find_heap_segment(const void *addr) -> heap_segment_t *
+  {
+    return const_cast<heap_segment_t *>(static_cast<const allocator_t *>(this)->_u_find_heap_segment(addr));
   }
   template <typename Allocator_Policy>
   auto allocator_t<Allocator_Policy>::underlying_memory() -> ::mcpputil::slab_t &
   {
-    return m_slab;
+    return m_segments.front().m_slab;
   }
   template <typename Allocator_Policy>
   auto allocator_t<Allocator_Policy>::underlying_memory() const -> const ::mcpputil::slab_t &
   {
-    return m_slab;
+    return m_segments.front().m_slab;
   }
   template <typename Allocator_Policy>
   inline uint8_t *allocator_t<Allocator_Policy>::current_end() const
   {
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
-    return m_current_end;
+    return _u_current_end();
   }
   template <typename Allocator_Policy>
   mcpputil::system_memory_range_t allocator_t<Allocator_Policy>::current_range() const
@@ -512,12 +1080,12 @@ namespace mcppalloc::sparse::details
   template <typename Allocator_Policy>
   inline uint8_t *allocator_t<Allocator_Policy>::_u_current_end() const
   {
-    return m_current_end;
+    return m_segments.front().m_current_end;
   }
   template <typename Allocator_Policy>
   mcpputil::system_memory_range_t allocator_t<Allocator_Policy>::_u_current_range() const
   {
-    return {m_slab.begin(), m_current_end};
+    return {underlying_memory().begin(), _u_current_end()};
   }
   template <typename Allocator_Policy>
   inline auto allocator_t<Allocator_Policy>::size() const noexcept -> size_t
@@ -534,37 +1102,53 @@ namespace mcppalloc::sparse::details
   template <typename Allocator_Policy>
   inline auto allocator_t<Allocator_Policy>::_u_size() const noexcept -> size_t
   {
-    return m_slab.size();
+    size_t ret = 0;
+    for (auto &&segment : m_segments) {
+      ret += segment.m_slab.size();
+    }
+    return ret;
   }
   template <typename Allocator_Policy>
   inline auto allocator_t<Allocator_Policy>::_u_current_size() const noexcept -> size_t
   {
-    return static_cast<size_t>(_u_current_end() - underlying_memory().begin());
+    size_t ret = 0;
+    for (auto &&segment : m_segments) {
+      ret += static_cast<size_t>(segment.m_current_end - segment.m_slab.begin());
+    }
+    return ret;
   }
 
   template <typename Allocator_Policy>
   inline void allocator_t<Allocator_Policy>::collapse()
   {
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    _u_collapse();
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_collapse()
+  {
     sparse_allocator_verifier_t::verify_blocks_sorted(*this);
     ;
-    ::std::sort(m_free_list.begin(), m_free_list.end());
-    for (auto it = m_free_list.rbegin(), end = m_free_list.rend(); it != end; ++it) {
-      auto prev = it + 1;
-      if (prev != end) {
-        if (prev->end() == it->begin()) {
-          prev->set_end(it->end());
-          m_free_list.erase(it.base() - 1);
+    for (auto &&segment : m_segments) {
+      auto &free_list = segment.m_free_list;
+      ::std::sort(free_list.begin(), free_list.end());
+      for (auto it = free_list.rbegin(), end = free_list.rend(); it != end; ++it) {
+        auto prev = it + 1;
+        if (prev != end) {
+          if (prev->end() == it->begin()) {
+            prev->set_end(it->end());
+            free_list.erase(it.base() - 1);
+          }
         }
       }
-    }
-    if (!m_free_list.empty()) {
-      if (m_free_list.back().end() == m_current_end) {
-        m_current_end = m_free_list.back().begin();
-        m_free_list.pop_back();
+      if (!free_list.empty()) {
+        if (free_list.back().end() == segment.m_current_end) {
+          segment.m_current_end = free_list.back().begin();
+          free_list.pop_back();
+        }
       }
+      ::std::sort(free_list.begin(), free_list.end(), mcpputil::system_memory_range_t::size_comparator());
     }
-    ::std::sort(m_free_list.begin(), m_free_list.end(), mcpputil::system_memory_range_t::size_comparator());
     sparse_allocator_verifier_t::verify_blocks_sorted(*this);
     ;
   }
@@ -575,29 +1159,46 @@ namespace mcppalloc::sparse::details
     return _ud_free_list();
   }
   template <typename Allocator_Policy>
-  inline auto allocator_t<Allocator_Policy>::_ud_free_list() const -> const memory_range_vector_t &
+  inline auto allocator_t<Allocator_Policy>::_ud_free_list() const -> memory_range_vector_t
   {
-    return m_free_list;
+    memory_range_vector_t ret;
+    for (auto &&segment : m_segments) {
+      ret.insert(ret.end(), segment.m_free_list.begin(), segment.m_free_list.end());
+    }
+    return ret;
   }
   template <typename Allocator_Policy>
   inline auto allocator_t<Allocator_Policy>::initialize_thread() -> this_thread_allocator_t &
   {
-    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
-    sparse_allocator_verifier_t::verify_blocks_sorted(*this);
-    ;
-    // first check to see if there is already a thread allocator for this thread.
-    auto it = m_thread_allocators.find(::std::this_thread::get_id());
-    if (it != m_thread_allocators.end()) {
-      return *it->second;
-    }
-    // one doesn't already exist.
-    // create a thread allocator.
-    thread_allocator_unique_ptr_t ta = mcpputil::make_unique_allocator<this_thread_allocator_t, allocator>(*this);
-    // get a reference to thread allocator.
-    auto &ret = *ta;
-    // put the thread allocator in the thread allocator list.
-    m_thread_allocators.emplace(::std::this_thread::get_id(), ::std::move(ta));
-    return ret;
+    this_thread_allocator_t *ret = nullptr;
+    bool adopted = false;
+    {
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+      sparse_allocator_verifier_t::verify_blocks_sorted(*this);
+      ;
+      // first check to see if there is already a thread allocator for this thread.
+      auto it = m_thread_allocators.find(::std::this_thread::get_id());
+      if (it != m_thread_allocators.end()) {
+        return *it->second;
+      }
+      // one doesn't already exist.
+      // adopt a parked thread allocator with warm blocks if possible, otherwise create one.
+      thread_allocator_unique_ptr_t ta = _adopt_parked_thread_allocator();
+      adopted = ta != nullptr;
+      if (!ta) {
+        ta = mcpputil::make_unique_allocator<this_thread_allocator_t, allocator>(*this);
+      }
+      ta->set_memory_pressure(memory_pressure());
+      // get a reference to thread allocator.
+      ret = ta.get();
+      // put the thread allocator in the thread allocator list.
+      m_thread_allocators.emplace(::std::this_thread::get_id(), ::std::move(ta));
+    }
+    // other threads may have queued objects while it was parked.
+    if (adopted) {
+      ret->destroy_queued();
+    }
+    return *ret;
   }
   template <typename Allocator_Policy>
   inline void allocator_t<Allocator_Policy>::destroy_thread()
@@ -622,6 +1223,72 @@ namespace mcppalloc::sparse::details
       sparse_allocator_verifier_t::verify_blocks_sorted(*this);
       ;
     }
+    if (m_max_parked_thread_allocators.load(::std::memory_order_relaxed)) {
+      ptr->_on_park();
+      // give surplus blocks to threads that want them before keeping the rest warm.
+      ptr->_do_maintenance();
+      _park_thread_allocator(ptr);
+    }
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::set_max_parked_thread_allocators(size_t max) noexcept
+  {
+    m_max_parked_thread_allocators = ::std::min(max, cs_max_parked_thread_allocators);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::max_parked_thread_allocators() const noexcept -> size_t
+  {
+    return m_max_parked_thread_allocators.load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::set_prefault_mode(prefault_mode_t mode) noexcept
+  {
+    m_prefault_mode.store(mode, ::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::prefault_mode() const noexcept -> prefault_mode_t
+  {
+    return m_prefault_mode.load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::num_parked_thread_allocators() const noexcept -> size_t
+  {
+    return m_num_parked_thread_allocators.load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::_park_thread_allocator(thread_allocator_unique_ptr_t &ta) noexcept
+  {
+    const size_t max = m_max_parked_thread_allocators.load(::std::memory_order_relaxed);
+    for (size_t i = 0; i < max; ++i) {
+      this_thread_allocator_t *expected = nullptr;
+      if (m_parked_thread_allocators[i].load(::std::memory_order_relaxed) == nullptr &&
+          m_parked_thread_allocators[i].compare_exchange_strong(expected, ta.get(), ::std::memory_order_release,
+                                                                ::std::memory_order_relaxed)) {
+        ta.release();
+        m_num_parked_thread_allocators.fetch_add(1, ::std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::_adopt_parked_thread_allocator() noexcept -> thread_allocator_unique_ptr_t
+  {
+    if (!m_num_parked_thread_allocators.load(::std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    // check all slots in case the maximum was lowered after parking.
+    for (auto &&slot : m_parked_thread_allocators) {
+      if (slot.load(::std::memory_order_relaxed) == nullptr) {
+        continue;
+      }
+      auto ta = slot.exchange(nullptr, ::std::memory_order_acquire);
+      if (ta) {
+        m_num_parked_thread_allocators.fetch_sub(1, ::std::memory_order_relaxed);
+        return thread_allocator_unique_ptr_t(ta);
+      }
+    }
+    return nullptr;
   }
   template <typename Allocator_Policy>
   auto allocator_t<Allocator_Policy>::_u_blocks() -> decltype(m_blocks) &
@@ -638,10 +1305,17 @@ namespace mcppalloc::sparse::details
   void allocator_t<Allocator_Policy>::bulk_destroy_memory(Container &container)
   {
     _d_verify();
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
     // this doesn't really free these objects.
     // instead it just marks the state that it should be freed in the future.
     for (auto &&os : container) {
       if (os) {
+        if_constexpr(has_on_deallocation_v<allocator_thread_policy_type>)
+        {
+          m_thread_policy.on_deallocation(os->object_start());
+        }
+        // the object is dead now, collecting its block later only reuses the memory.
+        _u_on_orphan_deallocation(*os);
         os->set_quasi_freed();
       }
     }
@@ -649,6 +1323,65 @@ namespace mcppalloc::sparse::details
     container.clear();
   }
   template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_destroy_remote(void *v)
+  {
+    auto handle = _u_find_block(v);
+    if (mcpputil_unlikely(!handle)) {
+      ::std::cerr << "mcppalloc: Remote destroy of object not in any block 0d6b3c1e-5f47-4a2e-9c88-7e21b4f0a936\n";
+      ::std::abort();
+    }
+    // handles keep their last owner when a block goes global, so check where the block lives.
+    if (!m_global_blocks.empty() && handle->m_block >= &m_global_blocks.front() && handle->m_block <= &m_global_blocks.back()) {
+      _u_destroy_global_object(static_cast<size_t>(handle->m_block - m_global_blocks.data()), v);
+      return;
+    }
+    assert(handle->m_thread_allocator);
+    handle->m_thread_allocator->_u_queue_destroy(v);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_destroy_global_object(size_t index, void *v)
+  {
+    auto &block = m_global_blocks[index];
+    auto os = object_state_type::from_object_start(v);
+    const size_t object_size = os->object_size();
+    // account before destroying clears the user data.
+    _u_on_orphan_deallocation(*os);
+    if_constexpr(has_on_deallocation_v<allocator_thread_policy_type>)
+    {
+      m_thread_policy.on_deallocation(v);
+    }
+    _u_account_global_block_removed(block);
+    size_t last_collapsed_size = 0;
+    size_t last_max_alloc_available = 0;
+    if (mcpputil_unlikely(!block.destroy(v, last_collapsed_size, last_max_alloc_available))) {
+      ::std::cerr << "mcppalloc: Unable to destroy object in global block 5a0e7d92-1c3b-4f68-a4d1-93b2e6c8f057\n";
+      ::std::abort();
+    }
+    block.m_live_bytes -= ::std::min(object_size, block.m_live_bytes);
+    block.m_live_objects -= ::std::min(static_cast<size_t>(1), block.m_live_objects);
+    _u_account_global_block_added(block);
+    if (block.empty()) {
+      _u_destroy_global_allocator_block(::std::move(block));
+      _u_remove_global_block(index);
+    } else {
+      // more may be available after destroying.
+      _u_unindex_global_block(index);
+      _u_index_global_block(index);
+    }
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_on_orphan_deallocation(const ::mcppalloc::details::object_state_base_t &os) noexcept
+  {
+    const size_t object_size = os.object_size();
+    m_orphan_counters.on_deallocation(this_thread_allocator_t::find_block_set_id(object_size), object_size);
+    if_constexpr(this_thread_allocator_t::cs_uses_allocation_tags)
+    {
+      const auto tag = static_cast<allocation_tag_t>(os.user_flags());
+      m_orphan_counters.on_tagged_deallocation(tag, object_size);
+      _add_tag_live_bytes(tag, -static_cast<int64_t>(object_size));
+    }
+  }
+  template <typename Allocator_Policy>
   auto allocator_t<Allocator_Policy>::thread_policy() noexcept -> allocator_thread_policy_type &
   {
     return m_thread_policy;
@@ -659,6 +1392,67 @@ namespace mcppalloc::sparse::details
     return m_thread_policy;
   }
 
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::stats_snapshot() const -> stats_type
+  {
+    auto ret = m_counters_registry.snapshot();
+    m_orphan_counters.add_to(ret);
+    return ret;
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::memory_usage() const -> memory_usage_stats_type
+  {
+    memory_usage_stats_type ret;
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    ret.m_global = m_global_memory_usage.snapshot(
+        mcpputil::align(sizeof(object_state_type), allocator_block_type::minimum_header_alignment()));
+    for (auto &&pair : m_thread_allocators) {
+      pair.second->add_memory_usage_to(ret);
+    }
+    // parked thread allocators are only adopted under the lock, so they stay alive while it is held.
+    for (auto &&slot : m_parked_thread_allocators) {
+      auto ta = slot.load(::std::memory_order_acquire);
+      if (ta) {
+        ta->add_memory_usage_to(ret);
+      }
+    }
+    return ret;
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::_counters_registry() noexcept
+      -> ::mcppalloc::details::allocation_counters_registry_t<this_thread_allocator_t::c_bins> &
+  {
+    return m_counters_registry;
+  }
+  template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::_request_block(size_t id) noexcept
+  {
+    auto &demand = m_block_demand[id];
+    size_t expected = demand.load(::std::memory_order_relaxed);
+    while (expected < cs_max_block_demand) {
+      if (demand.compare_exchange_weak(expected, expected + 1, ::std::memory_order_relaxed, ::std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  template <typename Allocator_Policy>
+  auto allocator_t<Allocator_Policy>::_block_demand(size_t id) const noexcept -> size_t
+  {
+    return m_block_demand[id].load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  bool allocator_t<Allocator_Policy>::_claim_block_demand(size_t id) noexcept
+  {
+    auto &demand = m_block_demand[id];
+    size_t expected = demand.load(::std::memory_order_relaxed);
+    while (expected > 0) {
+      if (demand.compare_exchange_weak(expected, expected - 1, ::std::memory_order_relaxed, ::std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
   template <typename Allocator_Policy>
   size_t allocator_t<Allocator_Policy>::num_global_blocks()
   {
@@ -680,20 +1474,25 @@ namespace mcppalloc::sparse::details
   template <typename Allocator_Policy>
   void allocator_t<Allocator_Policy>::_u_collect()
   {
-    // go through each block globally owned
-    for (auto block_it = m_global_blocks.rbegin(); block_it != m_global_blocks.rend(); ++block_it) {
-      auto &&block = *block_it;
+    // go through each block globally owned, backwards so that removal only moves visited blocks.
+    for (size_t i = m_global_blocks.size(); i > 0; --i) {
+      auto &&block = m_global_blocks[i - 1];
       // collect it
       size_t num_quasifreed = 0;
-      block.collect(num_quasifreed);
+      size_t quasifreed_bytes = 0;
+      _u_account_global_block_removed(block);
+      block.collect(num_quasifreed, quasifreed_bytes);
+      block.m_live_bytes -= ::std::min(quasifreed_bytes, block.m_live_bytes);
+      block.m_live_objects -= ::std::min(num_quasifreed, block.m_live_objects);
+      _u_account_global_block_added(block);
       // if after collection it is empty, destroy it.
       if (block.empty()) {
         _u_destroy_global_allocator_block(::std::move(block));
-        auto forward_it = (block_it + 1).base();
-        assert(&*forward_it == &*block_it);
-        auto moved_begin = m_global_blocks.erase(forward_it);
-        _u_move_registered_blocks(moved_begin, m_global_blocks.end(),
-                                  -static_cast<::std::ptrdiff_t>(sizeof(typename global_block_vector_type::value_type)));
+        _u_remove_global_block(i - 1);
+      } else {
+        // more may be available after collection.
+        _u_unindex_global_block(i - 1);
+        _u_index_global_block(i - 1);
       }
     }
     for (auto block_it = m_global_blocks.rbegin(); block_it != m_global_blocks.rend(); ++block_it) {
@@ -706,20 +1505,78 @@ namespace mcppalloc::sparse::details
   template <typename Allocator_Policy>
   auto allocator_t<Allocator_Policy>::_u_find_global_allocator_block(size_t sz,
                                                                      size_t minimum_alloc_length,
-                                                                     size_t maximum_alloc_length) ->
+                                                                     size_t maximum_alloc_length,
+                                                                     bool require_empty) ->
       typename global_block_vector_type::iterator
   {
     // sanity check min and max lengths.
     minimum_alloc_length = object_state_type::needed_size(sizeof(object_state_type), minimum_alloc_length);
     maximum_alloc_length = object_state_type::needed_size(sizeof(object_state_type), maximum_alloc_length);
-    // run find.
-    auto it = ::std::find_if(m_global_blocks.begin(), m_global_blocks.end(),
-                             [sz, minimum_alloc_length, maximum_alloc_length](allocator_block_type &block) {
-                               return block.minimum_allocation_length() == minimum_alloc_length &&
-                                      block.maximum_allocation_length() == maximum_alloc_length &&
-                                      block.max_alloc_available() >= sz;
-                             });
-    return it;
+    auto set_it = m_global_block_index.find(::std::make_pair(minimum_alloc_length, maximum_alloc_length));
+    if (set_it == m_global_block_index.end()) {
+      return m_global_blocks.end();
+    }
+    // best fit keeps the heap dense by preferring the fullest block that is usable.
+    auto it = set_it->second.lower_bound(::std::make_pair(sz, static_cast<size_t>(0)));
+    if (it == set_it->second.end()) {
+      return m_global_blocks.end();
+    }
+    if (require_empty) {
+      // empty blocks have the most space available, so look from the top down.
+      for (auto rit = set_it->second.rbegin(); rit != ::std::make_reverse_iterator(it); ++rit) {
+        if (m_global_blocks[rit->second].empty()) {
+          return m_global_blocks.begin() + static_cast<ptrdiff_t>(rit->second);
+        }
+      }
+      return m_global_blocks.end();
+    }
+    return m_global_blocks.begin() + static_cast<ptrdiff_t>(it->second);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_index_global_block(size_t i)
+  {
+    auto &block = m_global_blocks[i];
+    auto &set = m_global_block_index[::std::make_pair(block.minimum_allocation_length(), block.maximum_allocation_length())];
+    m_global_block_index_locations[i] = ::std::make_pair(&set, set.emplace(block.max_alloc_available(), i).first);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_unindex_global_block(size_t i)
+  {
+    auto &location = m_global_block_index_locations[i];
+    location.first->erase(location.second);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_remove_global_block(size_t i)
+  {
+    _u_account_global_block_removed(m_global_blocks[i]);
+    _u_unindex_global_block(i);
+    const size_t last = m_global_blocks.size() - 1;
+    if (i != last) {
+      // move the last block into the hole.
+      _u_unindex_global_block(last);
+      m_global_blocks[i] = ::std::move(m_global_blocks[last]);
+      _u_move_registered_block(&m_global_blocks[last], &m_global_blocks[i]);
+      _u_index_global_block(i);
+    }
+    m_global_blocks.pop_back();
+    m_global_block_index_locations.pop_back();
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_account_global_block_added(allocator_block_type &block)
+  {
+    block.m_accounted_secondary_memory = block.secondary_memory_used();
+    memory_usage_counters_t::add(m_global_memory_usage.m_primary_bytes, block.memory_size());
+    memory_usage_counters_t::add(m_global_memory_usage.m_secondary_bytes, block.m_accounted_secondary_memory);
+    memory_usage_counters_t::add(m_global_memory_usage.m_live_bytes, block.m_live_bytes);
+    memory_usage_counters_t::add(m_global_memory_usage.m_live_objects, block.m_live_objects);
+  }
+  template <typename Allocator_Policy>
+  void allocator_t<Allocator_Policy>::_u_account_global_block_removed(const allocator_block_type &block)
+  {
+    memory_usage_counters_t::sub(m_global_memory_usage.m_primary_bytes, block.memory_size());
+    memory_usage_counters_t::sub(m_global_memory_usage.m_secondary_bytes, block.m_accounted_secondary_memory);
+    memory_usage_counters_t::sub(m_global_memory_usage.m_live_bytes, block.m_live_bytes);
+    memory_usage_counters_t::sub(m_global_memory_usage.m_live_objects, block.m_live_objects);
   }
   template <typename Allocator_Policy>
   void allocator_t<Allocator_Policy>::to_ptree(::boost::property_tree::ptree &ptree, int level) const
@@ -728,15 +1585,16 @@ namespace mcppalloc::sparse::details
     ptree.put("name", typeid(*this).name());
     {
       ::boost::property_tree::ptree slab;
-      slab.put("size", ::std::to_string(m_slab.size()));
+      slab.put("size", ::std::to_string(underlying_memory().size()));
       ptree.put_child("slab", slab);
     }
+    ptree.put("num_heap_segments", ::std::to_string(m_segments.size()));
     ptree.put("size", ::std::to_string(_u_size()));
     ptree.put("current_size", ::std::to_string(_u_current_size()));
     ptree.put("num_blocks", ::std::to_string(m_blocks.size()));
     ptree.put("num_global_blocks", ::std::to_string(m_global_blocks.size()));
     ptree.put("num_thread_allocators", ::std::to_string(m_thread_allocators.size()));
-    ptree.put("free_list_size", ::std::to_string(m_free_list.size()));
+    ptree.put("free_list_size", ::std::to_string(_ud_free_list().size()));
     ptree.put("initial_heap_size", ::std::to_string(m_initial_gc_heap_size));
     ptree.put("minimum_expansion_size", ::std::to_string(m_minimum_expansion_size));
     ptree.put("maximum_heap_size", ::std::to_string(max_heap_size()));
@@ -0,0 +1,173 @@
+#pragma once
+#include "allocator.hpp"
+#include <algorithm>
+#include <iostream>
+namespace mcppalloc::sparse
+{
+  /**
+   * \brief Region of objects that all die together.
+   *
+   * Allocation only bumps a pointer and objects have no object state header.
+   * Destroying a single object does nothing, reset() frees every object at once by restoring the bump pointer.
+   * Memory comes from the global allocator in chunks that are chained when the current one is full.
+   * Chunks are kept across resets and only given back by release() or destruction.
+   * An arena may only be used by one thread at a time.
+   **/
+  template <typename Allocator_Policy = default_allocator_policy_t<::std::allocator<void>>>
+  class arena_t
+  {
+  public:
+    using global_allocator = allocator_t<Allocator_Policy>;
+    using allocator = typename Allocator_Policy::internal_allocator_type;
+    using block_type = block_t<Allocator_Policy>;
+    /**
+     * \brief Default bytes requested from the global allocator per chunk.
+     **/
+    static constexpr const size_t cs_default_chunk_size = 1 << 16;
+    /**
+     * \brief Constructor.
+     * @param allocator Global allocator to get chunks from.
+     * @param chunk_size Bytes to request per chunk, larger allocations get a chunk of their own.
+     **/
+    explicit arena_t(global_allocator &allocator, size_t chunk_size = cs_default_chunk_size)
+        : m_allocator(allocator), m_chunk_size(mcpputil::align(chunk_size, mcpputil::c_alignment))
+    {
+    }
+    arena_t(const arena_t &) = delete;
+    arena_t(arena_t &&) = delete;
+    arena_t &operator=(const arena_t &) = delete;
+    arena_t &operator=(arena_t &&) = delete;
+    ~arena_t()
+    {
+      release();
+    }
+    /**
+     * \brief Allocate memory of size.
+     *
+     * Aborts on out of memory.
+     **/
+    auto allocate(size_t size) -> block_type
+    {
+      auto ret = try_allocate(size);
+      if (mcpputil_unlikely(!ret.m_ptr)) {
+        ::std::cerr << "mcppalloc: Arena out of memory, aborting 3f0f6a54-2b1e-4c86-9a0b-5d7e8e1c4a27\n" << ::std::endl;
+        ::std::terminate();
+      }
+      return ret;
+    }
+    /**
+     * \brief Allocate memory of size.
+     *
+     * @return Block with nullptr on out of memory.
+     **/
+    auto try_allocate(size_t size) -> block_type
+    {
+      // zero sized objects still get distinct memory.
+      size = mcpputil::align(::std::max(size, mcpputil::c_alignment), mcpputil::c_alignment);
+      if (mcpputil_likely(static_cast<size_t>(m_end - m_current) >= size)) {
+        auto ret = m_current;
+        m_current += size;
+        return block_type{ret, size};
+      }
+      return _allocate_slow(size);
+    }
+    /**
+     * \brief Destroy a single object.
+     *
+     * This does nothing, memory is reclaimed by reset().
+     **/
+    void destroy(void *) noexcept
+    {
+    }
+    /**
+     * \brief Free every object by restoring the bump pointer to the first chunk.
+     **/
+    void reset() noexcept
+    {
+      m_current_chunk = 0;
+      if (m_chunks.empty()) {
+        m_current = m_end = nullptr;
+        return;
+      }
+      m_current = m_chunks.front().begin();
+      m_end = m_chunks.front().end();
+    }
+    /**
+     * \brief Free every object and give all chunks back to the global allocator.
+     **/
+    void release()
+    {
+      for (auto &&chunk : m_chunks) {
+        m_allocator.release_memory(chunk);
+      }
+      m_chunks.clear();
+      reset();
+    }
+    /**
+     * \brief Return the number of chunks held.
+     **/
+    auto num_chunks() const noexcept -> size_t
+    {
+      return m_chunks.size();
+    }
+    /**
+     * \brief Return the bytes of memory held in chunks.
+     **/
+    auto memory_size() const noexcept -> size_t
+    {
+      size_t ret = 0;
+      for (auto &&chunk : m_chunks) {
+        ret += mcpputil::size(chunk);
+      }
+      return ret;
+    }
+
+  private:
+    /**
+     * \brief Move to the next chunk that fits size, chaining a new chunk if none does.
+     **/
+    auto _allocate_slow(size_t size) -> block_type
+    {
+      // chunks after the current one are left over from before a reset.
+      while (!m_chunks.empty() && m_current_chunk + 1 < m_chunks.size()) {
+        ++m_current_chunk;
+        auto &chunk = m_chunks[m_current_chunk];
+        if (mcpputil::size(chunk) >= size) {
+          m_current = chunk.begin() + size;
+          m_end = chunk.end();
+          return block_type{chunk.begin(), size};
+        }
+      }
+      auto chunk = m_allocator.get_memory(::std::max(size, m_chunk_size), true);
+      if (!chunk.begin()) {
+        return block_type{nullptr, 0};
+      }
+      m_chunks.push_back(chunk);
+      m_current_chunk = m_chunks.size() - 1;
+      m_current = chunk.begin() + size;
+      m_end = chunk.end();
+      return block_type{chunk.begin(), size};
+    }
+    global_allocator &m_allocator;
+    /**
+     * \brief Bytes requested per chunk.
+     **/
+    size_t m_chunk_size;
+    /**
+     * \brief Bump pointer.
+     **/
+    uint8_t *m_current = nullptr;
+    /**
+     * \brief End of the current chunk.
+     **/
+    uint8_t *m_end = nullptr;
+    /**
+     * \brief Index of the current chunk.
+     **/
+    size_t m_current_chunk = 0;
+    /**
+     * \brief Chunks in the order they are used.
+     **/
+    mcpputil::rebind_vector_t<mcpputil::system_memory_range_t, allocator> m_chunks;
+  };
+}
@@ -4,4 +4,21 @@ namespace mcppalloc::sparse::details
 {
   template <typename Allocator_Policy>
   class allocator_t;
+  /**
+   * \brief When pages of blocks taken on by thread allocators are faulted in.
+   **/
+  enum class prefault_mode_t : uint8_t {
+    /**
+     * \brief Default, pages fault in as objects are carved.
+     **/
+    none = 0,
+    /**
+     * \brief Pages are faulted in bulk as soon as a block is taken on.
+     **/
+    immediate = 1,
+    /**
+     * \brief Pages are faulted in bulk by the next maintenance of the thread allocator.
+     **/
+    deferred = 2
+  };
 }
@@ -0,0 +1,184 @@
+#pragma once
+#include "allocator.hpp"
+#include <atomic>
+#include <cstdint>
+#include <mcpputil/mcpputil/concurrency.hpp>
+#include <utility>
+namespace mcppalloc::sparse
+{
+  template <typename Allocator_Policy>
+  class epoch_participant_t;
+  /**
+   * \brief Epoch based reclamation for objects read by concurrent lock free data structures.
+   *
+   * Participants pin the current epoch while they may hold references and retire objects instead of destroying them.
+   * The global epoch only advances once every pinned participant has observed it.
+   * An object retired in epoch e can not be referenced once the global epoch reaches e + 2.
+   * At that point it is handed to the thread allocator that owns its block to destroy on its next allocation or maintenance.
+   * Objects in global blocks are destroyed right away.
+   **/
+  template <typename Allocator_Policy = default_allocator_policy_t<::std::allocator<void>>>
+  class epoch_reclaimer_t
+  {
+  public:
+    using global_allocator = allocator_t<Allocator_Policy>;
+    using participant_type = epoch_participant_t<Allocator_Policy>;
+    using allocator = typename Allocator_Policy::internal_allocator_type;
+    using object_state_type = typename global_allocator::allocator_block_type::object_state_type;
+    /**
+     * \brief Retired object and the epoch it was retired in.
+     **/
+    using retired_type = ::std::pair<void *, uint64_t>;
+    using retired_vector_type = mcpputil::rebind_vector_t<retired_type, allocator>;
+    /**
+     * \brief Default number of retired objects a participant holds before trying to reclaim.
+     **/
+    static constexpr const size_t cs_default_batch_size = 1024;
+    explicit epoch_reclaimer_t(global_allocator &allocator);
+    epoch_reclaimer_t(const epoch_reclaimer_t &) = delete;
+    epoch_reclaimer_t(epoch_reclaimer_t &&) = delete;
+    epoch_reclaimer_t &operator=(const epoch_reclaimer_t &) = delete;
+    epoch_reclaimer_t &operator=(epoch_reclaimer_t &&) = delete;
+    /**
+     * \brief Destructor.
+     *
+     * All participants must be destroyed first.
+     * Objects retired by them are reclaimed.
+     **/
+    ~epoch_reclaimer_t();
+    /**
+     * \brief Return the global epoch.
+     **/
+    auto epoch() const noexcept -> uint64_t;
+    /**
+     * \brief Advance the global epoch if every pinned participant has observed it.
+     * @return True if the epoch advanced.
+     **/
+    bool try_advance() REQUIRES(!m_mutex);
+    /**
+     * \brief Reclaim safe objects retired by participants that no longer exist.
+     * @return Number of objects reclaimed.
+     **/
+    auto reclaim_orphans() -> size_t REQUIRES(!m_mutex);
+    /**
+     * \brief Return the number of objects retired by participants that no longer exist and not yet reclaimed.
+     **/
+    auto num_orphans() const -> size_t REQUIRES(!m_mutex);
+    /**
+     * \brief Return the number of retired objects a participant holds before trying to reclaim.
+     **/
+    auto batch_size() const noexcept -> size_t;
+    /**
+     * \brief Set the number of retired objects a participant holds before trying to reclaim.
+     **/
+    void set_batch_size(size_t batch_size) noexcept;
+    /**
+     * \brief Return the allocator objects are retired to.
+     **/
+    auto global() noexcept -> global_allocator &;
+    /**
+     * \brief Register a participant.
+     **/
+    void _register(participant_type &participant) REQUIRES(!m_mutex);
+    /**
+     * \brief Unregister a participant and adopt its retired objects.
+     **/
+    void _unregister(participant_type &participant) REQUIRES(!m_mutex);
+    /**
+     * \brief Hand objects that are safe to reclaim to their owners and remove them from retired.
+     * @return Number of objects reclaimed.
+     **/
+    auto _reclaim_safe(retired_vector_type &retired) -> size_t;
+
+  private:
+    global_allocator &m_allocator;
+    ::std::atomic<uint64_t> m_epoch{0};
+    ::std::atomic<size_t> m_batch_size{cs_default_batch_size};
+    mutable mcpputil::mutex_t m_mutex;
+    mcpputil::rebind_vector_t<participant_type *, allocator> m_participants GUARDED_BY(m_mutex);
+    /**
+     * \brief Objects retired by participants that no longer exist.
+     **/
+    retired_vector_type m_orphans GUARDED_BY(m_mutex);
+  };
+  /**
+   * \brief Participant in epoch based reclamation.
+   *
+   * A participant may only be used by one thread at a time.
+   **/
+  template <typename Allocator_Policy = default_allocator_policy_t<::std::allocator<void>>>
+  class epoch_participant_t
+  {
+  public:
+    using reclaimer_type = epoch_reclaimer_t<Allocator_Policy>;
+    explicit epoch_participant_t(reclaimer_type &reclaimer);
+    epoch_participant_t(const epoch_participant_t &) = delete;
+    epoch_participant_t(epoch_participant_t &&) = delete;
+    epoch_participant_t &operator=(const epoch_participant_t &) = delete;
+    epoch_participant_t &operator=(epoch_participant_t &&) = delete;
+    ~epoch_participant_t();
+    /**
+     * \brief Pin the current epoch.
+     *
+     * Calls nest, only the outermost enter and exit pin and unpin.
+     **/
+    void enter() noexcept;
+    /**
+     * \brief Unpin the epoch.
+     **/
+    void exit() noexcept;
+    /**
+     * \brief Return true if the epoch is pinned.
+     **/
+    auto pinned() const noexcept -> bool;
+    /**
+     * \brief Retire an object that may still be referenced by pinned participants.
+     *
+     * The object must have been allocated by the reclaimer's allocator and must no longer be reachable for new references.
+     * Once enough objects are retired this tries to reclaim.
+     **/
+    void retire(void *v);
+    /**
+     * \brief Try to advance the epoch and reclaim objects retired by this participant that are safe.
+     * @return Number of objects reclaimed.
+     **/
+    auto reclaim() -> size_t;
+    /**
+     * \brief Return the number of retired objects not yet reclaimed.
+     **/
+    auto num_retired() const noexcept -> size_t;
+
+  private:
+    reclaimer_type &m_reclaimer;
+    /**
+     * \brief Epoch observed on the outermost enter.
+     **/
+    ::std::atomic<uint64_t> m_epoch{0};
+    ::std::atomic<bool> m_pinned{false};
+    size_t m_depth = 0;
+    typename reclaimer_type::retired_vector_type m_retired;
+    friend reclaimer_type;
+  };
+  /**
+   * \brief Pin the epoch of a participant for a scope.
+   **/
+  template <typename Allocator_Policy>
+  class epoch_guard_t
+  {
+  public:
+    explicit epoch_guard_t(epoch_participant_t<Allocator_Policy> &participant) noexcept : m_participant(participant)
+    {
+      m_participant.enter();
+    }
+    epoch_guard_t(const epoch_guard_t &) = delete;
+    epoch_guard_t &operator=(const epoch_guard_t &) = delete;
+    ~epoch_guard_t()
+    {
+      m_participant.exit();
+    }
+
+  private:
+    epoch_participant_t<Allocator_Policy> &m_participant;
+  };
+}
+#include "epoch_reclaimer_impl.hpp"
@@ -0,0 +1,166 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+namespace mcppalloc::sparse
+{
+  template <typename Allocator_Policy>
+  epoch_reclaimer_t<Allocator_Policy>::epoch_reclaimer_t(global_allocator &allocator) : m_allocator(allocator)
+  {
+  }
+  template <typename Allocator_Policy>
+  epoch_reclaimer_t<Allocator_Policy>::~epoch_reclaimer_t()
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    if (!m_participants.empty()) {
+      ::std::cerr << "mcppalloc: Epoch reclaimer destroyed with live participants 7d2e5b1a-96c4-4f0e-b3a8-1c6f0e9d4a52\n";
+      ::std::abort();
+    }
+    // nothing can be pinned, so everything is safe.
+    m_epoch.fetch_add(2, ::std::memory_order_seq_cst);
+    _reclaim_safe(m_orphans);
+  }
+  template <typename Allocator_Policy>
+  auto epoch_reclaimer_t<Allocator_Policy>::epoch() const noexcept -> uint64_t
+  {
+    return m_epoch.load(::std::memory_order_seq_cst);
+  }
+  template <typename Allocator_Policy>
+  bool epoch_reclaimer_t<Allocator_Policy>::try_advance()
+  {
+    uint64_t epoch = m_epoch.load(::std::memory_order_seq_cst);
+    {
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+      for (auto &&participant : m_participants) {
+        if (participant->m_pinned.load(::std::memory_order_seq_cst) &&
+            participant->m_epoch.load(::std::memory_order_seq_cst) != epoch) {
+          return false;
+        }
+      }
+    }
+    // another thread may have advanced already, which is just as good.
+    m_epoch.compare_exchange_strong(epoch, epoch + 1, ::std::memory_order_seq_cst);
+    return true;
+  }
+  template <typename Allocator_Policy>
+  auto epoch_reclaimer_t<Allocator_Policy>::reclaim_orphans() -> size_t
+  {
+    try_advance();
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    return _reclaim_safe(m_orphans);
+  }
+  template <typename Allocator_Policy>
+  auto epoch_reclaimer_t<Allocator_Policy>::num_orphans() const -> size_t
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    return m_orphans.size();
+  }
+  template <typename Allocator_Policy>
+  auto epoch_reclaimer_t<Allocator_Policy>::batch_size() const noexcept -> size_t
+  {
+    return m_batch_size.load(::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  void epoch_reclaimer_t<Allocator_Policy>::set_batch_size(size_t batch_size) noexcept
+  {
+    m_batch_size.store(batch_size, ::std::memory_order_relaxed);
+  }
+  template <typename Allocator_Policy>
+  auto epoch_reclaimer_t<Allocator_Policy>::global() noexcept -> global_allocator &
+  {
+    return m_allocator;
+  }
+  template <typename Allocator_Policy>
+  void epoch_reclaimer_t<Allocator_Policy>::_register(participant_type &participant)
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    m_participants.push_back(&participant);
+  }
+  template <typename Allocator_Policy>
+  void epoch_reclaimer_t<Allocator_Policy>::_unregister(participant_type &participant)
+  {
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_mutex);
+    auto it = ::std::find(m_participants.begin(), m_participants.end(), &participant);
+    if (it != m_participants.end()) {
+      m_participants.erase(it);
+    }
+    m_orphans.insert(m_orphans.end(), participant.m_retired.begin(), participant.m_retired.end());
+    participant.m_retired.clear();
+  }
+  template <typename Allocator_Policy>
+  auto epoch_reclaimer_t<Allocator_Policy>::_reclaim_safe(retired_vector_type &retired) -> size_t
+  {
+    const uint64_t epoch = m_epoch.load(::std::memory_order_seq_cst);
+    // orphans from several participants are not in epoch order, so partition rather than look for a prefix.
+    auto end = ::std::partition(retired.begin(), retired.end(), [epoch](auto &&r) { return r.second + 2 <= epoch; });
+    if (end == retired.begin()) {
+      return 0;
+    }
+    {
+      // object headers in blocks owned by other threads are only written by those threads.
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_allocator._mutex());
+      for (auto it = retired.begin(); it != end; ++it) {
+        m_allocator._u_destroy_remote(it->first);
+      }
+    }
+    const auto ret = static_cast<size_t>(end - retired.begin());
+    retired.erase(retired.begin(), end);
+    return ret;
+  }
+  template <typename Allocator_Policy>
+  epoch_participant_t<Allocator_Policy>::epoch_participant_t(reclaimer_type &reclaimer) : m_reclaimer(reclaimer)
+  {
+    m_reclaimer._register(*this);
+  }
+  template <typename Allocator_Policy>
+  epoch_participant_t<Allocator_Policy>::~epoch_participant_t()
+  {
+    assert(!m_depth);
+    reclaim();
+    m_reclaimer._unregister(*this);
+  }
+  template <typename Allocator_Policy>
+  void epoch_participant_t<Allocator_Policy>::enter() noexcept
+  {
+    if (m_depth++) {
+      return;
+    }
+    m_pinned.store(true, ::std::memory_order_seq_cst);
+    m_epoch.store(m_reclaimer.epoch(), ::std::memory_order_seq_cst);
+  }
+  template <typename Allocator_Policy>
+  void epoch_participant_t<Allocator_Policy>::exit() noexcept
+  {
+    assert(m_depth);
+    if (--m_depth) {
+      return;
+    }
+    m_pinned.store(false, ::std::memory_order_seq_cst);
+  }
+  template <typename Allocator_Policy>
+  auto epoch_participant_t<Allocator_Policy>::pinned() const noexcept -> bool
+  {
+    return m_depth > 0;
+  }
+  template <typename Allocator_Policy>
+  void epoch_participant_t<Allocator_Policy>::retire(void *v)
+  {
+    m_retired.emplace_back(v, m_reclaimer.epoch());
+    if (mcpputil_unlikely(m_retired.size() >= m_reclaimer.batch_size())) {
+      reclaim();
+    }
+  }
+  template <typename Allocator_Policy>
+  auto epoch_participant_t<Allocator_Policy>::reclaim() -> size_t
+  {
+    // two advances are needed before the newest retirements are safe.
+    m_reclaimer.try_advance();
+    m_reclaimer.try_advance();
+    return m_reclaimer._reclaim_safe(m_retired);
+  }
+  template <typename Allocator_Policy>
+  auto epoch_participant_t<Allocator_Policy>::num_retired() const noexcept -> size_t
+  {
+    return m_retired.size();
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "allocator.hpp"
+namespace mcppalloc::sparse
+{
+  /**
+   * \brief Heap of objects that can be freed individually or dropped together.
+   *
+   * A heap has its own isolated block sets, so its objects never share blocks with other heaps or threads.
+   * This isolates fragmentation and lets destroy() give every block back without visiting objects.
+   * A heap may only be used by one thread at a time.
+   * Objects that are live when the heap is destructed are handed to the global allocator like those of an exiting thread.
+   **/
+  template <typename Allocator_Policy = default_allocator_policy_t<::std::allocator<void>>>
+  class heap_t
+  {
+  public:
+    using global_allocator = allocator_t<Allocator_Policy>;
+    using thread_allocator_type = typename global_allocator::thread_allocator_type;
+    using block_type = typename thread_allocator_type::block_type;
+    explicit heap_t(global_allocator &allocator) : m_thread_allocator(allocator)
+    {
+      m_thread_allocator.set_isolated(true);
+    }
+    heap_t(const heap_t &) = delete;
+    heap_t(heap_t &&) = delete;
+    heap_t &operator=(const heap_t &) = delete;
+    heap_t &operator=(heap_t &&) = delete;
+    /**
+     * \brief Allocate memory of size from this heap.
+     **/
+    auto allocate(size_t size) -> block_type
+    {
+      return m_thread_allocator.allocate(size);
+    }
+    /**
+     * \brief Allocate memory of size from this heap.
+     *
+     * @return Block with nullptr on out of memory.
+     **/
+    auto try_allocate(size_t size) -> block_type
+    {
+      return m_thread_allocator.try_allocate(size);
+    }
+    /**
+     * \brief Destroy a single object allocated from this heap.
+     *
+     * @return True on success, false if this heap did not allocate the object.
+     **/
+    bool destroy(void *v)
+    {
+      return m_thread_allocator.destroy(v);
+    }
+    /**
+     * \brief Destroy every object allocated from this heap.
+     *
+     * Cost is proportional to the number of blocks, not objects.
+     * The heap can be used again afterwards.
+     **/
+    void destroy()
+    {
+      m_thread_allocator.destroy_all();
+    }
+    /**
+     * \brief Return the memory usage of this heap.
+     **/
+    auto memory_usage() const noexcept -> memory_usage_t
+    {
+      return m_thread_allocator.memory_usage();
+    }
+    /**
+     * \brief Return the thread allocator that owns the blocks of this heap.
+     **/
+    auto thread_allocator() noexcept -> thread_allocator_type &
+    {
+      return m_thread_allocator;
+    }
+
+  private:
+    thread_allocator_type m_thread_allocator;
+  };
+}
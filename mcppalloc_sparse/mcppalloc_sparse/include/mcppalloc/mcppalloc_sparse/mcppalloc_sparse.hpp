@@ -1 +1,4 @@
 #include "allocator.hpp"
+#include "arena.hpp"
+#include "epoch_reclaimer.hpp"
+#include "heap.hpp"
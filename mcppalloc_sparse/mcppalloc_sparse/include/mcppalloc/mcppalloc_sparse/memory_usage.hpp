@@ -0,0 +1,111 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+namespace mcppalloc::sparse
+{
+  /**
+   * \brief Memory usage of a sparse allocator or one of its size bins.
+   **/
+  struct memory_usage_t {
+    /**
+     * \brief Bytes of memory in blocks.
+     **/
+    size_t m_primary_bytes = 0;
+    /**
+     * \brief Bytes of control structures such as free lists and block vectors.
+     **/
+    size_t m_secondary_bytes = 0;
+    /**
+     * \brief Bytes in live objects not counting their headers.
+     *
+     * Quasi freed objects are live until collected.
+     **/
+    size_t m_live_bytes = 0;
+    /**
+     * \brief Number of live objects.
+     **/
+    size_t m_live_objects = 0;
+    /**
+     * \brief Bytes of primary memory not used by live objects or their headers.
+     **/
+    size_t m_free_bytes = 0;
+    auto operator+=(const memory_usage_t &rhs) noexcept -> memory_usage_t &
+    {
+      m_primary_bytes += rhs.m_primary_bytes;
+      m_secondary_bytes += rhs.m_secondary_bytes;
+      m_live_bytes += rhs.m_live_bytes;
+      m_live_objects += rhs.m_live_objects;
+      m_free_bytes += rhs.m_free_bytes;
+      return *this;
+    }
+  };
+  /**
+   * \brief Memory usage of a sparse allocator by size bin.
+   * @tparam Bins Number of size bins.
+   **/
+  template <size_t Bins>
+  struct memory_usage_stats_t {
+    static constexpr const size_t cs_num_bins = Bins;
+    /**
+     * \brief Usage of thread owned blocks by size bin.
+     **/
+    ::std::array<memory_usage_t, Bins> m_bins{};
+    /**
+     * \brief Usage of globally owned blocks.
+     **/
+    memory_usage_t m_global;
+    /**
+     * \brief Return usage summed over all bins and global blocks.
+     **/
+    auto totals() const noexcept -> memory_usage_t
+    {
+      memory_usage_t ret = m_global;
+      for (auto &&bin : m_bins) {
+        ret += bin;
+      }
+      return ret;
+    }
+  };
+  namespace details
+  {
+    /**
+     * \brief Running memory usage counters for a size bin.
+     *
+     * These have a single writer, so updates are a relaxed load and store rather than a locked read modify write.
+     * Readers on other threads may see slightly stale values but never torn ones.
+     **/
+    class memory_usage_counters_t
+    {
+    public:
+      static void add(::std::atomic<size_t> &counter, size_t n) noexcept
+      {
+        counter.store(counter.load(::std::memory_order_relaxed) + n, ::std::memory_order_relaxed);
+      }
+      static void sub(::std::atomic<size_t> &counter, size_t n) noexcept
+      {
+        counter.store(counter.load(::std::memory_order_relaxed) - n, ::std::memory_order_relaxed);
+      }
+      /**
+       * \brief Return a snapshot of the counters.
+       * @param header_size Bytes of header per object.
+       **/
+      auto snapshot(size_t header_size) const noexcept -> memory_usage_t
+      {
+        memory_usage_t ret;
+        ret.m_primary_bytes = m_primary_bytes.load(::std::memory_order_relaxed);
+        ret.m_secondary_bytes = m_secondary_bytes.load(::std::memory_order_relaxed);
+        ret.m_live_bytes = m_live_bytes.load(::std::memory_order_relaxed);
+        ret.m_live_objects = m_live_objects.load(::std::memory_order_relaxed);
+        const size_t used = ret.m_live_bytes + ret.m_live_objects * header_size;
+        // stale reads may briefly disagree, never report a wrapped value.
+        ret.m_free_bytes = ret.m_primary_bytes > used ? ret.m_primary_bytes - used : 0;
+        return ret;
+      }
+      ::std::atomic<size_t> m_primary_bytes{0};
+      ::std::atomic<size_t> m_secondary_bytes{0};
+      ::std::atomic<size_t> m_live_bytes{0};
+      ::std::atomic<size_t> m_live_objects{0};
+    };
+  }
+}
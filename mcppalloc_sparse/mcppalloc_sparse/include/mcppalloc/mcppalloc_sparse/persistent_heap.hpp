@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+namespace mcppalloc::sparse::details
+{
+  /**
+   * \brief Record of an allocator block in a persistent heap.
+   *
+   * Blocks keep no header in heap memory, so this is what is needed to construct them again.
+   **/
+  struct persistent_block_record_t {
+    /**
+     * \brief Offset of the block from the start of the heap.
+     **/
+    uint64_t m_offset;
+    /**
+     * \brief Length of the block.
+     **/
+    uint64_t m_length;
+    /**
+     * \brief Minimum and maximum allocation lengths the block was constructed with.
+     **/
+    uint64_t m_minimum_alloc_length;
+    uint64_t m_maximum_alloc_length;
+  };
+  /**
+   * \brief Header at the start of a file backing a persistent heap.
+   *
+   * The heap follows the header in the file and is always mapped at the address it was created at.
+   * This is so that pointers stored in objects are still valid after the heap is reattached.
+   **/
+  struct persistent_heap_header_t {
+    /**
+     * \brief Bytes of file before the heap.
+     **/
+    static constexpr const size_t cs_size = 1 << 20;
+    static constexpr const uint64_t cs_magic = 0x6d6370707370686dull;
+    static constexpr const uint64_t cs_version = 1;
+    /**
+     * \brief Maximum number of blocks that may be recorded.
+     **/
+    static constexpr const size_t cs_max_blocks = (cs_size - 64) / sizeof(persistent_block_record_t);
+    uint64_t m_magic;
+    uint64_t m_version;
+    /**
+     * \brief Address the heap is mapped at.
+     **/
+    uint64_t m_heap_address;
+    uint64_t m_heap_size;
+    uint64_t m_num_blocks;
+    /**
+     * \brief Address of the object the heap is reached from, 0 for none.
+     **/
+    uint64_t m_root;
+    uint64_t m_padding[2];
+    /**
+     * \brief Blocks in the heap, unordered.
+     **/
+    ::std::array<persistent_block_record_t, cs_max_blocks> m_blocks;
+  };
+  static_assert(sizeof(persistent_heap_header_t) <= persistent_heap_header_t::cs_size, "Persistent heap header too large");
+}
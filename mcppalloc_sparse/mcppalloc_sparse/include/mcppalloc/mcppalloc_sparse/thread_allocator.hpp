@@ -1,9 +1,14 @@
 #pragma once
 #include "allocator_block_set.hpp"
+#include "declarations.hpp"
 #include "thread_allocator_abs_data.hpp"
 #include <array>
 #include <boost/property_tree/ptree_fwd.hpp>
+#include <mcppalloc/allocation_stats.hpp>
+#include <mcppalloc/allocator_policy_traits.hpp>
+#include <mcppalloc/memory_pressure.hpp>
 #include <mcppalloc/object_state.hpp>
+#include <mcppalloc/slow_path_monitor.hpp>
 #include <mcpputil/mcpputil/concurrency.hpp>
 #include <mcpputil/mcpputil/memory_range.hpp>
 namespace mcppalloc::sparse::details
@@ -50,6 +55,34 @@ namespace mcppalloc::sparse::details
      * \brief Number of allocator size bins.
      **/
     static constexpr const size_t c_bins = 18;
+    /**
+     * \brief Type of allocation counters for this thread allocator.
+     **/
+    using counters_type = ::mcppalloc::details::thread_allocation_counters_t<c_bins>;
+    /**
+     * \brief Type of allocation statistics snapshot.
+     **/
+    using stats_type = typename counters_type::stats_type;
+    /**
+     * \brief Type of memory usage by size bin.
+     **/
+    using memory_usage_stats_type = memory_usage_stats_t<c_bins>;
+    /**
+     * \brief Allocator block sets for each size bin.
+     **/
+    using block_set_family_type = ::std::array<this_allocator_block_set_t, c_bins>;
+    /**
+     * \brief True if allocations are tagged.
+     **/
+    static constexpr const bool cs_uses_allocation_tags = uses_allocation_tags_v<allocator_policy_type>;
+    /**
+     * \brief Bytes a tag may change locally before the change is flushed to the global allocator.
+     **/
+    static constexpr const int64_t cs_tag_flush_bytes = 1 << 16;
+    /**
+     * \brief Most times the thread policy is asked what to do about one failed allocation before it fails.
+     **/
+    static constexpr const size_t cs_max_allocation_attempts = 16;
     /**
      * \brief Constructor.
      * @param allocator Global allocator for slabs.
@@ -81,9 +114,10 @@ namespace mcppalloc::sparse::details
      **/
     size_t get_allocator_block_size(size_t id) const noexcept;
     /**
-     * \brief Return a reference to the allocator block set for a given size.
+     * \brief Return a reference to the allocator block set for a given size and lifetime.
      **/
-    this_allocator_block_set_t &allocator_by_size(size_t sz) noexcept;
+    this_allocator_block_set_t &allocator_by_size(size_t sz,
+                                                  allocation_lifetime_t lifetime = allocation_lifetime_t::short_lived) noexcept;
     /**
      * \brief Return an array of block sizes for all of the bins.
      **/
@@ -91,13 +125,75 @@ namespace mcppalloc::sparse::details
     /**
      * \brief Allocate memory of size.
      *
+     * @param tag Allocation tag, ignored unless the allocator policy uses allocation tags.
+     * @param lifetime Lifetime hint, allocations with different hints never share a block.
      * @return nullptr on error.
      **/
-    auto allocate(size_t size) -> block_type;
+    auto allocate(size_t size, allocation_tag_t tag = 0, allocation_lifetime_t lifetime = allocation_lifetime_t::short_lived)
+        -> block_type;
+    /**
+     * \brief Allocate memory of size with a lifetime hint.
+     **/
+    auto allocate(size_t size, allocation_lifetime_t lifetime) -> block_type;
     /**
      * \brief Allocate memory of size.
      **/
-    auto allocate_detailed(size_t size) -> allocation_return_type;
+    auto allocate_detailed(size_t size, allocation_tag_t tag = 0,
+                           allocation_lifetime_t lifetime = allocation_lifetime_t::short_lived) -> allocation_return_type;
+    /**
+     * \brief Attempt to allocate memory of size without aborting on out of memory.
+     *
+     * Before giving up this reclaims memory if the thread policy asks and then releases the emergency reserve.
+     * The thread policy is asked at most cs_max_allocation_attempts times.
+     * This also fails if the tag is over its hard quota.
+     * @return Block with nullptr on out of memory.
+     **/
+    auto try_allocate(size_t size, allocation_tag_t tag = 0, allocation_lifetime_t lifetime = allocation_lifetime_t::short_lived)
+        -> block_type;
+    /**
+     * \brief Attempt to allocate memory of size with a lifetime hint without aborting on out of memory.
+     **/
+    auto try_allocate(size_t size, allocation_lifetime_t lifetime) -> block_type;
+    /**
+     * \brief Attempt to allocate memory of size without aborting on out of memory.
+     *
+     * @return Allocation that is not valid on out of memory.
+     **/
+    auto try_allocate_detailed(size_t size, allocation_tag_t tag = 0,
+                               allocation_lifetime_t lifetime = allocation_lifetime_t::short_lived) -> allocation_return_type;
+    /**
+     * \brief Allocate memory of size close to another object.
+     *
+     * The object is placed in the block containing hint or the next block by address in the bin for size if either has room.
+     * Otherwise this falls back to normal placement.
+     * Objects traversed together that are allocated near each other share cache lines and pages.
+     * @param hint Address to allocate near, usually an object allocated by this thread allocator.
+     * @param tag Allocation tag, ignored unless the allocator policy uses allocation tags.
+     **/
+    auto allocate_near(const void *hint, size_t size, allocation_tag_t tag = 0,
+                       allocation_lifetime_t lifetime = allocation_lifetime_t::short_lived) -> block_type;
+    /**
+     * \brief Allocate memory of size close to another object with a lifetime hint.
+     **/
+    auto allocate_near(const void *hint, size_t size, allocation_lifetime_t lifetime) -> block_type;
+    /**
+     * \brief Allocate memory of size close to another object without aborting on out of memory.
+     *
+     * This also fails if the tag is over its hard quota.
+     * @return Block with nullptr on out of memory.
+     **/
+    auto try_allocate_near(const void *hint, size_t size, allocation_tag_t tag = 0,
+                           allocation_lifetime_t lifetime = allocation_lifetime_t::short_lived) -> block_type;
+    /**
+     * \brief Attempt to allocate memory of size close to another object with a lifetime hint.
+     **/
+    auto try_allocate_near(const void *hint, size_t size, allocation_lifetime_t lifetime) -> block_type;
+    /**
+     * \brief Return the bytes live in a tag as seen by this thread allocator.
+     *
+     * This is the global count plus changes of this thread allocator not yet flushed.
+     **/
+    auto tag_live_bytes(allocation_tag_t tag) const noexcept -> size_t;
     /**
      * \brief Attempt to allocate once.
      *
@@ -111,6 +207,13 @@ namespace mcppalloc::sparse::details
      * @return True on success, false on failure.
      **/
     bool destroy(void *v);
+    /**
+     * \brief Destroy every object allocated by this allocator at once.
+     *
+     * All blocks are released to the global allocator under a single lock without visiting objects.
+     * User data of objects is not destroyed and on_deallocation is not called for them.
+     **/
+    void destroy_all();
     /**
      * \brief Deallocate a pointer allocated by this allocator.
      *
@@ -123,9 +226,9 @@ namespace mcppalloc::sparse::details
      **/
     auto allocator_multiples() const -> const ::std::array<thread_allocator_abs_data_t, c_bins> &;
     /**
-     * \brief Return the array of allocators for debugging purposes.
+     * \brief Return the array of allocators of a lifetime for debugging purposes.
      **/
-    auto allocators() const -> const ::std::array<this_allocator_block_set_t, c_bins> &;
+    auto allocators(allocation_lifetime_t lifetime = allocation_lifetime_t::short_lived) const -> const block_set_family_type &;
     /**
      * \brief Free all empty blocks back to allocator.
      *
@@ -153,12 +256,96 @@ namespace mcppalloc::sparse::details
      * \brief Force a destruction of empty blocks.
      **/
     void set_force_free_empty_blocks() noexcept;
+    /**
+     * \brief Keep objects of this thread allocator in blocks that hold no other objects.
+     *
+     * Only empty global blocks are reused and no blocks are donated, so destroy_all() never drops foreign objects.
+     **/
+    void set_isolated(bool isolated) noexcept;
+    /**
+     * \brief Return true if this thread allocator only uses blocks of its own.
+     **/
+    auto isolated() const noexcept -> bool;
+    /**
+     * \brief Set the memory pressure this thread allocator responds to.
+     *
+     * This may be called from any thread.
+     * Under pressure no empty blocks are kept locally and the destroy threshold is lowered, critical pressure drops it to zero.
+     **/
+    void set_memory_pressure(memory_pressure_level_t level) noexcept;
+    /**
+     * \brief Return the memory pressure this thread allocator responds to.
+     **/
+    auto memory_pressure() const noexcept -> memory_pressure_level_t;
+    /**
+     * \brief Reclaim memory after an allocation failure.
+     *
+     * Frees empty blocks of this thread and then reclaims memory in the global allocator.
+     **/
+    void reclaim_memory();
     /**
      * \brief Do maintance on thread associated blocks.
      *
-     * This incldues coalescing, etc.
+     * This incldues coalescing, donating surplus blocks, etc.
      **/
     void _do_maintenance();
+    /**
+     * \brief Donate surplus blocks to bins other thread allocators are requesting.
+     *
+     * Empty blocks other than the block currently being allocated from are donated.
+     * Donated blocks become global blocks that the requesting thread allocators pick up instead of expanding the heap.
+     **/
+    void donate_surplus_blocks();
+    /**
+     * \brief Pre-fault blocks queued by the deferred pre-fault mode.
+     *
+     * This is part of maintenance and may also be called directly when the thread is idle.
+     **/
+    void prefault_pending_blocks();
+    /**
+     * \brief Destroy objects queued by other threads.
+     *
+     * This is part of allocation and maintenance and may also be called directly.
+     * Objects whose block has left this thread allocator since they were queued are routed again.
+     **/
+    void destroy_queued();
+    /**
+     * \brief Queue an object in a block owned by this thread allocator for this thread to destroy.
+     *
+     * Requires holding the global allocator lock.
+     **/
+    void _u_queue_destroy(void *v);
+    /**
+     * \brief Drop the state of the exiting thread before this thread allocator is parked for another thread.
+     *
+     * Drains queued destroys, cancels block requests, flushes tag byte counts, and clears reserves and no slow path sections.
+     * Objects queued while parked are destroyed by the adopting thread.
+     **/
+    void _on_park();
+    /**
+     * \brief Make sure a bin can take n objects of size without getting blocks from the global allocator.
+     *
+     * Blocks are added until there is room and the blocks of the bin are reserved.
+     * Reserved blocks are kept when empty, even under memory pressure, and are not donated to other threads.
+     * This takes the slow paths it reserves against, so call it before a latency critical section.
+     * @return False if the heap ran out of memory.
+     **/
+    bool reserve(size_t size, size_t n, allocation_lifetime_t lifetime = allocation_lifetime_t::short_lived);
+    /**
+     * \brief Start a section in which this thread allocator should not take slow paths.
+     *
+     * Freeing empty blocks triggered by deallocation is put off until after the section.
+     * Other slow paths, such as adding a block or maintenance, are counted or abort depending on action.
+     **/
+    void begin_no_slow_path(slow_path_action_t action = slow_path_action_t::count) noexcept;
+    /**
+     * \brief End a section started by begin_no_slow_path().
+     **/
+    void end_no_slow_path() noexcept;
+    /**
+     * \brief Return the number of slow paths taken inside no slow path sections.
+     **/
+    auto num_slow_path_events() const noexcept -> uint64_t;
     /**
      * \brief Return the bytes of primary memory used.
      **/
@@ -171,6 +358,21 @@ namespace mcppalloc::sparse::details
      * \brief Return the bytes of secondary memory used.
      **/
     auto secondary_memory_used_self() const noexcept -> size_type;
+    /**
+     * \brief Return the memory usage of a size bin.
+     *
+     * This is constant time and may be called from any thread while this thread allocator is alive.
+     * @param id Bin id.
+     **/
+    auto memory_usage(size_t id) const noexcept -> memory_usage_t;
+    /**
+     * \brief Add the memory usage of each size bin to stats.
+     **/
+    void add_memory_usage_to(memory_usage_stats_type &stats) const noexcept;
+    /**
+     * \brief Return the memory usage summed over all size bins.
+     **/
+    auto memory_usage() const noexcept -> memory_usage_t;
     /**
      * \brief Shrink secondary data structures to fit.
      **/
@@ -180,6 +382,13 @@ namespace mcppalloc::sparse::details
      **/
     void shrink_secondary_memory_usage_to_fit_self();
 
+    /**
+     * \brief Return allocation counters for this thread allocator.
+     *
+     * These may be read from any thread.
+     **/
+    auto counters() const noexcept -> const counters_type &;
+
     /**
      * \brief Put information about thread allocator into a property tree.
      * @param level Level of information to give.  Higher is more verbose.
@@ -207,18 +416,68 @@ namespace mcppalloc::sparse::details
      * \brief Execute free empty blocks.
      **/
     void _do_free_empty_blocks();
+    /**
+     * \brief Return destroy threshold adjusted for memory pressure.
+     **/
+    auto _effective_destroy_threshold() const noexcept -> destroy_threshold_type;
+    /**
+     * \brief Return minimum number of local blocks adjusted for memory pressure.
+     **/
+    auto _effective_minimum_local_blocks() const noexcept -> uint16_t;
+    /**
+     * \brief Check the quotas of a tag before an allocation of size.
+     *
+     * @return False if the tag is over its hard quota.
+     **/
+    bool _check_tag_quota(allocation_tag_t tag, size_t size);
+    /**
+     * \brief Attempt to allocate memory of size, near hint if it is not nullptr.
+     **/
+    auto _try_allocate_detailed(size_t size, allocation_tag_t tag, allocation_lifetime_t lifetime, const void *hint)
+        -> allocation_return_type;
+    /**
+     * \brief Account for a successful allocation.
+     **/
+    void _on_allocation(size_t id, allocation_return_type &ret, allocation_tag_t tag);
+    /**
+     * \brief Add to the bytes live in a tag, flushing to the global allocator if the local change is large.
+     **/
+    void _add_tag_live_bytes(allocation_tag_t tag, int64_t delta) noexcept;
     /**
      * \brief Attempt to add an allocator block with a given id.
+     * @param family Allocators to add the block to.
      * @param id Id to try to add.
      * @param sz Request size.
      * @param try_expand Attempt to expand underlying slab if necessary
      * @return True on success, false on failure.
      **/
-    bool _add_allocator_block(size_t id, size_t sz, bool try_expand);
+    bool _add_allocator_block(block_set_family_type &family, size_t id, size_t sz, bool try_expand);
+    /**
+     * \brief Pre-fault or queue the block just added for a bin according to the pre-fault mode.
+     **/
+    void _on_block_added(size_t id, allocation_lifetime_t lifetime);
+    /**
+     * \brief Fault in the pages of the part of a block objects have not been carved from yet.
+     **/
+    void _prefault_block(const this_block_type &block, size_t id);
     /**
-     * \brief Allocators used to allocate various sizes of memory.
+     * \brief Return the number of objects taking needed bytes including object state that fit in the free space of a bin.
      **/
-    ::std::array<this_allocator_block_set_t, c_bins> m_allocators;
+    auto _reserve_capacity(const this_allocator_block_set_t &abs, size_t needed) const -> size_t;
+    /**
+     * \brief Block queued to be pre-faulted, found again by its start since blocks move within their set.
+     **/
+    struct pending_prefault_t {
+      uint8_t *m_begin;
+      size_t m_id;
+      allocation_lifetime_t m_lifetime;
+    };
+    /**
+     * \brief Allocators used to allocate various sizes of memory, one family per lifetime hint.
+     *
+     * Keeping lifetimes apart lets blocks of short lived objects become empty and be freed.
+     **/
+    ::std::array<block_set_family_type, c_num_allocation_lifetimes> m_allocators;
     /**
      * \brief Global allocator used for getting slabs.
      **/
@@ -244,6 +503,52 @@ namespace mcppalloc::sparse::details
      * This sets the minimum number of blocks left after returning memory to global.
     **/
     uint16_t m_minimum_local_blocks = 2;
+    /**
+     * \brief Memory pressure set by the global allocator.
+     *
+     * Configured values are kept so that they apply again once pressure ends.
+     **/
+    ::std::atomic<memory_pressure_level_t> m_memory_pressure{memory_pressure_level_t::none};
+    /**
+     * \brief Outstanding block requests made by this thread allocator by bin.
+     *
+     * If this thread allocator later has surplus blocks in a bin, it cancels its own requests rather than donating.
+     **/
+    ::std::array<size_t, c_bins> m_block_requests{};
+    /**
+     * \brief Number of blocks kept by reserve() by lifetime and bin.
+     **/
+    ::std::array<::std::array<size_t, c_bins>, c_num_allocation_lifetimes> m_reserved_blocks{};
+    /**
+     * \brief True if blocks are never shared with other thread allocators, see set_isolated().
+     **/
+    bool m_isolated{false};
+    /**
+     * \brief Blocks queued by the deferred pre-fault mode.
+     **/
+    mcpputil::rebind_vector_t<pending_prefault_t, allocator> m_pending_prefaults;
+    /**
+     * \brief Slow paths taken inside no slow path sections.
+     **/
+    ::mcppalloc::details::slow_path_monitor_t m_slow_path_monitor;
+    /**
+     * \brief Objects queued by other threads for this thread to destroy.
+     *
+     * Guarded by the global allocator lock.
+     **/
+    mcpputil::rebind_vector_t<void *, allocator> m_queued_destroys;
+    /**
+     * \brief True if objects may be queued, read without the lock.
+     **/
+    ::std::atomic<bool> m_has_queued_destroys{false};
+    /**
+     * \brief Allocation counters.
+     **/
+    counters_type m_counters;
+    /**
+     * \brief Changes to bytes live by tag not yet flushed to the global allocator.
+     **/
+    ::std::array<int64_t, c_num_allocation_tags> m_tag_live_bytes_delta{};
   };
   /**
    * \brief Stream output for debugging.
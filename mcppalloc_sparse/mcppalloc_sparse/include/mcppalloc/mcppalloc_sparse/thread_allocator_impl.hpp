@@ -1,8 +1,12 @@
 
 #pragma once
 #include "functor.hpp"
+#include <array>
 #include <mcpputil/mcpputil/boost/property_tree/json_parser.hpp>
 #include <mcpputil/mcpputil/boost/property_tree/ptree.hpp>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 namespace mcppalloc::sparse::details
 {
@@ -11,41 +15,71 @@ namespace mcppalloc::sparse::details
       : m_allocator(allocator)
   {
     fill_multiples_with_default_values();
+    m_allocator._counters_registry().register_counters(m_counters);
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
   thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::~thread_allocator_t()
   {
+    destroy_queued();
     // set minimum local blocks to 0 so all free blooks go to global.
     set_minimum_local_blocks(0);
+    m_reserved_blocks = {};
     // debug mode verify.
-    for (auto &abs : m_allocators) {
-      sparse_allocator_block_set_verifier_t::verify_all(abs);
+    for (auto &family : m_allocators) {
+      for (auto &abs : family) {
+        sparse_allocator_block_set_verifier_t::verify_all(abs);
+      }
     }
     m_allocator._d_verify();
     // free empty blocks.
     free_empty_blocks(0, true);
     // blocks left need to be moved to global.
-    for (auto &abs : m_allocators) {
-      for (auto &&block : abs.m_blocks) {
-        if (block.valid()) {
-          assert(!block.empty());
-          m_allocator.to_global_allocator_block(std::move(block));
+    for (auto &family : m_allocators) {
+      for (auto &abs : family) {
+        for (auto &&block : abs.m_blocks) {
+          if (block.valid()) {
+            assert(!block.empty());
+            m_allocator.to_global_allocator_block(std::move(block));
+          }
         }
       }
     }
+    {
+      // objects queued since are in blocks that are now global.
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_allocator._mutex());
+      for (auto &&v : m_queued_destroys) {
+        m_allocator._u_destroy_remote(v);
+      }
+      m_queued_destroys.clear();
+    }
+    m_allocator._counters_registry().unregister_counters(m_counters);
+    for (size_t tag = 0; tag < c_num_allocation_tags; ++tag) {
+      if (m_tag_live_bytes_delta[tag]) {
+        m_allocator._add_tag_live_bytes(static_cast<allocation_tag_t>(tag), m_tag_live_bytes_delta[tag]);
+      }
+    }
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
   void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::free_empty_blocks(size_t min_to_leave, bool force)
   {
+    m_slow_path_monitor.on_slow_path("free empty blocks");
     m_allocator._d_verify();
-    for (auto &abs : m_allocators) {
-      // if num destroyed > threshold, try to free blocks.
-      if (force || abs.num_destroyed_since_last_free() > destroy_threshold()) {
+    for (auto &family : m_allocators) {
+      const auto &reserved = m_reserved_blocks[static_cast<size_t>(&family - m_allocators.data())];
+      for (auto &abs : family) {
+        const size_t id = static_cast<size_t>(&abs - family.data());
+        // if num destroyed > threshold, try to free blocks.
+        if (!force && abs.num_destroyed_since_last_free() <= destroy_threshold()) {
+          continue;
+        }
         abs.free_empty_blocks(
-            [this](typename this_allocator_block_set_t::allocator_block_type &&block) {
+            [this, id](typename this_allocator_block_set_t::allocator_block_type &&block) {
+              m_counters.on_block_destroyed(id);
+              m_counters.on_global_lock(id);
               m_allocator.destroy_allocator_block(*this, ::std::move(block));
             },
-            [this]() {
+            [this, id]() {
+              m_counters.on_global_lock(id);
               m_allocator._mutex().lock();
               assume_unlock(m_allocator._mutex());
             },
@@ -57,12 +91,29 @@ namespace mcppalloc::sparse::details
               MCPPALLOC_CONCURRENCY_LOCK_ASSUME(m_allocator._mutex());
               m_allocator._u_move_registered_blocks(begin, end, offset);
             },
-            min_to_leave);
+            ::std::max(min_to_leave, reserved[id]));
       }
     }
     m_force_free_empty_blocks = false;
   }
 
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::set_memory_pressure(memory_pressure_level_t level) noexcept
+  {
+    m_memory_pressure.store(level, ::std::memory_order_relaxed);
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::memory_pressure() const noexcept -> memory_pressure_level_t
+  {
+    return m_memory_pressure.load(::std::memory_order_relaxed);
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::reclaim_memory()
+  {
+    m_slow_path_monitor.on_slow_path("reclaim memory");
+    free_empty_blocks(0, true);
+    m_allocator.reclaim_memory();
+  }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
   size_t thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::find_block_set_id(size_t sz)
   {
@@ -104,7 +155,9 @@ namespace mcppalloc::sparse::details
       if (i == c_bins - 1) {
         max = c_infinite_length;
       }
-      m_allocators[i]._set_allocator_sizes(min, max);
+      for (auto &family : m_allocators) {
+        family[i]._set_allocator_sizes(min, max);
+      }
     }
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
@@ -137,10 +190,10 @@ namespace mcppalloc::sparse::details
     return m_allocator_multiples[id].allocator_multiple() * static_cast<unsigned>(2 << (id + 4));
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
-  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocator_by_size(size_t sz) noexcept
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocator_by_size(size_t sz, allocation_lifetime_t lifetime) noexcept
       -> this_allocator_block_set_t &
   {
-    return m_allocators[find_block_set_id(sz)];
+    return m_allocators[static_cast<size_t>(lifetime)][find_block_set_id(sz)];
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
   auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocator_block_sizes() const noexcept
@@ -157,24 +210,85 @@ namespace mcppalloc::sparse::details
   bool thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::destroy(void *v)
   {
     // only support slow lab right now.
-    assert(m_allocator.underlying_memory().memory_range().contains(v));
+    assert(m_allocator.heap_contains(v));
     // get object state
     auto os = this_block_type::object_state_type::from_object_start(v);
+    const size_t object_size = os->object_size();
+    // read the tag before destroying clears the user data.
+    const auto tag = static_cast<allocation_tag_t>(cs_uses_allocation_tags ? os->user_flags() : 0);
     // find block set id for object.
-    auto block_id = find_block_set_id(os->object_size());
-    // get a reference to the allocator.
-    auto allocator = &m_allocators[block_id];
-    // destroy object.
-    auto ret = allocator->destroy(v);
-    // handle allocator rounded size up.
-    if (!ret && block_id > 0) {
-      allocator = &m_allocators[block_id - 1];
+    const auto object_block_id = find_block_set_id(object_size);
+    auto block_id = object_block_id;
+    this_allocator_block_set_t *allocator = nullptr;
+    bool ret = false;
+    // the lifetime hint is not stored, so look in each family starting with the default one.
+    for (auto &family : m_allocators) {
+      block_id = object_block_id;
+      // get a reference to the allocator.
+      allocator = &family[block_id];
+      // destroy object.
       ret = allocator->destroy(v);
+      // handle allocator rounded size up.
+      if (!ret && block_id > 0) {
+        --block_id;
+        allocator = &family[block_id];
+        ret = allocator->destroy(v);
+      }
+      if (ret) {
+        break;
+      }
+    }
+    if (ret) {
+      if_constexpr(has_on_deallocation_v<allocator_traits>)
+      {
+        m_allocator.thread_policy().on_deallocation(v);
+      }
+      m_counters.on_deallocation(block_id, object_size);
+      if_constexpr(cs_uses_allocation_tags)
+      {
+        m_counters.on_tagged_deallocation(tag, object_size);
+        _add_tag_live_bytes(tag, -static_cast<int64_t>(object_size));
+      }
     }
     _check_do_free_empty_blocks(*allocator);
     return ret;
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::destroy_all()
+  {
+    // objects are dropped without being visited, so account for them by bin.
+    m_slow_path_monitor.on_slow_path("destroy all");
+    stats_type stats;
+    m_counters.add_to(stats);
+    MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_allocator._mutex());
+    // queued objects are dropped with their blocks.
+    m_queued_destroys.clear();
+    m_has_queued_destroys.store(false, ::std::memory_order_relaxed);
+    // so are reserved blocks.
+    m_reserved_blocks = {};
+    for (size_t id = 0; id < c_bins; ++id) {
+      const auto &bin = stats.m_bins[id];
+      m_counters.on_bulk_deallocation(id, bin.m_allocations - bin.m_deallocations, bin.m_bytes_allocated - bin.m_bytes_deallocated);
+      for (auto &family : m_allocators) {
+        family[id].release_all_blocks([this, id](typename this_allocator_block_set_t::allocator_block_type &&block) {
+          MCPPALLOC_CONCURRENCY_LOCK_ASSUME(m_allocator._mutex());
+          m_counters.on_block_destroyed(id);
+          m_allocator._u_destroy_allocator_block(*this, ::std::move(block));
+        });
+      }
+    }
+    if_constexpr(cs_uses_allocation_tags)
+    {
+      for (size_t i = 0; i < c_num_allocation_tags; ++i) {
+        const auto tag = static_cast<allocation_tag_t>(i);
+        const auto &tag_stats = stats.m_tags[i];
+        const size_t bytes = tag_stats.m_bytes_allocated - tag_stats.m_bytes_deallocated;
+        m_counters.on_bulk_tagged_deallocation(tag, tag_stats.m_allocations - tag_stats.m_deallocations, bytes);
+        _add_tag_live_bytes(tag, -static_cast<int64_t>(bytes));
+      }
+    }
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
   bool thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::deallocate(void *v)
   {
     return destroy(v);
@@ -185,8 +299,8 @@ namespace mcppalloc::sparse::details
     // do book keeping for returning memory to global.
     // do this if we exceed the destroy threshold or externally forced.
     bool should_force_free = m_force_free_empty_blocks.load(::std::memory_order_relaxed);
-
-    if (mcpputil_unlikely(should_force_free)) {
+    // put off until after any no slow path section.
+    if (mcpputil_unlikely(should_force_free) && !m_slow_path_monitor.active()) {
       _do_free_empty_blocks();
       return true;
     }
@@ -199,7 +313,7 @@ namespace mcppalloc::sparse::details
     if (_check_do_free_empty_blocks()) {
       return;
     }
-    if (allocator.num_destroyed_since_last_free() > destroy_threshold()) {
+    if (allocator.num_destroyed_since_last_free() > _effective_destroy_threshold() && !m_slow_path_monitor.active()) {
       _do_free_empty_blocks();
     }
   }
@@ -207,7 +321,29 @@ namespace mcppalloc::sparse::details
   void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_do_free_empty_blocks()
   {
     bool should_force_free = m_force_free_empty_blocks.load(::std::memory_order_relaxed);
-    free_empty_blocks(m_minimum_local_blocks, should_force_free);
+    donate_surplus_blocks();
+    free_empty_blocks(_effective_minimum_local_blocks(), should_force_free);
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_effective_destroy_threshold() const noexcept
+      -> destroy_threshold_type
+  {
+    switch (memory_pressure()) {
+    case memory_pressure_level_t::none:
+      return destroy_threshold();
+    case memory_pressure_level_t::moderate:
+      return destroy_threshold() >> 3;
+    default:
+      return 0;
+    }
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_effective_minimum_local_blocks() const noexcept -> uint16_t
+  {
+    if (memory_pressure() != memory_pressure_level_t::none) {
+      return 0;
+    }
+    return m_minimum_local_blocks;
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
   auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocator_multiples() const
@@ -216,60 +352,227 @@ namespace mcppalloc::sparse::details
     return m_allocator_multiples;
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
-  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocators() const
-      -> const ::std::array<this_allocator_block_set_t, c_bins> &
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocators(allocation_lifetime_t lifetime) const
+      -> const block_set_family_type &
+  {
+    return m_allocators[static_cast<size_t>(lifetime)];
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::counters() const noexcept -> const counters_type &
+  {
+    return m_counters;
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocate(size_t size, allocation_tag_t tag,
+                                                                               allocation_lifetime_t lifetime) -> block_type
   {
-    return m_allocators;
+    return ::std::get<0>(allocate_detailed(size, tag, lifetime));
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
-  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocate(size_t size) -> block_type
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocate(size_t size, allocation_lifetime_t lifetime)
+      -> block_type
   {
-    return ::std::get<0>(allocate_detailed(size));
+    return ::std::get<0>(allocate_detailed(size, 0, lifetime));
   }
 
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
-  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocate_detailed(size_t size) -> allocation_return_type
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocate_detailed(size_t size, allocation_tag_t tag,
+                                                                                        allocation_lifetime_t lifetime)
+      -> allocation_return_type
+  {
+    auto ret = try_allocate_detailed(size, tag, lifetime);
+    if (mcpputil_unlikely(!allocation_valid(ret))) {
+      ::std::cerr << "mcppalloc: Out of memory, aborting 09c30c8d-2cfa-4646-a562-24f06560fa5c\n" << ::std::endl;
+      ::std::terminate();
+    }
+    return ret;
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::try_allocate(size_t size, allocation_tag_t tag,
+                                                                                   allocation_lifetime_t lifetime) -> block_type
   {
+    return ::std::get<0>(try_allocate_detailed(size, tag, lifetime));
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::try_allocate(size_t size, allocation_lifetime_t lifetime)
+      -> block_type
+  {
+    return ::std::get<0>(try_allocate_detailed(size, 0, lifetime));
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::tag_live_bytes(allocation_tag_t tag) const noexcept -> size_t
+  {
+    // frees settled elsewhere may leave the flushed count below our pending batch.
+    const auto global = m_allocator._tag_live_bytes(tag);
+    return static_cast<size_t>(::std::max(global + m_tag_live_bytes_delta[tag], static_cast<int64_t>(0)));
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  bool thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_check_tag_quota(allocation_tag_t tag, size_t size)
+  {
+    using ::mcppalloc::details::allocation_failure_reason_t;
+    const size_t soft = m_allocator.tag_soft_quota(tag);
+    const size_t hard = m_allocator.tag_hard_quota(tag);
+    if (mcpputil_likely(!soft && !hard)) {
+      return true;
+    }
+    size_t live = tag_live_bytes(tag);
+    size_t attempts = 1;
+    while (hard && live + size > hard) {
+      if (attempts > cs_max_allocation_attempts) {
+        return false;
+      }
+      auto action = m_allocator.thread_policy().on_allocation_failure({attempts, allocation_failure_reason_t::hard_quota, tag});
+      if (action.m_reclaim) {
+        // reclaiming implies checking again, the policy may have freed objects of this tag.
+        reclaim_memory();
+      } else if (!action.m_repeat) {
+        return false;
+      }
+      ++attempts;
+      live = tag_live_bytes(tag);
+    }
+    // soft quotas only notify, once per crossing.
+    if (soft && live < soft && live + size >= soft) {
+      m_allocator.thread_policy().on_allocation_failure({1, allocation_failure_reason_t::soft_quota, tag});
+    }
+    return true;
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_on_allocation(size_t id, allocation_return_type &ret,
+                                                                                      allocation_tag_t tag)
+  {
+    m_counters.on_allocation(id, get_allocated_size(ret));
+    if_constexpr(cs_uses_allocation_tags)
+    {
+      ::std::get<1>(ret)->set_user_flags(tag);
+      m_counters.on_tagged_allocation(tag, get_allocated_size(ret));
+      _add_tag_live_bytes(tag, static_cast<int64_t>(get_allocated_size(ret)));
+    }
+    if_constexpr(has_on_allocation_v<allocator_traits>)
+    {
+      m_allocator.thread_policy().on_allocation(get_allocated_memory(ret), get_allocated_size(ret));
+    }
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_add_tag_live_bytes(allocation_tag_t tag, int64_t delta) noexcept
+  {
+    auto &local = m_tag_live_bytes_delta[tag];
+    local += delta;
+    if (mcpputil_unlikely(local >= cs_tag_flush_bytes || local <= -cs_tag_flush_bytes)) {
+      m_allocator._add_tag_live_bytes(tag, local);
+      local = 0;
+    }
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::try_allocate_detailed(size_t size, allocation_tag_t tag,
+                                                                                            allocation_lifetime_t lifetime)
+      -> allocation_return_type
+  {
+    return _try_allocate_detailed(size, tag, lifetime, nullptr);
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocate_near(const void *hint, size_t size,
+                                                                                    allocation_tag_t tag,
+                                                                                    allocation_lifetime_t lifetime) -> block_type
+  {
+    auto ret = _try_allocate_detailed(size, tag, lifetime, hint);
+    if (mcpputil_unlikely(!allocation_valid(ret))) {
+      ::std::cerr << "mcppalloc: Out of memory, aborting 09c30c8d-2cfa-4646-a562-24f06560fa5c\n" << ::std::endl;
+      ::std::terminate();
+    }
+    return ::std::get<0>(ret);
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::allocate_near(const void *hint, size_t size,
+                                                                                    allocation_lifetime_t lifetime) -> block_type
+  {
+    return allocate_near(hint, size, 0, lifetime);
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::try_allocate_near(const void *hint, size_t size,
+                                                                                        allocation_tag_t tag,
+                                                                                        allocation_lifetime_t lifetime) -> block_type
+  {
+    return ::std::get<0>(_try_allocate_detailed(size, tag, lifetime, hint));
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::try_allocate_near(const void *hint, size_t size,
+                                                                                        allocation_lifetime_t lifetime) -> block_type
+  {
+    return try_allocate_near(hint, size, 0, lifetime);
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_try_allocate_detailed(size_t size, allocation_tag_t tag,
+                                                                                             allocation_lifetime_t lifetime,
+                                                                                             const void *hint)
+      -> allocation_return_type
+  {
+    if_constexpr(cs_uses_allocation_tags)
+    {
+      assert(tag < c_num_allocation_tags);
+      if (mcpputil_unlikely(!_check_tag_quota(tag, size))) {
+        return allocation_return_type{block_type{nullptr, 0}, nullptr};
+      }
+    }
     _check_do_free_empty_blocks();
+    // put off until after any no slow path section.
+    if (mcpputil_unlikely(m_has_queued_destroys.load(::std::memory_order_relaxed)) && !m_slow_path_monitor.active()) {
+      destroy_queued();
+    }
     // find allocation set for allocation size.
     size_t id = find_block_set_id(size);
     if (mcpputil_unlikely(size < ::mcpputil::c_alignment)) {
       size = ::mcpputil::c_alignment;
     }
     // try allocation.
-    allocation_return_type ret = m_allocators[id].allocate(size);
+    auto &family = m_allocators[static_cast<size_t>(lifetime)];
+    allocation_return_type ret(block_type{nullptr, 0}, nullptr);
+    if (hint) {
+      ret = family[id].allocate_near(hint, size);
+    }
+    if (!allocation_valid(ret)) {
+      ret = family[id].allocate(size);
+    }
     // if successful returned.
     if (allocation_valid(ret)) {
-      m_allocator.thread_policy().on_allocation(get_allocated_memory(ret), get_allocated_size(ret));
+      _on_allocation(id, ret, tag);
       return ret;
     }
     size_t attempts = 1;
     bool try_expand = true;
-    bool success = _add_allocator_block(id, size, try_expand);
-    while (mcpputil_unlikely(!success)) {
+    bool success = _add_allocator_block(family, id, size, try_expand);
+    while (mcpputil_unlikely(!success) && attempts <= cs_max_allocation_attempts) {
       auto action = m_allocator.thread_policy().on_allocation_failure({attempts});
-      if (!action.m_repeat) {
+      if (action.m_reclaim) {
+        // reclaiming implies attempting again.
+        reclaim_memory();
+      } else if (!action.m_repeat) {
         break;
       }
       ++attempts;
       try_expand = action.m_attempt_expand;
-      success = _add_allocator_block(id, size, try_expand);
+      success = _add_allocator_block(family, id, size, try_expand);
+    }
+    // last resort, give this thread the emergency reserve so it can shed load.
+    if (mcpputil_unlikely(!success) && m_allocator.release_emergency_reserve()) {
+      success = _add_allocator_block(family, id, size, true);
     }
     if (!success) {
-      ::std::cerr << "mcppalloc: Out of memory, aborting 09c30c8d-2cfa-4646-a562-24f06560fa5c\n" << ::std::endl;
-      ::std::terminate();
+      return allocation_return_type{block_type{nullptr, 0}, nullptr};
     }
-    ret = m_allocators[id].allocate(size);
+    _on_block_added(id, lifetime);
+    ret = family[id].allocate(size);
     if (mcpputil_unlikely(!allocation_valid(ret))) // should be impossible.
     {
       ::std::cerr << "mcppalloc: Allocation failed in an impossible fashion.  6bfbf787-3443-47c5-8726-e49d7836315a\n";
       ::std::terminate();
     }
-    m_allocator.thread_policy().on_allocation(get_allocated_memory(ret), get_allocated_size(ret));
+    _on_allocation(id, ret, tag);
     return ret;
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
-  bool thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_add_allocator_block(size_t id, size_t sz, bool try_expand)
+  bool thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_add_allocator_block(block_set_family_type &family, size_t id,
+                                                                                          size_t sz, bool try_expand)
   {
     // if not succesful, that allocator needs more memory.
     // figre out how much memory to request.
@@ -279,7 +582,11 @@ namespace mcppalloc::sparse::details
       memory_request = sz * 3;
     }
     // Get the allocator for the size requested.
-    auto &abs = m_allocators[id];
+    auto &abs = family[id];
+    m_slow_path_monitor.on_slow_path("add block");
+    // polling reads files, so do it before taking the lock.
+    m_allocator.maybe_check_memory_pressure();
+    m_counters.on_global_lock(id);
     MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_allocator._mutex());
     // see if safe to add a block
     if (!abs.add_block_is_safe()) {
@@ -291,13 +598,21 @@ namespace mcppalloc::sparse::details
       m_allocator._u_move_registered_blocks(abs.m_blocks, offset);
     }
     typename global_allocator::allocator_block_type block;
+    const size_t num_global_blocks = m_allocator._u_num_global_blocks();
+    // partially used global blocks may hold short lived objects, so other lifetimes only reuse empty ones.
+    const bool short_lived = &family == &m_allocators[static_cast<size_t>(allocation_lifetime_t::short_lived)];
+    const bool require_empty = !short_lived || m_isolated;
     // fill the empty block.
-    bool success = m_allocator._u_get_unregistered_allocator_block(*this, memory_request, m_allocators[id].allocator_min_size(),
-                                                                   m_allocators[id].allocator_max_size(), sz, block, try_expand);
+    bool success = m_allocator._u_get_unregistered_allocator_block(*this, memory_request, abs.allocator_min_size(),
+                                                                   abs.allocator_max_size(), sz, require_empty, block, try_expand);
 
     if (mcpputil_unlikely(!success)) {
       return false;
     }
+    // if no global block could be reused, ask other threads to donate surplus blocks for next time.
+    if (m_allocator._u_num_global_blocks() == num_global_blocks && m_allocator._request_block(id)) {
+      ++m_block_requests[id];
+    }
     // gcreate and grab the empty block.
     auto &inserted_block_ref = abs.add_block(::std::move(block), []() {}, []() {},
                                              [this](auto begin, auto end, auto offset) {
@@ -305,9 +620,179 @@ namespace mcppalloc::sparse::details
                                                m_allocator._u_move_registered_blocks(begin, end, offset);
                                              });
     m_allocator._u_register_allocator_block(*this, inserted_block_ref);
+    m_counters.on_block_created(id);
+    return true;
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_on_block_added(size_t id, allocation_lifetime_t lifetime)
+  {
+    const auto &block = *m_allocators[static_cast<size_t>(lifetime)][id].last_block();
+    switch (m_allocator.prefault_mode()) {
+      case prefault_mode_t::immediate:
+        _prefault_block(block, id);
+        break;
+      case prefault_mode_t::deferred:
+        m_pending_prefaults.push_back(pending_prefault_t{block.begin(), id, lifetime});
+        break;
+      case prefault_mode_t::none:
+        break;
+    }
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::prefault_pending_blocks()
+  {
+    for (auto &&pending : m_pending_prefaults) {
+      // the block may have been freed or donated since it was queued.
+      const auto &blocks = m_allocators[static_cast<size_t>(pending.m_lifetime)][pending.m_id].m_blocks;
+      const auto it = ::std::find_if(blocks.begin(), blocks.end(), [&pending](auto &&block) { return block.begin() == pending.m_begin; });
+      if (it != blocks.end() && it->valid()) {
+        _prefault_block(*it, pending.m_id);
+      }
+    }
+    m_pending_prefaults.clear();
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::destroy_queued()
+  {
+    if (mcpputil_likely(!m_has_queued_destroys.load(::std::memory_order_relaxed))) {
+      return;
+    }
+    m_slow_path_monitor.on_slow_path("destroy queued");
+    mcpputil::rebind_vector_t<void *, allocator> queued;
+    {
+      MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_allocator._mutex());
+      queued.swap(m_queued_destroys);
+      m_has_queued_destroys.store(false, ::std::memory_order_relaxed);
+    }
+    for (auto &&v : queued) {
+      // the block may have been donated since the object was queued.
+      if (!destroy(v)) {
+        MCPPALLOC_CONCURRENCY_LOCK_GUARD(m_allocator._mutex());
+        m_allocator._u_destroy_remote(v);
+      }
+    }
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_u_queue_destroy(void *v)
+  {
+    m_queued_destroys.push_back(v);
+    m_has_queued_destroys.store(true, ::std::memory_order_relaxed);
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_on_park()
+  {
+    m_slow_path_monitor.end();
+    destroy_queued();
+    m_reserved_blocks = {};
+    m_force_free_empty_blocks = false;
+    m_memory_pressure.store(memory_pressure_level_t::none, ::std::memory_order_relaxed);
+    // nobody is left to receive the blocks we asked for.
+    for (size_t id = 0; id < c_bins; ++id) {
+      for (; m_block_requests[id] > 0; --m_block_requests[id]) {
+        if (!m_allocator._claim_block_demand(id)) {
+          break;
+        }
+      }
+      m_block_requests[id] = 0;
+    }
+    for (size_t tag = 0; tag < c_num_allocation_tags; ++tag) {
+      if (m_tag_live_bytes_delta[tag]) {
+        m_allocator._add_tag_live_bytes(static_cast<allocation_tag_t>(tag), m_tag_live_bytes_delta[tag]);
+        m_tag_live_bytes_delta[tag] = 0;
+      }
+    }
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_prefault_block([[maybe_unused]] const this_block_type &block,
+                                                                                     [[maybe_unused]] size_t id)
+  {
+#ifndef _WIN32
+    const uintptr_t page_size = mcpputil::slab_t::page_size();
+    // the page holding the tail object state is already resident and may be shared with another block.
+    const uintptr_t begin = (reinterpret_cast<uintptr_t>(block.current_end()) + page_size - 1) & ~(page_size - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(block.end());
+    if (begin >= end) {
+      return;
+    }
+    ::madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+    ::std::array<unsigned char, 256> residency;
+    uint64_t num_prefaulted = 0;
+    for (uintptr_t chunk = begin; chunk < end; chunk += residency.size() * page_size) {
+      const uintptr_t chunk_size = ::std::min<uintptr_t>(end - chunk, residency.size() * page_size);
+      if (::mincore(reinterpret_cast<void *>(chunk), chunk_size, residency.data())) {
+        residency.fill(0);
+      }
+      for (uintptr_t i = 0; i * page_size < chunk_size; ++i) {
+        if (residency[i] & 1) {
+          continue;
+        }
+        // write back what is there so the page is faulted in writable without changing it.
+        volatile uint8_t *const page = reinterpret_cast<uint8_t *>(chunk + i * page_size);
+        *page = *page;
+        ++num_prefaulted;
+      }
+    }
+    m_counters.on_pages_prefaulted(id, num_prefaulted);
+#endif
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  bool thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::reserve(size_t size, size_t n, allocation_lifetime_t lifetime)
+  {
+    const size_t id = find_block_set_id(size);
+    if (size < ::mcpputil::c_alignment) {
+      size = ::mcpputil::c_alignment;
+    }
+    using object_state_type = typename this_block_type::object_state_type;
+    const size_t needed = object_state_type::needed_size(sizeof(object_state_type), size);
+    auto &family = m_allocators[static_cast<size_t>(lifetime)];
+    auto &abs = family[id];
+    // coalesce so that free space is visible.
+    abs.collect();
+    while (_reserve_capacity(abs, needed) < n) {
+      if (!_add_allocator_block(family, id, size, true)) {
+        return false;
+      }
+      _on_block_added(id, lifetime);
+    }
+    // keep the blocks of this bin only when they become empty.
+    const auto num_blocks = static_cast<size_t>(
+        ::std::count_if(abs.m_blocks.begin(), abs.m_blocks.end(), [](auto &&block) { return block.valid(); }));
+    auto &reserved = m_reserved_blocks[static_cast<size_t>(lifetime)][id];
+    reserved = ::std::max(reserved, num_blocks);
     return true;
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_reserve_capacity(const this_allocator_block_set_t &abs,
+                                                                                       size_t needed) const -> size_t
+  {
+    size_t capacity = 0;
+    for (auto &&block : abs.m_blocks) {
+      if (!block.valid()) {
+        continue;
+      }
+      capacity += static_cast<size_t>(block.end() - reinterpret_cast<uint8_t *>(block.current_end())) / needed;
+      for (auto &&state : block.m_free_list) {
+        capacity += static_cast<size_t>(reinterpret_cast<uint8_t *>(state->next()) - reinterpret_cast<uint8_t *>(state)) / needed;
+      }
+    }
+    return capacity;
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::begin_no_slow_path(slow_path_action_t action) noexcept
+  {
+    m_slow_path_monitor.begin(action);
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::end_no_slow_path() noexcept
+  {
+    m_slow_path_monitor.end();
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::num_slow_path_events() const noexcept -> uint64_t
+  {
+    return m_slow_path_monitor.num_events();
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
   auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::destroy_threshold() const noexcept -> destroy_threshold_type
   {
     return static_cast<destroy_threshold_type>(m_destroy_threshold << 3);
@@ -333,16 +818,96 @@ namespace mcppalloc::sparse::details
     m_force_free_empty_blocks = true;
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::set_isolated(bool isolated) noexcept
+  {
+    m_isolated = isolated;
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::isolated() const noexcept -> bool
+  {
+    return m_isolated;
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
   void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::_do_maintenance()
   {
-    _check_do_free_empty_blocks();
+    m_slow_path_monitor.on_slow_path("maintenance");
+    prefault_pending_blocks();
+    destroy_queued();
+    if (!_check_do_free_empty_blocks()) {
+      donate_surplus_blocks();
+    }
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::donate_surplus_blocks()
+  {
+    // blocks of an isolated thread allocator would outlive destroy_all() in other threads.
+    if (m_isolated) {
+      return;
+    }
+    for (size_t id = 0; id < c_bins; ++id) {
+      // this is the common case, so keep it to a relaxed load.
+      if (m_allocator._block_demand(id) == 0) {
+        continue;
+      }
+      for (auto &family : m_allocators) {
+        auto &abs = family[id];
+        const size_t reserved = m_reserved_blocks[static_cast<size_t>(&family - m_allocators.data())][id];
+        // coalesce so that free space is visible.
+        abs.collect();
+        // objects in a donated block could no longer be destroyed through this thread allocator, so only donate empty blocks.
+        const auto is_surplus = [&abs](auto &block) { return &block != abs.last_block() && block.valid() && block.empty(); };
+        // a surplus block means our own requests are stale, so cancel them rather than donate to ourselves.
+        if (m_block_requests[id] && ::std::any_of(abs.m_blocks.begin(), abs.m_blocks.end(), is_surplus)) {
+          for (; m_block_requests[id] > 0; --m_block_requests[id]) {
+            if (!m_allocator._claim_block_demand(id)) {
+              m_block_requests[id] = 0;
+              break;
+            }
+          }
+        }
+        // reserved blocks stay.
+        size_t num_blocks = static_cast<size_t>(
+            ::std::count_if(abs.m_blocks.begin(), abs.m_blocks.end(), [](auto &&block) { return block.valid(); }));
+        // go backwards so that removing a block does not move blocks not yet visited.
+        for (size_t i = abs.m_blocks.size(); i > 0 && num_blocks > reserved; --i) {
+          auto it = abs.m_blocks.begin() + static_cast<ptrdiff_t>(i - 1);
+          auto &block = *it;
+          if (!is_surplus(block)) {
+            continue;
+          }
+          if (!m_allocator._claim_block_demand(id)) {
+            break;
+          }
+          m_counters.on_global_lock(id);
+          m_allocator.to_global_allocator_block(::std::move(block));
+          abs.remove_block(it,
+                           [this, id]() {
+                             m_counters.on_global_lock(id);
+                             m_allocator._mutex().lock();
+                             assume_unlock(m_allocator._mutex());
+                           },
+                           [this]() {
+                             MCPPALLOC_CONCURRENCY_LOCK_ASSUME(m_allocator._mutex());
+                             m_allocator._mutex().unlock();
+                           },
+                           [this](auto begin, auto end, auto offset) {
+                             MCPPALLOC_CONCURRENCY_LOCK_ASSUME(m_allocator._mutex());
+                             m_allocator._u_move_registered_blocks(begin, end, offset);
+                           });
+          m_counters.on_block_destroyed(id);
+          --num_blocks;
+        }
+      }
+    }
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
   auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::primary_memory_used() const noexcept -> size_type
   {
     size_type sz = 0;
-    for (auto &&allocator : m_allocators) {
-      sz += allocator.primary_memory_used();
+    for (auto &&family : m_allocators) {
+      for (auto &&allocator : family) {
+        sz += allocator.primary_memory_used();
+      }
     }
     return sz;
   }
@@ -350,8 +915,10 @@ namespace mcppalloc::sparse::details
   auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::secondary_memory_used() const noexcept -> size_type
   {
     size_type sz = secondary_memory_used_self();
-    for (auto &&allocator : m_allocators) {
-      sz += allocator.secondary_memory_used();
+    for (auto &&family : m_allocators) {
+      for (auto &&allocator : family) {
+        sz += allocator.secondary_memory_used();
+      }
     }
     return sz;
   }
@@ -361,10 +928,40 @@ namespace mcppalloc::sparse::details
     return 0;
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::memory_usage(size_t id) const noexcept -> memory_usage_t
+  {
+    memory_usage_t ret;
+    for (auto &&family : m_allocators) {
+      ret += family[id].memory_usage();
+    }
+    return ret;
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::add_memory_usage_to(memory_usage_stats_type &stats) const
+      noexcept
+  {
+    for (size_t id = 0; id < c_bins; ++id) {
+      stats.m_bins[id] += memory_usage(id);
+    }
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
+  auto thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::memory_usage() const noexcept -> memory_usage_t
+  {
+    memory_usage_t ret;
+    for (auto &&family : m_allocators) {
+      for (auto &&allocator : family) {
+        ret += allocator.memory_usage();
+      }
+    }
+    return ret;
+  }
+  template <typename Global_Allocator, typename Allocator_Thread_Policy>
   void thread_allocator_t<Global_Allocator, Allocator_Thread_Policy>::shrink_secondary_memory_usage_to_fit()
   {
-    for (auto &&allocator : m_allocators) {
-      allocator.shrink_secondary_memory_usage_to_fit();
+    for (auto &&family : m_allocators) {
+      for (auto &&allocator : family) {
+        allocator.shrink_secondary_memory_usage_to_fit();
+      }
     }
   }
   template <typename Global_Allocator, typename Allocator_Thread_Policy>
@@ -397,11 +994,14 @@ namespace mcppalloc::sparse::details
     ptree.put("force_free_empty_blocks", ::std::to_string(m_force_free_empty_blocks));
     if (level > 0) {
       ::boost::property_tree::ptree abs_array;
-      for (size_t i = 0; i < m_allocators.size(); ++i) {
-        ::boost::property_tree::ptree abs;
-        abs.put("id", ::std::to_string(i));
-        m_allocators[i].to_ptree(abs, level);
-        abs_array.add_child("allocator", abs);
+      for (size_t lifetime = 0; lifetime < m_allocators.size(); ++lifetime) {
+        for (size_t i = 0; i < c_bins; ++i) {
+          ::boost::property_tree::ptree abs;
+          abs.put("id", ::std::to_string(i));
+          abs.put("lifetime", ::std::to_string(lifetime));
+          m_allocators[lifetime][i].to_ptree(abs, level);
+          abs_array.add_child("allocator", abs);
+        }
       }
       ptree.put_child("abs_array", abs_array);
     }
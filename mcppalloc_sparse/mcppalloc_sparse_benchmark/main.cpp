@@ -0,0 +1,339 @@
+#include <mcpputil/mcpputil/declarations.hpp>
+// This Must be first.
+#include <chrono>
+#include <iostream>
+#include <mcppalloc/mcppalloc_slab_allocator/slab_allocator.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/slab_thread_cache.hpp>
+#include <mcppalloc/mcppalloc_sparse/mcppalloc_sparse.hpp>
+#include <mcppalloc/sampling_heap_profiler_thread_policy.hpp>
+#include <mcpputil/mcpputil/aligned_allocator.hpp>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+namespace
+{
+  /**
+   * \brief Thread policy that does work on every allocation.
+   **/
+  struct counting_thread_policy_t : public ::mcppalloc::default_allocator_thread_policy_t {
+    void on_allocation(void *, size_t)
+    {
+      ++m_num_allocations;
+    }
+    size_t m_num_allocations = 0;
+  };
+  /**
+   * \brief Allocator policy that maintains user data and calls an allocation hook.
+   **/
+  struct user_data_allocator_policy_t : public ::mcppalloc::default_allocator_policy_t<::mcpputil::default_aligned_allocator_t> {
+    using thread_policy_type = counting_thread_policy_t;
+    static const constexpr bool cs_uses_user_data = true;
+  };
+  /**
+   * \brief Allocator policy that samples allocations for heap profiling.
+   **/
+  struct profiled_allocator_policy_t : public ::mcppalloc::default_allocator_policy_t<::mcpputil::default_aligned_allocator_t> {
+    using thread_policy_type = ::mcppalloc::sampling_heap_profiler_thread_policy_t;
+  };
+  using default_policy_t = ::mcppalloc::default_allocator_policy_t<::mcpputil::default_aligned_allocator_t>;
+}
+template <>
+::mcppalloc::details::user_data_base_t mcppalloc::sparse::details::allocator_block_t<default_policy_t>::s_default_user_data{};
+template <>
+::mcppalloc::details::user_data_base_t mcppalloc::sparse::details::allocator_block_t<user_data_allocator_policy_t>::s_default_user_data{};
+template <>
+::mcppalloc::details::user_data_base_t mcppalloc::sparse::details::allocator_block_t<profiled_allocator_policy_t>::s_default_user_data{};
+namespace
+{
+  /**
+   * \brief Time allocate/destroy pairs on a thread allocator.
+   * @param name Name to print.
+   * @param num_objects Number of live objects per round.
+   * @param num_rounds Number of rounds.
+   * @param size Size of each allocation.
+   **/
+  template <typename Allocator_Policy>
+  void allocate_destroy_benchmark(const ::std::string &name, size_t num_objects, size_t num_rounds, size_t size)
+  {
+    using allocator_type = ::mcppalloc::sparse::allocator_t<Allocator_Policy>;
+    using ta_type = typename allocator_type::thread_allocator_type;
+    ::std::unique_ptr<allocator_type> allocator(new allocator_type());
+    if (!allocator->initialize(100000000, 1000000000)) {
+      ::std::cerr << "mcppalloc: Failed to initialize allocator for benchmark 5a4c4a3d-5d2c-4b7c-a1e8-0b3c2f7a6b19\n";
+      ::std::abort();
+    }
+    ta_type ta(*allocator);
+    ::std::vector<void *> ptrs(num_objects);
+    // warm up so that blocks exist.
+    for (auto &&ptr : ptrs) {
+      ptr = ta.allocate(size).m_ptr;
+    }
+    for (auto &&ptr : ptrs) {
+      ta.destroy(ptr);
+    }
+    const auto start = ::std::chrono::high_resolution_clock::now();
+    for (size_t round = 0; round < num_rounds; ++round) {
+      for (auto &&ptr : ptrs) {
+        ptr = ta.allocate(size).m_ptr;
+      }
+      for (auto &&ptr : ptrs) {
+        ta.destroy(ptr);
+      }
+    }
+    const auto end = ::std::chrono::high_resolution_clock::now();
+    const auto ns = ::std::chrono::duration_cast<::std::chrono::nanoseconds>(end - start).count();
+    const auto ops = num_objects * num_rounds;
+    ::std::cout << name << ": " << ops << " allocate/destroy pairs of " << size << " bytes, "
+                << static_cast<double>(ns) / static_cast<double>(ops) << " ns/pair\n";
+  }
+  /**
+   * \brief Measure memory held after short lived objects die in a mixed lifetime workload.
+   *
+   * Every round allocates short lived objects with a long lived object mixed in, then frees the short lived ones.
+   * @param hint True if long lived objects are allocated with a lifetime hint.
+   * @param num_rounds Number of rounds.
+   * @param num_objects Number of objects per round.
+   * @param long_lived_interval One in this many objects is long lived.
+   **/
+  void fragmentation_benchmark(bool hint, size_t num_rounds, size_t num_objects, size_t long_lived_interval)
+  {
+    using allocator_type = ::mcppalloc::sparse::allocator_t<default_policy_t>;
+    using ta_type = allocator_type::thread_allocator_type;
+    ::std::unique_ptr<allocator_type> allocator(new allocator_type());
+    if (!allocator->initialize(100000000, 1000000000)) {
+      ::std::cerr << "mcppalloc: Failed to initialize allocator for benchmark 5a4c4a3d-5d2c-4b7c-a1e8-0b3c2f7a6b19\n";
+      ::std::abort();
+    }
+    const auto lifetime = hint ? ::mcppalloc::allocation_lifetime_t::long_lived : ::mcppalloc::allocation_lifetime_t::short_lived;
+    ta_type ta(*allocator);
+    ::std::vector<void *> long_lived;
+    ::std::vector<void *> short_lived;
+    size_t live_bytes = 0;
+    const auto start = ::std::chrono::high_resolution_clock::now();
+    for (size_t round = 0; round < num_rounds; ++round) {
+      for (size_t i = 0; i < num_objects; ++i) {
+        const size_t size = 32 + (i % 4) * 32;
+        if (i % long_lived_interval == 0) {
+          long_lived.push_back(ta.allocate(size, lifetime).m_ptr);
+          live_bytes += size;
+        } else {
+          short_lived.push_back(ta.allocate(size).m_ptr);
+        }
+      }
+      for (auto &&ptr : short_lived) {
+        ta.destroy(ptr);
+      }
+      short_lived.clear();
+      ta.free_empty_blocks(0, true);
+    }
+    const auto end = ::std::chrono::high_resolution_clock::now();
+    const auto ms = ::std::chrono::duration_cast<::std::chrono::milliseconds>(end - start).count();
+    const auto stats = allocator->stats_snapshot().totals();
+    const auto usage = ta.memory_usage();
+    ::std::cout << "fragmentation " << (hint ? "with" : "without") << " lifetime hints: " << live_bytes << " live bytes held in "
+                << usage.m_primary_bytes << " bytes of blocks, " << stats.m_blocks_destroyed << " of " << stats.m_blocks_created
+                << " blocks reclaimed, " << ms << " ms\n";
+    for (auto &&ptr : long_lived) {
+      ta.destroy(ptr);
+    }
+  }
+  /**
+   * \brief Node of a linked list for the locality benchmark.
+   **/
+  struct list_node_t {
+    list_node_t *m_next;
+    size_t m_value;
+  };
+  /**
+   * \brief Time walking a linked list that is edited in a heap with holes between nodes.
+   *
+   * Each edit removes a random node and inserts a new node after another random node, as when a long lived structure is updated.
+   * Without hints the new node lands in whichever block has the best fitting hole, often the one the removed node left,
+   * with hints it lands in the hole closest to its predecessor.
+   * @param near True if each node is allocated near its predecessor.
+   * @param list_length Number of nodes.
+   * @param num_edits Number of edits.
+   * @param num_walks Number of times the list is walked.
+   **/
+  void locality_benchmark(bool near, size_t list_length, size_t num_edits, size_t num_walks)
+  {
+    using allocator_type = ::mcppalloc::sparse::allocator_t<default_policy_t>;
+    using ta_type = allocator_type::thread_allocator_type;
+    ::std::unique_ptr<allocator_type> allocator(new allocator_type());
+    if (!allocator->initialize(100000000, 1000000000)) {
+      ::std::cerr << "mcppalloc: Failed to initialize allocator for benchmark 5a4c4a3d-5d2c-4b7c-a1e8-0b3c2f7a6b19\n";
+      ::std::abort();
+    }
+    ta_type ta(*allocator);
+    const auto allocate_node = [&ta, near](list_node_t *prev) {
+      return near && prev ? ta.allocate_near(prev, sizeof(list_node_t)).m_ptr : ta.allocate(sizeof(list_node_t)).m_ptr;
+    };
+    // doubly linked so that a random node can be unlinked, the walk only follows m_next.
+    ::std::vector<list_node_t *> nodes(list_length, nullptr);
+    ::std::vector<list_node_t *> prevs(list_length, nullptr);
+    // a spacer after each node is freed afterwards, so every block holding nodes has room left.
+    ::std::vector<void *> spacers(list_length);
+    for (size_t i = 0; i < list_length; ++i) {
+      nodes[i] = new (allocate_node(i ? nodes[i - 1] : nullptr)) list_node_t{nullptr, i};
+      spacers[i] = ta.allocate(sizeof(list_node_t)).m_ptr;
+      if (i) {
+        nodes[i - 1]->m_next = nodes[i];
+      }
+    }
+    for (auto &&ptr : spacers) {
+      ta.destroy(ptr);
+    }
+    ::std::minstd_rand rng(5);
+    // index of each node in nodes, looked up through the value.
+    for (size_t i = 1; i < list_length; ++i) {
+      prevs[i] = nodes[i - 1];
+    }
+    for (size_t edit = 0; edit < num_edits; ++edit) {
+      // remove a node other than the head.
+      const size_t removed = 1 + rng() % (list_length - 1);
+      auto old = nodes[removed];
+      prevs[removed]->m_next = old->m_next;
+      if (old->m_next) {
+        prevs[old->m_next->m_value] = prevs[removed];
+      }
+      ta.destroy(old);
+      // insert its replacement after a random node.
+      const size_t after = rng() % list_length;
+      auto prev = after == removed ? prevs[removed] : nodes[after];
+      auto node = new (allocate_node(prev)) list_node_t{prev->m_next, removed};
+      if (node->m_next) {
+        prevs[node->m_next->m_value] = node;
+      }
+      prev->m_next = node;
+      prevs[removed] = prev;
+      nodes[removed] = node;
+    }
+    // timings are noisy, so also count steps that move to another page.
+    size_t page_changes = 0;
+    for (auto node = nodes.front(); node->m_next; node = node->m_next) {
+      if (reinterpret_cast<uintptr_t>(node) / 4096 != reinterpret_cast<uintptr_t>(node->m_next) / 4096) {
+        ++page_changes;
+      }
+    }
+    size_t sum = 0;
+    const auto start = ::std::chrono::high_resolution_clock::now();
+    for (size_t walk = 0; walk < num_walks; ++walk) {
+      for (auto node = nodes.front(); node; node = node->m_next) {
+        sum += node->m_value;
+      }
+    }
+    const auto end = ::std::chrono::high_resolution_clock::now();
+    const auto ns = ::std::chrono::duration_cast<::std::chrono::nanoseconds>(end - start).count();
+    const auto visits = list_length * num_walks;
+    ::std::cout << "locality " << (near ? "with" : "without") << " allocate_near: " << visits << " node visits, "
+                << static_cast<double>(ns) / static_cast<double>(visits) << " ns/node, " << page_changes
+                << " page changes per walk (checksum " << sum << ")\n";
+    for (auto &&node : nodes) {
+      ta.destroy(node);
+    }
+  }
+  /**
+   * \brief Time the slab allocator on a heap with many holes of mixed sizes.
+   *
+   * Each round frees a random half of the objects and allocates them again.
+   * @param num_objects Number of live objects.
+   * @param num_rounds Number of rounds.
+   **/
+  void slab_benchmark(size_t num_objects, size_t num_rounds)
+  {
+    ::mcppalloc::slab_allocator::details::slab_allocator_t slab(1 << 20, 1ull << 32);
+    ::std::minstd_rand rng(5);
+    ::std::vector<void *> objects(num_objects);
+    ::std::vector<size_t> sizes(num_objects);
+    for (size_t i = 0; i < num_objects; ++i) {
+      sizes[i] = 64 * (1 + rng() % 8);
+      objects[i] = slab.allocate_raw(sizes[i]);
+    }
+    const auto start = ::std::chrono::high_resolution_clock::now();
+    for (size_t round = 0; round < num_rounds; ++round) {
+      for (auto &&object : objects) {
+        if (rng() & 1) {
+          slab.deallocate_raw(object);
+          object = nullptr;
+        }
+      }
+      for (size_t i = 0; i < num_objects; ++i) {
+        if (!objects[i]) {
+          objects[i] = slab.allocate_raw(sizes[i]);
+        }
+      }
+    }
+    const auto end = ::std::chrono::high_resolution_clock::now();
+    const auto ns = ::std::chrono::duration_cast<::std::chrono::nanoseconds>(end - start).count();
+    const auto ops = num_objects * num_rounds;
+    ::std::cout << "slab allocator: " << num_objects << " objects, " << static_cast<double>(ns) / static_cast<double>(ops)
+                << " ns per free and allocate, " << slab.current_size() << " bytes used\n";
+    for (auto &&object : objects) {
+      slab.deallocate_raw(object);
+    }
+  }
+  /**
+   * \brief Time several threads allocating and freeing slab objects at once, directly or through thread caches.
+   * @param cached True if each thread uses a slab thread cache.
+   * @param num_threads Number of threads.
+   * @param size Size of objects.
+   * @param num_objects Number of objects each thread holds per round.
+   * @param num_rounds Number of rounds.
+   **/
+  void slab_threads_benchmark(bool cached, size_t num_threads, size_t size, size_t num_objects, size_t num_rounds)
+  {
+    using ::mcppalloc::slab_allocator::details::slab_thread_cache_t;
+    ::mcppalloc::slab_allocator::details::slab_allocator_t slab(1 << 20, 1ull << 34);
+    const auto start = ::std::chrono::high_resolution_clock::now();
+    ::std::vector<::std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&]() {
+        slab_thread_cache_t cache(slab, ::std::max<size_t>(slab_thread_cache_t::cs_default_max_bytes, size * 8));
+        ::std::vector<void *> objects(num_objects);
+        for (size_t round = 0; round < num_rounds; ++round) {
+          for (auto &&object : objects) {
+            object = cached ? cache.allocate_raw(size) : slab.allocate_raw(size);
+          }
+          for (auto &&object : objects) {
+            cached ? cache.deallocate_raw(object) : slab.deallocate_raw(object);
+          }
+        }
+      });
+    }
+    for (auto &&thread : threads) {
+      thread.join();
+    }
+    const auto end = ::std::chrono::high_resolution_clock::now();
+    const auto ns = ::std::chrono::duration_cast<::std::chrono::nanoseconds>(end - start).count();
+    const auto ops = num_threads * num_objects * num_rounds;
+    ::std::cout << "slab allocator " << (cached ? "with" : "without") << " thread caches: " << num_threads << " threads, "
+                << size << " byte objects, " << static_cast<double>(ns) / static_cast<double>(ops) << " ns per allocate and free, "
+                << slab.stats_snapshot().m_bins[0].m_global_lock_acquisitions << " lock acquisitions\n";
+  }
+}
+int main(int, char *[])
+{
+  static_assert(!::mcppalloc::has_on_allocation_v<default_policy_t::thread_policy_type>);
+  static_assert(!::mcppalloc::uses_user_data_v<default_policy_t>);
+  const size_t num_objects = 1000;
+  const size_t num_rounds = 1000;
+  for (size_t size : {16, 64, 256}) {
+    allocate_destroy_benchmark<default_policy_t>("default policy", num_objects, num_rounds, size);
+    allocate_destroy_benchmark<user_data_allocator_policy_t>("user data policy", num_objects, num_rounds, size);
+    allocate_destroy_benchmark<profiled_allocator_policy_t>("sampling heap profiler policy", num_objects, num_rounds, size);
+  }
+  for (bool hint : {false, true}) {
+    fragmentation_benchmark(hint, 100, 10000, 64);
+  }
+  for (bool near : {false, true}) {
+    locality_benchmark(near, 1 << 18, 1 << 18, 10);
+  }
+  slab_benchmark(1 << 16, 10);
+  for (bool cached : {false, true}) {
+    slab_threads_benchmark(cached, 4, 256, 1000, 1000);
+    // the size bitmap thread allocators refill with.
+    slab_threads_benchmark(cached, 4, (1 << 19) - 64, 4, 1000);
+  }
+  return 0;
+}
@@ -10,6 +10,27 @@ using namespace snowhouse;
 template <>
 ::mcppalloc::details::user_data_base_t mcppalloc::sparse::details::allocator_block_t<
     mcppalloc::default_allocator_policy_t<::mcpputil::aligned_allocator_t<void, 8ul>>>::s_default_user_data{};
+namespace
+{
+  struct user_data_thread_policy_t : public ::mcppalloc::default_allocator_thread_policy_t {
+    void on_allocation(void *, size_t)
+    {
+      ++m_num_allocations;
+    }
+    size_t m_num_allocations = 0;
+  };
+  struct user_data_allocator_policy_t : public ::mcppalloc::default_allocator_policy_t<::mcpputil::default_aligned_allocator_t> {
+    using thread_policy_type = user_data_thread_policy_t;
+    static const constexpr bool cs_uses_user_data = true;
+  };
+  static_assert(!::mcppalloc::has_on_allocation_v<::mcppalloc::default_allocator_thread_policy_t>);
+  static_assert(::mcppalloc::has_on_allocation_v<user_data_thread_policy_t>);
+  static_assert(!::mcppalloc::uses_user_data_v<::mcppalloc::default_allocator_policy_t<::mcpputil::default_aligned_allocator_t>>);
+  static_assert(::mcppalloc::uses_user_data_v<user_data_allocator_policy_t>);
+}
+template <>
+::mcppalloc::details::user_data_base_t
+    mcppalloc::sparse::details::allocator_block_t<user_data_allocator_policy_t>::s_default_user_data{};
 void allocator_block_tests()
 {
   describe("Block", []() {
@@ -229,6 +250,21 @@ void allocator_block_tests()
                  IsTrue());
       AssertThat(block.find_address(reinterpret_cast<uint8_t *>(alloc2) + 34 + aligned_header_size) == nullptr, IsTrue());
     });
+    it("user data", []() {
+      using user_data_block_type = typename ::mcppalloc::sparse::details::allocator_block_t<user_data_allocator_policy_t>;
+      using user_data_object_state_type = typename user_data_block_type::object_state_type;
+      void *memory2 = malloc(1000);
+      user_data_block_type block2(memory2, 992, 16, ::mcppalloc::c_infinite_length);
+      auto m = get_allocated_memory(block2.allocate(100));
+      AssertThat(user_data_object_state_type::from_object_start(m)->user_data() == &user_data_block_type::s_default_user_data,
+                 IsTrue());
+      block2.destroy(m);
+      m = get_allocated_memory(block2.allocate(100));
+      AssertThat(user_data_object_state_type::from_object_start(m)->user_data() == &user_data_block_type::s_default_user_data,
+                 IsTrue());
+      block2.destroy(m);
+      free(memory2);
+    });
     free(memory);
   });
 }
@@ -1,13 +1,83 @@
 #include <mcpputil/mcpputil/declarations.hpp>
 // This Must be first.
 #include <mcppalloc/mcppalloc_sparse/mcppalloc_sparse.hpp>
+#include <mcppalloc/sampling_heap_profiler_thread_policy.hpp>
 #include <mcpputil/mcpputil/aligned_allocator.hpp>
 #include <mcpputil/mcpputil/bandit.hpp>
 #include <mcpputil/mcpputil/literals.hpp>
 #include <mcpputil/mcpputil/memory_range.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 using namespace ::bandit;
 using namespace ::snowhouse;
 using namespace ::mcpputil::literals;
+namespace
+{
+  struct profiled_allocator_policy_t : public ::mcppalloc::default_allocator_policy_t<::mcpputil::default_aligned_allocator_t> {
+    using thread_policy_type = ::mcppalloc::sampling_heap_profiler_thread_policy_t;
+  };
+  struct memory_pressure_thread_policy_t : public ::mcppalloc::default_allocator_thread_policy_t {
+    void on_memory_pressure(const ::mcppalloc::memory_pressure_t &pressure)
+    {
+      ++m_num_calls;
+      m_last_level = pressure.m_level;
+    }
+    size_t m_num_calls = 0;
+    ::mcppalloc::memory_pressure_level_t m_last_level = ::mcppalloc::memory_pressure_level_t::none;
+  };
+  struct memory_pressure_allocator_policy_t : public ::mcppalloc::default_allocator_policy_t<::mcpputil::default_aligned_allocator_t> {
+    using thread_policy_type = memory_pressure_thread_policy_t;
+  };
+  struct tagged_thread_policy_t : public ::mcppalloc::default_allocator_thread_policy_t {
+    ::mcppalloc::details::allocation_failure_action_t on_allocation_failure(const ::mcppalloc::details::allocation_failure_t &failure)
+    {
+      if (failure.m_reason == ::mcppalloc::details::allocation_failure_reason_t::soft_quota) {
+        ++m_num_soft_quota;
+      } else if (failure.m_reason == ::mcppalloc::details::allocation_failure_reason_t::hard_quota) {
+        ++m_num_hard_quota;
+      } else {
+        ++m_num_out_of_memory;
+      }
+      if (m_always_reclaim) {
+        return ::mcppalloc::details::allocation_failure_action_t{false, false, true};
+      }
+      return ::mcppalloc::default_allocator_thread_policy_t::on_allocation_failure(failure);
+    }
+    size_t m_num_soft_quota = 0;
+    size_t m_num_hard_quota = 0;
+    size_t m_num_out_of_memory = 0;
+    /**
+     * \brief Ask to reclaim memory on every failure, even when that does not help.
+     **/
+    bool m_always_reclaim = false;
+  };
+  struct tagged_allocator_policy_t : public ::mcppalloc::default_allocator_policy_t<::mcpputil::default_aligned_allocator_t> {
+    using thread_policy_type = tagged_thread_policy_t;
+    static constexpr const bool cs_uses_allocation_tags = true;
+  };
+  /**
+   * \brief Write fake cgroup memory files.
+   **/
+  void write_cgroup_files(const ::std::string &prefix, size_t current, size_t high, size_t high_events, size_t max_events)
+  {
+    ::std::ofstream(prefix + "memory.current") << current << "\n";
+    ::std::ofstream(prefix + "memory.high") << high << "\n";
+    ::std::ofstream(prefix + "memory.events") << "low 0\nhigh " << high_events << "\nmax " << max_events << "\noom 0\noom_kill 0\n";
+  }
+}
+template <>
+::mcppalloc::details::user_data_base_t
+    mcppalloc::sparse::details::allocator_block_t<profiled_allocator_policy_t>::s_default_user_data{};
+template <>
+::mcppalloc::details::user_data_base_t
+    mcppalloc::sparse::details::allocator_block_t<memory_pressure_allocator_policy_t>::s_default_user_data{};
+template <>
+::mcppalloc::details::user_data_base_t
+    mcppalloc::sparse::details::allocator_block_t<tagged_allocator_policy_t>::s_default_user_data{};
 void allocator_tests()
 {
   describe("allocator", []() {
@@ -76,6 +146,70 @@ void allocator_tests()
                  Equals(static_cast<void *>(allocator->underlying_memory().begin())));
       //*/
     });
+    it("heap_segments", []() {
+      ::std::unique_ptr<allocator_type> allocator(new allocator_type());
+      AssertThat(allocator->initialize(::mcpputil::slab_t::page_size() * 4, 100000000), IsTrue());
+      AssertThat(allocator->num_heap_segments(), Equals(1_sz));
+      // take the address space right after the heap so that it can not grow in place.
+      ::mcpputil::slab_t blocker;
+      AssertThat(blocker.allocate(::mcpputil::slab_t::page_size(), allocator->underlying_memory().end()), IsTrue());
+      const bool blocked = blocker.begin() == allocator->underlying_memory().end();
+      const auto initial_begin = allocator->underlying_memory().begin();
+      auto memory1 = allocator->get_memory(::mcpputil::slab_t::page_size() * 4, true);
+      AssertThat(memory1.begin() != nullptr, IsTrue());
+      auto memory2 = allocator->get_memory(::mcpputil::slab_t::page_size() * 8, true);
+      AssertThat(memory2.begin() != nullptr, IsTrue());
+      AssertThat(allocator->underlying_memory().begin(), Equals(initial_begin));
+      AssertThat(allocator->heap_contains(memory2.begin()), IsTrue());
+      AssertThat(allocator->heap_contains(memory2.end() - 1), IsTrue());
+      AssertThat(allocator->size(), IsGreaterThanOrEqualTo(::mcpputil::slab_t::page_size() * 12));
+      if (blocked) {
+        AssertThat(allocator->num_heap_segments(), Equals(2_sz));
+        AssertThat(allocator->underlying_memory().memory_range().contains(memory2.begin()), IsFalse());
+        AssertThat(allocator->heap_contains(blocker.begin()), IsFalse());
+      }
+      // released memory goes back to the segment it came from.
+      auto memory3 = allocator->get_memory(::mcpputil::slab_t::page_size(), true);
+      allocator->release_memory(memory2);
+      AssertThat(allocator->in_free_list(memory2), IsTrue());
+      AssertThat(allocator->get_memory(::mcpputil::slab_t::page_size() * 8, false), Equals(memory2));
+      allocator->release_memory(memory3);
+      allocator->release_memory(memory2);
+      allocator->release_memory(memory1);
+      allocator->collapse();
+      AssertThat(allocator->free_list_length(), Equals(0_sz));
+      AssertThat(allocator->current_size(), Equals(0_sz));
+    });
+    it("emergency_reserve", []() {
+      const size_t heap_size = ::mcpputil::slab_t::page_size() * 64;
+      const size_t reserve_size = ::mcpputil::slab_t::page_size() * 8;
+      ::std::unique_ptr<allocator_type> allocator(new allocator_type());
+      AssertThat(allocator->initialize(heap_size, heap_size, reserve_size), IsTrue());
+      AssertThat(allocator->emergency_reserve_available(), Equals(reserve_size));
+      ta_type ta(*allocator);
+      // exhaust the heap without aborting.
+      ::std::vector<void *> ptrs;
+      for (;;) {
+        void *ptr = ta.try_allocate(1000).m_ptr;
+        if (!ptr) {
+          break;
+        }
+        ptrs.push_back(ptr);
+        AssertThat(ptrs.size(), IsLessThan(heap_size / 1000));
+      }
+      AssertThat(ptrs.empty(), IsFalse());
+      AssertThat(allocator->num_emergency_reserve_releases(), Equals(1_sz));
+      AssertThat(allocator->emergency_reserve_available(), Equals(0_sz));
+      // the reserve can not come back until memory is reclaimed.
+      AssertThat(allocator->replenish_emergency_reserve(), IsFalse());
+      for (auto &&ptr : ptrs) {
+        AssertThat(ta.destroy(ptr), IsTrue());
+      }
+      ta.reclaim_memory();
+      AssertThat(allocator->replenish_emergency_reserve(), IsTrue());
+      AssertThat(allocator->emergency_reserve_available(), Equals(reserve_size));
+      AssertThat(ta.try_allocate(1000).m_ptr != nullptr, IsTrue());
+    });
     it("test3", []() {
       ::std::unique_ptr<allocator_type> allocator = ::std::make_unique<allocator_type>();
       AssertThat(allocator->initialize(100000, 100000000), IsTrue());
@@ -158,5 +292,961 @@ void allocator_tests()
       void *alloc2 = ta2.allocate(100).m_ptr;
       (void)alloc2;
     });
+    it("sampling_heap_profiler", []() {
+      using profiled_allocator_type = ::mcppalloc::sparse::allocator_t<profiled_allocator_policy_t>;
+      auto allocator = ::std::make_unique<profiled_allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      auto &profiler = allocator->thread_policy();
+      profiler.set_sampling_interval(1);
+      auto &ta = allocator->initialize_thread();
+      ::std::vector<void *> ptrs;
+      for (size_t i = 0; i < 100; ++i) {
+        ptrs.push_back(ta.allocate(100).m_ptr);
+      }
+      // the first allocation on a thread may only seed the sampler.
+      AssertThat(profiler.num_live_samples(), IsGreaterThanOrEqualTo(99_sz));
+      ::std::stringstream ss;
+      profiler.write_profile(ss);
+      AssertThat(ss.str().find("heap profile: ") == 0, IsTrue());
+      AssertThat(ss.str().find("@ heap_v2/1\n") != ::std::string::npos, IsTrue());
+      AssertThat(ss.str().find("MAPPED_LIBRARIES:") != ::std::string::npos, IsTrue());
+      for (auto &&ptr : ptrs) {
+        AssertThat(ta.destroy(ptr), IsTrue());
+      }
+      AssertThat(profiler.num_live_samples(), Equals(0_sz));
+      allocator->destroy_thread();
+    });
+    it("memory_pressure", []() {
+      using pressure_allocator_type = ::mcppalloc::sparse::allocator_t<memory_pressure_allocator_policy_t>;
+      using ::mcppalloc::memory_pressure_level_t;
+      const ::std::string prefix = "/tmp/mcppalloc_memory_pressure_test_" + ::std::to_string(::getpid()) + "_";
+      write_cgroup_files(prefix, 100, 1000, 0, 0);
+      auto allocator = ::std::make_unique<pressure_allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      allocator->set_memory_pressure_watcher(::mcppalloc::cgroup_memory_watcher_t(
+          prefix + "memory.current", prefix + "memory.high", prefix + "memory.events"));
+      auto &ta = allocator->initialize_thread();
+      const size_t id = ta.find_block_set_id(100);
+      ::std::vector<void *> ptrs;
+      for (size_t i = 0; i < 100; ++i) {
+        ptrs.push_back(ta.allocate(100).m_ptr);
+      }
+      for (auto &&ptr : ptrs) {
+        AssertThat(ta.destroy(ptr), IsTrue());
+      }
+      AssertThat(ta.allocators()[id].m_blocks.empty(), IsFalse());
+      AssertThat(allocator->check_memory_pressure().m_level == memory_pressure_level_t::none, IsTrue());
+      // the thread policy only hears about changes.
+      AssertThat(allocator->thread_policy().m_num_calls, Equals(0_sz));
+      // usage near memory.high.
+      write_cgroup_files(prefix, 900, 1000, 0, 0);
+      AssertThat(allocator->check_memory_pressure().m_level == memory_pressure_level_t::moderate, IsTrue());
+      AssertThat(ta.memory_pressure() == memory_pressure_level_t::moderate, IsTrue());
+      AssertThat(allocator->thread_policy().m_last_level == memory_pressure_level_t::moderate, IsTrue());
+      // the next allocation gives back empty blocks in other bins.
+      void *large = ta.allocate(2000).m_ptr;
+      AssertThat(large != nullptr, IsTrue());
+      AssertThat(ta.allocators()[id].m_blocks.empty(), IsTrue());
+      // hitting the limit is critical even if usage has dropped.
+      write_cgroup_files(prefix, 100, 1000, 0, 1);
+      AssertThat(allocator->check_memory_pressure().m_level == memory_pressure_level_t::critical, IsTrue());
+      AssertThat(allocator->memory_pressure() == memory_pressure_level_t::critical, IsTrue());
+      write_cgroup_files(prefix, 100, 1000, 0, 1);
+      AssertThat(allocator->check_memory_pressure().m_level == memory_pressure_level_t::none, IsTrue());
+      AssertThat(ta.memory_pressure() == memory_pressure_level_t::none, IsTrue());
+      AssertThat(allocator->thread_policy().m_num_calls, Equals(3_sz));
+      AssertThat(allocator->purge_free_memory(), IsGreaterThan(0_sz));
+      AssertThat(ta.destroy(large), IsTrue());
+      allocator->destroy_thread();
+      for (auto &&name : {"memory.current", "memory.high", "memory.events"}) {
+        ::std::remove((prefix + name).c_str());
+      }
+    });
+    it("donate_surplus_blocks", []() {
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(10000000, 100000000), IsTrue());
+      ta_type ta1(*allocator);
+      ta_type ta2(*allocator);
+      const size_t id = ta1.find_block_set_id(100);
+      // leave ta1 with several empty blocks.
+      ta1.set_minimum_local_blocks(100);
+      ::std::vector<void *> ptrs;
+      while (ta1.allocators()[id].m_blocks.size() < 4) {
+        ptrs.push_back(ta1.allocate(100).m_ptr);
+      }
+      for (auto &&ptr : ptrs) {
+        AssertThat(ta1.destroy(ptr), IsTrue());
+      }
+      ptrs.clear();
+      // nothing is requested so nothing is donated.
+      ta1._do_maintenance();
+      AssertThat(allocator->num_global_blocks(), Equals(0_sz));
+      // ta2 has to create a block, which requests one for next time.
+      ptrs.push_back(ta2.allocate(100).m_ptr);
+      AssertThat(allocator->_block_demand(id), Equals(1_sz));
+      const size_t ta1_blocks = ta1.allocators()[id].m_blocks.size();
+      ta1._do_maintenance();
+      AssertThat(allocator->_block_demand(id), Equals(0_sz));
+      AssertThat(allocator->num_global_blocks(), Equals(1_sz));
+      AssertThat(ta1.allocators()[id].m_blocks.size(), Equals(ta1_blocks - 1));
+      // ta2 picks up the donated block instead of creating one.
+      while (ta2.allocators()[id].m_blocks.size() < 2) {
+        ptrs.push_back(ta2.allocate(100).m_ptr);
+      }
+      AssertThat(allocator->num_global_blocks(), Equals(0_sz));
+      AssertThat(allocator->_block_demand(id), Equals(0_sz));
+      for (auto &&ptr : ptrs) {
+        AssertThat(ta2.destroy(ptr), IsTrue());
+      }
+      // blocks that still hold objects are not donated, so their objects can be destroyed by their owner.
+      ta_type ta3(*allocator);
+      ::std::vector<void *> kept;
+      while (ta3.allocators()[id].m_blocks.size() < 3) {
+        kept.push_back(ta3.allocate(100).m_ptr);
+      }
+      for (size_t i = 0; i < kept.size(); ++i) {
+        if (i % 2) {
+          AssertThat(ta3.destroy(kept[i]), IsTrue());
+        }
+      }
+      void *ptr = ta2.allocate(100, ::mcppalloc::allocation_lifetime_t::long_lived).m_ptr;
+      AssertThat(allocator->_block_demand(id), IsGreaterThan(0_sz));
+      ta3._do_maintenance();
+      AssertThat(allocator->num_global_blocks(), Equals(0_sz));
+      for (size_t i = 0; i < kept.size(); i += 2) {
+        AssertThat(ta3.destroy(kept[i]), IsTrue());
+      }
+      AssertThat(ta2.destroy(ptr), IsTrue());
+    });
+    it("global_block_best_fit", []() {
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(10000000, 100000000), IsTrue());
+      const size_t id = ta_type::find_block_set_id(100);
+      ::std::vector<::std::vector<void *>> ptrs_by_block;
+      ::std::vector<uint8_t *> block_begins;
+      {
+        ta_type ta(*allocator);
+        auto &abs = ta.allocators()[id];
+        ::std::vector<void *> ptrs;
+        while (abs.m_blocks.size() < 4) {
+          const size_t num_blocks = abs.m_blocks.size();
+          void *ptr = ta.allocate(100).m_ptr;
+          if (abs.m_blocks.size() != num_blocks && !ptrs.empty()) {
+            ptrs_by_block.push_back(::std::move(ptrs));
+            ptrs.clear();
+          }
+          ptrs.push_back(ptr);
+        }
+        ptrs_by_block.push_back(::std::move(ptrs));
+        for (auto &&block : abs.m_blocks) {
+          block_begins.push_back(block.begin());
+        }
+        // leave block 0 mostly free, block 1 half free, block 2 full.
+        for (size_t i = 1; i < ptrs_by_block[0].size(); ++i) {
+          AssertThat(ta.destroy(ptrs_by_block[0][i]), IsTrue());
+        }
+        for (size_t i = 0; i < ptrs_by_block[1].size() / 2; ++i) {
+          AssertThat(ta.destroy(ptrs_by_block[1][i]), IsTrue());
+        }
+      }
+      AssertThat(allocator->num_global_blocks(), Equals(4_sz));
+      ta_type ta2(*allocator);
+      AssertThat(ta2.allocate(100).m_ptr != nullptr, IsTrue());
+      // the fullest usable block is adopted.
+      AssertThat(ta2.allocators()[id].m_blocks.front().begin(), Equals(block_begins[1]));
+      AssertThat(allocator->num_global_blocks(), Equals(3_sz));
+      // other lifetimes do not adopt partially used blocks.
+      AssertThat(ta2.allocate(100, ::mcppalloc::allocation_lifetime_t::long_lived).m_ptr != nullptr, IsTrue());
+      AssertThat(allocator->num_global_blocks(), Equals(3_sz));
+      const auto long_lived_begin = ta2.allocators(::mcppalloc::allocation_lifetime_t::long_lived)[id].m_blocks.front().begin();
+      AssertThat(::std::find(block_begins.begin(), block_begins.end(), long_lived_begin) == block_begins.end(), IsTrue());
+      {
+        // registrations follow blocks moved within the global pool.
+        MCPPALLOC_CONCURRENCY_LOCK_GUARD(allocator->_mutex());
+        for (auto &&handle : allocator->_u_blocks()) {
+          AssertThat(handle.m_block->begin(), Equals(handle.m_begin));
+        }
+      }
+    });
+    it("park_thread_allocators", []() {
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(10000000, 100000000), IsTrue());
+      allocator->set_max_parked_thread_allocators(2);
+      const size_t id = ta_type::find_block_set_id(100);
+      auto &ta = allocator->initialize_thread();
+      void *ptr = ta.allocate(100).m_ptr;
+      const size_t num_blocks = ta.allocators()[id].m_blocks.size();
+      allocator->destroy_thread();
+      AssertThat(allocator->num_parked_thread_allocators(), Equals(1_sz));
+      AssertThat(allocator->num_global_blocks(), Equals(0_sz));
+      // the next thread adopts the parked thread allocator with its blocks.
+      ::std::thread thread([&allocator, id, num_blocks, ptr]() {
+        auto &ta2 = allocator->initialize_thread();
+        AssertThat(allocator->num_parked_thread_allocators(), Equals(0_sz));
+        AssertThat(ta2.allocators()[id].m_blocks.size(), Equals(num_blocks));
+        AssertThat(ta2.destroy(ptr), IsTrue());
+        allocator->destroy_thread();
+      });
+      thread.join();
+      AssertThat(allocator->num_parked_thread_allocators(), Equals(1_sz));
+      // parking is capped.
+      ::std::vector<::std::thread> threads;
+      for (size_t i = 0; i < 4; ++i) {
+        threads.emplace_back([&allocator]() {
+          auto &ta3 = allocator->initialize_thread();
+          ta3.destroy(ta3.allocate(100).m_ptr);
+          allocator->destroy_thread();
+        });
+      }
+      for (auto &&t : threads) {
+        t.join();
+      }
+      AssertThat(allocator->num_parked_thread_allocators(), IsLessThanOrEqualTo(2_sz));
+      AssertThat(allocator->num_parked_thread_allocators(), IsGreaterThanOrEqualTo(1_sz));
+      allocator->set_max_parked_thread_allocators(0);
+      allocator->shutdown();
+      AssertThat(allocator->num_parked_thread_allocators(), Equals(0_sz));
+    });
+    it("park_resets_thread_state", []() {
+      using tagged_allocator_type = ::mcppalloc::sparse::allocator_t<tagged_allocator_policy_t>;
+      auto allocator = ::std::make_unique<tagged_allocator_type>();
+      AssertThat(allocator->initialize(10000000, 100000000), IsTrue());
+      allocator->set_max_parked_thread_allocators(1);
+      void *ptr = nullptr;
+      ::std::thread exited([&allocator, &ptr]() {
+        auto &ta = allocator->initialize_thread();
+        ptr = ta.allocate(100, 1).m_ptr;
+        AssertThat(ta.reserve(100, 1000), IsTrue());
+        ta.begin_no_slow_path();
+        allocator->destroy_thread();
+      });
+      exited.join();
+      AssertThat(allocator->num_parked_thread_allocators(), Equals(1_sz));
+      // the tag bytes of the exited thread are no longer pending.
+      AssertThat(allocator->tag_live_bytes(1), IsGreaterThanOrEqualTo(100_sz));
+      {
+        MCPPALLOC_CONCURRENCY_LOCK_GUARD(allocator->_mutex());
+        allocator->_u_destroy_remote(ptr);
+      }
+      ::std::thread adopter([&allocator]() {
+        auto &ta = allocator->initialize_thread();
+        AssertThat(allocator->num_parked_thread_allocators(), Equals(0_sz));
+        // objects queued while parked are destroyed on adoption.
+        AssertThat(ta.memory_usage().m_live_objects, Equals(0_sz));
+        AssertThat(ta.tag_live_bytes(1), Equals(0_sz));
+        // the no slow path section of the exited thread is over.
+        const auto num_events = ta.num_slow_path_events();
+        ta.reclaim_memory();
+        AssertThat(ta.num_slow_path_events(), Equals(num_events));
+        allocator->destroy_thread();
+      });
+      adopter.join();
+      allocator->set_max_parked_thread_allocators(0);
+      allocator->shutdown();
+    });
+    it("stats_snapshot", []() {
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      auto &ta = allocator->initialize_thread();
+      ::std::vector<void *> ptrs;
+      for (size_t i = 0; i < 100; ++i) {
+        ptrs.push_back(ta.allocate(100).m_ptr);
+      }
+      auto stats = allocator->stats_snapshot();
+      AssertThat(stats.m_num_threads, Equals(1_sz));
+      const size_t bin = ta.find_block_set_id(100);
+      AssertThat(stats.m_bins[bin].m_allocations, Equals(100u));
+      AssertThat(stats.m_bins[bin].m_bytes_allocated, IsGreaterThanOrEqualTo(10000u));
+      AssertThat(stats.m_bins[bin].m_blocks_created, IsGreaterThanOrEqualTo(1u));
+      AssertThat(stats.m_bins[bin].m_global_lock_acquisitions, IsGreaterThanOrEqualTo(1u));
+      AssertThat(stats.totals().live_objects(), Equals(100));
+      for (size_t i = 0; i < 50; ++i) {
+        AssertThat(ta.destroy(ptrs[i]), IsTrue());
+      }
+      stats = allocator->stats_snapshot();
+      AssertThat(stats.m_bins[bin].m_deallocations, Equals(50u));
+      AssertThat(stats.totals().live_objects(), Equals(50));
+      for (size_t i = 50; i < 100; ++i) {
+        AssertThat(ta.destroy(ptrs[i]), IsTrue());
+      }
+      allocator->destroy_thread();
+      // counters of destroyed threads are retained.
+      stats = allocator->stats_snapshot();
+      AssertThat(stats.m_num_threads, Equals(0_sz));
+      AssertThat(stats.totals().m_allocations, Equals(100u));
+      AssertThat(stats.totals().live_objects(), Equals(0));
+      AssertThat(stats.totals().live_bytes(), Equals(0));
+    });
+    it("arena", []() {
+      using arena_type = ::mcppalloc::sparse::arena_t<policy>;
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      {
+        arena_type arena(*allocator, 4096);
+        // objects are packed with no header.
+        auto block1 = arena.allocate(24);
+        auto block2 = arena.allocate(24);
+        AssertThat(block1.m_size, Equals(32_sz));
+        AssertThat(static_cast<uint8_t *>(block2.m_ptr), Equals(static_cast<uint8_t *>(block1.m_ptr) + 32));
+        AssertThat(arena.num_chunks(), Equals(1_sz));
+        // full chunks are chained.
+        for (size_t i = 0; i < 1000; ++i) {
+          auto block = arena.allocate(100);
+          AssertThat(block.m_ptr != nullptr, IsTrue());
+          ::std::memset(block.m_ptr, 0xab, 100);
+          arena.destroy(block.m_ptr);
+        }
+        const size_t num_chunks = arena.num_chunks();
+        AssertThat(num_chunks, IsGreaterThan(1_sz));
+        // allocations larger than a chunk get their own.
+        auto large = arena.allocate(10000);
+        AssertThat(large.m_size, Equals(10000_sz));
+        AssertThat(arena.num_chunks(), Equals(num_chunks + 1));
+        // reset reuses the chunks from the start.
+        arena.reset();
+        AssertThat(arena.allocate(24).m_ptr, Equals(block1.m_ptr));
+        for (size_t i = 0; i < 1000; ++i) {
+          arena.allocate(100);
+        }
+        AssertThat(arena.num_chunks(), Equals(num_chunks + 1));
+        AssertThat(arena.memory_size(), IsGreaterThanOrEqualTo(4096 * num_chunks + 10000));
+        arena.release();
+        AssertThat(arena.num_chunks(), Equals(0_sz));
+        arena.allocate(100);
+      }
+      {
+        // zero sized allocations on a fresh arena still get memory.
+        arena_type arena(*allocator, 4096);
+        auto block1 = arena.allocate(0);
+        auto block2 = arena.allocate(0);
+        AssertThat(block1.m_ptr != nullptr, IsTrue());
+        AssertThat(block1.m_size, Equals(mcpputil::c_alignment));
+        AssertThat(block2.m_ptr != block1.m_ptr, IsTrue());
+      }
+      allocator->collapse();
+      AssertThat(allocator->current_size(), Equals(0_sz));
+    });
+    it("epoch_reclaimer", []() {
+      using reclaimer_type = ::mcppalloc::sparse::epoch_reclaimer_t<policy>;
+      using participant_type = ::mcppalloc::sparse::epoch_participant_t<policy>;
+      using object_state_type = reclaimer_type::object_state_type;
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      auto &ta = allocator->initialize_thread();
+      {
+        reclaimer_type reclaimer(*allocator);
+        participant_type writer(reclaimer);
+        participant_type reader(reclaimer);
+        ::std::vector<void *> ptrs;
+        for (size_t i = 0; i < 100; ++i) {
+          ptrs.push_back(ta.allocate(100).m_ptr);
+        }
+        AssertThat(ta.memory_usage().m_live_objects, Equals(100_sz));
+        // a pinned reader keeps retired objects alive.
+        reader.enter();
+        for (auto &&ptr : ptrs) {
+          writer.retire(ptr);
+        }
+        AssertThat(writer.reclaim(), Equals(0_sz));
+        AssertThat(writer.num_retired(), Equals(100_sz));
+        AssertThat(object_state_type::from_object_start(ptrs.front())->quasi_freed(), IsFalse());
+        reader.exit();
+        AssertThat(writer.reclaim(), Equals(100_sz));
+        AssertThat(ta.memory_usage().m_live_objects, Equals(100_sz));
+        // the owning thread destroys them on its next allocation.
+        void *ptr = ta.allocate(100).m_ptr;
+        AssertThat(ta.memory_usage().m_live_objects, Equals(1_sz));
+        // objects retired by a participant that goes away are adopted by the reclaimer.
+        reader.enter();
+        {
+          participant_type temporary(reclaimer);
+          temporary.retire(ptr);
+        }
+        AssertThat(reclaimer.num_orphans(), Equals(1_sz));
+        reader.exit();
+        reclaimer.reclaim_orphans();
+        reclaimer.reclaim_orphans();
+        AssertThat(reclaimer.num_orphans(), Equals(0_sz));
+      }
+      allocator->destroy_thread();
+    });
+    it("allocation_tag_quota_bulk_destroy", []() {
+      using tagged_allocator_type = ::mcppalloc::sparse::allocator_t<tagged_allocator_policy_t>;
+      auto allocator = ::std::make_unique<tagged_allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      auto &ta = allocator->initialize_thread();
+      allocator->set_tag_quota(1, 0, 1 << 17);
+      ::std::vector<::mcppalloc::details::object_state_base_t *> states;
+      for (void *ptr = ta.try_allocate(1024, 1).m_ptr; ptr; ptr = ta.try_allocate(1024, 1).m_ptr) {
+        states.push_back(tagged_allocator_type::object_state_type::from_object_start(ptr));
+      }
+      const size_t num_objects = states.size();
+      AssertThat(num_objects, IsGreaterThan(0_sz));
+      AssertThat(allocator->thread_policy().m_num_hard_quota, Equals(1_sz));
+      // objects that die through bulk destroy and collect settle their tag.
+      allocator->bulk_destroy_memory(states);
+      auto stats = allocator->stats_snapshot();
+      AssertThat(stats.m_tags[1].live_objects(), Equals(0));
+      AssertThat(stats.totals().live_objects(), Equals(0));
+      AssertThat(ta.tag_live_bytes(1), Equals(0_sz));
+      ta.reclaim_memory();
+      AssertThat(ta.memory_usage().m_live_objects, Equals(0_sz));
+      // so the quota admits as much again.
+      ::std::vector<void *> ptrs;
+      for (size_t i = 0; i < num_objects; ++i) {
+        void *ptr = ta.try_allocate(1024, 1).m_ptr;
+        AssertThat(ptr != nullptr, IsTrue());
+        ptrs.push_back(ptr);
+      }
+      AssertThat(ta.try_allocate(1024, 1).m_ptr == nullptr, IsTrue());
+      for (auto &&ptr : ptrs) {
+        AssertThat(ta.destroy(ptr), IsTrue());
+      }
+      stats = allocator->stats_snapshot();
+      AssertThat(stats.m_tags[1].live_bytes(), Equals(0));
+      AssertThat(ta.tag_live_bytes(1), Equals(0_sz));
+      allocator->destroy_thread();
+    });
+    it("bounded_allocation_attempts", []() {
+      using tagged_allocator_type = ::mcppalloc::sparse::allocator_t<tagged_allocator_policy_t>;
+      using tagged_ta_type = tagged_allocator_type::thread_allocator_type;
+      const size_t heap_size = ::mcpputil::slab_t::page_size() * 64;
+      auto allocator = ::std::make_unique<tagged_allocator_type>();
+      AssertThat(allocator->initialize(heap_size, heap_size), IsTrue());
+      auto &policy = allocator->thread_policy();
+      policy.m_always_reclaim = true;
+      auto &ta = allocator->initialize_thread();
+      // a policy that keeps asking to reclaim does not keep a tag over its hard quota spinning.
+      allocator->set_tag_quota(1, 0, 1);
+      AssertThat(ta.try_allocate(100, 1).m_ptr == nullptr, IsTrue());
+      AssertThat(policy.m_num_hard_quota, Equals(tagged_ta_type::cs_max_allocation_attempts));
+      // nor an allocation that is out of memory.
+      ::std::vector<void *> ptrs;
+      for (void *ptr = ta.try_allocate(1000).m_ptr; ptr; ptr = ta.try_allocate(1000).m_ptr) {
+        ptrs.push_back(ptr);
+      }
+      AssertThat(ptrs.empty(), IsFalse());
+      AssertThat(policy.m_num_out_of_memory, Equals(tagged_ta_type::cs_max_allocation_attempts));
+      for (auto &&ptr : ptrs) {
+        AssertThat(ta.destroy(ptr), IsTrue());
+      }
+      allocator->destroy_thread();
+    });
+    it("epoch_reclaimer_remote", []() {
+      using tagged_allocator_type = ::mcppalloc::sparse::allocator_t<tagged_allocator_policy_t>;
+      using reclaimer_type = ::mcppalloc::sparse::epoch_reclaimer_t<tagged_allocator_policy_t>;
+      using participant_type = ::mcppalloc::sparse::epoch_participant_t<tagged_allocator_policy_t>;
+      auto allocator = ::std::make_unique<tagged_allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      reclaimer_type reclaimer(*allocator);
+      // objects left in global blocks by a thread that exited.
+      ::std::vector<void *> orphaned;
+      ::std::thread exited([&allocator, &orphaned]() {
+        auto &ta = allocator->initialize_thread();
+        for (size_t i = 0; i < 100; ++i) {
+          orphaned.push_back(ta.allocate(1000, 2).m_ptr);
+        }
+        allocator->destroy_thread();
+      });
+      exited.join();
+      // objects owned by a thread that is still running.
+      ::std::vector<void *> owned;
+      ::std::atomic<size_t> stage{0};
+      ::std::thread owner([&allocator, &owned, &stage]() {
+        auto &ta = allocator->initialize_thread();
+        for (size_t i = 0; i < 100; ++i) {
+          owned.push_back(ta.allocate(100, 1).m_ptr);
+        }
+        stage = 1;
+        while (stage.load() != 2) {
+          ::std::this_thread::yield();
+        }
+        // queued objects are destroyed by the owner on its next allocation.
+        AssertThat(ta.memory_usage().m_live_objects, Equals(100_sz));
+        AssertThat(ta.destroy(ta.allocate(100).m_ptr), IsTrue());
+        AssertThat(ta.memory_usage().m_live_objects, Equals(0_sz));
+        allocator->destroy_thread();
+      });
+      while (stage.load() != 1) {
+        ::std::this_thread::yield();
+      }
+      AssertThat(allocator->stats_snapshot().totals().live_objects(), Equals(200));
+      {
+        participant_type participant(reclaimer);
+        for (auto &&ptr : owned) {
+          participant.retire(ptr);
+        }
+        for (auto &&ptr : orphaned) {
+          participant.retire(ptr);
+        }
+        AssertThat(participant.reclaim(), Equals(200_sz));
+      }
+      // objects in global blocks are destroyed right away.
+      auto stats = allocator->stats_snapshot();
+      AssertThat(stats.m_tags[2].live_objects(), Equals(0));
+      AssertThat(stats.m_tags[1].live_objects(), Equals(100));
+      AssertThat(allocator->memory_usage().m_global.m_live_objects, Equals(0_sz));
+      AssertThat(allocator->tag_live_bytes(2), Equals(0_sz));
+      stage = 2;
+      owner.join();
+      stats = allocator->stats_snapshot();
+      AssertThat(stats.totals().live_objects(), Equals(0));
+      AssertThat(stats.totals().live_bytes(), Equals(0));
+      AssertThat(stats.m_tags[1].live_objects(), Equals(0));
+      AssertThat(allocator->tag_live_bytes(1), Equals(0_sz));
+    });
+    it("epoch_reclaimer_concurrent", []() {
+      using reclaimer_type = ::mcppalloc::sparse::epoch_reclaimer_t<policy>;
+      using participant_type = ::mcppalloc::sparse::epoch_participant_t<policy>;
+      using guard_type = ::mcppalloc::sparse::epoch_guard_t<policy>;
+      struct node_t {
+        size_t m_value;
+        size_t m_check;
+      };
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      reclaimer_type reclaimer(*allocator);
+      reclaimer.set_batch_size(64);
+      ::std::atomic<node_t *> shared{nullptr};
+      ::std::atomic<bool> done{false};
+      ::std::atomic<size_t> torn{0};
+      auto reader = [&]() {
+        participant_type participant(reclaimer);
+        while (!done.load()) {
+          guard_type guard(participant);
+          auto node = shared.load();
+          if (node && node->m_check != ~node->m_value) {
+            ++torn;
+          }
+        }
+      };
+      ::std::thread reader1(reader);
+      ::std::thread reader2(reader);
+      {
+        auto &ta = allocator->initialize_thread();
+        participant_type participant(reclaimer);
+        for (size_t i = 0; i < 20000; ++i) {
+          auto node = static_cast<node_t *>(ta.allocate(sizeof(node_t)).m_ptr);
+          node->m_value = i;
+          node->m_check = ~i;
+          auto old = shared.exchange(node);
+          if (old) {
+            participant.retire(old);
+          }
+        }
+        done = true;
+        reader1.join();
+        reader2.join();
+        participant.retire(shared.exchange(nullptr));
+      }
+      AssertThat(torn.load(), Equals(0_sz));
+      allocator->destroy_thread();
+    });
+    it("heaps", []() {
+      using heap_type = ::mcppalloc::sparse::heap_t<policy>;
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      heap_type heap1(*allocator);
+      heap_type heap2(*allocator);
+      ::std::vector<void *> ptrs1;
+      ::std::vector<void *> ptrs2;
+      for (size_t i = 0; i < 1000; ++i) {
+        const size_t size = 16 + (i % 10) * 100;
+        ptrs1.push_back(heap1.allocate(size).m_ptr);
+        ptrs2.push_back(heap2.allocate(size).m_ptr);
+        ::std::memset(ptrs2.back(), static_cast<int>(i & 0xff), size);
+      }
+      // objects can still be freed one at a time, but only by their own heap.
+      AssertThat(heap2.destroy(ptrs1.back()), IsFalse());
+      AssertThat(heap1.destroy(ptrs1.back()), IsTrue());
+      ptrs1.pop_back();
+      AssertThat(heap1.memory_usage().m_live_objects, Equals(999_sz));
+      heap1.destroy();
+      AssertThat(heap1.memory_usage().m_primary_bytes, Equals(0_sz));
+      AssertThat(heap1.memory_usage().m_live_objects, Equals(0_sz));
+      // the other heap is untouched.
+      AssertThat(allocator->stats_snapshot().totals().live_objects(), Equals(1000));
+      AssertThat(heap2.memory_usage().m_live_objects, Equals(1000_sz));
+      for (size_t i = 0; i < ptrs2.size(); ++i) {
+        AssertThat(*static_cast<uint8_t *>(ptrs2[i]), Equals(static_cast<uint8_t>(i & 0xff)));
+      }
+      // the heap can be reused after destruction.
+      void *ptr = heap1.allocate(100).m_ptr;
+      AssertThat(ptr != nullptr, IsTrue());
+      AssertThat(heap1.destroy(ptr), IsTrue());
+      heap1.destroy();
+      heap2.destroy();
+      allocator->collapse();
+      AssertThat(allocator->current_size(), Equals(0_sz));
+    });
+    it("heap_isolation", []() {
+      using heap_type = ::mcppalloc::sparse::heap_t<policy>;
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      // an exited thread leaves a mostly free block with a live object in the global pool.
+      size_t *foreign;
+      {
+        ta_type ta(*allocator);
+        foreign = static_cast<size_t *>(ta.allocate(100).m_ptr);
+        *foreign = 0x5a5a;
+      }
+      AssertThat(allocator->num_global_blocks(), Equals(1_sz));
+      heap_type heap(*allocator);
+      const size_t id = ta_type::find_block_set_id(100);
+      ::std::vector<void *> ptrs;
+      while (heap.thread_allocator().allocators()[id].m_blocks.size() < 3) {
+        ptrs.push_back(heap.allocate(100).m_ptr);
+      }
+      // the heap does not adopt the block.
+      AssertThat(allocator->num_global_blocks(), Equals(1_sz));
+      for (size_t i = 0; i < ptrs.size(); i += 2) {
+        AssertThat(heap.destroy(ptrs[i]), IsTrue());
+      }
+      // nor donate its own blocks to a thread asking for one.
+      ta_type ta2(*allocator);
+      void *ptr = ta2.allocate(100, ::mcppalloc::allocation_lifetime_t::long_lived).m_ptr;
+      AssertThat(allocator->_block_demand(id), IsGreaterThan(0_sz));
+      heap.thread_allocator()._do_maintenance();
+      AssertThat(allocator->num_global_blocks(), Equals(1_sz));
+      AssertThat(ta2.destroy(ptr), IsTrue());
+      heap.destroy();
+      // the foreign object survives the heap.
+      AssertThat(*foreign, Equals(0x5a5a_sz));
+      AssertThat(allocator->stats_snapshot().totals().live_objects(), Equals(1));
+      AssertThat(heap.memory_usage().m_live_objects, Equals(0_sz));
+    });
+    it("allocation_tags", []() {
+      using tagged_allocator_type = ::mcppalloc::sparse::allocator_t<tagged_allocator_policy_t>;
+      auto allocator = ::std::make_unique<tagged_allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      auto &ta = allocator->initialize_thread();
+      ::std::vector<void *> ptrs;
+      for (size_t i = 0; i < 100; ++i) {
+        ptrs.push_back(ta.allocate(64, 1).m_ptr);
+        ptrs.push_back(ta.allocate(256, 2).m_ptr);
+      }
+      auto stats = allocator->stats_snapshot();
+      AssertThat(stats.m_tags[1].live_objects(), Equals(100));
+      AssertThat(stats.m_tags[2].live_objects(), Equals(100));
+      AssertThat(stats.m_tags[0].live_objects(), Equals(0));
+      AssertThat(ta.tag_live_bytes(2), IsGreaterThanOrEqualTo(25600_sz));
+      // allocating near another object keeps the tag asked for.
+      void *near = ta.allocate_near(ptrs[0], 64, 3).m_ptr;
+      AssertThat(allocator->stats_snapshot().m_tags[3].live_objects(), Equals(1));
+      AssertThat(ta.tag_live_bytes(3), IsGreaterThanOrEqualTo(64_sz));
+      AssertThat(ta.destroy(near), IsTrue());
+      AssertThat(ta.tag_live_bytes(3), Equals(0_sz));
+      // destroy attributes objects to the tag they were allocated with.
+      for (size_t i = 0; i < ptrs.size(); i += 2) {
+        AssertThat(ta.destroy(ptrs[i]), IsTrue());
+      }
+      stats = allocator->stats_snapshot();
+      AssertThat(stats.m_tags[1].live_objects(), Equals(0));
+      AssertThat(stats.m_tags[2].live_objects(), Equals(100));
+      AssertThat(ta.tag_live_bytes(1), Equals(0_sz));
+      // crossing the soft quota notifies once and still allocates.
+      const size_t live = ta.tag_live_bytes(2);
+      allocator->set_tag_quota(2, live + 1000, live + 4096);
+      for (size_t i = 0; i < 8; ++i) {
+        void *ptr = ta.try_allocate(256, 2).m_ptr;
+        AssertThat(ptr != nullptr, IsTrue());
+        ptrs.push_back(ptr);
+      }
+      AssertThat(allocator->thread_policy().m_num_soft_quota, Equals(1_sz));
+      AssertThat(allocator->thread_policy().m_num_hard_quota, Equals(0_sz));
+      // the hard quota fails allocations of the tag only.
+      while (ta.tag_live_bytes(2) + 256 <= live + 4096) {
+        ptrs.push_back(ta.allocate(256, 2).m_ptr);
+      }
+      AssertThat(ta.try_allocate(256, 2).m_ptr == nullptr, IsTrue());
+      AssertThat(allocator->thread_policy().m_num_hard_quota, Equals(1_sz));
+      void *untagged = ta.try_allocate(256).m_ptr;
+      AssertThat(untagged != nullptr, IsTrue());
+      // freeing memory of the tag lets it allocate again.
+      AssertThat(ta.destroy(ptrs.back()), IsTrue());
+      ptrs.pop_back();
+      void *ptr = ta.try_allocate(256, 2).m_ptr;
+      AssertThat(ptr != nullptr, IsTrue());
+      AssertThat(ta.destroy(ptr), IsTrue());
+      AssertThat(ta.destroy(untagged), IsTrue());
+      for (size_t i = 1; i < ptrs.size(); i += 2) {
+        AssertThat(ta.destroy(ptrs[i]), IsTrue());
+      }
+      for (size_t i = 200; i < ptrs.size(); i += 2) {
+        AssertThat(ta.destroy(ptrs[i]), IsTrue());
+      }
+      AssertThat(allocator->stats_snapshot().m_tags[2].live_objects(), Equals(0));
+      allocator->destroy_thread();
+    });
+    it("lifetime_hints", []() {
+      using ::mcppalloc::allocation_lifetime_t;
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      ta_type ta(*allocator);
+      const size_t id = ta.find_block_set_id(64);
+      ::std::vector<void *> short_lived;
+      ::std::vector<void *> long_lived;
+      for (size_t i = 0; i < 4000; ++i) {
+        if (i % 32 == 0) {
+          long_lived.push_back(ta.allocate(64, allocation_lifetime_t::long_lived).m_ptr);
+        } else {
+          short_lived.push_back(ta.allocate(64).m_ptr);
+        }
+      }
+      AssertThat(ta.allocators(allocation_lifetime_t::long_lived)[id].m_blocks.size(), Equals(1_sz));
+      AssertThat(ta.allocators(allocation_lifetime_t::permanent)[id].m_blocks.empty(), IsTrue());
+      AssertThat(ta.allocators()[id].m_blocks.size(), IsGreaterThan(1_sz));
+      // once the short lived objects die every block of theirs can be freed.
+      for (auto &&ptr : short_lived) {
+        AssertThat(ta.destroy(ptr), IsTrue());
+      }
+      ta.free_empty_blocks(0, true);
+      AssertThat(ta.allocators()[id].m_blocks.empty(), IsTrue());
+      AssertThat(ta.memory_usage(id).m_live_objects, Equals(long_lived.size()));
+      AssertThat(ta.memory_usage().m_primary_bytes, Equals(ta.get_allocator_block_size(id)));
+      for (auto &&ptr : long_lived) {
+        AssertThat(ta.destroy(ptr), IsTrue());
+      }
+      ta.free_empty_blocks(0, true);
+      AssertThat(ta.memory_usage().m_primary_bytes, Equals(0_sz));
+    });
+    it("allocate_near", []() {
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      ta_type ta(*allocator);
+      const size_t id = ta.find_block_set_id(64);
+      ::std::vector<void *> ptrs;
+      while (ta.allocators()[id].m_blocks.size() < 4) {
+        ptrs.push_back(ta.allocate(64).m_ptr);
+      }
+      const auto &blocks = ta.allocators()[id].m_blocks;
+      const auto block_of = [&blocks](void *v) -> size_t {
+        for (size_t i = 0; i < blocks.size(); ++i) {
+          if (blocks[i].begin() <= static_cast<uint8_t *>(v) && static_cast<uint8_t *>(v) < blocks[i].end()) {
+            return i;
+          }
+        }
+        return blocks.size();
+      };
+      // make holes in the second block and in the third block.
+      const auto in_block = [&](size_t block) {
+        ::std::vector<size_t> ret;
+        for (size_t i = 0; i < ptrs.size(); ++i) {
+          if (block_of(ptrs[i]) == block) {
+            ret.push_back(i);
+          }
+        }
+        return ret;
+      };
+      const auto second = in_block(1);
+      const auto third = in_block(2);
+      AssertThat(ta.destroy(ptrs[second[10]]), IsTrue());
+      AssertThat(ta.destroy(ptrs[third[10]]), IsTrue());
+      ptrs[second[10]] = nullptr;
+      ptrs[third[10]] = nullptr;
+      // the hole next to the hint is used.
+      void *near = ta.allocate_near(ptrs[third[5]], 64).m_ptr;
+      AssertThat(block_of(near), Equals(2_sz));
+      ptrs[third[10]] = near;
+      // a full block falls through to the next block by address.
+      near = ta.allocate_near(ptrs[in_block(0)[3]], 64).m_ptr;
+      AssertThat(block_of(near), Equals(1_sz));
+      ptrs[second[10]] = near;
+      // with no room near the hint this falls back to normal placement.
+      near = ta.allocate_near(ptrs[in_block(0)[3]], 64).m_ptr;
+      AssertThat(near != nullptr, IsTrue());
+      ptrs.push_back(near);
+      // with more holes than are compared the allocation still lands in the block of the hint.
+      const auto holes = in_block(2);
+      const size_t num_holes = 2 * allocator_type::allocator_block_type::cs_max_allocate_near_candidates;
+      AssertThat(holes.size(), IsGreaterThan(2 * num_holes));
+      for (size_t i = 0; i < num_holes; ++i) {
+        AssertThat(ta.destroy(ptrs[holes[2 * i + 1]]), IsTrue());
+        ptrs[holes[2 * i + 1]] = nullptr;
+      }
+      near = ta.allocate_near(ptrs[holes.back()], 64).m_ptr;
+      AssertThat(block_of(near), Equals(2_sz));
+      ptrs.push_back(near);
+      for (auto &&ptr : ptrs) {
+        if (ptr) {
+          AssertThat(ta.destroy(ptr), IsTrue());
+        }
+      }
+    });
+    it("memory_usage", []() {
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      auto &ta = allocator->initialize_thread();
+      const size_t bin = ta.find_block_set_id(100);
+      auto &abs = ta.allocators()[bin];
+      // check running counters against a walk of the blocks.
+      auto check_abs = [&abs]() {
+        size_t primary = 0;
+        size_t secondary = abs.secondary_memory_used_self();
+        size_t live_bytes = 0;
+        size_t live_objects = 0;
+        for (auto &&block : abs.m_blocks) {
+          primary += block.memory_size();
+          secondary += block.secondary_memory_used();
+          live_bytes += block.m_live_bytes;
+          live_objects += block.m_live_objects;
+        }
+        const auto usage = abs.memory_usage();
+        AssertThat(usage.m_primary_bytes, Equals(primary));
+        AssertThat(usage.m_secondary_bytes, Equals(secondary));
+        AssertThat(usage.m_live_bytes, Equals(live_bytes));
+        AssertThat(usage.m_live_objects, Equals(live_objects));
+      };
+      ::std::vector<void *> ptrs;
+      for (size_t i = 0; i < 100; ++i) {
+        ptrs.push_back(ta.allocate(100).m_ptr);
+      }
+      check_abs();
+      auto usage = ta.memory_usage(bin);
+      AssertThat(usage.m_live_objects, Equals(100_sz));
+      AssertThat(usage.m_live_bytes, IsGreaterThanOrEqualTo(10000_sz));
+      AssertThat(usage.m_primary_bytes, IsGreaterThan(usage.m_live_bytes));
+      AssertThat(usage.m_free_bytes, IsLessThan(usage.m_primary_bytes - usage.m_live_bytes));
+      AssertThat(ta.memory_usage().m_live_objects, Equals(100_sz));
+      AssertThat(ta.primary_memory_used(), Equals(ta.memory_usage().m_primary_bytes));
+      for (size_t i = 0; i < 100; i += 2) {
+        AssertThat(ta.destroy(ptrs[i]), IsTrue());
+      }
+      check_abs();
+      AssertThat(ta.memory_usage(bin).m_live_objects, Equals(50_sz));
+      ta._do_maintenance();
+      check_abs();
+      auto global_usage = allocator->memory_usage();
+      AssertThat(global_usage.m_bins[bin].m_live_objects + global_usage.m_global.m_live_objects, Equals(50_sz));
+      AssertThat(global_usage.totals().m_primary_bytes,
+                 Equals(ta.memory_usage().m_primary_bytes + global_usage.m_global.m_primary_bytes));
+      for (size_t i = 1; i < 100; i += 2) {
+        AssertThat(ta.destroy(ptrs[i]), IsTrue());
+      }
+      check_abs();
+      AssertThat(ta.memory_usage(bin).m_live_bytes, Equals(0_sz));
+      allocator->destroy_thread();
+      allocator->collect();
+      global_usage = allocator->memory_usage();
+      AssertThat(global_usage.totals().m_live_objects, Equals(0_sz));
+      AssertThat(global_usage.totals().m_live_bytes, Equals(0_sz));
+    });
+    it("prefault", []() {
+      const auto pages_prefaulted = [](allocator_type &allocator) {
+        return allocator.stats_snapshot().totals().m_pages_prefaulted;
+      };
+      {
+        auto allocator = ::std::make_unique<allocator_type>();
+        AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+        allocator->set_prefault_mode(::mcppalloc::sparse::details::prefault_mode_t::immediate);
+        ta_type ta(*allocator);
+        void *ptr = ta.allocate(1000).m_ptr;
+        AssertThat(pages_prefaulted(*allocator), IsGreaterThan(0u));
+        AssertThat(ta.destroy(ptr), IsTrue());
+      }
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      allocator->set_prefault_mode(::mcppalloc::sparse::details::prefault_mode_t::deferred);
+      ta_type ta(*allocator);
+      void *ptr = ta.allocate(1000).m_ptr;
+      AssertThat(pages_prefaulted(*allocator), Equals(0u));
+      ta._do_maintenance();
+      const auto num_prefaulted = pages_prefaulted(*allocator);
+      AssertThat(num_prefaulted, IsGreaterThan(0u));
+      // resident pages are not counted again.
+      ta.prefault_pending_blocks();
+      AssertThat(pages_prefaulted(*allocator), Equals(num_prefaulted));
+      AssertThat(ta.destroy(ptr), IsTrue());
+    });
+    it("reserve_no_slow_path", []() {
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize(1000000, 100000000), IsTrue());
+      ta_type ta(*allocator);
+      AssertThat(ta.reserve(100, 1000), IsTrue());
+      ta.begin_no_slow_path();
+      ::std::vector<void *> ptrs;
+      for (size_t i = 0; i < 1000; ++i) {
+        ptrs.push_back(ta.allocate(100).m_ptr);
+        AssertThat(ptrs.back() != nullptr, IsTrue());
+      }
+      for (auto &&ptr : ptrs) {
+        AssertThat(ta.destroy(ptr), IsTrue());
+      }
+      AssertThat(ta.num_slow_path_events(), Equals(0u));
+      ta._do_maintenance();
+      AssertThat(ta.num_slow_path_events(), Equals(1u));
+      ta.end_no_slow_path();
+      // outside a section nothing is counted.
+      ta._do_maintenance();
+      AssertThat(ta.num_slow_path_events(), Equals(1u));
+      // reserving keeps the blocks of the bin without raising the minimum for every bin.
+      const size_t id = ta.find_block_set_id(100);
+      const auto &blocks = ta.allocators()[id].m_blocks;
+      const auto num_valid = [&blocks]() {
+        return static_cast<size_t>(::std::count_if(blocks.begin(), blocks.end(), [](auto &&block) { return block.valid(); }));
+      };
+      const size_t num_blocks = num_valid();
+      AssertThat(num_blocks, IsGreaterThan(2_sz));
+      AssertThat(ta.minimum_local_blocks(), Equals(static_cast<uint16_t>(2)));
+      // reserved blocks survive memory pressure.
+      ta.set_memory_pressure(::mcppalloc::memory_pressure_level_t::critical);
+      ta.free_empty_blocks(0, true);
+      AssertThat(num_valid(), Equals(num_blocks));
+      ta.set_memory_pressure(::mcppalloc::memory_pressure_level_t::none);
+      // and are not donated to threads asking for blocks.
+      ta_type ta2(*allocator);
+      void *ptr = ta2.allocate(100).m_ptr;
+      AssertThat(allocator->_block_demand(id), Equals(1_sz));
+      ta._do_maintenance();
+      AssertThat(num_valid(), Equals(num_blocks));
+      AssertThat(allocator->num_global_blocks(), Equals(0_sz));
+      AssertThat(ta2.destroy(ptr), IsTrue());
+    });
+    it("persistent_heap", []() {
+      char path[] = "/tmp/mcppalloc_persistent_heap_XXXXXX";
+      const int fd = ::mkstemp(path);
+      AssertThat(fd >= 0, IsTrue());
+      ::close(fd);
+      ::std::vector<size_t *> ptrs;
+      {
+        auto allocator = ::std::make_unique<allocator_type>();
+        AssertThat(allocator->initialize_persistent(path, 1 << 24), IsTrue());
+        AssertThat(allocator->is_persistent(), IsTrue());
+        auto &ta = allocator->initialize_thread();
+        for (size_t i = 0; i < 2000; ++i) {
+          ptrs.push_back(static_cast<size_t *>(ta.allocate(100).m_ptr));
+          *ptrs.back() = i;
+        }
+        // leave holes for recovery to find.
+        for (size_t i = 0; i < ptrs.size(); i += 2) {
+          AssertThat(ta.destroy(ptrs[i]), IsTrue());
+        }
+        allocator->set_persistent_root(ptrs[1]);
+        AssertThat(allocator->sync(), IsTrue());
+      }
+      // reattach as a restarted process would.
+      auto allocator = ::std::make_unique<allocator_type>();
+      AssertThat(allocator->initialize_persistent(path, 0), IsTrue());
+      AssertThat(allocator->persistent_root(), Equals(static_cast<void *>(ptrs[1])));
+      AssertThat(allocator->num_global_blocks(), IsGreaterThan(0_sz));
+      AssertThat(allocator->memory_usage().m_global.m_live_objects, Equals(ptrs.size() / 2));
+      for (size_t i = 1; i < ptrs.size(); i += 2) {
+        AssertThat(*ptrs[i], Equals(i));
+      }
+      // new objects fill the holes without touching live objects.
+      auto &ta = allocator->initialize_thread();
+      ::std::vector<size_t *> new_ptrs;
+      for (size_t i = 0; i < ptrs.size() / 2; ++i) {
+        new_ptrs.push_back(static_cast<size_t *>(ta.allocate(100).m_ptr));
+        AssertThat(allocator->heap_contains(new_ptrs.back()), IsTrue());
+        *new_ptrs.back() = 0;
+      }
+      for (size_t i = 1; i < ptrs.size(); i += 2) {
+        AssertThat(*ptrs[i], Equals(i));
+      }
+      AssertThat(allocator->memory_usage().totals().m_live_objects, Equals(ptrs.size()));
+      allocator.reset();
+      ::unlink(path);
+    });
   });
 }
@@ -1,18 +1,70 @@
 #include <mcpputil/mcpputil/declarations.hpp>
 // This Must be first.
+#include <mcppalloc/mcppalloc_slab_allocator/shared_slab_allocator.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/signal_safe_slab_allocator.hpp>
 #include <mcppalloc/mcppalloc_slab_allocator/slab_allocator.hpp>
+#include <mcppalloc/mcppalloc_slab_allocator/slab_thread_cache.hpp>
 #include <mcpputil/mcpputil/bandit.hpp>
 #include <mcpputil/mcpputil/container.hpp>
 #include <mcpputil/mcpputil/unsafe_cast.hpp>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <csignal>
+#include <pthread.h>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 using namespace bandit;
 using namespace ::snowhouse;
 using ::mcpputil::unsafe_cast;
 using ::mcpputil::align;
+using ::mcppalloc::slab_allocator::details::slab_allocator_object_t;
+#ifndef _WIN32
+namespace
+{
+  ::mcppalloc::slab_allocator::details::signal_safe_slab_allocator_t *s_signal_allocator = nullptr;
+  ::std::atomic<size_t> s_signal_allocations{0};
+  ::std::atomic<size_t> s_signal_failures{0};
+  /**
+   * \brief Allocate, fill, check and free a few objects from a signal handler.
+   **/
+  void signal_allocate_handler(int)
+  {
+    const int saved_errno = errno;
+    void *objects[3];
+    const size_t sizes[3] = {32, 200, 1000};
+    for (size_t i = 0; i < 3; ++i) {
+      objects[i] = s_signal_allocator->allocate_raw(sizes[i]);
+      if (!objects[i]) {
+        s_signal_failures.fetch_add(1);
+        continue;
+      }
+      ::std::memset(objects[i], static_cast<int>(0xa0 + i), sizes[i]);
+    }
+    for (size_t i = 0; i < 3; ++i) {
+      if (!objects[i]) {
+        continue;
+      }
+      const auto bytes = reinterpret_cast<const uint8_t *>(objects[i]);
+      if (bytes[0] != 0xa0 + i || bytes[sizes[i] - 1] != 0xa0 + i) {
+        s_signal_failures.fetch_add(1);
+      }
+      s_signal_allocator->deallocate_raw(objects[i]);
+      s_signal_allocations.fetch_add(1);
+    }
+    errno = saved_errno;
+  }
+}
+#endif
 void slab_allocator_bandit_tests()
 {
   describe("Slab Allocator", []() {
     it("sa_test1", []() {
-      using ::mcppalloc::slab_allocator::details::slab_allocator_object_t;
       ::mcppalloc::slab_allocator::details::slab_allocator_t slab(500000, 5000000);
       using slab_type = decltype(slab);
       uint8_t *alloc1 = reinterpret_cast<uint8_t *>(slab.allocate_raw(100));
@@ -63,11 +115,10 @@ void slab_allocator_bandit_tests()
                  Equals(4 * slab_type::cs_header_sz + 3 * align(100, slab_type::alignment())));
       slab.deallocate_raw(alloc3);
       slab.deallocate_raw(alloc4);
-      AssertThat(slab_allocator_object_t::from_object_start(alloc3, slab_type::alignment())->next() ==
-                     &*slab._u_object_current_end(),
+      // alloc4 coalesces backwards into alloc3, which becomes the end.
+      AssertThat(slab_allocator_object_t::from_object_start(alloc3, slab_type::alignment()) == &*slab._u_object_current_end(),
                  IsTrue());
-      AssertThat(slab_allocator_object_t::from_object_start(alloc3, slab_type::alignment())->next_valid(), IsTrue());
-      AssertThat(slab_allocator_object_t::from_object_start(alloc3, slab_type::alignment())->next()->next_valid(), IsFalse());
+      AssertThat(slab_allocator_object_t::from_object_start(alloc3, slab_type::alignment())->next_valid(), IsFalse());
       alloc3 = reinterpret_cast<uint8_t *>(slab.allocate_raw(100));
       alloc4 = reinterpret_cast<uint8_t *>(slab.allocate_raw(100));
       AssertThat(static_cast<uintptr_t>(alloc3 - slab.begin()),
@@ -109,5 +160,303 @@ void slab_allocator_bandit_tests()
       AssertThat(slab_allocator_object_t::from_object_start(alloc4, slab_type::alignment())->next_valid(), IsTrue());
 
     });
+    it("sa_coalesce_both_ways", []() {
+      ::mcppalloc::slab_allocator::details::slab_allocator_t slab(500000, 5000000);
+      using slab_type = decltype(slab);
+      void *alloc1 = slab.allocate_raw(100);
+      void *alloc2 = slab.allocate_raw(100);
+      void *alloc3 = slab.allocate_raw(100);
+      void *alloc4 = slab.allocate_raw(100);
+      slab.deallocate_raw(alloc1);
+      slab.deallocate_raw(alloc3);
+      AssertThat(slab._u_num_free(), Equals(2u));
+      // freeing the middle object merges with both neighbours.
+      slab.deallocate_raw(alloc2);
+      AssertThat(slab._u_num_free(), Equals(1u));
+      auto merged = slab_allocator_object_t::from_object_start(alloc1, slab_type::alignment());
+      AssertThat(merged->next() == slab_allocator_object_t::from_object_start(alloc4, slab_type::alignment()), IsTrue());
+      AssertThat(slab_type::_links(merged->next())->m_prev == merged, IsTrue());
+      // the last object merges backwards into the end pointer.
+      slab.deallocate_raw(alloc4);
+      AssertThat(slab._u_num_free(), Equals(0u));
+      AssertThat(slab._u_empty(), IsTrue());
+    });
+    it("sa_unbounded_free_index", []() {
+      ::mcppalloc::slab_allocator::details::slab_allocator_t slab(500000, 5000000);
+      ::std::vector<void *> allocs;
+      for (size_t i = 0; i < 4000; ++i) {
+        allocs.push_back(slab.allocate_raw(64 + (i % 3) * 64));
+      }
+      // more holes than the old fixed free map held.
+      for (size_t i = 0; i < allocs.size(); i += 2) {
+        slab.deallocate_raw(allocs[i]);
+      }
+      AssertThat(slab._u_num_free(), Equals(2000u));
+      const auto size = slab.current_size();
+      // best fit reuses every hole without growing.
+      for (size_t i = 0; i < allocs.size(); i += 2) {
+        allocs[i] = slab.allocate_raw(64 + (i % 3) * 64);
+      }
+      AssertThat(slab._u_num_free(), Equals(0u));
+      AssertThat(slab.current_size(), Equals(size));
+      for (auto &&alloc : allocs) {
+        slab.deallocate_raw(alloc);
+      }
+      AssertThat(slab._u_empty(), IsTrue());
+      slab._verify();
+    });
+    it("sa_allocate_aligned", []() {
+      ::mcppalloc::slab_allocator::details::slab_allocator_t slab(500000, 5000000);
+      const size_t alignment = 4096;
+      void *small = slab.allocate_raw(100);
+      // the leading remainder at the end becomes a free object instead of a padding allocation.
+      void *aligned1 = slab.allocate_aligned(1000, alignment);
+      AssertThat(reinterpret_cast<uintptr_t>(aligned1) % alignment, Equals(0u));
+      AssertThat(slab._u_num_free(), Equals(1u));
+      // small allocations fill the remainder.
+      void *small2 = slab.allocate_raw(100);
+      AssertThat(small2 < aligned1, IsTrue());
+      void *aligned2 = slab.allocate_aligned(3000, alignment);
+      AssertThat(reinterpret_cast<uintptr_t>(aligned2) % alignment, Equals(0u));
+      void *last = slab.allocate_raw(100);
+      slab._verify();
+      // a freed hole is reused when it can hold the aligned start.
+      slab.deallocate_raw(aligned2);
+      void *aligned3 = slab.allocate_aligned(2000, alignment);
+      AssertThat(aligned3, Equals(aligned2));
+      // small alignments need no splitting.
+      void *aligned4 = slab.allocate_aligned(100, 16);
+      AssertThat(reinterpret_cast<uintptr_t>(aligned4) % 16, Equals(0u));
+      slab._verify();
+      for (auto &&alloc : {small, aligned1, small2, aligned3, last, aligned4}) {
+        slab.deallocate_raw(alloc);
+      }
+      slab._verify();
+      AssertThat(slab._u_num_free(), Equals(0u));
+      AssertThat(slab._u_empty(), IsTrue());
+      // aligning the header instead, caches keep aligned objects they can hand out again.
+      ::mcppalloc::slab_allocator::details::slab_thread_cache_t cache(slab);
+      const size_t offset = slab.cs_header_sz;
+      void *cached = cache.allocate_aligned(alignment - offset, alignment, offset);
+      AssertThat((reinterpret_cast<uintptr_t>(cached) - offset) % alignment, Equals(0u));
+      cache.deallocate_raw(cached);
+      AssertThat(cache.allocate_aligned(alignment - offset, alignment, offset), Equals(cached));
+      cache.deallocate_raw(cached);
+      cache.flush();
+      slab._verify();
+      AssertThat(slab._u_empty(), IsTrue());
+    });
+    it("sa_growth_policy_and_trim", []() {
+      ::mcppalloc::slab_allocator::details::slab_allocator_t slab(1 << 16, 1 << 16);
+      // fixed steps up to a cap.
+      slab.set_growth_policy({1.0, 1 << 16, 1 << 18});
+      ::std::vector<void *> allocs;
+      while (void *alloc = slab.allocate_raw(1 << 12)) {
+        allocs.push_back(alloc);
+      }
+      AssertThat(static_cast<size_t>(slab.end() - slab.begin()), Equals(size_t(1) << 18));
+      AssertThat(slab.stats_snapshot().m_bins[0].m_blocks_created, Equals(3u));
+      ::std::memset(allocs.back(), 0xff, 1 << 12);
+      for (auto &&alloc : allocs) {
+        slab.deallocate_raw(alloc);
+      }
+      AssertThat(slab._u_empty(), IsTrue());
+      // freed memory above the end is given back and reads as zero.
+      const auto page_size = ::mcpputil::slab_t::page_size();
+      AssertThat(slab.trim(page_size), Equals((size_t(1) << 18) - 2 * page_size));
+      AssertThat(static_cast<uint8_t *>(allocs.back())[0], Equals(0u));
+      AssertThat(slab.trim(1 << 20), Equals(0u));
+      slab.set_growth_policy({});
+      AssertThat(slab.growth_policy().m_factor, Equals(2.0));
+      slab._verify();
+    });
+    it("sa_thread_cache", []() {
+      using ::mcppalloc::slab_allocator::details::slab_thread_cache_t;
+      ::mcppalloc::slab_allocator::details::slab_allocator_t slab(500000, 5000000);
+      {
+        slab_thread_cache_t cache(slab, 1 << 16);
+        // a miss refills a whole batch under one lock.
+        void *alloc1 = cache.allocate_raw(100);
+        AssertThat(slab.stats_snapshot().m_bins[0].m_global_lock_acquisitions, Equals(1u));
+        AssertThat(cache.num_cached(), Equals(slab_thread_cache_t::cs_max_batch - 1));
+        // hits and frees do not take the lock.
+        cache.deallocate_raw(alloc1);
+        void *alloc2 = cache.allocate_raw(100);
+        AssertThat(alloc2 == alloc1, IsTrue());
+        AssertThat(slab.stats_snapshot().m_bins[0].m_global_lock_acquisitions, Equals(1u));
+        // overflowing the cache returns half of it.
+        ::std::vector<void *> allocs;
+        for (size_t i = 0; i < 1000; ++i) {
+          allocs.push_back(cache.allocate_raw(100));
+        }
+        for (auto &&alloc : allocs) {
+          cache.deallocate_raw(alloc);
+        }
+        AssertThat(cache.cached_bytes() <= (1u << 16), IsTrue());
+        cache.deallocate_raw(alloc2);
+        cache.flush();
+        AssertThat(cache.num_cached(), Equals(0u));
+        AssertThat(cache.cached_bytes(), Equals(0u));
+        AssertThat(slab._u_empty(), IsTrue());
+      }
+      // caches on several threads share one slab.
+      ::std::vector<::std::thread> threads;
+      for (size_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&slab, t]() {
+          slab_thread_cache_t cache(slab, 1 << 14);
+          ::std::vector<void *> allocs;
+          for (size_t i = 0; i < 2000; ++i) {
+            allocs.push_back(cache.allocate_raw(64 * (1 + (i + t) % 5)));
+            if (i % 3 == 0) {
+              cache.deallocate_raw(allocs[i / 2]);
+              allocs[i / 2] = cache.allocate_raw(64);
+            }
+          }
+          for (auto &&alloc : allocs) {
+            cache.deallocate_raw(alloc);
+          }
+        });
+      }
+      for (auto &&thread : threads) {
+        thread.join();
+      }
+      slab._verify();
+      AssertThat(slab._u_empty(), IsTrue());
+    });
+#ifndef _WIN32
+    it("sa_signal_safe", []() {
+      using ::mcppalloc::slab_allocator::details::signal_safe_slab_allocator_t;
+      ::mcppalloc::slab_allocator::details::slab_allocator_t slab(500000, 50000000);
+      signal_safe_slab_allocator_t allocator(slab, 1 << 22);
+      AssertThat(signal_safe_slab_allocator_t::size_class(48), Equals(0u));
+      AssertThat(signal_safe_slab_allocator_t::size_class(49), Equals(1u));
+      AssertThat(signal_safe_slab_allocator_t::size_class(signal_safe_slab_allocator_t::cs_max_allocation + 1),
+                 Equals(signal_safe_slab_allocator_t::cs_num_classes));
+      void *alloc1 = allocator.allocate_raw(100);
+      AssertThat(allocator.contains(alloc1), IsTrue());
+      allocator.deallocate_raw(alloc1);
+      AssertThat(allocator.allocate_raw(100) == alloc1, IsTrue());
+      allocator.deallocate_raw(alloc1);
+      // raise signals that allocate while this thread allocates from the same allocator.
+      s_signal_allocator = &allocator;
+      struct sigaction action;
+      struct sigaction old_action;
+      ::std::memset(&action, 0, sizeof(action));
+      action.sa_handler = signal_allocate_handler;
+      sigemptyset(&action.sa_mask);
+      action.sa_flags = SA_RESTART;
+      sigaction(SIGUSR1, &action, &old_action);
+      const auto target = pthread_self();
+      ::std::atomic<bool> done{false};
+      ::std::thread signaller([&done, target]() {
+        while (!done.load()) {
+          pthread_kill(target, SIGUSR1);
+          ::std::this_thread::yield();
+        }
+      });
+      ::std::vector<::std::pair<uint8_t *, size_t>> live(64, {nullptr, 0});
+      size_t failures = 0;
+      for (size_t i = 0; i < 200000 || s_signal_allocations.load() < 3000; ++i) {
+        auto &entry = live[i % live.size()];
+        if (entry.first) {
+          if (entry.first[0] != static_cast<uint8_t>(entry.second) ||
+              entry.first[entry.second - 1] != static_cast<uint8_t>(entry.second)) {
+            ++failures;
+          }
+          allocator.deallocate_raw(entry.first);
+        }
+        entry.second = 1 + (i * 7919) % 2000;
+        entry.first = reinterpret_cast<uint8_t *>(allocator.allocate_raw(entry.second));
+        ::std::memset(entry.first, static_cast<int>(static_cast<uint8_t>(entry.second)), entry.second);
+      }
+      done = true;
+      signaller.join();
+      sigaction(SIGUSR1, &old_action, nullptr);
+      s_signal_allocator = nullptr;
+      AssertThat(failures, Equals(0u));
+      AssertThat(s_signal_failures.load(), Equals(0u));
+      AssertThat(s_signal_allocations.load() >= 3000, IsTrue());
+      // everything is reused, so the bump pointer stayed within what 64 live objects and a handler need.
+      const auto remaining = allocator.remaining();
+      for (auto &&entry : live) {
+        allocator.deallocate_raw(entry.first);
+      }
+      for (auto &&entry : live) {
+        entry.first = reinterpret_cast<uint8_t *>(allocator.allocate_raw(entry.second));
+      }
+      AssertThat(allocator.remaining(), Equals(remaining));
+      for (auto &&entry : live) {
+        allocator.deallocate_raw(entry.first);
+      }
+    });
+    it("sa_shared", []() {
+      using ::mcppalloc::slab_allocator::details::shared_slab_allocator_t;
+      char path[] = "/tmp/mcppalloc_shared_slab_XXXXXX";
+      const int fd = ::mkstemp(path);
+      AssertThat(fd >= 0, IsTrue());
+      ::unlink(path);
+      bool rejected = false;
+      try {
+        shared_slab_allocator_t empty(fd);
+      } catch (const ::std::invalid_argument &) {
+        rejected = true;
+      }
+      AssertThat(rejected, IsTrue());
+      shared_slab_allocator_t allocator(fd, 1 << 20);
+      auto message = reinterpret_cast<uint64_t *>(allocator.allocate_raw(256));
+      message[0] = 42;
+      const auto message_offset = allocator.offset(message);
+      // another process maps the file at another address, reads the message by offset and replies in shared memory.
+      pid_t child = ::fork();
+      if (!child) {
+        shared_slab_allocator_t attached(fd);
+        auto received = reinterpret_cast<uint64_t *>(attached.from_offset(message_offset));
+        auto reply = reinterpret_cast<uint64_t *>(attached.allocate_raw(1000));
+        reply[0] = received[0] + 1;
+        received[1] = attached.offset(reply);
+        ::_exit(attached.begin() != allocator.begin() && reply ? 0 : 1);
+      }
+      int status = 0;
+      ::waitpid(child, &status, 0);
+      AssertThat(WIFEXITED(status) && WEXITSTATUS(status) == 0, IsTrue());
+      auto reply = reinterpret_cast<uint64_t *>(allocator.from_offset(message[1]));
+      AssertThat(reply[0], Equals(43u));
+      allocator._verify();
+      allocator.deallocate_raw(message);
+      // a process that dies holding the lock leaves the allocator usable.
+      child = ::fork();
+      if (!child) {
+        shared_slab_allocator_t attached(fd);
+        ::pthread_mutex_lock(&attached._mutex());
+        ::_exit(0);
+      }
+      ::waitpid(child, &status, 0);
+      void *alloc = allocator.allocate_raw(100);
+      AssertThat(alloc != nullptr, IsTrue());
+      allocator.deallocate_raw(alloc);
+      allocator.deallocate_raw(reply);
+      allocator._verify();
+      AssertThat(allocator.num_free(), Equals(1u));
+      AssertThat(allocator.bytes_in_use(), Equals(0u));
+      // running out of capacity fails instead of growing.
+      AssertThat(allocator.allocate_raw(1 << 20) == nullptr, IsTrue());
+      ::close(fd);
+    });
+#endif
+    it("sa_stats", []() {
+      ::mcppalloc::slab_allocator::details::slab_allocator_t slab(500000, 5000000);
+      using slab_type = decltype(slab);
+      void *alloc1 = slab.allocate_raw(100);
+      void *alloc2 = slab.allocate_raw(100);
+      auto stats = slab.stats_snapshot();
+      AssertThat(stats.m_bins[0].m_allocations, Equals(2u));
+      AssertThat(stats.m_bins[0].m_bytes_allocated, Equals(2 * align(100, slab_type::alignment())));
+      AssertThat(stats.m_bins[0].m_global_lock_acquisitions, Equals(2u));
+      slab.deallocate_raw(alloc1);
+      slab.deallocate_raw(alloc2);
+      stats = slab.stats_snapshot();
+      AssertThat(stats.m_bins[0].m_deallocations, Equals(2u));
+      AssertThat(stats.totals().live_bytes(), Equals(0));
+    });
   });
 }